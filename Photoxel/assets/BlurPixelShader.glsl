@@ -0,0 +1,22 @@
+#version 330 core
+
+layout(location = 0) out vec4 o_FragColor;
+
+in vec2 v_TexCoords;
+
+uniform sampler2D u_Texture;
+// One texel along the axis of this pass, in texture coordinates
+uniform vec2 u_Direction;
+uniform int u_TapCount;
+// Tap 0 is the centre texel, the rest are mirrored and sit between two texels
+uniform float u_Offsets[32];
+uniform float u_Weights[32];
+
+void main() {
+	vec4 colour = texture(u_Texture, v_TexCoords) * u_Weights[0];
+	for (int i = 1; i < u_TapCount; i++) {
+		vec2 offset = u_Direction * u_Offsets[i];
+		colour += (texture(u_Texture, v_TexCoords + offset) + texture(u_Texture, v_TexCoords - offset)) * u_Weights[i];
+	}
+	o_FragColor = colour;
+}
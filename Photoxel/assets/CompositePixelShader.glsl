@@ -0,0 +1,54 @@
+#version 330 core
+
+layout(location = 0) out vec4 o_FragColor;
+
+// Texture coordinates of the image
+in vec2 v_TexCoords;
+
+// Layers blended by one pass, MAX_BATCH_LAYERS on the C++ side
+#define MAX_LAYERS 6
+
+// Result of the passes before this one, transparent for the first
+uniform sampler2D u_Base;
+uniform int u_HasBase;
+uniform vec4 u_BaseRect;
+uniform int u_LayerCount;
+uniform sampler2D u_Layers[MAX_LAYERS];
+uniform sampler2D u_Masks[MAX_LAYERS];
+// Where each layer texture sits in the image, offset in xy and size in zw. Masks cover the whole image
+uniform vec4 u_LayerRects[MAX_LAYERS];
+uniform float u_Opacities[MAX_LAYERS];
+uniform int u_BlendModes[MAX_LAYERS];
+uniform int u_HasMasks[MAX_LAYERS];
+
+// Same order as the BlendMode enum
+vec3 blendColour(vec3 base, vec3 layer, int mode) {
+	if (mode == 1) return base * layer;
+	if (mode == 2) return base + layer - base * layer;
+	if (mode == 3) return mix(2.0 * base * layer, 1.0 - 2.0 * (1.0 - base) * (1.0 - layer), step(0.5, base));
+	if (mode == 4) return min(base + layer, 1.0);
+	return layer;
+}
+
+// Samplers in an array can only be indexed by constants, so every layer is its own call
+vec4 composite(vec4 base, sampler2D layerTexture, sampler2D maskTexture, int i) {
+	vec4 layer = texture(layerTexture, (v_TexCoords - u_LayerRects[i].xy) / u_LayerRects[i].zw);
+	float coverage = u_Opacities[i] * (u_HasMasks[i] != 0 ? texture(maskTexture, v_TexCoords).r : 1.0);
+
+	float layerAlpha = layer.a * coverage;
+	vec3 mixed = mix(layer.rgb, blendColour(base.rgb, layer.rgb, u_BlendModes[i]), base.a);
+	float remaining = base.a * (1.0 - layerAlpha);
+	float alpha = layerAlpha + remaining;
+	return vec4((mixed * layerAlpha + base.rgb * remaining) / max(alpha, 1e-6), alpha);
+}
+
+void main() {
+	vec4 colour = u_HasBase != 0 ? texture(u_Base, (v_TexCoords - u_BaseRect.xy) / u_BaseRect.zw) : vec4(0.0);
+	if (u_LayerCount > 0) colour = composite(colour, u_Layers[0], u_Masks[0], 0);
+	if (u_LayerCount > 1) colour = composite(colour, u_Layers[1], u_Masks[1], 1);
+	if (u_LayerCount > 2) colour = composite(colour, u_Layers[2], u_Masks[2], 2);
+	if (u_LayerCount > 3) colour = composite(colour, u_Layers[3], u_Masks[3], 3);
+	if (u_LayerCount > 4) colour = composite(colour, u_Layers[4], u_Masks[4], 4);
+	if (u_LayerCount > 5) colour = composite(colour, u_Layers[5], u_Masks[5], 5);
+	o_FragColor = colour;
+}
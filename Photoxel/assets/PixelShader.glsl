@@ -95,10 +95,44 @@ vec4 gradient(vec4 fragColor, vec3 startColour, vec3 endColour, float angle, flo
 	return mix(fragColor, colour, intensity);
 }
 
-vec4 mosaic(int pixelSize, int width, int height) {
+// The blocks snap to the source grid, inputRect places the input texture in source coordinates
+vec4 mosaic(int pixelSize, int width, int height, vec4 inputRect) {
 	vec2 pixel = vec2(pixelSize) / vec2(width, height);
-	vec2 coord = floor(v_TexCoords / pixel) * pixel;
-	return texture(u_Texture, coord);
+	vec2 coord = inputRect.xy + v_TexCoords * inputRect.zw;
+	coord = floor(coord / pixel) * pixel;
+	return texture(u_Texture, (coord - inputRect.xy) / inputRect.zw);
+}
+
+// The table is only declared when the filter is in the chain, so it is passed in
+vec4 lut(vec4 fragColor, sampler3D table, float size, vec3 domainMin, vec3 domainMax, int tetrahedral) {
+	vec3 position = clamp((fragColor.rgb - domainMin) / (domainMax - domainMin), 0.0f, 1.0f) * (size - 1.0f);
+	if (tetrahedral == 0) {
+		// Hardware trilinear filtering, the lattice points sit at the texel centres
+		return vec4(texture(table, (position + 0.5f) / size).rgb, fragColor.a);
+	}
+
+	vec3 base = min(floor(position), vec3(size - 2.0f));
+	vec3 f = position - base;
+	ivec3 cell = ivec3(base);
+	// Walks from the lowest corner to the highest along the axes with the largest fractions first
+	ivec3 first, second;
+	vec3 weights;
+	if (f.r >= f.g) {
+		if (f.g >= f.b)			{ first = ivec3(1, 0, 0); second = ivec3(1, 1, 0); weights = f.rgb; }
+		else if (f.r >= f.b)	{ first = ivec3(1, 0, 0); second = ivec3(1, 0, 1); weights = f.rbg; }
+		else					{ first = ivec3(0, 0, 1); second = ivec3(1, 0, 1); weights = f.brg; }
+	}
+	else {
+		if (f.b >= f.g)			{ first = ivec3(0, 0, 1); second = ivec3(0, 1, 1); weights = f.bgr; }
+		else if (f.b >= f.r)	{ first = ivec3(0, 1, 0); second = ivec3(0, 1, 1); weights = f.gbr; }
+		else					{ first = ivec3(0, 1, 0); second = ivec3(1, 1, 0); weights = f.grb; }
+	}
+
+	vec3 colour = texelFetch(table, cell, 0).rgb * (1.0f - weights.x);
+	colour += texelFetch(table, cell + first, 0).rgb * (weights.x - weights.y);
+	colour += texelFetch(table, cell + second, 0).rgb * (weights.y - weights.z);
+	colour += texelFetch(table, cell + ivec3(1), 0).rgb * weights.z;
+	return vec4(colour, fragColor.a);
 }
 
 void main() {
@@ -0,0 +1,24 @@
+#version 330 core
+
+layout(location = 0) out vec4 o_FragColor;
+
+// Texture coordinates of the image
+in vec2 v_TexCoords;
+
+uniform sampler2D u_Source;
+// Filters rendered over the bounds of the selection only, offset in xy and size in zw
+uniform sampler2D u_Filtered;
+uniform vec4 u_FilteredRect;
+uniform sampler2D u_Selection;
+// Zero for the pass copying the source under the whole target
+uniform int u_Filtering;
+
+void main() {
+	vec4 source = texture(u_Source, v_TexCoords);
+	if (u_Filtering == 0) {
+		o_FragColor = source;
+		return;
+	}
+	vec4 filtered = texture(u_Filtered, (v_TexCoords - u_FilteredRect.xy) / u_FilteredRect.zw);
+	o_FragColor = mix(source, filtered, texture(u_Selection, v_TexCoords).r);
+}
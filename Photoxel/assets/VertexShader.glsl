@@ -5,8 +5,11 @@ layout(location = 1) in vec2 a_TexCoords;
 
 out vec2 v_TexCoords;
 
+// Where the output sits in the input texture, offset in xy and size in zw
+uniform vec4 u_TexRect = vec4(0.0, 0.0, 1.0, 1.0);
+
 void main()
 {
 	gl_Position = vec4(a_Position.xyz, 1.0);
-	v_TexCoords = a_TexCoords;
+	v_TexCoords = u_TexRect.xy + a_TexCoords * u_TexRect.zw;
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+#include "Anonymise.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace Photoxel
+{
+	// Long side of the grayscale image the trackers follow the faces in
+	static constexpr uint32_t TRACK_SIZE = 640;
+	// Peak to sidelobe ratio under which a track is considered lost, dlib's own examples sit above 10
+	static constexpr double MIN_TRACK_CONFIDENCE = 7.0;
+
+	glm::vec4 PadFace(const dlib::rectangle& face, float padding)
+	{
+		const float width = static_cast<float>(face.width());
+		const float height = static_cast<float>(face.height());
+		return glm::vec4(face.left() - width * padding, face.top() - height * padding,
+			face.right() + 1 + width * padding, face.bottom() + 1 + height * padding);
+	}
+
+	// Pixel bounds of face inside the buffer, empty when it lies outside
+	static glm::uvec4 ClampFace(const glm::vec4& face, uint32_t width, uint32_t height)
+	{
+		const float w = static_cast<float>(width), h = static_cast<float>(height);
+		return glm::uvec4(
+			static_cast<uint32_t>(glm::clamp(std::floor(face.x), 0.0f, w)),
+			static_cast<uint32_t>(glm::clamp(std::floor(face.y), 0.0f, h)),
+			static_cast<uint32_t>(glm::clamp(std::ceil(face.z), 0.0f, w)),
+			static_cast<uint32_t>(glm::clamp(std::ceil(face.w), 0.0f, h)));
+	}
+
+	static void PixelateFace(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels,
+		const glm::uvec4& bounds, float block, const glm::vec2& origin)
+	{
+		// Same grid the mosaic shader snaps to, anchored at the top left corner of the source
+		const int64_t firstColumn = static_cast<int64_t>(std::floor((bounds.x - origin.x) / block));
+		const int64_t lastColumn = static_cast<int64_t>(std::floor((bounds.z - 1 - origin.x) / block));
+		const int64_t firstRow = static_cast<int64_t>(std::floor((bounds.y - origin.y) / block));
+		const int64_t lastRow = static_cast<int64_t>(std::floor((bounds.w - 1 - origin.y) / block));
+		const size_t stride = static_cast<size_t>(width) * channels;
+		const uint32_t colours = std::min(channels, 3u);
+
+		ThreadPool::Get().ParallelFor(static_cast<size_t>(lastRow - firstRow + 1), [&](size_t i) {
+			const int64_t row = firstRow + static_cast<int64_t>(i);
+			// The whole block is averaged, even the part outside the face, so it matches across crops
+			const uint32_t y0 = static_cast<uint32_t>(glm::clamp(std::lround(origin.y + row * block), 0l, static_cast<long>(height)));
+			const uint32_t y1 = static_cast<uint32_t>(glm::clamp(std::lround(origin.y + (row + 1) * block), 0l, static_cast<long>(height)));
+			for (int64_t column = firstColumn; column <= lastColumn; column++) {
+				const uint32_t x0 = static_cast<uint32_t>(glm::clamp(std::lround(origin.x + column * block), 0l, static_cast<long>(width)));
+				const uint32_t x1 = static_cast<uint32_t>(glm::clamp(std::lround(origin.x + (column + 1) * block), 0l, static_cast<long>(width)));
+				if (x1 <= x0 || y1 <= y0) continue;
+
+				uint32_t sum[3] = { 0, 0, 0 };
+				for (uint32_t y = y0; y < y1; y++) {
+					const uint8_t* src = pixels + y * stride + static_cast<size_t>(x0) * channels;
+					for (uint32_t x = x0; x < x1; x++, src += channels) {
+						for (uint32_t c = 0; c < colours; c++) sum[c] += src[c];
+					}
+				}
+				const uint32_t count = (x1 - x0) * (y1 - y0);
+				uint8_t average[3];
+				for (uint32_t c = 0; c < colours; c++) {
+					average[c] = static_cast<uint8_t>((sum[c] + count / 2) / count);
+				}
+
+				for (uint32_t y = std::max(y0, bounds.y); y < std::min(y1, bounds.w); y++) {
+					const uint32_t from = std::max(x0, bounds.x), to = std::min(x1, bounds.z);
+					uint8_t* dst = pixels + y * stride + static_cast<size_t>(from) * channels;
+					for (uint32_t x = from; x < to; x++, dst += channels) {
+						for (uint32_t c = 0; c < colours; c++) dst[c] = average[c];
+					}
+				}
+			}
+		});
+	}
+
+	static void BlurFace(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels,
+		const glm::uvec4& bounds, float sigma, GaussianBlur& blur)
+	{
+		if (sigma < MIN_GAUSSIAN_SIGMA) {
+			return;
+		}
+
+		const uint32_t halo = static_cast<uint32_t>(std::ceil(sigma * 3.0f));
+		const uint32_t x0 = bounds.x > halo ? bounds.x - halo : 0;
+		const uint32_t y0 = bounds.y > halo ? bounds.y - halo : 0;
+		const uint32_t x1 = std::min(bounds.z + halo, width);
+		const uint32_t y1 = std::min(bounds.w + halo, height);
+		const uint32_t cropWidth = x1 - x0, cropHeight = y1 - y0;
+		const size_t stride = static_cast<size_t>(width) * channels;
+		const uint32_t colours = std::min(channels, 3u);
+
+		// The blur engine works on RGBA, the crop only holds the face and its halo
+		std::vector<uint8_t> crop(static_cast<size_t>(cropWidth) * cropHeight * 4, 255);
+		for (uint32_t y = 0; y < cropHeight; y++) {
+			const uint8_t* src = pixels + (y0 + y) * stride + static_cast<size_t>(x0) * channels;
+			uint8_t* dst = crop.data() + static_cast<size_t>(y) * cropWidth * 4;
+			for (uint32_t x = 0; x < cropWidth; x++, src += channels, dst += 4) {
+				for (uint32_t c = 0; c < colours; c++) dst[c] = src[c];
+			}
+		}
+		blur.Apply(crop.data(), crop.data(), cropWidth, cropHeight, sigma);
+		for (uint32_t y = bounds.y; y < bounds.w; y++) {
+			const uint8_t* src = crop.data() + (static_cast<size_t>(y - y0) * cropWidth + (bounds.x - x0)) * 4;
+			uint8_t* dst = pixels + y * stride + static_cast<size_t>(bounds.x) * channels;
+			for (uint32_t x = bounds.x; x < bounds.z; x++, src += 4, dst += channels) {
+				for (uint32_t c = 0; c < colours; c++) dst[c] = src[c];
+			}
+		}
+	}
+
+	void AnonymiseFaces(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels,
+		const std::vector<glm::vec4>& faces, const FilterParameters& parameters, float scale,
+		GaussianBlur& blur, const glm::vec2& origin)
+	{
+		for (const glm::vec4& face : faces) {
+			const glm::uvec4 bounds = ClampFace(face, width, height);
+			if (bounds.z <= bounds.x || bounds.w <= bounds.y) {
+				continue;
+			}
+			if (parameters.Anonymise == AnonymiseMode::Pixelate) {
+				const float block = std::max(1.0f, parameters.FaceMosaic * scale);
+				PixelateFace(pixels, width, height, channels, bounds, block, origin);
+			}
+			else {
+				BlurFace(pixels, width, height, channels, bounds, parameters.FaceBlurSigma * scale, blur);
+			}
+		}
+	}
+
+	FaceTracker::FaceTracker(uint32_t keyframeInterval)
+		: m_KeyframeInterval(std::max(keyframeInterval, 1u))
+	{
+	}
+
+	void FaceTracker::PrepareTrackImage(const uint8_t* data, uint32_t width, uint32_t height)
+	{
+		// Box filtered by a whole factor, which also keeps the trackers clear of aliasing
+		const uint32_t factor = std::max(1u, (std::max(width, height) + TRACK_SIZE - 1) / TRACK_SIZE);
+		const uint32_t trackWidth = std::max(1u, width / factor);
+		const uint32_t trackHeight = std::max(1u, height / factor);
+		m_TrackScale = 1.0 / factor;
+		m_TrackImage.set_size(trackHeight, trackWidth);
+
+		ThreadPool::Get().ParallelFor(trackHeight, [&](size_t row) {
+			unsigned char* dst = &m_TrackImage[static_cast<long>(row)][0];
+			for (uint32_t x = 0; x < trackWidth; x++) {
+				uint32_t sum = 0;
+				for (uint32_t dy = 0; dy < factor; dy++) {
+					const uint8_t* src = data + ((row * factor + dy) * width + static_cast<size_t>(x) * factor) * 3;
+					for (uint32_t dx = 0; dx < factor; dx++, src += 3) {
+						// Rec. 601 luma in 8 bit fixed point
+						sum += (77 * src[0] + 150 * src[1] + 29 * src[2]) >> 8;
+					}
+				}
+				dst[x] = static_cast<unsigned char>(sum / (factor * factor));
+			}
+		});
+	}
+
+	const std::vector<dlib::rectangle>& FaceTracker::Update(FaceDetector& detector, const uint8_t* data, uint32_t width, uint32_t height)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const bool resized = width != m_FrameWidth || height != m_FrameHeight;
+		m_WasKeyframe = !m_HasKeyframe || resized || m_FramesSinceKeyframe >= m_KeyframeInterval;
+		m_FrameWidth = width;
+		m_FrameHeight = height;
+		PrepareTrackImage(data, width, height);
+
+		if (m_WasKeyframe) {
+			m_Faces = detector.Detect(data, width, height);
+			m_Trackers.assign(m_Faces.size(), dlib::correlation_tracker());
+			ThreadPool::Get().ParallelFor(m_Faces.size(), [&](size_t i) {
+				const dlib::rectangle& face = m_Faces[i];
+				m_Trackers[i].start_track(m_TrackImage, dlib::drectangle(face.left() * m_TrackScale, face.top() * m_TrackScale,
+					face.right() * m_TrackScale, face.bottom() * m_TrackScale));
+			});
+			m_HasKeyframe = true;
+			m_FramesSinceKeyframe = 1;
+		}
+		else {
+			std::vector<double> confidence(m_Trackers.size());
+			ThreadPool::Get().ParallelFor(m_Trackers.size(), [&](size_t i) {
+				confidence[i] = m_Trackers[i].update(m_TrackImage);
+			});
+
+			std::vector<dlib::correlation_tracker> trackers;
+			m_Faces.clear();
+			for (size_t i = 0; i < m_Trackers.size(); i++) {
+				if (confidence[i] < MIN_TRACK_CONFIDENCE) continue;
+				const dlib::drectangle position = m_Trackers[i].get_position();
+				m_Faces.emplace_back(std::lround(position.left() / m_TrackScale), std::lround(position.top() / m_TrackScale),
+					std::lround(position.right() / m_TrackScale), std::lround(position.bottom() / m_TrackScale));
+				trackers.push_back(std::move(m_Trackers[i]));
+			}
+			m_Trackers = std::move(trackers);
+			m_FramesSinceKeyframe++;
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return m_Faces;
+	}
+
+	void FaceTracker::Reset()
+	{
+		m_HasKeyframe = false;
+		m_Trackers.clear();
+		m_Faces.clear();
+	}
+
+	void FaceTracker::SetKeyframeInterval(uint32_t frames)
+	{
+		m_KeyframeInterval = std::max(frames, 1u);
+	}
+
+	uint32_t FaceTracker::GetKeyframeInterval() const
+	{
+		return m_KeyframeInterval;
+	}
+
+	const std::vector<dlib::rectangle>& FaceTracker::GetFaces() const
+	{
+		return m_Faces;
+	}
+
+	bool FaceTracker::WasKeyframe() const
+	{
+		return m_WasKeyframe;
+	}
+
+	double FaceTracker::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+#include <glm/glm.hpp>
+#include <dlib/image_processing.h>
+#include "Filters.h"
+#include "FaceDetector.h"
+#include "GaussianBlur.h"
+
+namespace Photoxel
+{
+	static constexpr int MAX_FACE_MOSAIC = 64;
+	static constexpr float MAX_FACE_BLUR_SIGMA = 64.0f;
+	static constexpr float MAX_FACE_PADDING = 1.0f;
+	static constexpr uint32_t DEFAULT_KEYFRAME_INTERVAL = 10;
+	static constexpr uint32_t MAX_KEYFRAME_INTERVAL = 60;
+
+	// Bounds (x0, y0, x1, y1) of a detection grown by padding times its size on every side
+	glm::vec4 PadFace(const dlib::rectangle& face, float padding);
+
+	// Pixelates or blurs the given bounds of packed RGB (channels = 3) or RGBA (channels = 4) pixels.
+	// The mosaic and sigma of parameters are in source pixels and scale takes them to the pixels of
+	// the buffer. Blocks snap to the grid of the whole source like the Pixelate filter, origin is
+	// where the source starts in buffer pixels, so a crop gets the same blocks as the full image.
+	// Every block takes the average of its pixels and the blur sees a 3 sigma halo around the face
+	void AnonymiseFaces(uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels,
+		const std::vector<glm::vec4>& faces, const FilterParameters& parameters, float scale,
+		GaussianBlur& blur, const glm::vec2& origin = glm::vec2(0.0f));
+
+	// Runs the detector on keyframes only and follows the faces it found with correlation trackers
+	// in between, on a small grayscale copy of the frame. Faces are tracked in parallel and a track
+	// whose peak to sidelobe ratio drops too low is dropped until the next keyframe
+	class FaceTracker
+	{
+	public:
+		FaceTracker(uint32_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+
+		// Takes a packed RGB frame, returns the faces in frame pixels
+		const std::vector<dlib::rectangle>& Update(FaceDetector& detector, const uint8_t* data, uint32_t width, uint32_t height);
+		// The next frame is a keyframe
+		void Reset();
+
+		void SetKeyframeInterval(uint32_t frames);
+		uint32_t GetKeyframeInterval() const;
+		const std::vector<dlib::rectangle>& GetFaces() const;
+		bool WasKeyframe() const;
+		double GetLastTime() const;
+	private:
+		void PrepareTrackImage(const uint8_t* data, uint32_t width, uint32_t height);
+
+		uint32_t m_KeyframeInterval;
+		uint32_t m_FramesSinceKeyframe = 0;
+		bool m_HasKeyframe = false, m_WasKeyframe = false;
+		uint32_t m_FrameWidth = 0, m_FrameHeight = 0;
+		// Track image pixels per frame pixel
+		double m_TrackScale = 1.0;
+		dlib::array2d<unsigned char> m_TrackImage;
+		std::vector<dlib::correlation_tracker> m_Trackers;
+		std::vector<dlib::rectangle> m_Faces;
+		double m_LastTime = 0.0;
+	};
+}
@@ -8,18 +8,34 @@
 #include "FileDialog.h"
 #include "imgui_internals.h"
 #include <filesystem>
+#include <unordered_set>
 #include "IconsFontAwesome5.h"
 #include "ColorGenerator.h"
 #include <stb_image_write.h>
 #include <stb_image_resize.h>
 #include <dlib/image_processing/generic_image.h>
 #include <glad/glad.h>
+#include <glm/gtc/constants.hpp>
 
 #define WIDTH 1280
 #define HEIGHT 720
 
 namespace Photoxel
 {
+	static constexpr float MAX_BLUR_SIGMA = 64.0f;
+	// Tiles of the full resolution refinement rendered per frame once a drag ends
+	static constexpr uint32_t REFINE_TILES_PER_FRAME = 4;
+	// Resolution of the drag preview relative to the on screen size
+	static constexpr float PREVIEW_SCALE = 0.5f;
+	static constexpr float MIN_IMAGE_ZOOM = 0.05f;
+	static constexpr float MAX_IMAGE_ZOOM = 32.0f;
+	static constexpr float MAX_BILATERAL_SPATIAL = 64.0f;
+	static constexpr float MAX_BILATERAL_RANGE = 0.5f;
+	static constexpr float MAX_LEVELS_CLIP = 5.0f;
+	static constexpr float MAX_CLAHE_CLIP = 8.0f;
+	// Library faces looked up for every face of the open image
+	static constexpr size_t FACE_MATCH_COUNT = 50;
+
 	Application::Application()
 		: m_Running(true)
 	{
@@ -30,7 +46,15 @@ namespace Photoxel
 		});
 		m_Window->SetIcons("logo.png");
 		m_Renderer = std::make_shared<Renderer>();
+		m_Layers = std::make_shared<LayerStack>(*m_Renderer);
+		m_Compositor = std::make_shared<Compositor>(*m_Renderer);
+		// The empty document is the first step, opening an image can be undone too
+		m_History = std::make_shared<History>();
+		m_History->Commit(*m_Layers);
+		m_VideoGraph = std::make_shared<RenderGraph>(*m_Renderer);
+		m_VideoGraph->SetFaceKeyframeInterval(m_FaceKeyframeInterval);
 		m_ViewportFramebuffer = std::make_shared<Framebuffer>(1280u, 720u);
+		m_PreviewFramebuffer = std::make_shared<Framebuffer>(1u, 1u);
 
 		m_GuiLayer = std::make_shared<ImGuiLayer>(m_Window);
 		m_GuiWindow = std::make_shared<ImGuiWindow>("Viewport", false);
@@ -38,8 +62,10 @@ namespace Photoxel
 		const int data = -16777216;
 		m_VideoFrame = std::make_shared<Image>(1, 1, &data);
 		m_Camera = std::make_shared<Photoxel::Image>(1, 1, &data);
-		m_PrevCamera = std::make_shared<Photoxel::Image>(1, 1, &data);
-		m_Detector = dlib::get_frontal_face_detector();
+		m_MotionMask = std::make_shared<Photoxel::Image>(1, 1, &data);
+		m_MotionDetector.SetSettings(m_MotionSettings);
+		m_DetectionProfile.ROI = dlib::rectangle(0, 0, 511, 511);
+		m_FaceDetector.SetProfile(m_DetectionProfile);
 
 		m_FilterMap = {
 			{ "Negative", Filter::Negative },
@@ -49,8 +75,16 @@ namespace Photoxel
 			{ "Contrast", Filter::Contrast },
 			{ "Edge Detection", Filter::EdgeDetection },
 			{ "Binary", Filter::Binary },
+			{ "Gaussian Blur", Filter::GaussianBlur },
 			{ "Gradient", Filter::Gradient },
-			{ "Pixelate", Filter::Pixelate }
+			{ "Pixelate", Filter::Pixelate },
+			{ "Convolution", Filter::Convolution },
+			{ "LUT", Filter::Lut },
+			{ "Median", Filter::Median },
+			{ "Bilateral Denoise", Filter::Bilateral },
+			{ "Auto Levels", Filter::AutoLevels },
+			{ "CLAHE", Filter::Clahe },
+			{ "Anonymise Faces", Filter::Anonymise }
 		};
 	}
 
@@ -60,95 +94,88 @@ namespace Photoxel
 		mySequence.myItems.push_back(MySequence::MySequenceItem{ 0, 0, 10, true });
 
 		while (m_Running) {
-			if (m_Image)
-			{
-				m_ViewportFramebuffer->Resize(m_Image->GetWidth(), m_Image->GetHeight());
+			// The image renders only what the Viewport window shows, at the size it is shown at
+			if (m_SectionFocus == IMAGE && !m_Layers->IsEmpty()) {
+				m_ViewportFramebuffer->Resize(std::max(1u, static_cast<uint32_t>(std::lround(m_ImageViewportSize.x))),
+					std::max(1u, static_cast<uint32_t>(std::lround(m_ImageViewportSize.y))));
+			}
+			else if (m_SectionFocus == VIDEO) {
+				m_ViewportFramebuffer->Resize(m_VideoFrame->GetWidth(), m_VideoFrame->GetHeight());
 			}
-			m_ViewportFramebuffer->Begin();
-			m_Renderer->BeginScene();
-			m_ViewportFramebuffer->ClearAttachment();
 
 			if (m_Video) {
 				int status = m_Video->Read();
 				uint8_t* buffer = m_Video->GetFrame();
 				if (status == 2) continue;
 				//if (!buffer) continue;
-				m_VideoFrame->SetData2(m_Video->GetWidth(), m_Video->GetHeight(), buffer);
-			}
-
-			switch (m_SectionFocus) {
-				case IMAGE:
-					if (m_Image) {
-						m_Image->Bind();
-						m_Renderer->BindImageShader();
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat("u_Brightness", m_Brightness);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat("u_Contrast", m_Contrast);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat("u_Thresehold", m_Thresehold);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_Width", m_Image->GetWidth());
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_Height", m_Image->GetHeight());
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_Mosaic", m_Mosaic);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_MosaicWidth", m_Image->GetWidth());
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_MosaicHeight", m_Image->GetHeight());
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat3("u_StartColour", m_StartColour);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat3("u_EndColour", m_EndColour);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat("u_Angle", m_Angle);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetFloat("u_Intensity", m_Intensity);
-						dynamic_cast<Shader*>(m_Renderer->GetShader())->SetInt("u_Texture", 0);
-					}
-					break;
-				case VIDEO:
-					m_VideoFrame->Bind();
-					m_Renderer->BindVideoShader();
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat("u_Brightness", m_VideoBrightness);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat("u_Contrast", m_VideoContrast);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat("u_Thresehold", m_VideoThresehold);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_Width", m_VideoFrame->GetWidth());
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_Height", m_VideoFrame->GetHeight());
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_Mosaic", m_VideoMosaic);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_MosaicWidth", m_VideoFrame->GetWidth());
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_MosaicHeight", m_VideoFrame->GetHeight());
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat3("u_StartColour", m_VideoStartColour);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat3("u_EndColour", m_VideoEndColour);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat("u_Angle", m_VideoAngle);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetFloat("u_Intensity", m_VideoIntensity);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderVideo())->SetInt("u_Texture", 0);
-					break;
-				case CAMERA:
-					m_Camera->Bind(0);
-					m_PrevCamera->Bind(1);
-					m_Renderer->BindCameraShader();
-					dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_Texture", 0);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_PrevTexture", 1);
-					dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_Movement", m_Movement ? 1 : 0);
-					break;
-			}
-
-			m_Renderer->OnRender();
-
-			if (m_HistogramHasUpdate)
-			{
-				m_HistogramHasUpdate = false;
-				std::vector<uint8_t>& data = m_ViewportFramebuffer->GetData();
+				// Paused videos return the same frame, only decoded frames need an upload and a render
+				if (status == 1) {
+					m_VideoFrame->SetData2(m_Video->GetWidth(), m_Video->GetHeight(), buffer);
+					m_VideoRevision++;
+					m_ViewportDirty |= (m_SectionFocus == VIDEO);
+				}
+			}
 
-				int width = m_ViewportFramebuffer->GetWidth();
-				int height = m_ViewportFramebuffer->GetHeight();
+			// The filter passes only run when something they read changed since the last render
+			ViewportState state = GetViewportState();
+			const bool cameraFrame = (m_SectionFocus == CAMERA && m_IsRecording);
+			if (m_ViewportDirty || cameraFrame || state != m_RenderedState) {
+				m_ViewportFramebuffer->Begin();
+				m_Renderer->BeginScene();
+				m_ViewportFramebuffer->ClearAttachment();
+
+				if (m_SectionFocus != IMAGE) {
+					m_Compositor->CancelRefinement();
+					m_ShowingPreview = false;
+				}
 
-				int pixelCount = width * height;
-				int byteCount = pixelCount * 4;
+				switch (m_SectionFocus) {
+					case IMAGE:
+						if (!m_Layers->IsEmpty()) {
+							RenderImage();
+						}
+						break;
+					case VIDEO:
+						m_VideoGraph->Execute(m_VideoFrame->GetRendererID(), m_VideoFrame->GetWidth(), m_VideoFrame->GetHeight(),
+							m_VideoRevision, m_VideoParameters, *m_ViewportFramebuffer);
+						break;
+					case CAMERA:
+						m_Camera->Bind(0);
+						m_MotionMask->Bind(1);
+						m_Renderer->BindCameraShader();
+						dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_Texture", 0);
+						dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_MotionMask", 1);
+						dynamic_cast<Shader*>(m_Renderer->GetShaderCamera())->SetInt("u_Movement", m_Movement ? 1 : 0);
+						m_Renderer->OnRender();
+						break;
+				}
 
-				red.clear();
-				green.clear();
-				blue.clear();
+				m_RenderedState = std::move(state);
+				m_ViewportDirty = false;
+				m_ViewportRenders++;
+			}
+			else if (m_ShowingPreview && !m_ImageInteracting && !m_Compositor->IsRefining()) {
+				// The drag that left a proxy on screen is over
+				RenderImage();
+			}
 
-				red.reserve(pixelCount);
-				green.reserve(pixelCount);
-				blue.reserve(pixelCount);
+			if (m_Compositor->IsRefining() && m_Compositor->StepRefinement(REFINE_TILES_PER_FRAME)) {
+				m_ShowingPreview = false;
+				m_HistogramHasUpdate = true;
+			}
 
-				for (int i = 0; i < byteCount; i += 4) {
-					red.emplace_back((float)data[i]);
-					green.emplace_back((float)data[i + 1]);
-					blue.emplace_back((float)data[i + 2]);
-				}
+			if (m_HistogramHasUpdate)
+			{
+				m_HistogramHasUpdate = false;
+				// Reading back the proxy keeps a drag from stalling on the full resolution target
+				const auto& histogramSource = m_ShowingPreview ? m_PreviewFramebuffer : m_ViewportFramebuffer;
+				const std::vector<uint8_t> data = histogramSource->GetData();
+
+				Histogram histogram;
+				histogram.Compute(data.data(), histogramSource->GetWidth(), histogramSource->GetHeight(), 4);
+				red.assign(histogram.Red.begin(), histogram.Red.end());
+				green.assign(histogram.Green.begin(), histogram.Green.end());
+				blue.assign(histogram.Blue.begin(), histogram.Blue.end());
 			}
 
 			m_GuiLayer->Begin();
@@ -157,15 +184,49 @@ namespace Photoxel
 			RenderCameraTab();
 			RenderVideoTab();
 			RenderImageTab();
+			m_ImageInteracting = (m_SectionFocus == IMAGE) && ImGui::IsAnyItemActive();
+
+			// An edit becomes a history step once the control making it is let go
+			if (!m_ImageInteracting) {
+				std::vector<LayerState> layers = GetLayerStates();
+				if (layers != m_HistoryState) {
+					m_History->Commit(*m_Layers);
+					m_HistoryState = std::move(layers);
+				}
+			}
 
 			m_ViewportFramebuffer->End();
 			m_GuiLayer->End();
-			m_Window->Update();
+
+			// Nothing animates on its own, so sleep until the user does something. A change made by
+			// this frame's UI still has to reach the viewport first
+			const bool videoPlaying = m_Video && !m_Video->IsPaused();
+			const bool pending = m_ViewportDirty || GetViewportState() != m_RenderedState
+				|| m_Compositor->IsRefining() || (m_ShowingPreview && !m_ImageInteracting);
+			m_Window->Update(!videoPlaying && !m_IsRecording && !pending);
 		}
 	}
 
 	void Application::RenderMenuBar()
 	{
+		const ImGuiIO& io = ImGui::GetIO();
+		if (io.KeyCtrl && !io.WantTextInput) {
+			if (ImGui::IsKeyPressed('Z') && m_History->CanUndo()) {
+				StepHistory(false);
+			}
+			else if (ImGui::IsKeyPressed('Y') && m_History->CanRedo()) {
+				StepHistory(true);
+			}
+		}
+		if (!io.KeyCtrl && !io.WantTextInput && !ImGui::IsAnyItemActive() && m_ViewportHasKeys) {
+			if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_RightArrow)) || ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_PageDown))) {
+				StepFolder(1);
+			}
+			else if (ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_LeftArrow)) || ImGui::IsKeyPressed(ImGui::GetKeyIndex(ImGuiKey_PageUp))) {
+				StepFolder(-1);
+			}
+		}
+
 		if (ImGui::BeginMenuBar())
 		{
 			if (ImGui::BeginMenu("File"))
@@ -175,8 +236,7 @@ namespace Photoxel
 						case IMAGE: {
 							std::string filepath = FileDialog::OpenFile(*m_Window.get(), "Image Files (*.png, *.jpg)|*.png;*.jpg|");
 							if (filepath == "") break;
-							m_Image = std::make_shared<Image>(filepath.c_str());
-							m_HistogramHasUpdate = true;
+							OpenImage(filepath);
 							break;
 						}
 						case VIDEO: {
@@ -194,8 +254,7 @@ namespace Photoxel
 						case IMAGE: {
 							std::string filepath = FileDialog::OpenFile(*m_Window.get(), "Image Files (*.png, *.jpg)|*.png;*.jpg|");
 							if (filepath == "") break;
-							m_Image = std::make_shared<Image>(filepath.c_str());
-							m_HistogramHasUpdate = true;
+							OpenImage(filepath);
 							break;
 						}
 						case VIDEO: {
@@ -209,23 +268,34 @@ namespace Photoxel
 					
 				}
 
+				if (ImGui::MenuItem(ICON_FA_ARROW_RIGHT"\tNext Image", "Right", false, m_FolderBrowser.IsOpen())) {
+					StepFolder(1);
+				}
+				if (ImGui::MenuItem(ICON_FA_ARROW_LEFT"\tPrevious Image", "Left", false, m_FolderBrowser.IsOpen())) {
+					StepFolder(-1);
+				}
+
 				ImGui::Separator();
 
 				if (ImGui::MenuItem(ICON_FA_SAVE"\t Save File")) {
-					if (m_SectionFocus == IMAGE && m_Image) {
-						std::string filepath = FileDialog::SaveFile(*m_Window.get(), "(.jpg)\0*.jpg\0(.png)\0*.png");
-						std::vector<uint8_t> data = m_ViewportFramebuffer->GetData();
-						stbi_write_png(filepath.c_str(), m_Image->GetWidth(),
-							m_Image->GetHeight(), 4, data.data(), m_Image->GetWidth() * 4);
+					if (m_SectionFocus == IMAGE && !m_Layers->IsEmpty()) {
+						std::string filepath = FileDialog::SaveFile(*m_Window.get(), "PNG Image (*.png)|*.png|");
+						std::vector<uint8_t> data = RenderImageExport();
+						if (stbi_write_png(filepath.c_str(), m_Layers->GetWidth(),
+							m_Layers->GetHeight(), 4, data.data(), m_Layers->GetWidth() * 4)) {
+							m_FolderImageState = GetLayerStates();
+						}
 					}
 				}
 
 				if (ImGui::MenuItem(ICON_FA_SAVE"\t Save File As...")) {
-					if (m_SectionFocus == IMAGE && m_Image) {
-						std::string filepath = FileDialog::SaveFile(*m_Window.get(), "(.jpg)\0*.jpg\0(.png)\0*.png");
-						std::vector<uint8_t> data = m_ViewportFramebuffer->GetData();
-						stbi_write_png(filepath.c_str(), m_Image->GetWidth(),
-							m_Image->GetHeight(), 4, data.data(), m_Image->GetWidth() * 4);
+					if (m_SectionFocus == IMAGE && !m_Layers->IsEmpty()) {
+						std::string filepath = FileDialog::SaveFile(*m_Window.get(), "PNG Image (*.png)|*.png|");
+						std::vector<uint8_t> data = RenderImageExport();
+						if (stbi_write_png(filepath.c_str(), m_Layers->GetWidth(),
+							m_Layers->GetHeight(), 4, data.data(), m_Layers->GetWidth() * 4)) {
+							m_FolderImageState = GetLayerStates();
+						}
 					}
 				}
 				
@@ -236,6 +306,15 @@ namespace Photoxel
 
 				ImGui::EndMenu();
 			}
+			if (ImGui::BeginMenu("Edit")) {
+				if (ImGui::MenuItem(ICON_FA_UNDO"\tUndo", "Ctrl+Z", false, m_History->CanUndo())) {
+					StepHistory(false);
+				}
+				if (ImGui::MenuItem(ICON_FA_REDO"\tRedo", "Ctrl+Y", false, m_History->CanRedo())) {
+					StepHistory(true);
+				}
+				ImGui::EndMenu();
+			}
 			if (ImGui::BeginMenu("Help")) {
 				if (ImGui::MenuItem(ICON_FA_BOOK"\tUser Manual")) {
 					ShellExecuteA(GetDesktopWindow(), "open", "Photoxel.pdf", NULL, NULL, SW_SHOWNORMAL);
@@ -244,6 +323,24 @@ namespace Photoxel
 			}
 			ImGui::EndMenuBar();
 		}
+
+		if (m_PendingFolderStep != 0) {
+			ImGui::OpenPopup("Discard changes?");
+		}
+		if (ImGui::BeginPopupModal("Discard changes?", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+			ImGui::Text("The edits of this image have not been saved");
+			if (ImGui::Button("Discard")) {
+				MoveFolder(m_PendingFolderStep);
+				m_PendingFolderStep = 0;
+				ImGui::CloseCurrentPopup();
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Cancel")) {
+				m_PendingFolderStep = 0;
+				ImGui::CloseCurrentPopup();
+			}
+			ImGui::EndPopup();
+		}
 	}
 
 	void Application::RenderImageTab()
@@ -262,36 +359,126 @@ namespace Photoxel
 			m_SectionFocus = IMAGE;
 		}
 		ImVec2 viewportSize = ImGui::GetContentRegionAvail();
-		ImGui::PlotHistogramColour("HistogramRed", red.data(), red.size(), 0, NULL, 0.0f, 255.0f, ImVec2(viewportSize.x, viewportSize.y / 3.2), 4, ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
-		ImGui::PlotHistogramColour("HistogramGreen", green.data(), green.size(), 0, NULL, 0.0f, 255.0f, ImVec2(viewportSize.x, viewportSize.y / 3.2), 4, ImVec4(0.0f, 1.0f, 0.0f, 1.0f));
-		ImGui::PlotHistogramColour("HistogramBlue", blue.data(), blue.size(), 0, NULL, 0.0f, 255.0f, ImVec2(viewportSize.x, viewportSize.y / 3.2), 4, ImVec4(0.0f, 0.0f, 1.0f, 1.0f));
+		ImGui::PlotHistogramColour("HistogramRed", red.data(), (int)red.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(viewportSize.x, viewportSize.y / 3.2), sizeof(float), ImVec4(1.0f, 0.0f, 0.0f, 1.0f));
+		ImGui::PlotHistogramColour("HistogramGreen", green.data(), (int)green.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(viewportSize.x, viewportSize.y / 3.2), sizeof(float), ImVec4(0.0f, 1.0f, 0.0f, 1.0f));
+		ImGui::PlotHistogramColour("HistogramBlue", blue.data(), (int)blue.size(), 0, NULL, 0.0f, FLT_MAX, ImVec2(viewportSize.x, viewportSize.y / 3.2), sizeof(float), ImVec4(0.0f, 0.0f, 1.0f, 1.0f));
 		ImGui::End();
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
-		ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_HorizontalScrollbar);
+		ImGui::Begin("Viewport", nullptr, ImGuiWindowFlags_NoScrollbar | ImGuiWindowFlags_NoScrollWithMouse);
 		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
 			m_SectionFocus = IMAGE;
 		}
+		// Hovering only counts while the keyboard is not moving through the items of another window
+		m_ViewportHasKeys = ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)
+			|| (ImGui::IsWindowHovered(ImGuiHoveredFlags_ChildWindows) && !ImGui::GetIO().NavVisible);
 
-		if (m_Image)
+		const ImVec2 windowSize = ImGui::GetWindowSize();
+		const ImVec2 viewportSize = ImGui::GetContentRegionAvail();
+		if (!m_Layers->IsEmpty() && viewportSize.x >= 1.0f && viewportSize.y >= 1.0f)
 		{
-			const ImVec2 windowSize = ImGui::GetWindowSize();
-			const ImVec2 viewportSize = ImGui::GetContentRegionAvail();
 			const float navbarHeight = windowSize.y - viewportSize.y;
 
-			float widthScale = viewportSize.x / m_Image->GetWidth();
-			float heightScale = viewportSize.y / m_Image->GetHeight();
+			float widthScale = viewportSize.x / m_Layers->GetWidth();
+			float heightScale = viewportSize.y / m_Layers->GetHeight();
 			float minScale = glm::min(widthScale, heightScale);
-			glm::vec2 scaleImageSize = glm::vec2(m_Image->GetWidth(), m_Image->GetHeight()) * minScale;
+			glm::vec2 scaleImageSize = glm::vec2(m_Layers->GetWidth(), m_Layers->GetHeight()) * minScale;
 			scaleImageSize *= m_ImageScale;
 
-			ImGui::SetCursorPosX(viewportSize.x / 2 - scaleImageSize.x / 2);
-			ImGui::SetCursorPosY((viewportSize.y / 2 - scaleImageSize.y / 2) + navbarHeight);
+			// Dragging pans, the wheel zooms around the point under the cursor
+			ImGui::SetCursorPos(ImVec2(0.0f, navbarHeight));
+			ImGui::InvisibleButton("ViewportCanvas", viewportSize);
+			const ImVec2 canvasMin = ImGui::GetItemRectMin();
+			const glm::vec2 cursor(ImGui::GetIO().MousePos.x - canvasMin.x, ImGui::GetIO().MousePos.y - canvasMin.y);
+			if (!m_SelectionTool && ImGui::IsItemActive() && ImGui::IsMouseDragging(ImGuiMouseButton_Left)) {
+				const ImVec2 delta = ImGui::GetIO().MouseDelta;
+				m_ImageCenter -= glm::vec2(delta.x, delta.y) / scaleImageSize;
+			}
+			if (ImGui::IsItemHovered() && ImGui::GetIO().MouseWheel != 0.0f) {
+				const glm::vec2 origin = glm::vec2(viewportSize.x, viewportSize.y) * 0.5f - m_ImageCenter * scaleImageSize;
+				const glm::vec2 anchor = (cursor - origin) / scaleImageSize;
+				const float zoom = glm::clamp(m_ImageScale * std::pow(1.2f, ImGui::GetIO().MouseWheel), MIN_IMAGE_ZOOM, MAX_IMAGE_ZOOM);
+				scaleImageSize *= zoom / m_ImageScale;
+				m_ImageScale = zoom;
+				m_ImageCenter = anchor + (glm::vec2(viewportSize.x, viewportSize.y) * 0.5f - cursor) / scaleImageSize;
+			}
+			m_ImageCenter = glm::clamp(m_ImageCenter, glm::vec2(0.0f), glm::vec2(1.0f));
+			const glm::vec2 origin = glm::vec2(viewportSize.x, viewportSize.y) * 0.5f - m_ImageCenter * scaleImageSize;
+			const glm::vec2 imageSize(m_Layers->GetWidth(), m_Layers->GetHeight());
+
+			// With the selection tool dragging outlines a selection in image pixels, a click clears it
+			if (m_SelectionTool) {
+				const glm::vec2 point = glm::clamp((cursor - origin) / scaleImageSize, glm::vec2(0.0f), glm::vec2(1.0f)) * imageSize;
+				if (ImGui::IsItemActivated()) {
+					m_SelectionPoints = { point };
+				}
+				else if (ImGui::IsItemActive() && !m_SelectionPoints.empty()) {
+					if (m_SelectionShape != SelectionShape::Lasso) {
+						m_SelectionPoints.resize(1);
+						m_SelectionPoints.push_back(point);
+					}
+					else if (glm::length((point - m_SelectionPoints.back()) / imageSize * scaleImageSize) >= 2.0f) {
+						m_SelectionPoints.push_back(point);
+					}
+				}
+				if (ImGui::IsItemDeactivated()) {
+					Layer& layer = m_Layers->GetActive();
+					const glm::vec2 extent = m_SelectionPoints.empty() ? glm::vec2(0.0f) : point - m_SelectionPoints.front();
+					if (m_SelectionPoints.size() > 1 && (std::abs(extent.x) >= 1.0f || std::abs(extent.y) >= 1.0f || m_SelectionPoints.size() > 2)) {
+						layer.Selection = CreateSelection(m_Layers->GetWidth(), m_Layers->GetHeight(), m_SelectionShape,
+							m_SelectionPoints, m_SelectionFeather);
+					}
+					else {
+						layer.Selection.reset();
+					}
+					m_SelectionPoints.clear();
+					m_HistogramHasUpdate = true;
+				}
+			}
+
+			// Only the part of the image inside the window gets rendered and drawn
+			const glm::vec2 visibleMin = glm::max(origin, glm::vec2(0.0f));
+			const glm::vec2 visibleMax = glm::min(origin + scaleImageSize, glm::vec2(viewportSize.x, viewportSize.y));
+			if (visibleMax.x - visibleMin.x >= 1.0f && visibleMax.y - visibleMin.y >= 1.0f) {
+				m_ImageRegion = glm::vec4((visibleMin - origin) / scaleImageSize, (visibleMax - origin) / scaleImageSize);
+				m_ImageViewportSize = visibleMax - visibleMin;
+
+				ImGui::SetCursorPos(ImVec2(visibleMin.x, visibleMin.y + navbarHeight));
+				const auto& shown = m_ShowingPreview ? m_PreviewFramebuffer : m_ViewportFramebuffer;
+				ImGui::Image(
+					(ImTextureID)shown->GetColorAttachment(),
+					ImVec2(m_ImageViewportSize.x, m_ImageViewportSize.y)
+				);
+			}
 
-			ImGui::Image(
-				(ImTextureID)m_ViewportFramebuffer->GetColorAttachment(),
-				ImVec2(scaleImageSize.x, scaleImageSize.y)
-			);
+			// Outline of the selection being drawn, over the image
+			if (m_SelectionPoints.size() > 1) {
+				ImDrawList* drawList = ImGui::GetWindowDrawList();
+				std::vector<ImVec2> outline;
+				for (const glm::vec2& point : m_SelectionPoints) {
+					const glm::vec2 screen = origin + point / imageSize * scaleImageSize;
+					outline.push_back(ImVec2(canvasMin.x + screen.x, canvasMin.y + screen.y));
+				}
+				const ImU32 colour = IM_COL32(255, 255, 255, 220);
+				switch (m_SelectionShape) {
+					case SelectionShape::Rectangle:
+						drawList->AddRect(outline[0], outline[1], colour);
+						break;
+					case SelectionShape::Ellipse: {
+						const ImVec2 centre((outline[0].x + outline[1].x) * 0.5f, (outline[0].y + outline[1].y) * 0.5f);
+						const ImVec2 radius(std::abs(outline[1].x - outline[0].x) * 0.5f, std::abs(outline[1].y - outline[0].y) * 0.5f);
+						for (int i = 0; i < 64; i++) {
+							const float angle = i * 2.0f * glm::pi<float>() / 64.0f;
+							drawList->PathLineTo(ImVec2(centre.x + radius.x * std::cos(angle), centre.y + radius.y * std::sin(angle)));
+						}
+						drawList->PathStroke(colour, true);
+						break;
+					}
+					case SelectionShape::Lasso:
+						drawList->AddPolyline(outline.data(), static_cast<int>(outline.size()), colour, true, 1.0f);
+						break;
+				}
+			}
 		}
 
 		ImGui::End();
@@ -302,12 +489,128 @@ namespace Photoxel
 			m_SectionFocus = IMAGE;
 		}
 
+		if (!m_Layers->IsEmpty()) {
+			RenderImageFilters(m_Layers->GetActive());
+		}
+		ImGui::End();
+
+
+		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
+		ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(0.0f, 0.0f, 0.0f, 0.0f));
+		ImGui::Begin("Effects");
+		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
+			m_SectionFocus = IMAGE;
+		}
+		ImVec2 effectsSize = ImGui::GetContentRegionAvail();
+		for (auto& [name, filter] : m_FilterMap)
+		{
+			if (ImGui::Button(name.c_str(), ImVec2(effectsSize.x, 30.0f)) && !m_Layers->IsEmpty()) {
+				std::vector<Filter>& filters = m_Layers->GetActive().Filters;
+				if (!HasFilter(filters, filter)) {
+					filters.push_back(filter);
+					UpdateImageInfo();
+				}
+			}
+		}
+		ImGui::End();
+		ImGui::PopStyleColor();
+		ImGui::PopStyleVar();
+
+		RenderLayersPanel();
+		RenderFaceLibrary();
+		RenderDuplicates();
+		RenderBatch();
+
+		ImGui::Begin("Stats");
+		// Graph statistics are the ones of the layer being edited
+		Layer* active = m_Layers->IsEmpty() ? nullptr : &m_Layers->GetActive();
+		ImVec2 size2 = ImGui::GetContentRegionAvail();
+		ImGui::PushTextWrapPos(ImGui::GetCursorPos().x + size2.x);
+		if (active) ImGui::Text("Image name: %s", m_Layers->Get(0).Source->GetFilename());
+		ImGui::PopTextWrapPos();
+		if (active) ImGui::Text("Image size: (%d x %d)", m_Layers->GetWidth(), m_Layers->GetHeight());
+		if (active) ImGui::Text("Render passes: %d (%d pooled targets)", (int)active->Graph->GetPasses().size(), (int)active->Graph->GetPoolSize());
+		ImGui::Text("Viewport renders: %d", (int)m_ViewportRenders);
+		if (m_FolderBrowser.IsOpen()) {
+			ImageCache& images = m_FolderBrowser.GetCache();
+			ImGui::Text("Folder: image %d of %d, opened in %.1f ms", (int)m_FolderBrowser.GetIndex() + 1, (int)m_FolderBrowser.GetCount(),
+				m_FolderBrowser.GetLastAcquireTime());
+			if (!m_FolderError.empty()) {
+				ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", m_FolderError.c_str());
+			}
+			ImGui::Text("Image cache: %.1f MB in %d images, %d hits, %d misses", images.GetUsage() / (1024.0f * 1024.0f),
+				(int)images.GetEntryCount(), (int)m_FolderBrowser.GetHits(), (int)m_FolderBrowser.GetMisses());
+			int imageBudget = static_cast<int>(images.GetBudget() >> 20);
+			if (ImGui::SliderInt("Image cache budget (MB)", &imageBudget, 0, 4096)) {
+				images.SetBudget(static_cast<size_t>(imageBudget) << 20);
+			}
+		}
+		if (active) {
+			PassCache& cache = active->Graph->GetCache();
+			ImGui::Text("Pass cache: %.1f MB in %d entries, %d passes reused", cache.GetUsage() / (1024.0f * 1024.0f),
+				(int)cache.GetEntryCount(), (int)active->Graph->GetLastReusedPasses());
+			int cacheBudget = static_cast<int>(cache.GetBudget() >> 20);
+			if (ImGui::SliderInt("Cache budget (MB)", &cacheBudget, 0, 2048)) {
+				for (size_t i = 0; i < m_Layers->GetCount(); i++) {
+					m_Layers->Get(i).Graph->GetCache().SetBudget(static_cast<size_t>(cacheBudget) << 20);
+				}
+			}
+		}
+		if (active && HasFilter(active->Filters, Filter::GaussianBlur) && active->Parameters.BlurSigma > MAX_GPU_GAUSSIAN_SIGMA)
+			ImGui::Text("CPU blur: %.2f ms", active->Graph->GetLastCpuBlurTime());
+		if (active && HasFilter(active->Filters, Filter::Convolution)) {
+			const ConvolutionEngine& engine = active->Graph->GetConvolutionEngine();
+			ImGui::Text("Convolution: %.2f ms (%s%s)", engine.GetLastConvolutionTime(), GetConvolutionPathName(engine.GetLastPath()),
+				ConvolutionEngine::HasAVX2() ? ", AVX2" : "");
+		}
+		if (active && HasFilter(active->Filters, Filter::Median))
+			ImGui::Text("Median: %.2f ms", active->Graph->GetMedianFilter().GetLastTime());
+		if (active && HasFilter(active->Filters, Filter::Bilateral))
+			ImGui::Text("Bilateral grid: %.2f ms", active->Graph->GetBilateralGrid().GetLastTime());
+		if (active && (HasFilter(active->Filters, Filter::AutoLevels) || HasFilter(active->Filters, Filter::Clahe)))
+			ImGui::Text("Histogram filters: %.2f ms", active->Graph->GetLastHistogramTime());
+		ImGui::Text("History: step %d of %d, %.1f MB (%d of %d tiles compressed, %.2f ms)", (int)m_History->GetPosition() + 1,
+			(int)m_History->GetStepCount(), m_History->GetUsage() / (1024.0f * 1024.0f), (int)m_History->GetCompressedTiles(),
+			(int)m_History->GetTileCount(), m_History->GetLastTime());
+		int historyBudget = static_cast<int>(m_History->GetBudget() >> 20);
+		if (ImGui::SliderInt("History budget (MB)", &historyBudget, 16, 4096)) {
+			m_History->SetBudget(static_cast<size_t>(historyBudget) << 20);
+		}
+		ImGui::Checkbox("Preview proxy while dragging", &m_ProxyPreview);
+		if (active) {
+			ImGui::Text("Rendered region: (%d x %d)", m_ViewportFramebuffer->GetWidth(), m_ViewportFramebuffer->GetHeight());
+		}
+		if (m_ShowingPreview) {
+			ImGui::Text("Preview: (%d x %d), refined %.0f%%", m_PreviewFramebuffer->GetWidth(), m_PreviewFramebuffer->GetHeight(),
+				m_Compositor->GetRefinementProgress() * 100.0f);
+		}
+		//ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
+		ImGui::SliderFloat("Zoom", &m_ImageScale, MIN_IMAGE_ZOOM, MAX_IMAGE_ZOOM, "%.2f", ImGuiSliderFlags_AlwaysClamp | ImGuiSliderFlags_Logarithmic);
+		if (ImGui::Button("Fit to window")) {
+			m_ImageScale = 1.0f;
+			m_ImageCenter = glm::vec2(0.5f);
+		}
+		
+		if (ImGui::Button("Eliminar imagen")) {
+			if (active) {
+				m_Compositor->CancelRefinement();
+				m_Layers->Clear();
+				m_HistogramHasUpdate = true;
+				m_ViewportDirty = true;
+			}
+		}
+		
+		ImGui::End();
+	}
+
+	void Application::RenderImageFilters(Layer& layer)
+	{
 		if (ImGui::TreeNode("Eliminar filtros"))
 		{
 			for (auto& [name, filter] : m_FilterMap) {
-				if (m_ImageFilters.find(filter) != m_ImageFilters.end()) {
+				if (HasFilter(layer.Filters, filter)) {
 					if (ImGui::Button(name.c_str())) {
-						m_ImageFilters.erase(filter);
+						layer.Filters.erase(std::remove(layer.Filters.begin(), layer.Filters.end(), filter), layer.Filters.end());
 						UpdateImageInfo();
 					}
 				}
@@ -315,76 +618,220 @@ namespace Photoxel
 			ImGui::TreePop();
 		}
 
-		if (m_ImageFilters.find(Filter::Brightness) != m_ImageFilters.end()) {
-			if (ImGui::SliderFloat("Brightness", &m_Brightness, 0.0f, 2.0f)) {
+		if (HasFilter(layer.Filters, Filter::Brightness)) {
+			if (ImGui::SliderFloat("Brightness", &layer.Parameters.Brightness, 0.0f, 2.0f)) {
 				m_HistogramHasUpdate = true;
 			}
 		}
-		if (m_ImageFilters.find(Filter::Contrast) != m_ImageFilters.end()) {
-			if (ImGui::SliderFloat("Contrast", &m_Contrast, -1.0f, 1.0f)) {
+		if (HasFilter(layer.Filters, Filter::Contrast)) {
+			if (ImGui::SliderFloat("Contrast", &layer.Parameters.Contrast, -1.0f, 1.0f)) {
 				m_HistogramHasUpdate = true;
 			}
 		}
-		if (m_ImageFilters.find(Filter::Binary) != m_ImageFilters.end()) {
-			if (ImGui::SliderFloat("Thresehold", &m_Thresehold, 0.0f, 5.0f)) {
+		if (HasFilter(layer.Filters, Filter::Binary)) {
+			if (ImGui::SliderFloat("Thresehold", &layer.Parameters.Thresehold, 0.0f, 5.0f)) {
 				m_HistogramHasUpdate = true;
 			}
 		}
-		if (m_ImageFilters.find(Filter::Pixelate) != m_ImageFilters.end()) {
-			if (ImGui::SliderInt("Mosaic", &m_Mosaic, 1, 100)) {
+		if (HasFilter(layer.Filters, Filter::Pixelate)) {
+			if (ImGui::SliderInt("Mosaic", &layer.Parameters.Mosaic, 1, 100)) {
 				m_HistogramHasUpdate = true;
 			}
 		}
-		if (m_ImageFilters.find(Filter::Gradient) != m_ImageFilters.end()) {
-			if (ImGui::ColorEdit3("Start Colour", glm::value_ptr(m_StartColour))) 
+		if (HasFilter(layer.Filters, Filter::GaussianBlur)) {
+			if (ImGui::SliderFloat("Sigma", &layer.Parameters.BlurSigma, MIN_GAUSSIAN_SIGMA, MAX_BLUR_SIGMA, "%.1f", ImGuiSliderFlags_Logarithmic)) {
 				m_HistogramHasUpdate = true;
-			if (ImGui::ColorEdit3("End Colour", glm::value_ptr(m_EndColour))) 
+			}
+		}
+		if (HasFilter(layer.Filters, Filter::Convolution)) {
+			if (RenderKernelEditor(layer.Parameters.Kernel, layer.Preset)) {
+				m_HistogramHasUpdate = true;
+			}
+		}
+		if (HasFilter(layer.Filters, Filter::Median)) {
+			if (ImGui::SliderInt("Median radius", &layer.Parameters.MedianRadius, 1, MAX_MEDIAN_RADIUS)) {
+				m_HistogramHasUpdate = true;
+			}
+		}
+		if (HasFilter(layer.Filters, Filter::Bilateral)) {
+			if (ImGui::SliderFloat("Spatial sigma", &layer.Parameters.BilateralSpatial, MIN_BILATERAL_SPATIAL, MAX_BILATERAL_SPATIAL, "%.1f", ImGuiSliderFlags_Logarithmic)) {
 				m_HistogramHasUpdate = true;
-			if (ImGui::SliderFloat("Angle", &m_Angle, 0.0f, 360.0f)) 
+			}
+			if (ImGui::SliderFloat("Range sigma", &layer.Parameters.BilateralRange, MIN_BILATERAL_RANGE, MAX_BILATERAL_RANGE, "%.2f")) {
 				m_HistogramHasUpdate = true;
-			if (ImGui::SliderFloat("Intensity", &m_Intensity, 0.0f, 1.0f)) 
+			}
+		}
+		if (HasFilter(layer.Filters, Filter::AutoLevels)) {
+			if (ImGui::SliderFloat("Clip (%)", &layer.Parameters.LevelsClip, 0.0f, MAX_LEVELS_CLIP, "%.2f")) {
 				m_HistogramHasUpdate = true;
+			}
 		}
-		ImGui::End();
-
+		if (HasFilter(layer.Filters, Filter::Clahe)) {
+			if (ImGui::SliderInt("Tiles", &layer.Parameters.ClaheTiles, MIN_CLAHE_TILES, MAX_CLAHE_TILES)) {
+				m_HistogramHasUpdate = true;
+			}
+			if (ImGui::SliderFloat("Clip limit", &layer.Parameters.ClaheClip, 1.0f, MAX_CLAHE_CLIP, "%.1f")) {
+				m_HistogramHasUpdate = true;
+			}
+		}
+		if (HasFilter(layer.Filters, Filter::Anonymise)) {
+			if (RenderAnonymiseControls(layer.Parameters)) {
+				m_HistogramHasUpdate = true;
+			}
+			if (RenderDetectionModel(layer.Parameters.FaceModel, layer.Graph->GetFaceModelError())) {
+				m_HistogramHasUpdate = true;
+			}
+			ImGui::Text("Faces: %d (%.2f ms)", layer.Graph->GetLastFaceCount(), layer.Graph->GetLastFaceTime());
+		}
+		if (HasFilter(layer.Filters, Filter::Gradient)) {
+			if (ImGui::ColorEdit3("Start Colour", glm::value_ptr(layer.Parameters.StartColour))) 
+				m_HistogramHasUpdate = true;
+			if (ImGui::ColorEdit3("End Colour", glm::value_ptr(layer.Parameters.EndColour))) 
+				m_HistogramHasUpdate = true;
+			if (ImGui::SliderFloat("Angle", &layer.Parameters.Angle, 0.0f, 360.0f)) 
+				m_HistogramHasUpdate = true;
+			if (ImGui::SliderFloat("Intensity", &layer.Parameters.Intensity, 0.0f, 1.0f)) 
+				m_HistogramHasUpdate = true;
+		}
+		if (RenderLutEditor(layer.Filters, layer.Parameters, *layer.Graph)) {
+			UpdateImageInfo();
+		}
+	}
 
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
-		ImGui::PushStyleColor(ImGuiCol_Button, ImVec4(0.0f, 0.0f, 0.0f, 0.0f));
-		ImGui::Begin("Effects");
+	void Application::RenderLayersPanel()
+	{
+		ImGui::Begin("Layers");
 		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
 			m_SectionFocus = IMAGE;
 		}
-		ImVec2 effectsSize = ImGui::GetContentRegionAvail();
-		for (auto& [name, filter] : m_FilterMap)
-		{
-			if (ImGui::Button(name.c_str(), ImVec2(effectsSize.x, 30.0f))) {
-				m_ImageFilters.insert(filter);
-				UpdateImageInfo();
+		if (m_Layers->IsEmpty()) {
+			ImGui::TextDisabled("Open an image to add layers over it");
+			ImGui::End();
+			return;
+		}
+
+		// Top of the stack first, the way it ends up on screen
+		bool changed = false;
+		for (size_t i = m_Layers->GetCount(); i-- > 0;) {
+			Layer& layer = m_Layers->Get(i);
+			ImGui::PushID(static_cast<int>(i));
+			changed |= ImGui::Checkbox("##Visible", &layer.Visible);
+			ImGui::SameLine();
+			if (ImGui::Selectable(layer.Name.c_str(), i == m_Layers->GetActiveIndex())) {
+				m_Layers->SetActive(i);
 			}
+			ImGui::PopID();
 		}
-		ImGui::End();
-		ImGui::PopStyleColor();
-		ImGui::PopStyleVar();
 
-		ImGui::Begin("Stats");
-		ImVec2 size2 = ImGui::GetContentRegionAvail();
-		ImGui::PushTextWrapPos(ImGui::GetCursorPos().x + size2.x);
-		if (m_Image) ImGui::Text("Image name: %s", m_Image->GetFilename());
-		ImGui::PopTextWrapPos();
-		if (m_Image) ImGui::Text("Image size: (%d x %d)", m_Image->GetWidth(), m_Image->GetHeight());
-		//ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
-		ImGui::SliderFloat("Zoom", &m_ImageScale, 0.0f, 5.0f, "%.2f", ImGuiSliderFlags_AlwaysClamp);
-		
-		if (ImGui::Button("Eliminar imagen")) {
-			if (m_Image) {
-				const int data = -16777216;
-				m_Image->SetData(1, 1, &data);
-				m_Image = nullptr;
-				m_HistogramHasUpdate = true;
+		// The refinement in flight may belong to the graph of a layer that goes away
+		if (ImGui::Button(ICON_FA_PLUS" Add")) {
+			std::string filepath = FileDialog::OpenFile(*m_Window.get(), "Image Files (*.png, *.jpg)|*.png;*.jpg|");
+			if (filepath != "") {
+				m_Compositor->CancelRefinement();
+				auto image = std::make_shared<Image>(filepath.c_str());
+				m_Layers->Add(image->GetFilename(), image);
+				changed = true;
 			}
 		}
-		
+		ImGui::SameLine();
+		if (ImGui::Button(ICON_FA_TRASH" Remove") && m_Layers->GetCount() > 1) {
+			m_Compositor->CancelRefinement();
+			m_Layers->Remove(m_Layers->GetActiveIndex());
+			changed = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button(ICON_FA_ARROW_UP)) {
+			m_Layers->Move(m_Layers->GetActiveIndex(), 1);
+			changed = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button(ICON_FA_ARROW_DOWN)) {
+			m_Layers->Move(m_Layers->GetActiveIndex(), -1);
+			changed = true;
+		}
+
+		ImGui::Separator();
+		Layer& layer = m_Layers->GetActive();
+		changed |= ImGui::SliderFloat("Opacity", &layer.Opacity, 0.0f, 1.0f, "%.2f");
+		if (ImGui::BeginCombo("Blend", GetBlendModeName(layer.Blend))) {
+			for (BlendMode mode : { BlendMode::Normal, BlendMode::Multiply, BlendMode::Screen, BlendMode::Overlay, BlendMode::Add }) {
+				if (ImGui::Selectable(GetBlendModeName(mode), mode == layer.Blend)) {
+					layer.Blend = mode;
+					changed = true;
+				}
+			}
+			ImGui::EndCombo();
+		}
+
+		if (!layer.Mask && ImGui::Button("Add mask")) {
+			layer.Mask = std::make_unique<LayerMask>(m_Layers->GetWidth(), m_Layers->GetHeight());
+			changed = true;
+		}
+		if (layer.Mask && ImGui::Button("Invert mask")) {
+			layer.Mask->Invert();
+			changed = true;
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Load mask")) {
+			std::string filepath = FileDialog::OpenFile(*m_Window.get(), "Image Files (*.png, *.jpg)|*.png;*.jpg|");
+			if (filepath != "") {
+				std::unique_ptr<LayerMask> mask = LayerMask::Load(filepath, m_Layers->GetWidth(), m_Layers->GetHeight());
+				m_LayerError = mask ? "" : "Could not read " + filepath;
+				if (mask) {
+					layer.Mask = std::move(mask);
+					changed = true;
+				}
+			}
+		}
+		if (layer.Mask) {
+			ImGui::SameLine();
+			if (ImGui::Button("Remove mask")) {
+				layer.Mask.reset();
+				changed = true;
+			}
+		}
+		if (!m_LayerError.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", m_LayerError.c_str());
+		}
+
+		// Selections keep the filters of the layer inside them, drawn on the viewport
+		ImGui::Separator();
+		ImGui::Checkbox("Select", &m_SelectionTool);
+		ImGui::SameLine();
+		if (ImGui::BeginCombo("##SelectionShape", GetSelectionShapeName(m_SelectionShape))) {
+			for (SelectionShape shape : { SelectionShape::Rectangle, SelectionShape::Ellipse, SelectionShape::Lasso }) {
+				if (ImGui::Selectable(GetSelectionShapeName(shape), shape == m_SelectionShape)) {
+					m_SelectionShape = shape;
+					m_SelectionTool = true;
+				}
+			}
+			ImGui::EndCombo();
+		}
+		ImGui::SliderFloat("Feather", &m_SelectionFeather, 0.0f, MAX_SELECTION_FEATHER, "%.1f px");
+		if (layer.Selection) {
+			if (ImGui::Button("Invert selection")) {
+				layer.Selection->Invert();
+				changed = true;
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Clear selection")) {
+				layer.Selection.reset();
+				changed = true;
+			}
+			ImGui::Text("Selection: %d tiles, filters over %.0f%% of the view", (int)m_Compositor->GetLastSelectionTiles(),
+				m_Compositor->GetLastSelectionCoverage() * 100.0f);
+		}
+
+		ImGui::Separator();
+		ImGui::Text("Composite passes: %d", (int)m_Compositor->GetLastBatchCount());
+		const TileCompositor& tiles = m_Compositor->GetTileCompositor();
+		ImGui::Text("Last export: %d tiles blended, %d unchanged (%.2f ms)", (int)tiles.GetLastBlendedTiles(),
+			(int)tiles.GetLastSkippedTiles(), tiles.GetLastTime());
 		ImGui::End();
+
+		if (changed) {
+			m_HistogramHasUpdate = true;
+		}
 	}
 
 	void Application::RenderVideoTab()
@@ -414,11 +861,10 @@ namespace Photoxel
 		for (auto& [name, filter] : m_FilterMap)
 		{
 			if (ImGui::Button(name.c_str(), ImVec2(effectsSize.x, 30.0f))) {
-				m_VideoFilters.insert(filter);
-				m_Renderer->GetShaderVideo()->RecreateShader({
-					{ "VertexShader", Photoxel::ShaderType::Vertex },
-					{ "PixelShader", Photoxel::ShaderType::Pixel }
-					}, m_VideoFilters);
+				if (!HasFilter(m_VideoFilters, filter)) {
+					m_VideoFilters.push_back(filter);
+					m_VideoGraph->SetChain(m_VideoFilters);
+				}
 			}
 		}
 		ImGui::End();
@@ -464,37 +910,67 @@ namespace Photoxel
 		if (ImGui::TreeNode("Eliminar filtros"))
 		{
 			for (auto& [name, filter] : m_FilterMap) {
-				if (m_VideoFilters.find(filter) != m_VideoFilters.end()) {
+				if (HasFilter(m_VideoFilters, filter)) {
 					if (ImGui::Button(name.c_str())) {
-						m_VideoFilters.erase(filter);
-						m_Renderer->GetShaderVideo()->RecreateShader({
-						{ "VertexShader", Photoxel::ShaderType::Vertex },
-						{ "PixelShader", Photoxel::ShaderType::Pixel }
-						}, m_VideoFilters);
+						m_VideoFilters.erase(std::remove(m_VideoFilters.begin(), m_VideoFilters.end(), filter), m_VideoFilters.end());
+						m_VideoGraph->SetChain(m_VideoFilters);
 					}
 				}
 			}
 			ImGui::TreePop();
 		}
 
-		if (m_VideoFilters.find(Filter::Brightness) != m_VideoFilters.end()) {
-			ImGui::SliderFloat("Brightness", &m_VideoBrightness, 0.0f, 2.0f);
+		if (HasFilter(m_VideoFilters, Filter::Brightness)) {
+			ImGui::SliderFloat("Brightness", &m_VideoParameters.Brightness, 0.0f, 2.0f);
+		}
+		if (HasFilter(m_VideoFilters, Filter::Contrast)) {
+			ImGui::SliderFloat("Contrast", &m_VideoParameters.Contrast, -1.0f, 1.0f);
+		}
+		if (HasFilter(m_VideoFilters, Filter::Binary)) {
+			ImGui::SliderFloat("Thresehold", &m_VideoParameters.Thresehold, 0.0f, 5.0f);
 		}
-		if (m_VideoFilters.find(Filter::Contrast) != m_VideoFilters.end()) {
-			ImGui::SliderFloat("Contrast", &m_VideoContrast, -1.0f, 1.0f);
+		if (HasFilter(m_VideoFilters, Filter::Pixelate)) {
+			ImGui::SliderInt("Mosaic", &m_VideoParameters.Mosaic, 1, 100);
 		}
-		if (m_VideoFilters.find(Filter::Binary) != m_VideoFilters.end()) {
-			ImGui::SliderFloat("Thresehold", &m_VideoThresehold, 0.0f, 5.0f);
+		if (HasFilter(m_VideoFilters, Filter::GaussianBlur)) {
+			ImGui::SliderFloat("Sigma", &m_VideoParameters.BlurSigma, MIN_GAUSSIAN_SIGMA, MAX_BLUR_SIGMA, "%.1f", ImGuiSliderFlags_Logarithmic);
 		}
-		if (m_VideoFilters.find(Filter::Pixelate) != m_VideoFilters.end()) {
-			ImGui::SliderInt("Mosaic", &m_VideoMosaic, 1, 100);
+		if (HasFilter(m_VideoFilters, Filter::Convolution)) {
+			RenderKernelEditor(m_VideoParameters.Kernel, m_VideoKernelPreset);
 		}
-		if (m_VideoFilters.find(Filter::Gradient) != m_VideoFilters.end()) {
-			ImGui::ColorEdit3("Start Colour", glm::value_ptr(m_VideoStartColour));
-			ImGui::ColorEdit3("End Colour", glm::value_ptr(m_VideoEndColour));
-			ImGui::SliderFloat("Angle", &m_VideoAngle, 0.0f, 360.0f);
-			ImGui::SliderFloat("Intensity", &m_VideoIntensity, 0.0f, 1.0f);
+		if (HasFilter(m_VideoFilters, Filter::Median)) {
+			ImGui::SliderInt("Median radius", &m_VideoParameters.MedianRadius, 1, MAX_MEDIAN_RADIUS);
 		}
+		if (HasFilter(m_VideoFilters, Filter::Bilateral)) {
+			ImGui::SliderFloat("Spatial sigma", &m_VideoParameters.BilateralSpatial, MIN_BILATERAL_SPATIAL, MAX_BILATERAL_SPATIAL, "%.1f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Range sigma", &m_VideoParameters.BilateralRange, MIN_BILATERAL_RANGE, MAX_BILATERAL_RANGE, "%.2f");
+		}
+		if (HasFilter(m_VideoFilters, Filter::AutoLevels)) {
+			ImGui::SliderFloat("Clip (%)", &m_VideoParameters.LevelsClip, 0.0f, MAX_LEVELS_CLIP, "%.2f");
+		}
+		if (HasFilter(m_VideoFilters, Filter::Clahe)) {
+			ImGui::SliderInt("Tiles", &m_VideoParameters.ClaheTiles, MIN_CLAHE_TILES, MAX_CLAHE_TILES);
+			ImGui::SliderFloat("Clip limit", &m_VideoParameters.ClaheClip, 1.0f, MAX_CLAHE_CLIP, "%.1f");
+		}
+		if (HasFilter(m_VideoFilters, Filter::Anonymise)) {
+			RenderAnonymiseControls(m_VideoParameters);
+			RenderDetectionModel(m_VideoParameters.FaceModel, m_VideoGraph->GetFaceModelError());
+			if (ImGui::SliderInt("Detect every", &m_FaceKeyframeInterval, 1, MAX_KEYFRAME_INTERVAL, "%d frames")) {
+				m_VideoGraph->SetFaceKeyframeInterval(m_FaceKeyframeInterval);
+			}
+			ImGui::Text("Faces: %d (%.2f ms)", m_VideoGraph->GetLastFaceCount(), m_VideoGraph->GetLastFaceTime());
+			RenderVideoExport();
+		}
+		if (HasFilter(m_VideoFilters, Filter::Gradient)) {
+			ImGui::ColorEdit3("Start Colour", glm::value_ptr(m_VideoParameters.StartColour));
+			ImGui::ColorEdit3("End Colour", glm::value_ptr(m_VideoParameters.EndColour));
+			ImGui::SliderFloat("Angle", &m_VideoParameters.Angle, 0.0f, 360.0f);
+			ImGui::SliderFloat("Intensity", &m_VideoParameters.Intensity, 0.0f, 1.0f);
+		}
+		if (RenderLutEditor(m_VideoFilters, m_VideoParameters, *m_VideoGraph)) {
+			m_VideoGraph->SetChain(m_VideoFilters);
+		}
+		RenderVideoFaceIndex();
 		
 		ImGui::End();
 
@@ -522,6 +998,8 @@ namespace Photoxel
 			const int data = -16777216;
 			m_VideoFrame->SetData(1, 1, &data);
 			m_Video = nullptr;
+			m_ViewportDirty = true;
+			m_FaceCountCurve.clear();
 			currentFrame = 0;
 		}
 		
@@ -529,6 +1007,10 @@ namespace Photoxel
 			currentFrame = m_Video->GetCurrentSecond();
 
 		ImSequencer::Sequencer(&mySequence, &currentFrame, &expanded, &selectedEntry, &firstFrame, ImSequencer::SEQUENCER_EDIT_STARTEND | ImSequencer::SEQUENCER_CHANGE_FRAME);
+		if (!m_FaceCountCurve.empty()) {
+			ImGui::PlotLines("Faces", m_FaceCountCurve.data(), static_cast<int>(m_FaceCountCurve.size()), 0, nullptr,
+				0.0f, FLT_MAX, ImVec2(ImGui::GetContentRegionAvail().x - 50.0f, 40.0f));
+		}
 		
 		if (m_Video) {
 			if (m_Video->GetCurrentSecond() != currentFrame) {
@@ -550,9 +1032,13 @@ namespace Photoxel
 			m_Capture2.StopCapture();
 			const int data = -16777216;
 			m_Camera->SetData(1, 1, &data);
-			m_PrevCamera->SetData(1, 1, &data);
+			m_MotionMask->SetData(1, 1, &data);
+			m_MotionDetector.Reset();
+			m_MotionEvents.Close();
 			m_Dets.clear();
+			m_ForceFullScan = true;
 			m_IsRecording = false;
+			m_ViewportDirty = true;
 		}
 
 		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, ImVec2(0.0f, 0.0f));
@@ -581,61 +1067,80 @@ namespace Photoxel
 				m_Capture2.StopCapture();
 				const int data = -16777216;
 				m_Camera->SetData(1, 1, &data);
-				m_PrevCamera->SetData(1, 1, &data);
+				m_MotionMask->SetData(1, 1, &data);
+				m_MotionDetector.Reset();
+				m_MotionEvents.Close();
 				m_Dets.clear();
+				m_ForceFullScan = true;
 				m_IsRecording = false;
+				m_ViewportDirty = true;
 			}
 		}
 		ImGui::End();
 
 		if (m_IsRecording) 
 		{
-			m_PrevCamera->SetData(m_PrevWidth, m_PrevHeight, m_PrevCapture.data());
-
 			uint8_t* data = m_Capture2.GetBuffer();
 			uint32_t width = 512;
 			uint32_t height = 512;
 
-			size_t dataSize = width * height * sizeof(data);
-			m_PrevWidth = width;
-			m_PrevHeight = height;
-			m_PrevCapture.resize(width * height * sizeof(data));
-			std::copy(data, data + dataSize, m_PrevCapture.begin());
+			// Motion and face detection see the denoised frame too, sensor noise only adds false motion
+			if (m_CameraDenoise != CameraDenoise::Off) {
+				m_CameraPixels.resize(static_cast<size_t>(width) * height * 3);
+				if (m_CameraDenoise == CameraDenoise::Median) {
+					m_CameraMedian.Apply(data, m_CameraPixels.data(), width, height, 3, m_CameraParameters.MedianRadius);
+				}
+				else {
+					m_CameraBilateral.Apply(data, m_CameraPixels.data(), width, height, 3,
+						m_CameraParameters.BilateralSpatial, m_CameraParameters.BilateralRange);
+				}
+				data = m_CameraPixels.data();
+			}
+
+			m_MotionDetector.Process(data, width, height);
+			uint32_t motionArea = 0;
+			for (const auto& region : m_MotionDetector.GetRegions()) {
+				motionArea += region.Area;
+			}
+			m_MotionEvents.Update(static_cast<uint32_t>(m_MotionDetector.GetRegions().size()), motionArea);
+			UpdateFaceDetections(data, width, height);
 
-			dlib::array2d<dlib::rgb_pixel> img(width, height);
+			dlib::array2d<dlib::rgb_pixel> img(height, width);
 			memcpy(&img[0][0], data, width * height * 3);
 
-			//uint32_t scaledWidth = 512;
-			//uint32_t scaledHeight = 512;
-			//dlib::array2d<dlib::rgb_pixel> img2(scaledWidth, scaledHeight);
-			//if (a > 10) {
+			if (m_DetectionProfile.UseROI) {
+				dlib::draw_rectangle(img, m_DetectionProfile.ROI, dlib::rgb_pixel(255, 255, 255), 1);
+			}
 
-			//	std::vector<uint8_t> rescale(width * height * 3);
-			//	stbir_resize_uint8(data, width, height, width * 3,
-			//		rescale.data(), scaledWidth, scaledHeight, scaledWidth * 3, 3);
+			if (m_Movement) {
+				m_MotionMask->SetLuminance(m_MotionDetector.GetMaskWidth(), m_MotionDetector.GetMaskHeight(),
+					m_MotionDetector.GetMask(), m_MotionDetector.GetMaskStride());
+				for (const auto& region : m_MotionDetector.GetRegions()) {
+					dlib::rectangle rect(region.X, region.Y, region.X + region.Width - 1, region.Y + region.Height - 1);
+					dlib::draw_rectangle(img, rect, dlib::rgb_pixel(255, 255, 0), 2);
+				}
+			}
 
-			//	memcpy(&img2[0][0], rescale.data(), scaledWidth * scaledHeight * 3);
-			if (!m_Movement) {
-				m_Dets = m_Detector(img);
+			if (m_AnonymiseCamera) {
+				auto start = std::chrono::high_resolution_clock::now();
+				std::vector<glm::vec4> faces;
+				for (const auto& face : m_Dets) {
+					faces.push_back(PadFace(face, m_CameraParameters.FacePadding));
+				}
+				AnonymiseFaces(reinterpret_cast<uint8_t*>(&img[0][0]), width, height, 3, faces, m_CameraParameters, 1.0f, m_CameraBlur);
+				auto end = std::chrono::high_resolution_clock::now();
+				m_CameraAnonymiseTime = std::chrono::duration<double, std::milli>(end - start).count();
 			}
 			else {
-				m_Dets.clear();
-			}
-
-			int iterator = 0;
-			for (const auto& face : m_Dets) {
-				dlib::rectangle rect(
-					face.left() * (width / static_cast<double>(width)),
-					face.top() * (height / static_cast<double>(height)),
-					face.right() * (width / static_cast<double>(width)),
-					face.bottom() * (height / static_cast<double>(height))
-				);
-				dlib::draw_rectangle(img, rect, GetBasicColor(iterator), 1 * 4);
-				dlib::point labelPos(rect.left() - 10, rect.top());
-				// TODO: Need to change draw_string to work from () to []
-				dlib::draw_string(img, labelPos, std::to_string(iterator + 1), 
-					GetBasicColor(iterator));
-				iterator++;
+				int iterator = 0;
+				for (const auto& face : m_Dets) {
+					dlib::draw_rectangle(img, face, GetBasicColor(iterator), 1 * 4);
+					dlib::point labelPos(face.left() - 10, face.top());
+					// TODO: Need to change draw_string to work from () to []
+					dlib::draw_string(img, labelPos, std::to_string(iterator + 1), 
+						GetBasicColor(iterator));
+					iterator++;
+				}
 			}
 
 			m_Camera->SetData(width, height, &img[0][0]);
@@ -678,20 +1183,981 @@ namespace Photoxel
 		if (ImGui::Button(m_Movement ? "Rostros" : "Movimiento")) {
 			m_Movement = !m_Movement;
 		}
+
+		RenderCameraDenoise();
+		RenderCameraAnonymise();
+		RenderMotionStats();
+		RenderDetectionGating();
+		RenderDetectionProfile();
 		ImGui::End();
 	}
 
-	void Application::Close()
+	void Application::UpdateFaceDetections(const uint8_t* data, uint32_t width, uint32_t height)
 	{
-		m_Running = false;
+		const auto& regions = m_MotionDetector.GetRegions();
+		const bool refresh = m_FullScanInterval > 0 && m_FramesSinceFullScan >= static_cast<uint32_t>(m_FullScanInterval);
+
+		if (!m_MotionGating || m_ForceFullScan || refresh) {
+			m_Dets = m_FaceDetector.Detect(data, width, height);
+			m_ForceFullScan = false;
+			m_FramesSinceFullScan = 0;
+			m_GatingStats.FullScans++;
+		}
+		else if (regions.empty()) {
+			// Nothing moved, the faces found last time are still where they were
+			m_FramesSinceFullScan++;
+			m_GatingStats.Skipped++;
+			m_GatingStats.ScannedRatio = 0.0f;
+			return;
+		}
+		else {
+			std::vector<dlib::rectangle> changed;
+			changed.reserve(regions.size());
+			for (const auto& region : regions) {
+				dlib::rectangle rect(region.X, region.Y, region.X + region.Width - 1, region.Y + region.Height - 1);
+				changed.push_back(dlib::grow_rect(rect, m_DetectionPadding));
+			}
+
+			// Faces outside every changed box are kept, the rest are looked for again
+			std::vector<dlib::rectangle> dets;
+			for (const auto& face : m_Dets) {
+				bool touched = false;
+				for (const auto& rect : changed) {
+					if (!face.intersect(rect).is_empty()) {
+						touched = true;
+						break;
+					}
+				}
+				if (!touched) {
+					dets.push_back(face);
+				}
+			}
+			for (const auto& face : m_FaceDetector.DetectRegions(data, width, height, changed)) {
+				dets.push_back(face);
+			}
+
+			m_Dets = dets;
+			m_FramesSinceFullScan++;
+			m_GatingStats.PartialScans++;
+		}
+
+		m_GatingStats.ScannedRatio = m_FaceDetector.GetLastScannedArea() / static_cast<float>(width * height);
+		m_GatingStats.DetectorTime += m_FaceDetector.GetLastDetectionTime();
 	}
 
-	void Application::UpdateImageInfo()
+	void Application::RenderDetectionGating()
+	{
+		if (!ImGui::CollapsingHeader("Motion gating"))
+			return;
+
+		if (ImGui::Checkbox("Gate detector with motion", &m_MotionGating)) {
+			m_ForceFullScan = true;
+		}
+		ImGui::SliderInt("Padding", &m_DetectionPadding, 0, 128, "%d px");
+		ImGui::SliderInt("Full scan every", &m_FullScanInterval, 0, 600, m_FullScanInterval == 0 ? "Never" : "%d frames");
+
+		const uint32_t frames = m_GatingStats.FullScans + m_GatingStats.PartialScans + m_GatingStats.Skipped;
+		ImGui::Text("Full scans: %d", m_GatingStats.FullScans);
+		ImGui::Text("Partial scans: %d", m_GatingStats.PartialScans);
+		ImGui::Text("Skipped frames: %d", m_GatingStats.Skipped);
+		ImGui::Text("Scanned area: %.1f%%", m_GatingStats.ScannedRatio * 100.0f);
+		if (frames > 0) {
+			ImGui::Text("Detector average: %.2f ms/frame", m_GatingStats.DetectorTime / frames);
+		}
+		if (ImGui::Button("Reset counters")) {
+			m_GatingStats = {};
+		}
+	}
+
+	void Application::RenderCameraDenoise()
+	{
+		if (!ImGui::CollapsingHeader("Noise reduction"))
+			return;
+
+		static const char* modeNames[] = { "Off", "Median", "Bilateral grid" };
+		int mode = static_cast<int>(m_CameraDenoise);
+		if (ImGui::Combo("Denoise", &mode, modeNames, IM_ARRAYSIZE(modeNames))) {
+			m_CameraDenoise = static_cast<CameraDenoise>(mode);
+		}
+
+		// Frames are 512x512, a quarter of a megapixel
+		const float megapixels = 512.0f * 512.0f / 1e6f;
+		if (m_CameraDenoise == CameraDenoise::Median) {
+			ImGui::SliderInt("Median radius", &m_CameraParameters.MedianRadius, 1, MAX_MEDIAN_RADIUS);
+			const double time = m_CameraMedian.GetLastTime();
+			ImGui::Text("Median: %.2f ms (%.1f ms/MP)", time, time / megapixels);
+		}
+		else if (m_CameraDenoise == CameraDenoise::Bilateral) {
+			ImGui::SliderFloat("Spatial sigma", &m_CameraParameters.BilateralSpatial, MIN_BILATERAL_SPATIAL, MAX_BILATERAL_SPATIAL, "%.1f", ImGuiSliderFlags_Logarithmic);
+			ImGui::SliderFloat("Range sigma", &m_CameraParameters.BilateralRange, MIN_BILATERAL_RANGE, MAX_BILATERAL_RANGE, "%.2f");
+			const double time = m_CameraBilateral.GetLastTime();
+			ImGui::Text("Bilateral grid: %.2f ms (%.1f ms/MP)", time, time / megapixels);
+		}
+	}
+
+	void Application::RenderCameraAnonymise()
 	{
-		m_Renderer->GetShader()->RecreateShader({
-			{ "VertexShader", Photoxel::ShaderType::Vertex },
-			{ "PixelShader", Photoxel::ShaderType::Pixel }
-		}, m_ImageFilters);
+		if (!ImGui::CollapsingHeader("Face anonymisation"))
+			return;
+
+		ImGui::Checkbox("Anonymise faces", &m_AnonymiseCamera);
+		RenderAnonymiseControls(m_CameraParameters);
+		if (m_AnonymiseCamera) {
+			ImGui::Text("Anonymisation: %.2f ms", m_CameraAnonymiseTime);
+		}
+	}
+
+	bool Application::RenderAnonymiseControls(FilterParameters& parameters)
+	{
+		static const char* modeNames[] = { "Pixelate", "Blur" };
+		bool changed = false;
+		int mode = static_cast<int>(parameters.Anonymise);
+		if (ImGui::Combo("Faces", &mode, modeNames, IM_ARRAYSIZE(modeNames))) {
+			parameters.Anonymise = static_cast<AnonymiseMode>(mode);
+			changed = true;
+		}
+		if (parameters.Anonymise == AnonymiseMode::Pixelate) {
+			changed |= ImGui::SliderInt("Face mosaic", &parameters.FaceMosaic, 2, MAX_FACE_MOSAIC);
+		}
+		else {
+			changed |= ImGui::SliderFloat("Face sigma", &parameters.FaceBlurSigma, MIN_GAUSSIAN_SIGMA, MAX_FACE_BLUR_SIGMA, "%.1f", ImGuiSliderFlags_Logarithmic);
+		}
+		changed |= ImGui::SliderFloat("Face padding", &parameters.FacePadding, 0.0f, MAX_FACE_PADDING, "%.2f");
+		return changed;
+	}
+
+	bool Application::RenderDetectionModel(DetectionModel& model, const std::string& error)
+	{
+		static const char* modelNames[] = { "HOG", "CNN (MMOD)" };
+		int index = static_cast<int>(model);
+		const bool changed = ImGui::Combo("Detector", &index, modelNames, IM_ARRAYSIZE(modelNames));
+		if (changed) {
+			model = static_cast<DetectionModel>(index);
+		}
+		if (model == DetectionModel::Cnn && !error.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s, using HOG", error.c_str());
+		}
+		return changed;
+	}
+
+	void Application::RenderVideoExport()
+	{
+		if (!ImGui::CollapsingHeader("Anonymised export"))
+			return;
+
+		if (m_VideoAnonymiser.IsRunning()) {
+			ImGui::ProgressBar(m_VideoAnonymiser.GetProgress());
+			ImGui::Text("%lld frames, %.1f fps", static_cast<long long>(m_VideoAnonymiser.GetFramesWritten()),
+				m_VideoAnonymiser.GetFramesPerSecond());
+			if (ImGui::Button("Cancel export")) {
+				m_VideoAnonymiser.Cancel();
+			}
+			return;
+		}
+
+		// The other filters of the chain need the GPU, the export runs on its own thread without one
+		ImGui::TextDisabled("Only the faces are covered, the other filters are not applied");
+		if (!m_Video) {
+			ImGui::TextDisabled("Open a video to export it");
+		}
+		else if (ImGui::Button("Export anonymised video")) {
+			const std::string filepath = FileDialog::SaveFile(*m_Window.get(), "MP4 Video (*.mp4)|*.mp4|");
+			if (!filepath.empty()) {
+				m_VideoAnonymiser.Start(m_Video->GetFilename(), filepath, m_VideoParameters,
+					static_cast<uint32_t>(m_FaceKeyframeInterval));
+			}
+		}
+		if (m_VideoAnonymiser.GetFramesWritten() > 0) {
+			ImGui::Text("Last export: %lld frames, %.1f fps", static_cast<long long>(m_VideoAnonymiser.GetFramesWritten()),
+				m_VideoAnonymiser.GetFramesPerSecond());
+		}
+		const std::string error = m_VideoAnonymiser.GetError();
+		if (!error.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.c_str());
+		}
+	}
+
+	void Application::RenderVideoFaceIndex()
+	{
+		// Picks up an index that finished since the last frame
+		if (m_FaceIndexPending && !m_FaceIndexer.IsRunning()) {
+			m_FaceIndexPending = false;
+			if (m_FaceIndexer.GetError().empty()) {
+				m_FaceCountCurve = m_FaceIndexer.GetIndex().GetFaceCountPerSecond();
+			}
+		}
+
+		if (!ImGui::CollapsingHeader("Face index"))
+			return;
+
+		if (m_FaceIndexer.IsRunning()) {
+			ImGui::ProgressBar(m_FaceIndexer.GetProgress());
+			ImGui::Text("%lld frames, %.1f fps", static_cast<long long>(m_FaceIndexer.GetFramesScanned()),
+				m_FaceIndexer.GetFramesPerSecond());
+			if (ImGui::Button("Cancel index")) {
+				m_FaceIndexer.Cancel();
+			}
+			return;
+		}
+
+		if (!m_Video) {
+			ImGui::TextDisabled("Open a video to index its faces");
+		}
+		else if (ImGui::Button("Index faces")) {
+			FaceIndexOptions options;
+			options.KeyframeInterval = static_cast<uint32_t>(m_FaceKeyframeInterval);
+			options.Model = m_VideoParameters.FaceModel;
+			m_FaceCountCurve.clear();
+			m_FaceIndexer.Start(m_Video->GetFilename(), options);
+			m_FaceIndexPending = true;
+		}
+
+		const std::string error = m_FaceIndexer.GetError();
+		if (!error.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.c_str());
+			return;
+		}
+		const FaceIndex& index = m_FaceIndexer.GetIndex();
+		if (index.Frames.empty())
+			return;
+
+		ImGui::Text("%d frames, %u tracks", static_cast<int>(index.Frames.size()), index.TrackCount);
+		ImGui::Text("%u segments in %.1f s (%.1f fps)", index.SegmentCount, index.Time, index.Frames.size() / index.Time);
+		if (ImGui::Button("Save JSON")) {
+			const std::string filepath = FileDialog::SaveFile(*m_Window.get(), "JSON (*.json)|*.json|");
+			if (!filepath.empty()) {
+				index.SaveJson(filepath);
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Save CSV")) {
+			const std::string filepath = FileDialog::SaveFile(*m_Window.get(), "CSV (*.csv)|*.csv|");
+			if (!filepath.empty()) {
+				index.SaveCsv(filepath);
+			}
+		}
+	}
+
+	void Application::RenderFaceLibrary()
+	{
+		ImGui::Begin("People");
+		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
+			m_SectionFocus = IMAGE;
+		}
+
+		// Opens the library a scan just finished, its index and people are already on disk
+		if (m_FaceLibraryPending && !m_FaceLibraryBuilder.IsRunning()) {
+			m_FaceLibraryPending = false;
+			m_FaceLibraryError = m_FaceLibraryBuilder.GetError();
+			if (m_FaceLibraryError.empty() && !m_FaceLibrary.Open(m_FaceLibraryPath, m_FaceLibraryError)) {
+				m_FaceLibrary.Close();
+			}
+		}
+
+		if (m_FaceLibraryBuilder.IsRunning()) {
+			ImGui::ProgressBar(m_FaceLibraryBuilder.GetProgress());
+			if (m_FaceLibraryBuilder.IsIndexing()) {
+				ImGui::Text("Grouping %lld new faces", static_cast<long long>(m_FaceLibraryBuilder.GetFacesFound()));
+			}
+			else {
+				ImGui::Text("%lld images, %lld faces", static_cast<long long>(m_FaceLibraryBuilder.GetImagesScanned()),
+					static_cast<long long>(m_FaceLibraryBuilder.GetFacesFound()));
+				if (ImGui::Button("Cancel scan")) {
+					m_FaceLibraryBuilder.Cancel();
+				}
+			}
+			ImGui::End();
+			return;
+		}
+
+		if (ImGui::Button("Scan folder")) {
+			const std::string folder = FileDialog::OpenFolder(*m_Window.get());
+			if (!folder.empty()) {
+				// The library lives in the folder it indexes, a second scan only adds the new photos
+				m_FaceLibraryPath = (std::filesystem::path(folder) / "photoxel.faces").string();
+				m_FaceLibrary.Close();
+				m_FaceMatches.clear();
+				FaceLibraryOptions options;
+				options.Model = m_DetectionProfile.Model;
+				m_FaceLibraryBuilder.Start(folder, m_FaceLibraryPath, options);
+				m_FaceLibraryPending = true;
+			}
+		}
+		ImGui::SameLine();
+		if (ImGui::Button("Open library")) {
+			const std::string path = FileDialog::OpenFile(*m_Window.get(), "Face library (*.faces)|*.faces|");
+			if (!path.empty()) {
+				m_FaceLibraryPath = path;
+				m_FaceMatches.clear();
+				if (!m_FaceLibrary.Open(path, m_FaceLibraryError)) {
+					m_FaceLibrary.Close();
+				}
+			}
+		}
+		if (!m_FaceLibraryError.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", m_FaceLibraryError.c_str());
+		}
+		if (!m_FaceLibrary.IsOpen()) {
+			ImGui::End();
+			return;
+		}
+
+		const auto& people = m_FaceLibrary.GetPeople();
+		ImGui::Text("%d images, %d faces, %d people", static_cast<int>(m_FaceLibrary.GetImageCount()),
+			static_cast<int>(m_FaceLibrary.GetFaceCount()), static_cast<int>(people.size()));
+		if (m_Layers->IsEmpty()) {
+			ImGui::TextDisabled("Open an image to find its people");
+		}
+		else if (ImGui::Button("Find people in this image")) {
+			FindImageFaces();
+		}
+
+		// Every row opens the photo it comes from
+		std::string open;
+		if (!m_FaceMatches.empty() && ImGui::CollapsingHeader("Matches", ImGuiTreeNodeFlags_DefaultOpen)) {
+			for (size_t i = 0; i < m_FaceMatches.size(); i++) {
+				const FaceRecord& face = m_FaceLibrary.GetFace(m_FaceMatches[i].Face);
+				const std::string& image = m_FaceLibrary.GetImage(face.Image);
+				ImGui::PushID(static_cast<int>(i));
+				if (ImGui::Selectable(std::filesystem::path(image).filename().string().c_str())) {
+					open = image;
+				}
+				ImGui::SameLine();
+				ImGui::TextDisabled("%.2f", m_FaceMatches[i].Distance);
+				ImGui::PopID();
+			}
+		}
+		if (ImGui::CollapsingHeader("People")) {
+			for (size_t person = 0; person < people.size(); person++) {
+				if (!ImGui::TreeNode(reinterpret_cast<void*>(person), "Person %d (%d faces)", static_cast<int>(person + 1),
+					static_cast<int>(people[person].size()))) continue;
+				for (uint32_t face : people[person]) {
+					const std::string& image = m_FaceLibrary.GetImage(m_FaceLibrary.GetFace(face).Image);
+					ImGui::PushID(static_cast<int>(face));
+					if (ImGui::Selectable(std::filesystem::path(image).filename().string().c_str())) {
+						open = image;
+					}
+					ImGui::PopID();
+				}
+				ImGui::TreePop();
+			}
+		}
+		ImGui::End();
+
+		if (!open.empty() && std::filesystem::exists(open)) {
+			OpenImage(open);
+		}
+	}
+
+	void Application::FindImageFaces()
+	{
+		m_FaceMatches.clear();
+		m_FaceLibraryError.clear();
+		if (!m_FaceEncoder.IsLoaded() && !m_FaceEncoder.Load(m_FaceLibraryError)) {
+			return;
+		}
+
+		const Layer& layer = m_Layers->Get(0);
+		const uint32_t width = m_Layers->GetWidth(), height = m_Layers->GetHeight();
+		const uint8_t* pixels = layer.GetSourcePixels();
+		std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+			rgb[i * 3 + 0] = pixels[i * 4 + 0];
+			rgb[i * 3 + 1] = pixels[i * 4 + 1];
+			rgb[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+
+		// Same settings as the scan so the faces line up with the ones in the library
+		FaceDetector detector;
+		DetectionProfile profile;
+		const FaceLibraryOptions options;
+		profile.DetectionResolution = options.DetectionResolution;
+		profile.MinFaceSize = options.MinFaceSize;
+		profile.Model = m_DetectionProfile.Model;
+		detector.SetProfile(profile);
+		const std::vector<dlib::rectangle> faces = detector.Detect(rgb.data(), width, height);
+
+		// Matches of every face, the closest first and each photo listed once
+		std::vector<FaceMatch> matches;
+		for (const FaceDescriptor& descriptor : m_FaceEncoder.Encode(rgb.data(), width, height, faces)) {
+			const std::vector<FaceMatch> found = m_FaceLibrary.Find(descriptor.data(), FACE_MATCH_COUNT);
+			matches.insert(matches.end(), found.begin(), found.end());
+		}
+		std::sort(matches.begin(), matches.end(), [](const FaceMatch& a, const FaceMatch& b) { return a.Distance < b.Distance; });
+		std::unordered_set<uint32_t> images;
+		for (const FaceMatch& match : matches) {
+			if (images.insert(m_FaceLibrary.GetFace(match.Face).Image).second) {
+				m_FaceMatches.push_back(match);
+			}
+		}
+		if (faces.empty()) {
+			m_FaceLibraryError = "No faces found in this image";
+		}
+	}
+
+	void Application::RenderDuplicates()
+	{
+		ImGui::Begin("Duplicates");
+		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
+			m_SectionFocus = IMAGE;
+		}
+
+		if (m_DuplicateFinder.IsRunning()) {
+			ImGui::ProgressBar(m_DuplicateFinder.GetProgress());
+			ImGui::Text("%lld images hashed, %lld from the last scan", static_cast<long long>(m_DuplicateFinder.GetImagesHashed()),
+				static_cast<long long>(m_DuplicateFinder.GetImagesReused()));
+			if (ImGui::Button("Cancel scan")) {
+				m_DuplicateFinder.Cancel();
+			}
+			ImGui::End();
+			return;
+		}
+
+		int distance = static_cast<int>(m_DuplicateOptions.MaxDistance);
+		if (ImGui::SliderInt("Max distance (bits)", &distance, 0, 16)) {
+			m_DuplicateOptions.MaxDistance = static_cast<uint32_t>(distance);
+		}
+		if (ImGui::Button("Find duplicates in folder")) {
+			const std::string folder = FileDialog::OpenFolder(*m_Window.get());
+			if (!folder.empty()) {
+				m_DuplicateFinder.Start(folder, m_DuplicateOptions);
+			}
+		}
+
+		const std::string error = m_DuplicateFinder.GetError();
+		if (!error.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.c_str());
+			ImGui::End();
+			return;
+		}
+		const std::string warning = m_DuplicateFinder.GetWarning();
+		if (!warning.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.8f, 0.3f, 1.0f), "%s", warning.c_str());
+		}
+		const std::vector<HashedImage>& images = m_DuplicateFinder.GetImages();
+		const std::vector<DuplicateGroup>& groups = m_DuplicateFinder.GetGroups();
+		if (images.empty()) {
+			ImGui::End();
+			return;
+		}
+
+		ImGui::Text("%d images, %d groups of duplicates in %.1f s", static_cast<int>(images.size()),
+			static_cast<int>(groups.size()), m_DuplicateFinder.GetTime());
+		std::string open;
+		for (size_t group = 0; group < groups.size(); group++) {
+			if (!ImGui::TreeNode(reinterpret_cast<void*>(group), "%s (%d images)",
+				std::filesystem::path(images[groups[group].front()].Path).filename().string().c_str(),
+				static_cast<int>(groups[group].size()))) continue;
+			for (uint32_t image : groups[group]) {
+				ImGui::PushID(static_cast<int>(image));
+				if (ImGui::Selectable(images[image].Path.c_str())) {
+					open = images[image].Path;
+				}
+				ImGui::PopID();
+			}
+			ImGui::TreePop();
+		}
+		ImGui::End();
+
+		if (!open.empty() && std::filesystem::exists(open)) {
+			OpenImage(open);
+		}
+	}
+
+	void Application::RenderBatch()
+	{
+		ImGui::Begin("Batch");
+		if (ImGui::IsWindowFocused(ImGuiFocusedFlags_ChildWindows)) {
+			m_SectionFocus = IMAGE;
+		}
+
+		const BatchReport report = m_BatchProcessor.GetReport();
+		if (m_BatchProcessor.IsRunning()) {
+			ImGui::ProgressBar(m_BatchProcessor.GetProgress());
+			ImGui::Text("%lld images written, %lld from an earlier run, %lld failed", static_cast<long long>(report.Written),
+				static_cast<long long>(report.Resumed), static_cast<long long>(report.Failed));
+			if (ImGui::Button("Cancel batch")) {
+				m_BatchProcessor.Cancel();
+			}
+			ImGui::End();
+			return;
+		}
+
+		if (ImGui::Button("Save chain of the active layer") && !m_Layers->IsEmpty()) {
+			const std::string path = FileDialog::SaveFile(*m_Window.get(), "Filter Chains (*.pxchain)|*.pxchain|");
+			if (!path.empty()) {
+				const Layer& layer = m_Layers->GetActive();
+				FilterChain chain;
+				chain.Filters = layer.Filters;
+				chain.Parameters = layer.Parameters;
+				m_BatchChainError = chain.Save(path) ? "" : "Could not write " + path;
+				m_BatchChainPath = path;
+			}
+		}
+		if (ImGui::Button("Chain")) {
+			const std::string path = FileDialog::OpenFile(*m_Window.get(), "Filter Chains (*.pxchain)|*.pxchain|");
+			if (!path.empty()) {
+				m_BatchChainPath = path;
+			}
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", m_BatchChainPath.c_str());
+		if (ImGui::Button("Input")) {
+			const std::string folder = FileDialog::OpenFolder(*m_Window.get());
+			if (!folder.empty()) {
+				m_BatchInput = folder;
+			}
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", m_BatchInput.c_str());
+		if (ImGui::Button("Output")) {
+			const std::string folder = FileDialog::OpenFolder(*m_Window.get());
+			if (!folder.empty()) {
+				m_BatchOutput = folder;
+			}
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", m_BatchOutput.c_str());
+
+		int budget = static_cast<int>(m_BatchOptions.MemoryBudget >> 20);
+		if (ImGui::SliderInt("Memory budget (MB)", &budget, 64, 8192)) {
+			m_BatchOptions.MemoryBudget = static_cast<uint64_t>(budget) << 20;
+		}
+		ImGui::SliderInt("JPEG quality", &m_BatchOptions.JpegQuality, 50, 100);
+		if (ImGui::Button("Process folder") && !m_BatchChainPath.empty() && !m_BatchInput.empty() && !m_BatchOutput.empty()) {
+			// Read again so changes saved since it was picked are used
+			FilterChain chain;
+			if (chain.Load(m_BatchChainPath, m_BatchChainError)) {
+				m_BatchChainError.clear();
+				m_BatchProcessor.Start(chain, m_BatchInput, m_BatchOutput, m_BatchOptions);
+			}
+		}
+
+		const std::string error = !m_BatchChainError.empty() ? m_BatchChainError : m_BatchProcessor.GetError();
+		if (!error.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", error.c_str());
+			ImGui::End();
+			return;
+		}
+		if (report.Written + report.Resumed + report.Failed == 0) {
+			ImGui::End();
+			return;
+		}
+
+		ImGui::Text("%lld images in %.1f s, %lld from an earlier run, %lld failed", static_cast<long long>(report.Written),
+			report.Seconds, static_cast<long long>(report.Resumed), static_cast<long long>(report.Failed));
+		ImGui::Text("Peak memory in flight: %llu MB", static_cast<unsigned long long>(report.PeakMemory >> 20));
+		// Busy seconds are summed over the pool threads, the stage with the most is the bottleneck
+		const std::pair<const char*, const BatchStage*> stages[] = {
+			{ "Decode", &report.Decoding }, { "Filter", &report.Filtering }, { "Encode", &report.Encoding }
+		};
+		for (const auto& [name, stage] : stages) {
+			ImGui::Text("%s: %.1f s busy, %.1f images/s, %.1f MP/s per thread", name, stage->Seconds,
+				stage->Seconds > 0.0 ? stage->Images / stage->Seconds : 0.0,
+				stage->Seconds > 0.0 ? stage->Megapixels / stage->Seconds : 0.0);
+		}
+		ImGui::End();
+	}
+
+	void Application::RenderMotionStats()
+	{
+		ImGui::Text(ICON_FA_RUNNING " Motion: %.1f%%", m_MotionDetector.GetMotionRatio() * 100.0f);
+		ImGui::Text("Motion regions: %d", (int)m_MotionDetector.GetRegions().size());
+		ImGui::Text("Motion time: %.2f ms (labelling %.3f ms)", m_MotionDetector.GetLastProcessTime(),
+			m_MotionDetector.GetLastLabelTime());
+
+		if (ImGui::CollapsingHeader("Motion events")) {
+			ImGui::TextUnformatted(m_MotionEvents.IsActive() ? "Motion in progress" : "No motion");
+			ImGui::SameLine();
+			if (ImGui::Button("Clear")) {
+				m_MotionEvents.Clear();
+			}
+			ImGui::BeginChild("MotionEvents", ImVec2(0.0f, 150.0f), true);
+			for (const auto& event : m_MotionEvents.GetEvents()) {
+				ImGui::Text("%s - %s  %.1f s, %d blobs, %d px", event.Start.c_str(),
+					event.End.empty() ? "..." : event.End.c_str(), event.Duration, event.PeakBlobs, event.PeakArea);
+			}
+			ImGui::EndChild();
+		}
+
+		if (!ImGui::CollapsingHeader("Motion engine"))
+			return;
+
+		bool changed = false;
+		int downscale = m_MotionSettings.Downscale;
+		if (ImGui::SliderInt("Downscale", &downscale, 1, 8)) {
+			m_MotionSettings.Downscale = downscale;
+			changed = true;
+		}
+		changed |= ImGui::SliderFloat("Learning rate", &m_MotionSettings.LearningRate, 0.001f, 0.5f, "%.3f", ImGuiSliderFlags_Logarithmic);
+		changed |= ImGui::SliderFloat("Motion threshold", &m_MotionSettings.Threshold, 1.0f, 100.0f);
+		int minArea = m_MotionSettings.MinRegionArea;
+		if (ImGui::SliderInt("Min region", &minArea, 1, 200)) {
+			m_MotionSettings.MinRegionArea = minArea;
+			changed = true;
+		}
+		changed |= ImGui::Checkbox("Morphological cleanup", &m_MotionSettings.Cleanup);
+
+		if (changed) {
+			m_MotionDetector.SetSettings(m_MotionSettings);
+		}
+
+		if (ImGui::TreeNode("Regions")) {
+			for (const auto& region : m_MotionDetector.GetRegions()) {
+				ImGui::Text("(%d, %d) %d x %d, area %d, centroid (%.0f, %.0f)", region.X, region.Y,
+					region.Width, region.Height, region.Area, region.CentroidX, region.CentroidY);
+			}
+			ImGui::TreePop();
+		}
+	}
+
+	void Application::RenderDetectionProfile()
+	{
+		if (!ImGui::CollapsingHeader("Detection profile"))
+			return;
+
+		static const char* upsampleNames[] = { "None", "Pyramid 2x" };
+		bool changed = false;
+
+		int resolution = m_DetectionProfile.DetectionResolution;
+		if (ImGui::SliderInt("Resolution", &resolution, 0, 1024, resolution == 0 ? "Full frame" : "%d px")) {
+			m_DetectionProfile.DetectionResolution = resolution;
+			changed = true;
+		}
+		int minFace = m_DetectionProfile.MinFaceSize;
+		if (ImGui::SliderInt("Min face", &minFace, 20, 256, "%d px")) {
+			m_DetectionProfile.MinFaceSize = minFace;
+			changed = true;
+		}
+		int maxFace = m_DetectionProfile.MaxFaceSize;
+		if (ImGui::SliderInt("Max face", &maxFace, 0, 512, maxFace == 0 ? "Unlimited" : "%d px")) {
+			m_DetectionProfile.MaxFaceSize = maxFace;
+			changed = true;
+		}
+		int upsample = static_cast<int>(m_DetectionProfile.Upsample);
+		if (ImGui::Combo("Upsample", &upsample, upsampleNames, IM_ARRAYSIZE(upsampleNames))) {
+			m_DetectionProfile.Upsample = static_cast<DetectionUpsample>(upsample);
+			changed = true;
+		}
+
+		changed |= RenderDetectionModel(m_DetectionProfile.Model, m_FaceDetector.GetModelError());
+
+		int threads = m_DetectionProfile.ThreadCount;
+		if (ImGui::SliderInt("Threads", &threads, 0, 16, threads == 0 ? "All cores" : "%d")) {
+			m_DetectionProfile.ThreadCount = threads;
+			changed = true;
+		}
+
+		changed |= ImGui::Checkbox("Region of interest", &m_DetectionProfile.UseROI);
+		if (m_DetectionProfile.UseROI) {
+			int roi[4] = {
+				(int)m_DetectionProfile.ROI.left(), (int)m_DetectionProfile.ROI.top(),
+				(int)m_DetectionProfile.ROI.right(), (int)m_DetectionProfile.ROI.bottom()
+			};
+			if (ImGui::InputInt4("ROI (l, t, r, b)", roi)) {
+				m_DetectionProfile.ROI = dlib::rectangle(roi[0], roi[1], roi[2], roi[3]);
+				changed = true;
+			}
+		}
+
+		if (changed) {
+			m_FaceDetector.SetProfile(m_DetectionProfile);
+			m_ForceFullScan = true;
+		}
+
+		ImGui::Text("Detection size: (%d x %d)", m_FaceDetector.GetDetectionWidth(), m_FaceDetector.GetDetectionHeight());
+		ImGui::Text("Pyramid levels: %d", m_FaceDetector.GetPyramidLevels());
+		ImGui::Text("Detection time: %.2f ms", m_FaceDetector.GetLastDetectionTime());
+	}
+
+	void Application::Close()
+	{
+		m_Running = false;
+	}
+
+	std::vector<Application::LayerState> Application::GetLayerStates() const
+	{
+		std::vector<LayerState> states;
+		for (size_t i = 0; i < m_Layers->GetCount(); i++) {
+			const Layer& layer = m_Layers->Get(i);
+			LayerState& state = states.emplace_back();
+			state.Id = layer.Id;
+			state.Revision = layer.Revision;
+			state.MaskRevision = layer.Mask ? layer.Mask->GetRevision() : 0;
+			state.SelectionRevision = layer.Selection ? layer.Selection->GetRevision() : 0;
+			state.Filters = layer.Filters;
+			state.Parameters = layer.Parameters;
+			state.Opacity = layer.Opacity;
+			state.Blend = layer.Blend;
+			state.Visible = layer.Visible;
+		}
+		return states;
+	}
+
+	Application::ViewportState Application::GetViewportState() const
+	{
+		ViewportState state;
+		state.Focus = m_SectionFocus;
+		state.TargetWidth = m_ViewportFramebuffer->GetWidth();
+		state.TargetHeight = m_ViewportFramebuffer->GetHeight();
+		switch (m_SectionFocus) {
+			case IMAGE:
+				state.SourceWidth = m_Layers->GetWidth();
+				state.SourceHeight = m_Layers->GetHeight();
+				state.Layers = GetLayerStates();
+				state.Region = m_ImageRegion;
+				break;
+			case VIDEO:
+				state.Source = m_VideoFrame->GetRendererID();
+				state.SourceWidth = m_VideoFrame->GetWidth();
+				state.SourceHeight = m_VideoFrame->GetHeight();
+				state.Chain = m_VideoFilters;
+				state.Parameters = m_VideoParameters;
+				break;
+			case CAMERA:
+				state.Source = m_Camera->GetRendererID();
+				state.Movement = m_Movement;
+				break;
+		}
+		return state;
+	}
+
+	bool Application::RenderKernelEditor(ConvolutionKernel& kernel, KernelPreset& preset)
+	{
+		static const char* presetNames[] = { "Identity", "Sharpen", "Emboss", "Sobel X", "Sobel Y", "Laplacian", "Box", "Gaussian", "Custom" };
+		bool changed = false;
+
+		int presetIndex = static_cast<int>(preset);
+		if (ImGui::Combo("Kernel", &presetIndex, presetNames, IM_ARRAYSIZE(presetNames))) {
+			preset = static_cast<KernelPreset>(presetIndex);
+			if (preset != KernelPreset::Custom) {
+				kernel = ConvolutionKernel::FromPreset(preset, kernel.Size);
+			}
+			changed = true;
+		}
+
+		int size = static_cast<int>(kernel.Size);
+		if (ImGui::SliderInt("Kernel size", &size, 1, MAX_KERNEL_SIZE)) {
+			size |= 1;
+			if (preset == KernelPreset::Custom) {
+				// Keep the weights around the centre, anything outside the new size is dropped
+				ConvolutionKernel resized;
+				resized.Size = static_cast<uint32_t>(size);
+				resized.Weights.assign(resized.Size * resized.Size, 0.0f);
+				resized.Bias = kernel.Bias;
+				const int offset = (size - static_cast<int>(kernel.Size)) / 2;
+				for (int j = 0; j < static_cast<int>(kernel.Size); j++) {
+					for (int i = 0; i < static_cast<int>(kernel.Size); i++) {
+						if (j + offset < 0 || i + offset < 0 || j + offset >= size || i + offset >= size) continue;
+						resized.Weights[(j + offset) * size + i + offset] = kernel.Weights[j * kernel.Size + i];
+					}
+				}
+				kernel = std::move(resized);
+			}
+			else {
+				kernel = ConvolutionKernel::FromPreset(preset, static_cast<uint32_t>(size));
+			}
+			changed = true;
+		}
+
+		// Larger kernels come from the presets, a grid of them would not fit the panel
+		if (kernel.Size <= 9) {
+			for (uint32_t j = 0; j < kernel.Size; j++) {
+				for (uint32_t i = 0; i < kernel.Size; i++) {
+					ImGui::PushID(static_cast<int>(j * kernel.Size + i));
+					ImGui::SetNextItemWidth(48.0f);
+					if (ImGui::DragFloat("##Weight", &kernel.Weights[j * kernel.Size + i], 0.01f, 0.0f, 0.0f, "%.2f")) {
+						preset = KernelPreset::Custom;
+						changed = true;
+					}
+					ImGui::PopID();
+					if (i + 1 < kernel.Size) ImGui::SameLine();
+				}
+			}
+		}
+
+		changed |= ImGui::SliderFloat("Bias", &kernel.Bias, -1.0f, 1.0f);
+		if (ImGui::Button("Normalize")) {
+			float sum = 0.0f;
+			for (float weight : kernel.Weights) sum += weight;
+			if (sum != 0.0f) {
+				for (float& weight : kernel.Weights) weight /= sum;
+				changed = true;
+			}
+		}
+		ImGui::SameLine();
+		ImGui::Text("%s", GetConvolutionPathName(ConvolutionEngine::ChoosePath(kernel)));
+		return changed;
+	}
+
+	bool Application::RenderLutEditor(std::vector<Filter>& chain, FilterParameters& parameters, RenderGraph& graph)
+	{
+		static const char* interpolationNames[] = { "Trilinear", "Tetrahedral" };
+		static const char* bakeSizeNames[] = { "33", "65" };
+		static constexpr uint32_t bakeSizes[] = { 33, 65 };
+		bool changed = false;
+
+		if (HasFilter(chain, Filter::Lut)) {
+			const Lut3D* lut = parameters.Lut.get();
+			ImGui::Text("LUT: %s (%d^3)", lut ? (lut->GetTitle().empty() ? "Untitled" : lut->GetTitle().c_str()) : "Identity",
+				lut ? (int)lut->GetSize() : (int)MIN_LUT_SIZE);
+
+			int interpolation = static_cast<int>(parameters.Interpolation);
+			if (ImGui::Combo("Interpolation", &interpolation, interpolationNames, IM_ARRAYSIZE(interpolationNames))) {
+				parameters.Interpolation = static_cast<LutInterpolation>(interpolation);
+				changed = true;
+			}
+
+			if (ImGui::Button("Import .cube")) {
+				std::string filepath = FileDialog::OpenFile(*m_Window.get(), "Cube LUT (*.cube)|*.cube|");
+				if (!filepath.empty()) {
+					std::shared_ptr<Lut3D> loaded = Lut3D::LoadCube(filepath, m_LutError);
+					if (loaded) {
+						parameters.Lut = loaded;
+						m_LutError.clear();
+						changed = true;
+					}
+				}
+			}
+			ImGui::SameLine();
+			if (ImGui::Button("Export .cube") && lut) {
+				const std::string filepath = FileDialog::SaveFile(*m_Window.get(), "Cube LUT (*.cube)|*.cube|");
+				if (!filepath.empty()) {
+					m_LutError = lut->SaveCube(filepath) ? "" : "Could not write " + filepath;
+				}
+			}
+		}
+
+		// The first run of colour only filters becomes a single LUT, one already in it is folded in too
+		auto first = std::find_if(chain.begin(), chain.end(), IsColourOnly);
+		auto last = std::find_if_not(first, chain.end(), IsColourOnly);
+		const bool lutOutside = HasFilter(chain, Filter::Lut) && std::find(first, last, Filter::Lut) == last;
+		if (first != last && !lutOutside && (last - first > 1 || *first != Filter::Lut)) {
+			int bakeSize = (m_LutBakeSize == bakeSizes[0]) ? 0 : 1;
+			if (ImGui::Combo("Bake size", &bakeSize, bakeSizeNames, IM_ARRAYSIZE(bakeSizeNames))) {
+				m_LutBakeSize = bakeSizes[bakeSize];
+			}
+			if (ImGui::Button("Bake colour filters to LUT")) {
+				parameters.Lut = graph.BakeLut(std::vector<Filter>(first, last), parameters, m_LutBakeSize);
+				first = chain.erase(first, last);
+				chain.insert(first, Filter::Lut);
+				m_LutError.clear();
+				changed = true;
+			}
+		}
+
+		if (!m_LutError.empty()) {
+			ImGui::TextColored(ImVec4(1.0f, 0.4f, 0.4f, 1.0f), "%s", m_LutError.c_str());
+		}
+		return changed;
+	}
+
+	const char* Application::GetConvolutionPathName(ConvolutionPath path)
+	{
+		switch (path)
+		{
+			case ConvolutionPath::Separable:	return "Separable";
+			case ConvolutionPath::FFT:			return "FFT";
+			default:							return "Direct";
+		}
+	}
+
+	void Application::RenderImage()
+	{
+		// While a control is held a lower resolution preview is rendered, the on screen resolution
+		// is refined a few tiles per frame once it is let go
+		if (m_ProxyPreview && m_ImageInteracting) {
+			m_PreviewFramebuffer->Resize(std::max(1u, static_cast<uint32_t>(m_ImageViewportSize.x * PREVIEW_SCALE)),
+				std::max(1u, static_cast<uint32_t>(m_ImageViewportSize.y * PREVIEW_SCALE)));
+			m_Compositor->Execute(*m_Layers, *m_PreviewFramebuffer, m_ImageRegion);
+			m_ShowingPreview = true;
+		}
+		else if (m_ShowingPreview) {
+			m_Compositor->BeginRefinement(*m_Layers, *m_ViewportFramebuffer, m_ImageRegion);
+			// Composites of several layers are rendered whole, there is nothing left to refine
+			if (!m_Compositor->IsRefining()) {
+				m_ShowingPreview = false;
+				m_HistogramHasUpdate = true;
+			}
+		}
+		else {
+			m_Compositor->Execute(*m_Layers, *m_ViewportFramebuffer, m_ImageRegion);
+		}
+	}
+
+	std::vector<uint8_t> Application::RenderImageExport()
+	{
+		// The only full resolution render, the viewport never needs more than what is on screen
+		return m_Compositor->Export(*m_Layers);
+	}
+
+	void Application::StepHistory(bool redo)
+	{
+		// Layers missing from the step are destroyed, along with a graph that may be refining
+		m_Compositor->CancelRefinement();
+		if (redo ? m_History->Redo(*m_Layers) : m_History->Undo(*m_Layers)) {
+			m_HistoryState = GetLayerStates();
+			m_HistogramHasUpdate = true;
+			m_ViewportDirty = true;
+		}
+	}
+
+	void Application::OpenImage(const std::string& path)
+	{
+		m_FolderBrowser.Open(path);
+		m_FolderError.clear();
+		ShowFolderImage();
+	}
+
+	void Application::StepFolder(int offset)
+	{
+		const int64_t index = static_cast<int64_t>(m_FolderBrowser.GetIndex()) + offset;
+		if (!m_FolderBrowser.IsOpen() || index < 0 || index >= static_cast<int64_t>(m_FolderBrowser.GetCount())) {
+			return;
+		}
+		if (GetLayerStates() != m_FolderImageState) {
+			m_PendingFolderStep = offset;
+			return;
+		}
+		MoveFolder(offset);
+	}
+
+	void Application::MoveFolder(int offset)
+	{
+		const size_t shown = m_FolderBrowser.GetIndex();
+		m_FolderError.clear();
+		while (m_FolderBrowser.Step(offset)) {
+			if (ShowFolderImage()) {
+				return;
+			}
+		}
+		m_FolderBrowser.Step(static_cast<int>(shown) - static_cast<int>(m_FolderBrowser.GetIndex()));
+	}
+
+	bool Application::ShowFolderImage()
+	{
+		// Usually prefetched, only the upload is left
+		std::shared_ptr<const DecodedImage> decoded = m_FolderBrowser.Acquire();
+		if (!decoded) {
+			m_FolderError += (m_FolderError.empty() ? "Could not read " : ", ") + m_FolderBrowser.GetPath();
+			return false;
+		}
+		m_Compositor->CancelRefinement();
+		m_Layers->Clear();
+		auto image = std::make_shared<Image>(decoded);
+		m_Layers->Add(image->GetFilename(), image);
+		m_FolderImageState = GetLayerStates();
+		m_HistogramHasUpdate = true;
+		m_ViewportDirty = true;
+		return true;
+	}
+
+	void Application::UpdateImageInfo()
+	{
+		if (!m_Layers->IsEmpty()) {
+			Layer& layer = m_Layers->GetActive();
+			layer.Graph->SetChain(layer.Filters);
+		}
 		m_HistogramHasUpdate = true;
 	}
 }
\ No newline at end of file
@@ -16,6 +16,21 @@
 #include <thread>
 #include <mutex>
 #include "Capture.h"
+#include "FaceDetector.h"
+#include "MotionDetector.h"
+#include "MotionEventLog.h"
+#include "RenderGraph.h"
+#include "Layer.h"
+#include "Compositor.h"
+#include "History.h"
+#include "Selection.h"
+#include "Anonymise.h"
+#include "VideoAnonymiser.h"
+#include "VideoFaceIndex.h"
+#include "FaceLibrary.h"
+#include "DuplicateFinder.h"
+#include "BatchProcessor.h"
+#include "FolderBrowser.h"
 
 namespace Photoxel {
 	static const char* SequencerItemTypeNames[] = { "Video" };
@@ -145,11 +160,13 @@ namespace Photoxel {
 		std::shared_ptr<Photoxel::Window> m_Window;
 		std::shared_ptr<Photoxel::Renderer> m_Renderer;
 		std::shared_ptr<Photoxel::Framebuffer> m_ViewportFramebuffer;
+		// Lower resolution render of the visible region shown while a control is held
+		std::shared_ptr<Photoxel::Framebuffer> m_PreviewFramebuffer;
 		std::shared_ptr<Photoxel::ImGuiLayer> m_GuiLayer;
 		bool m_Running;
 		std::shared_ptr<Photoxel::ImGuiWindow> m_GuiWindow;
 
-		std::shared_ptr<Photoxel::Image> m_Image, m_VideoFrame, m_Camera, m_PrevCamera;
+		std::shared_ptr<Photoxel::Image> m_VideoFrame, m_Camera, m_MotionMask;
 		std::shared_ptr<Video> m_Video = nullptr;
 		MySequence mySequence;
 		
@@ -158,41 +175,212 @@ namespace Photoxel {
 		std::vector<const char*> m_WebcamDevicesNamesRef;
 		SimpleCapParams m_Capture = {};
 		bool m_IsRecording = false;
-		dlib::frontal_face_detector m_Detector;
+		FaceDetector m_FaceDetector;
+		DetectionProfile m_DetectionProfile;
 		std::vector<dlib::rectangle> m_Dets;
 
-		uint32_t m_PrevWidth = 0, m_PrevHeight = 0;
-		std::vector<uint8_t> m_PrevCapture;
+		MotionDetector m_MotionDetector;
+		MotionSettings m_MotionSettings;
+		MotionEventLog m_MotionEvents;
 		bool m_Movement = false;
 
+		struct GatingStats {
+			uint32_t FullScans = 0;
+			uint32_t PartialScans = 0;
+			uint32_t Skipped = 0;
+			float ScannedRatio = 0.0f;
+			double DetectorTime = 0.0;
+		};
+		bool m_MotionGating = true;
+		bool m_ForceFullScan = true;
+		int m_DetectionPadding = 32;
+		int m_FullScanInterval = 300;
+		uint32_t m_FramesSinceFullScan = 0;
+		GatingStats m_GatingStats;
+
+		enum class CameraDenoise {
+			Off,
+			Median,
+			Bilateral
+		};
+		CameraDenoise m_CameraDenoise = CameraDenoise::Off;
+		// Only the noise reduction and anonymisation fields are read
+		FilterParameters m_CameraParameters;
+		MedianFilter m_CameraMedian;
+		BilateralGrid m_CameraBilateral;
+		std::vector<uint8_t> m_CameraPixels;
+		// Covers the detected faces of the frame shown instead of outlining them
+		bool m_AnonymiseCamera = false;
+		GaussianBlur m_CameraBlur;
+		double m_CameraAnonymiseTime = 0.0;
+
+		// What the composite reads from a layer
+		struct LayerState {
+			uint64_t Id = 0, Revision = 0, MaskRevision = 0, SelectionRevision = 0;
+			std::vector<Filter> Filters;
+			FilterParameters Parameters;
+			float Opacity = 1.0f;
+			BlendMode Blend = BlendMode::Normal;
+			bool Visible = true;
+
+			bool operator==(const LayerState& other) const
+			{
+				return Id == other.Id && Revision == other.Revision && MaskRevision == other.MaskRevision
+					&& SelectionRevision == other.SelectionRevision
+					&& Filters == other.Filters && Parameters == other.Parameters && Opacity == other.Opacity
+					&& Blend == other.Blend && Visible == other.Visible;
+			}
+		};
+
+		// Everything the viewport render reads, compared every frame to skip redundant renders
+		struct ViewportState {
+			Section Focus = IMAGE;
+			uint32_t Source = 0, SourceWidth = 0, SourceHeight = 0;
+			uint32_t TargetWidth = 0, TargetHeight = 0;
+			glm::vec4 Region = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+			std::vector<Filter> Chain;
+			FilterParameters Parameters;
+			std::vector<LayerState> Layers;
+			bool Movement = false;
+
+			bool operator==(const ViewportState& other) const
+			{
+				return Focus == other.Focus && Source == other.Source && SourceWidth == other.SourceWidth
+					&& SourceHeight == other.SourceHeight && TargetWidth == other.TargetWidth
+					&& TargetHeight == other.TargetHeight && Region == other.Region && Chain == other.Chain
+					&& Parameters == other.Parameters && Layers == other.Layers && Movement == other.Movement;
+			}
+
+			bool operator!=(const ViewportState& other) const
+			{
+				return !(*this == other);
+			}
+		};
+		ViewportState m_RenderedState;
+		// Set for changes the state cannot see, like a new image or a new video frame
+		bool m_ViewportDirty = true;
+		uint32_t m_ViewportRenders = 0;
+
 		Section m_SectionFocus = IMAGE;
-		std::unordered_set<Filter> m_ImageFilters;
-		std::unordered_set<Filter> m_VideoFilters;
+		// Every layer of the image keeps its own filters, parameters and render graph
+		std::shared_ptr<LayerStack> m_Layers;
+		std::shared_ptr<Compositor> m_Compositor;
+		// Last mask import failure, shown under the layer controls
+		std::string m_LayerError;
+		std::shared_ptr<History> m_History;
+		// Layers as of the newest history step, an edit is whatever differs from it
+		std::vector<LayerState> m_HistoryState;
+		// Dragging on the viewport outlines a selection instead of panning
+		bool m_SelectionTool = false;
+		SelectionShape m_SelectionShape = SelectionShape::Rectangle;
+		float m_SelectionFeather = 0.0f;
+		// Image pixels of the outline being drawn
+		std::vector<glm::vec2> m_SelectionPoints;
+		// Filters in the order they were added, which is the order they render in
+		std::vector<Filter> m_VideoFilters;
+		FilterParameters m_VideoParameters;
+		KernelPreset m_VideoKernelPreset = KernelPreset::Sharpen;
+		uint32_t m_LutBakeSize = 33;
+		// Last .cube import or export failure, shown under the LUT controls
+		std::string m_LutError;
+		std::shared_ptr<RenderGraph> m_VideoGraph;
+		// Frames between two face detections, in the video preview and in the anonymised export
+		int m_FaceKeyframeInterval = DEFAULT_KEYFRAME_INTERVAL;
+		VideoAnonymiser m_VideoAnonymiser;
+		VideoFaceIndexer m_FaceIndexer;
+		// Most faces in each second of the last index, drawn under the timeline
+		std::vector<float> m_FaceCountCurve;
+		bool m_FaceIndexPending = false;
+		// Faces of a photo folder grouped by person, kept next to the photos
+		FaceLibraryBuilder m_FaceLibraryBuilder;
+		FaceLibrary m_FaceLibrary;
+		FaceEncoder m_FaceEncoder;
+		std::string m_FaceLibraryPath;
+		std::string m_FaceLibraryError;
+		bool m_FaceLibraryPending = false;
+		// Faces of the library that look like the ones of the open image
+		std::vector<FaceMatch> m_FaceMatches;
+		DuplicateFinder m_DuplicateFinder;
+		DuplicateOptions m_DuplicateOptions;
+		// Next and previous image of the folder the open image is in
+		FolderBrowser m_FolderBrowser;
+		// Layers as the folder image was shown or last saved, stepping away from other ones asks first
+		std::vector<LayerState> m_FolderImageState;
+		// Step waiting for the user to discard the edits, 0 when none
+		int m_PendingFolderStep = 0;
+		// Images of the folder that could not be read by the last open or step
+		std::string m_FolderError;
+		// The arrow keys step through the folder only while the Viewport window has them
+		bool m_ViewportHasKeys = false;
+		// Applies a saved filter chain to a whole folder
+		BatchProcessor m_BatchProcessor;
+		BatchOptions m_BatchOptions;
+		std::string m_BatchChainPath, m_BatchInput, m_BatchOutput;
+		std::string m_BatchChainError;
+		// Bumped whenever the pixels of the source change, the pass caches key on it
+		uint64_t m_VideoRevision = 0;
+		bool m_ProxyPreview = true;
+		bool m_ImageInteracting = false;
+		// The preview is on screen until the refinement of the full resolution render completes
+		bool m_ShowingPreview = false;
 
 		Capture m_Capture2;
 
 		std::map<std::string, Filter> m_FilterMap;
 
-		float m_Brightness = 0.0f, m_VideoBrightness = 0.0f;
-		float m_Contrast = 0.0f, m_VideoContrast = 0.0f;
-		float m_Thresehold = 0.0f, m_VideoThresehold = 0.0f;
-		int m_Mosaic = 10, m_VideoMosaic = 10;
-		glm::vec3 m_StartColour = glm::vec3(1,0,0), m_EndColour = glm::vec3(0,1,0);
-		glm::vec3 m_VideoStartColour = glm::vec3(1, 0, 0), m_VideoEndColour = glm::vec3(0, 1, 0);
-		float m_Angle = 90.0f, m_Intensity = 0.5f;
-		float m_VideoAngle = 90.0f, m_VideoIntensity = 0.5f;
-
 		float m_ImageScale = 1.0f;
 
 
 		std::vector<float> red, green, blue;
 		bool m_HistogramHasUpdate = false;
 
-		glm::vec2 m_ImageViewportSize;
+		// On screen size of the visible part of the image and the texture coordinates it covers
+		glm::vec2 m_ImageViewportSize = glm::vec2(0.0f);
+		glm::vec4 m_ImageRegion = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		// Texture coordinate of the image shown at the centre of the Viewport window
+		glm::vec2 m_ImageCenter = glm::vec2(0.5f);
 
 		void RenderMenuBar();
 		void RenderImageTab();
+		void RenderImageFilters(Layer& layer);
+		void RenderLayersPanel();
+		// Replaces every layer with the image at path
+		void OpenImage(const std::string& path);
+		// Opens the image offset places away in the folder of the open one, unsaved edits are
+		// only dropped once the user confirms
+		void StepFolder(int offset);
+		// Moves by offset, past the images that cannot be read. Stays on the shown image when
+		// none of the rest can
+		void MoveFolder(int offset);
+		// False, with the image in m_FolderError, when it cannot be read
+		bool ShowFolderImage();
+		void StepHistory(bool redo);
 		void RenderVideoTab();
 		void RenderCameraTab();
+		void UpdateFaceDetections(const uint8_t* data, uint32_t width, uint32_t height);
+		void RenderCameraDenoise();
+		void RenderCameraAnonymise();
+		void RenderVideoExport();
+		void RenderVideoFaceIndex();
+		void RenderFaceLibrary();
+		// Looks up the faces of the open image in the face library
+		void FindImageFaces();
+		void RenderDuplicates();
+		void RenderBatch();
+		// Returns true when a value changed
+		bool RenderAnonymiseControls(FilterParameters& parameters);
+		// error is shown while the CNN is picked but could not be loaded
+		bool RenderDetectionModel(DetectionModel& model, const std::string& error);
+		void RenderMotionStats();
+		void RenderDetectionGating();
+		void RenderDetectionProfile();
+		std::vector<LayerState> GetLayerStates() const;
+		ViewportState GetViewportState() const;
+		bool RenderKernelEditor(ConvolutionKernel& kernel, KernelPreset& preset);
+		static const char* GetConvolutionPathName(ConvolutionPath path);
+		// Returns true when the chain or the table changed
+		bool RenderLutEditor(std::vector<Filter>& chain, FilterParameters& parameters, RenderGraph& graph);
+		void RenderImage();
+		std::vector<uint8_t> RenderImageExport();
 	};
 }
\ No newline at end of file
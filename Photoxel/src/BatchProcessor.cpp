@@ -0,0 +1,434 @@
+#include "BatchProcessor.h"
+#include "ImageFolder.h"
+#include "ThreadPool.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <unordered_set>
+
+namespace Photoxel
+{
+	static constexpr char JOURNAL_FILE_MAGIC[4] = { 'P', 'X', 'B', 'J' };
+	static constexpr uint32_t JOURNAL_FILE_VERSION = 1;
+	static constexpr const char* JOURNAL_FILE_NAME = "photoxel.batch";
+	// Images are written aside under this suffix and renamed once complete
+	static constexpr const char* PARTIAL_SUFFIX = ".part";
+	// Images queued per pool thread at most, however small they are, so a cancel stops quickly
+	static constexpr size_t JOBS_PER_THREAD = 4;
+
+	struct BatchProcessor::Job {
+		std::string Source;
+		// Generic path under the input folder, the key of the journal
+		std::string Relative;
+		std::unique_ptr<uint8_t, void(*)(void*)> Pixels{ nullptr, stbi_image_free };
+		uint32_t Width = 0, Height = 0, Channels = 0;
+		// Bytes taken from the memory budget
+		uint64_t Bytes = 0;
+	};
+
+	static int64_t GetNanoseconds(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	// Paths the journal lists, false when there is no journal of this chain. A record cut short by a
+	// crash is dropped from the file so the next ones follow a complete record
+	static bool ReadJournal(const std::string& path, uint64_t chainHash, std::unordered_set<std::string>& done)
+	{
+		std::ifstream reader(path, std::ios::binary);
+		char magic[4];
+		uint32_t version = 0;
+		uint64_t hash = 0;
+		if (!reader || !reader.read(magic, sizeof(magic)) || std::memcmp(magic, JOURNAL_FILE_MAGIC, sizeof(magic)) != 0
+			|| !reader.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != JOURNAL_FILE_VERSION
+			|| !reader.read(reinterpret_cast<char*>(&hash), sizeof(hash)) || hash != chainHash) {
+			return false;
+		}
+		std::streamoff complete = reader.tellg();
+		std::string relative;
+		uint32_t length = 0;
+		while (reader.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+			relative.resize(length);
+			if (!reader.read(relative.data(), length)) break;
+			done.insert(relative);
+			complete = reader.tellg();
+		}
+		reader.close();
+
+		std::error_code error;
+		if (std::filesystem::file_size(path, error) != static_cast<uintmax_t>(complete)) {
+			std::filesystem::resize_file(path, static_cast<uintmax_t>(complete), error);
+		}
+		return true;
+	}
+
+	BatchProcessor::~BatchProcessor()
+	{
+		Cancel();
+	}
+
+	void BatchProcessor::Start(const FilterChain& chain, const std::string& input, const std::string& output,
+		const BatchOptions& options)
+	{
+		Cancel();
+		m_Cancelled = false;
+		m_ImageCount = 0;
+		m_Written = 0;
+		m_Resumed = 0;
+		m_Failed = 0;
+		for (StageCounters* stage : { &m_Decoding, &m_Filtering, &m_Encoding }) {
+			stage->Images = 0;
+			stage->Nanoseconds = 0;
+			stage->Pixels = 0;
+		}
+		m_PeakMemory = 0;
+		m_Seconds = 0.0;
+		{
+			std::lock_guard<std::mutex> lock(m_ErrorMutex);
+			m_Error.clear();
+			m_Failures.clear();
+		}
+		m_Chain = chain;
+		m_Options = options;
+		m_Start = std::chrono::steady_clock::now();
+		m_Running = true;
+		m_Thread = std::thread(&BatchProcessor::Run, this, input, output);
+	}
+
+	void BatchProcessor::Cancel()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_FlightMutex);
+			m_Cancelled = true;
+		}
+		m_FlightChanged.notify_all();
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void BatchProcessor::Fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Error = error;
+	}
+
+	void BatchProcessor::Run(std::string input, std::string output)
+	{
+		namespace fs = std::filesystem;
+		std::error_code fileError;
+		const fs::path inputPath = fs::absolute(input, fileError).lexically_normal();
+		const fs::path outputPath = fs::absolute(output, fileError).lexically_normal();
+		// A later run would find the results among the images to process
+		const fs::path nested = outputPath.lexically_relative(inputPath);
+		if (!nested.empty() && *nested.begin() != "..") {
+			Fail("The output folder cannot be inside the input folder");
+			m_Running = false;
+			return;
+		}
+		fs::create_directories(outputPath, fileError);
+		if (fileError) {
+			Fail("Could not create " + outputPath.string());
+			m_Running = false;
+			return;
+		}
+
+		const std::string journalPath = (outputPath / JOURNAL_FILE_NAME).string();
+		const uint64_t chainHash = m_Chain.GetHash();
+		std::unordered_set<std::string> done;
+		const bool resume = ReadJournal(journalPath, chainHash, done);
+		m_Journal = std::ofstream(journalPath, std::ios::binary | (resume ? std::ios::app : std::ios::trunc));
+		if (!resume) {
+			m_Journal.write(JOURNAL_FILE_MAGIC, sizeof(JOURNAL_FILE_MAGIC));
+			m_Journal.write(reinterpret_cast<const char*>(&JOURNAL_FILE_VERSION), sizeof(JOURNAL_FILE_VERSION));
+			m_Journal.write(reinterpret_cast<const char*>(&chainHash), sizeof(chainHash));
+			m_Journal.flush();
+		}
+		if (!m_Journal) {
+			Fail("Could not write " + journalPath);
+			m_Running = false;
+			return;
+		}
+
+		// Images journaled by a run of the same chain are skipped as long as their result is still there
+		std::vector<std::shared_ptr<Job>> pending;
+		for (const std::string& path : FindImages(inputPath.string())) {
+			auto job = std::make_shared<Job>();
+			job->Source = path;
+			job->Relative = fs::path(path).lexically_relative(inputPath).generic_string();
+			if (done.count(job->Relative) && fs::exists(outputPath / fs::path(job->Relative), fileError)) {
+				m_Resumed++;
+				continue;
+			}
+			pending.push_back(std::move(job));
+		}
+		m_ImageCount = static_cast<int64_t>(pending.size());
+		m_Output = outputPath.string();
+
+		// The size of an image is read from its header, so the budget is taken before it is decoded
+		const size_t maxJobs = (ThreadPool::Get().GetThreadCount() + 1) * JOBS_PER_THREAD;
+		for (std::shared_ptr<Job>& job : pending) {
+			int width = 0, height = 0, channels = 0;
+			if (stbi_info(job->Source.c_str(), &width, &height, &channels)) {
+				job->Bytes = static_cast<uint64_t>(width) * height * 4;
+			}
+			{
+				std::unique_lock<std::mutex> lock(m_FlightMutex);
+				m_FlightChanged.wait(lock, [&]() {
+					return m_Cancelled || m_JobsInFlight == 0
+						|| (m_JobsInFlight < maxJobs && m_InFlight + job->Bytes <= m_Options.MemoryBudget);
+				});
+				if (m_Cancelled) break;
+				m_InFlight += job->Bytes;
+				m_JobsInFlight++;
+				m_PeakMemory = std::max<uint64_t>(m_PeakMemory, m_InFlight);
+			}
+			ThreadPool::Get().Submit([this, job]() { DecodeImage(job); });
+			job.reset();
+		}
+		{
+			std::unique_lock<std::mutex> lock(m_FlightMutex);
+			m_FlightChanged.wait(lock, [&]() { return m_JobsInFlight == 0; });
+		}
+		m_Journal.close();
+		m_Renderers.clear();
+		m_Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_Start).count();
+		m_Running = false;
+	}
+
+	// Every stage queues the next one on the worker it runs on, which takes it before anything
+	// else, so an image is usually finished by the core that decoded it
+	void BatchProcessor::DecodeImage(std::shared_ptr<Job> job)
+	{
+		if (m_Cancelled) {
+			Release(*job, false);
+			return;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		int width = 0, height = 0, channels = 0;
+		job->Pixels.reset(stbi_load(job->Source.c_str(), &width, &height, &channels, 4));
+		if (!job->Pixels) {
+			Release(*job, true);
+			return;
+		}
+		job->Width = static_cast<uint32_t>(width);
+		job->Height = static_cast<uint32_t>(height);
+		job->Channels = static_cast<uint32_t>(channels);
+		m_Decoding.Nanoseconds += GetNanoseconds(start);
+		m_Decoding.Pixels += static_cast<int64_t>(width) * height;
+		m_Decoding.Images++;
+
+		// The header may have been unreadable on its own
+		const uint64_t bytes = static_cast<uint64_t>(width) * height * 4;
+		if (bytes != job->Bytes) {
+			std::lock_guard<std::mutex> lock(m_FlightMutex);
+			m_InFlight = m_InFlight - job->Bytes + bytes;
+			m_PeakMemory = std::max<uint64_t>(m_PeakMemory, m_InFlight);
+			job->Bytes = bytes;
+		}
+		ThreadPool::Get().Submit([this, job]() { FilterImage(job); });
+	}
+
+	void BatchProcessor::FilterImage(std::shared_ptr<Job> job)
+	{
+		if (m_Cancelled) {
+			Release(*job, false);
+			return;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		std::unique_ptr<FilterChainRenderer> renderer;
+		{
+			std::lock_guard<std::mutex> lock(m_RendererMutex);
+			if (!m_Renderers.empty()) {
+				renderer = std::move(m_Renderers.back());
+				m_Renderers.pop_back();
+			}
+		}
+		if (!renderer) {
+			renderer = std::make_unique<FilterChainRenderer>();
+		}
+		renderer->Apply(m_Chain, job->Pixels.get(), job->Width, job->Height);
+		{
+			std::lock_guard<std::mutex> lock(m_RendererMutex);
+			m_Renderers.push_back(std::move(renderer));
+		}
+		m_Filtering.Nanoseconds += GetNanoseconds(start);
+		m_Filtering.Pixels += static_cast<int64_t>(job->Width) * job->Height;
+		m_Filtering.Images++;
+		ThreadPool::Get().Submit([this, job]() { EncodeImage(job); });
+	}
+
+	void BatchProcessor::EncodeImage(std::shared_ptr<Job> job)
+	{
+		namespace fs = std::filesystem;
+		if (m_Cancelled) {
+			Release(*job, false);
+			return;
+		}
+		const auto start = std::chrono::steady_clock::now();
+		const fs::path destination = fs::path(m_Output) / fs::path(job->Relative);
+		std::error_code fileError;
+		fs::create_directories(destination.parent_path(), fileError);
+		std::string extension = destination.extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		const bool jpeg = extension == ".jpg" || extension == ".jpeg";
+
+		// JPEG drops the alpha itself, the other formats keep it only when the source had one
+		const int width = static_cast<int>(job->Width), height = static_cast<int>(job->Height);
+		uint8_t* pixels = job->Pixels.get();
+		int channels = 4;
+		if (!jpeg && job->Channels != 2 && job->Channels != 4) {
+			const size_t count = static_cast<size_t>(width) * height;
+			for (size_t i = 0; i < count; i++) {
+				pixels[i * 3 + 0] = pixels[i * 4 + 0];
+				pixels[i * 3 + 1] = pixels[i * 4 + 1];
+				pixels[i * 3 + 2] = pixels[i * 4 + 2];
+			}
+			channels = 3;
+		}
+		const std::string partial = destination.string() + PARTIAL_SUFFIX;
+		bool written;
+		if (jpeg) {
+			written = stbi_write_jpg(partial.c_str(), width, height, channels, pixels, m_Options.JpegQuality) != 0;
+		}
+		else if (extension == ".png") {
+			written = stbi_write_png(partial.c_str(), width, height, channels, pixels, width * channels) != 0;
+		}
+		else {
+			written = stbi_write_bmp(partial.c_str(), width, height, channels, pixels) != 0;
+		}
+		if (written) {
+			fs::rename(partial, destination, fileError);
+			written = !fileError;
+		}
+		if (!written) {
+			fs::remove(partial, fileError);
+			Release(*job, true);
+			return;
+		}
+		m_Encoding.Nanoseconds += GetNanoseconds(start);
+		m_Encoding.Pixels += static_cast<int64_t>(width) * height;
+		m_Encoding.Images++;
+
+		{
+			// Flushed with every record, a crash loses at most the images still in flight
+			std::lock_guard<std::mutex> lock(m_JournalMutex);
+			const uint32_t length = static_cast<uint32_t>(job->Relative.size());
+			m_Journal.write(reinterpret_cast<const char*>(&length), sizeof(length));
+			m_Journal.write(job->Relative.data(), length);
+			m_Journal.flush();
+		}
+		m_Written++;
+		Release(*job, false);
+	}
+
+	void BatchProcessor::Release(const Job& job, bool failed)
+	{
+		if (failed) {
+			m_Failed++;
+			std::lock_guard<std::mutex> lock(m_ErrorMutex);
+			m_Failures.push_back(job.Source);
+		}
+		// Notified under the lock, the processor can be gone as soon as the last job released it
+		std::lock_guard<std::mutex> lock(m_FlightMutex);
+		m_InFlight -= job.Bytes;
+		m_JobsInFlight--;
+		m_FlightChanged.notify_all();
+	}
+
+	bool BatchProcessor::IsRunning() const
+	{
+		return m_Running;
+	}
+
+	float BatchProcessor::GetProgress() const
+	{
+		const int64_t count = m_ImageCount;
+		return count > 0 ? std::min(1.0f, static_cast<float>(m_Written + m_Failed) / count) : 0.0f;
+	}
+
+	BatchReport BatchProcessor::GetReport() const
+	{
+		const auto toStage = [](const StageCounters& counters) {
+			BatchStage stage;
+			stage.Images = counters.Images;
+			stage.Seconds = counters.Nanoseconds * 1e-9;
+			stage.Megapixels = counters.Pixels * 1e-6;
+			return stage;
+		};
+		BatchReport report;
+		report.Decoding = toStage(m_Decoding);
+		report.Filtering = toStage(m_Filtering);
+		report.Encoding = toStage(m_Encoding);
+		report.Written = m_Written;
+		report.Resumed = m_Resumed;
+		report.Failed = m_Failed;
+		report.PeakMemory = m_PeakMemory;
+		report.Seconds = m_Running ? std::chrono::duration<double>(std::chrono::steady_clock::now() - m_Start).count() : m_Seconds.load();
+		return report;
+	}
+
+	std::vector<std::string> BatchProcessor::GetFailures() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Failures;
+	}
+
+	std::string BatchProcessor::GetError() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Error;
+	}
+
+	static void PrintStage(const char* name, const BatchStage& stage)
+	{
+		// Per thread of the pool, the time of a stage is summed over the threads it ran on
+		std::cout << std::left << std::setw(8) << name << std::right << std::setw(10) << stage.Images
+			<< std::setw(12) << std::fixed << std::setprecision(1) << stage.Seconds
+			<< std::setw(14) << (stage.Seconds > 0.0 ? stage.Images / stage.Seconds : 0.0)
+			<< std::setw(12) << (stage.Seconds > 0.0 ? stage.Megapixels / stage.Seconds : 0.0) << std::endl;
+	}
+
+	int RunBatch(const std::string& chainPath, const std::string& input, const std::string& output)
+	{
+		FilterChain chain;
+		std::string error;
+		if (!chain.Load(chainPath, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+
+		BatchProcessor processor;
+		processor.Start(chain, input, output);
+		while (processor.IsRunning()) {
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+			const BatchReport report = processor.GetReport();
+			std::cout << report.Written << " images written (" << static_cast<int>(processor.GetProgress() * 100.0f) << "%), "
+				<< report.Resumed << " from an earlier run, " << report.Failed << " failed" << std::endl;
+		}
+		if (!processor.GetError().empty()) {
+			std::cerr << processor.GetError() << std::endl;
+			return 1;
+		}
+		for (const std::string& failure : processor.GetFailures()) {
+			std::cerr << "Could not process " << failure << std::endl;
+		}
+
+		const BatchReport report = processor.GetReport();
+		std::cout << "stage       images      busy s  images/s/thr    MP/s/thr" << std::endl;
+		PrintStage("decode", report.Decoding);
+		PrintStage("filter", report.Filtering);
+		PrintStage("encode", report.Encoding);
+		std::cout << report.Written << " images in " << std::setprecision(1) << report.Seconds << " s ("
+			<< (report.Seconds > 0.0 ? report.Written / report.Seconds : 0.0) << " images/s on "
+			<< ThreadPool::Get().GetThreadCount() + 1 << " threads), peak " << (report.PeakMemory >> 20)
+			<< " MB decoded in flight" << std::endl;
+		return report.Failed > 0 ? 2 : 0;
+	}
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FilterChain.h"
+
+namespace Photoxel
+{
+	struct BatchOptions {
+		// Decoded pixels allowed in flight at once, the decoding stops until images are written out.
+		// An image larger than the budget still goes through, on its own
+		uint64_t MemoryBudget = 1ull << 30;
+		int JpegQuality = 92;
+	};
+
+	// Time the pool spent in one stage. Stages overlap, so the seconds of all of them add up to
+	// more than the wall clock, and the stage with the most seconds is the one to speed up
+	struct BatchStage {
+		int64_t Images = 0;
+		double Seconds = 0.0;
+		double Megapixels = 0.0;
+	};
+
+	struct BatchReport {
+		BatchStage Decoding, Filtering, Encoding;
+		int64_t Written = 0;
+		// Written by an earlier run of the same chain and skipped
+		int64_t Resumed = 0;
+		int64_t Failed = 0;
+		uint64_t PeakMemory = 0;
+		double Seconds = 0.0;
+	};
+
+	// Applies a saved filter chain to every image of a folder and its subfolders and writes the
+	// results to the same relative paths under another folder, on a thread of its own. Every image
+	// goes through decode, filter and encode as three tasks on the thread pool, the next stage
+	// queued by the one before on the same worker while idle workers steal new images.
+	// Every image written is appended to a journal in the output folder, a run cut short by a
+	// cancel or a crash picks up where it stopped when it is started again with the same chain
+	class BatchProcessor
+	{
+	public:
+		BatchProcessor() = default;
+		~BatchProcessor();
+
+		BatchProcessor(const BatchProcessor&) = delete;
+		BatchProcessor& operator=(const BatchProcessor&) = delete;
+
+		// A run still going is cancelled
+		void Start(const FilterChain& chain, const std::string& input, const std::string& output,
+			const BatchOptions& options = BatchOptions());
+		// Images in flight are dropped before their next stage, unjournaled, and processed again by the
+		// next run. Returns once all of them left the pipeline
+		void Cancel();
+
+		bool IsRunning() const;
+		float GetProgress() const;
+		// Live while it runs, complete once it stopped
+		BatchReport GetReport() const;
+		// Images that could not be read or written
+		std::vector<std::string> GetFailures() const;
+		// Empty unless the last run failed
+		std::string GetError() const;
+	private:
+		struct Job;
+
+		void Run(std::string input, std::string output);
+		void DecodeImage(std::shared_ptr<Job> job);
+		void FilterImage(std::shared_ptr<Job> job);
+		void EncodeImage(std::shared_ptr<Job> job);
+		// Gives back the memory of a job that left the pipeline
+		void Release(const Job& job, bool failed);
+		void Fail(const std::string& error);
+
+		struct StageCounters {
+			std::atomic<int64_t> Images{ 0 }, Nanoseconds{ 0 }, Pixels{ 0 };
+		};
+
+		std::thread m_Thread;
+		std::atomic<bool> m_Running{ false }, m_Cancelled{ false };
+		std::atomic<int64_t> m_ImageCount{ 0 }, m_Written{ 0 }, m_Resumed{ 0 }, m_Failed{ 0 };
+		StageCounters m_Decoding, m_Filtering, m_Encoding;
+		std::atomic<uint64_t> m_PeakMemory{ 0 };
+		std::chrono::steady_clock::time_point m_Start;
+		std::atomic<double> m_Seconds{ 0.0 };
+		// Bytes of the images between decode and encode, the dispatcher waits on it
+		std::mutex m_FlightMutex;
+		std::condition_variable m_FlightChanged;
+		uint64_t m_InFlight = 0;
+		size_t m_JobsInFlight = 0;
+		// Renderers not in use by a filter task, one is made whenever all of them are busy
+		std::mutex m_RendererMutex;
+		std::vector<std::unique_ptr<FilterChainRenderer>> m_Renderers;
+		std::mutex m_JournalMutex;
+		std::ofstream m_Journal;
+		mutable std::mutex m_ErrorMutex;
+		std::string m_Error;
+		std::vector<std::string> m_Failures;
+		FilterChain m_Chain;
+		std::string m_Output;
+		BatchOptions m_Options;
+	};
+
+	// "Photoxel --batch look.pxchain photos output" processes a folder from the command line and
+	// prints the throughput of every stage
+	int RunBatch(const std::string& chainPath, const std::string& input, const std::string& output);
+}
@@ -0,0 +1,381 @@
+#include "Benchmark.h"
+#include "FaceDetector.h"
+#include "ThreadPool.h"
+#include "Lut3D.h"
+#include "Denoise.h"
+#include "FaceEncoder.h"
+#include "HnswIndex.h"
+#include <stb_image.h>
+#include <stb_image_resize.h>
+#include <stb_image_write.h>
+#include <chrono>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <functional>
+#include <algorithm>
+#include <random>
+
+namespace Photoxel
+{
+	static constexpr int BENCHMARK_WIDTH = 1920;
+	static constexpr int BENCHMARK_HEIGHT = 1080;
+	static constexpr int BENCHMARK_RUNS = 5;
+	// Frames handed to DetectBatch per throughput run
+	static constexpr size_t DETECTOR_BATCH = 8;
+	// Overlap a detection needs with a true face to count as finding it, the usual face benchmark rule
+	static constexpr double RECALL_OVERLAP = 0.5;
+	// Synthetic faces per person and queries timed by the face search benchmark
+	static constexpr size_t SEARCH_FACES_PER_PERSON = 20;
+	static constexpr size_t SEARCH_QUERIES = 1000;
+	static constexpr size_t SEARCH_RESULTS = 10;
+
+	static double TimeDetection(FaceDetector& detector, const dlib::array2d<dlib::rgb_pixel>& image,
+		std::vector<dlib::rectangle>& dets)
+	{
+		double best = 0.0;
+		for (int run = 0; run < BENCHMARK_RUNS; run++) {
+			auto start = std::chrono::high_resolution_clock::now();
+			dets = detector.DetectImage(image);
+			auto end = std::chrono::high_resolution_clock::now();
+			double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
+			best = (run == 0) ? elapsed : std::min(best, elapsed);
+		}
+		return best;
+	}
+
+	int RunFaceDetectionBenchmark(const std::string& imagePath)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 3);
+		if (!pixels) {
+			std::cout << "Could not load " << imagePath << '\n';
+			return 1;
+		}
+
+		// Always measure at 1080p so runs on different pictures are comparable
+		dlib::array2d<dlib::rgb_pixel> image(BENCHMARK_HEIGHT, BENCHMARK_WIDTH);
+		stbir_resize_uint8(pixels, width, height, width * 3,
+			reinterpret_cast<uint8_t*>(&image[0][0]), BENCHMARK_WIDTH, BENCHMARK_HEIGHT, BENCHMARK_WIDTH * 3, 3);
+		stbi_image_free(pixels);
+
+		FaceDetector detector;
+		DetectionProfile profile;
+		profile.DetectionResolution = 0;
+		profile.ThreadCount = 1;
+		detector.SetProfile(profile);
+
+		std::vector<dlib::rectangle> reference;
+		const double serial = TimeDetection(detector, image, reference);
+		std::cout << "Serial detector: " << serial << " ms, " << reference.size() << " faces, "
+			<< detector.GetPyramidLevels() << " pyramid levels\n";
+
+		const uint32_t poolThreads = ThreadPool::Get().GetThreadCount() + 1;
+		for (uint32_t threads = 2; threads <= 16; threads *= 2) {
+			if (threads > poolThreads) {
+				std::cout << threads << " threads: skipped, pool only has " << poolThreads << '\n';
+				continue;
+			}
+
+			profile.ThreadCount = threads;
+			detector.SetProfile(profile);
+
+			std::vector<dlib::rectangle> dets;
+			const double parallel = TimeDetection(detector, image, dets);
+			const bool identical = dets == reference;
+			std::cout << threads << " threads: " << parallel << " ms, speedup " << serial / parallel
+				<< "x, " << (identical ? "identical" : "MISMATCH") << '\n';
+			if (!identical) {
+				return 1;
+			}
+		}
+
+		return 0;
+	}
+
+	int RunLutBenchmark(const std::string& lutPath, const std::string& imagePath, const std::string& outputPath)
+	{
+		std::string error;
+		std::shared_ptr<Lut3D> lut = Lut3D::LoadCube(lutPath, error);
+		if (!lut) {
+			std::cout << "Could not load " << lutPath << ": " << error << '\n';
+			return 1;
+		}
+
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 4);
+		if (!pixels) {
+			std::cout << "Could not load " << imagePath << '\n';
+			return 1;
+		}
+
+		std::vector<uint8_t> output(static_cast<size_t>(width) * height * 4);
+		for (LutInterpolation interpolation : { LutInterpolation::Trilinear, LutInterpolation::Tetrahedral }) {
+			double best = 0.0;
+			for (int run = 0; run < BENCHMARK_RUNS; run++) {
+				auto start = std::chrono::high_resolution_clock::now();
+				lut->Apply(pixels, output.data(), width, height, interpolation);
+				auto end = std::chrono::high_resolution_clock::now();
+				double elapsed = std::chrono::duration<double, std::milli>(end - start).count();
+				best = (run == 0) ? elapsed : std::min(best, elapsed);
+			}
+			std::cout << (interpolation == LutInterpolation::Trilinear ? "Trilinear: " : "Tetrahedral: ") << best << " ms, "
+				<< (width * static_cast<double>(height)) / (best * 1000.0) << " Mpixels/s\n";
+		}
+		stbi_image_free(pixels);
+
+		// The last run was tetrahedral
+		if (!outputPath.empty() && !stbi_write_png(outputPath.c_str(), width, height, 4, output.data(), width * 4)) {
+			std::cout << "Could not write " << outputPath << '\n';
+			return 1;
+		}
+		return 0;
+	}
+
+	int RunDenoiseBenchmark(const std::string& imagePath)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 4);
+		if (!pixels) {
+			std::cout << "Could not load " << imagePath << '\n';
+			return 1;
+		}
+
+		const double megapixels = width * static_cast<double>(height) / 1e6;
+		std::vector<uint8_t> output(static_cast<size_t>(width) * height * 4);
+		auto report = [&](const std::string& name, const std::function<double()>& run) {
+			double best = 0.0;
+			for (int i = 0; i < BENCHMARK_RUNS; i++) {
+				const double elapsed = run();
+				best = (i == 0) ? elapsed : std::min(best, elapsed);
+			}
+			std::cout << name << ": " << best << " ms, " << best / megapixels << " ms/MP\n";
+		};
+
+		std::cout << width << "x" << height << ", " << ThreadPool::Get().GetThreadCount() + 1 << " threads\n";
+		MedianFilter median;
+		for (uint32_t radius : { 2u, 8u, 16u, 32u }) {
+			report("Median radius " + std::to_string(radius), [&]() {
+				median.Apply(pixels, output.data(), width, height, 4, radius);
+				return median.GetLastTime();
+			});
+		}
+		BilateralGrid bilateral;
+		const std::pair<float, float> sigmas[] = { { 16.0f, 0.1f }, { 8.0f, 0.1f }, { 4.0f, 0.05f } };
+		for (const auto& [spatial, range] : sigmas) {
+			report("Bilateral grid " + std::to_string(static_cast<int>(spatial)) + " / " + std::to_string(range), [&]() {
+				bilateral.Apply(pixels, output.data(), width, height, 4, spatial, range);
+				return bilateral.GetLastTime();
+			});
+		}
+
+		stbi_image_free(pixels);
+		return 0;
+	}
+
+	static bool IsSameFace(const dlib::rectangle& a, const dlib::rectangle& b)
+	{
+		const double intersection = static_cast<double>(a.intersect(b).area());
+		return intersection / (a.area() + b.area() - intersection) >= RECALL_OVERLAP;
+	}
+
+	// Faces of reference with a detection on them, every detection counts for one face only
+	static size_t CountFound(const std::vector<dlib::rectangle>& reference, const std::vector<dlib::rectangle>& dets)
+	{
+		std::vector<bool> used(dets.size(), false);
+		size_t found = 0;
+		for (const auto& face : reference) {
+			for (size_t i = 0; i < dets.size(); i++) {
+				if (!used[i] && IsSameFace(face, dets[i])) {
+					used[i] = true;
+					found++;
+					break;
+				}
+			}
+		}
+		return found;
+	}
+
+	int RunDetectorBenchmark(const std::string& imagePath, const std::string& facesPath)
+	{
+		int width, height, channels;
+		unsigned char* pixels = stbi_load(imagePath.c_str(), &width, &height, &channels, 3);
+		if (!pixels) {
+			std::cout << "Could not load " << imagePath << '\n';
+			return 1;
+		}
+
+		std::vector<uint8_t> frame(static_cast<size_t>(BENCHMARK_WIDTH) * BENCHMARK_HEIGHT * 3);
+		stbir_resize_uint8(pixels, width, height, width * 3, frame.data(), BENCHMARK_WIDTH, BENCHMARK_HEIGHT, BENCHMARK_WIDTH * 3, 3);
+		stbi_image_free(pixels);
+		const std::vector<const uint8_t*> batch(DETECTOR_BATCH, frame.data());
+
+		// One "left top width height" line per face, in pixels of the original image
+		std::vector<dlib::rectangle> truth;
+		if (!facesPath.empty()) {
+			std::ifstream reader(facesPath);
+			if (!reader) {
+				std::cout << "Could not load " << facesPath << '\n';
+				return 1;
+			}
+			const double scaleX = static_cast<double>(BENCHMARK_WIDTH) / width;
+			const double scaleY = static_cast<double>(BENCHMARK_HEIGHT) / height;
+			std::string line;
+			while (std::getline(reader, line)) {
+				std::istringstream fields(line);
+				double left, top, faceWidth, faceHeight;
+				if (line.empty() || line[0] == '#' || !(fields >> left >> top >> faceWidth >> faceHeight)) continue;
+				truth.push_back(dlib::rectangle(std::lround(left * scaleX), std::lround(top * scaleY),
+					std::lround((left + faceWidth) * scaleX) - 1, std::lround((top + faceHeight) * scaleY) - 1));
+			}
+		}
+
+		struct Run {
+			DetectionModel Model;
+			uint32_t Resolution;
+			double FramesPerSecond;
+			std::vector<dlib::rectangle> Faces;
+		};
+		std::vector<Run> runs;
+		for (DetectionModel model : { DetectionModel::Hog, DetectionModel::Cnn }) {
+			FaceDetector detector;
+			DetectionProfile profile;
+			profile.Model = model;
+			// Small enough that only the resolution decides what the detector sees
+			profile.MinFaceSize = 20;
+			detector.SetProfile(profile);
+			if (detector.GetActiveModel() != model) {
+				std::cout << "CNN skipped: " << detector.GetModelError() << '\n';
+				continue;
+			}
+
+			for (uint32_t resolution : { 640u, 1280u, 0u }) {
+				profile.DetectionResolution = resolution;
+				detector.SetProfile(profile);
+				// The first batch also warms up the network copies of every thread
+				const std::vector<dlib::rectangle> faces = detector.DetectBatch(batch, BENCHMARK_WIDTH, BENCHMARK_HEIGHT).front();
+				double best = 0.0;
+				for (int run = 0; run < BENCHMARK_RUNS; run++) {
+					detector.DetectBatch(batch, BENCHMARK_WIDTH, BENCHMARK_HEIGHT);
+					const double elapsed = detector.GetLastDetectionTime();
+					best = (run == 0) ? elapsed : std::min(best, elapsed);
+				}
+				runs.push_back({ model, resolution, DETECTOR_BATCH * 1000.0 / best, faces });
+			}
+		}
+
+		// Without annotations the faces either model finds at full resolution stand in for the truth
+		if (facesPath.empty()) {
+			for (const Run& run : runs) {
+				if (run.Resolution != 0) continue;
+				for (const auto& face : run.Faces) {
+					if (CountFound({ face }, truth) == 0) {
+						truth.push_back(face);
+					}
+				}
+			}
+			std::cout << "No annotations, recall is against the " << truth.size() << " faces found by any model at full resolution\n";
+		}
+
+		std::cout << BENCHMARK_WIDTH << "x" << BENCHMARK_HEIGHT << ", batches of " << DETECTOR_BATCH << ", "
+			<< ThreadPool::Get().GetThreadCount() + 1 << " threads\n";
+		for (const Run& run : runs) {
+			const size_t found = CountFound(truth, run.Faces);
+			std::cout << (run.Model == DetectionModel::Hog ? "HOG " : "CNN ")
+				<< (run.Resolution == 0 ? std::string("full") : std::to_string(run.Resolution) + " px") << ": "
+				<< run.FramesPerSecond << " fps, " << run.Faces.size() << " detections, recall " << found << "/" << truth.size();
+			if (!truth.empty()) {
+				std::cout << " (" << 100.0 * found / truth.size() << "%)";
+			}
+			std::cout << '\n';
+		}
+		return 0;
+	}
+
+	int RunFaceSearchBenchmark(size_t count)
+	{
+		// People are random points on the unit sphere like real descriptors, their faces scattered
+		// around them about as far apart as photos of one person are
+		std::mt19937 random(42);
+		std::normal_distribution<float> normal(0.0f, 1.0f);
+		const size_t people = std::max<size_t>(1, count / SEARCH_FACES_PER_PERSON);
+		std::vector<float> centres(people * FACE_DESCRIPTOR_SIZE);
+		for (size_t person = 0; person < people; person++) {
+			float* centre = &centres[person * FACE_DESCRIPTOR_SIZE];
+			float length = 0.0f;
+			for (uint32_t i = 0; i < FACE_DESCRIPTOR_SIZE; i++) {
+				centre[i] = normal(random);
+				length += centre[i] * centre[i];
+			}
+			for (uint32_t i = 0; i < FACE_DESCRIPTOR_SIZE; i++) {
+				centre[i] /= std::sqrt(length);
+			}
+		}
+		const float spread = SAME_PERSON_DISTANCE / (2.0f * std::sqrt(static_cast<float>(FACE_DESCRIPTOR_SIZE)));
+		std::vector<float> descriptors(count * FACE_DESCRIPTOR_SIZE);
+		for (size_t face = 0; face < count; face++) {
+			const float* centre = &centres[(face % people) * FACE_DESCRIPTOR_SIZE];
+			for (uint32_t i = 0; i < FACE_DESCRIPTOR_SIZE; i++) {
+				descriptors[face * FACE_DESCRIPTOR_SIZE + i] = centre[i] + spread * normal(random);
+			}
+		}
+
+		VectorView vectors;
+		vectors.Data = descriptors.data();
+		vectors.Stride = FACE_DESCRIPTOR_SIZE * sizeof(float);
+		vectors.Count = count;
+		vectors.Dimension = FACE_DESCRIPTOR_SIZE;
+		HnswIndex index;
+		auto start = std::chrono::high_resolution_clock::now();
+		index.Build(vectors);
+		auto end = std::chrono::high_resolution_clock::now();
+		std::cout << count << " faces of " << people << " people indexed in "
+			<< std::chrono::duration<double>(end - start).count() << " s, " << index.GetLevels() << " levels, "
+			<< ThreadPool::Get().GetThreadCount() + 1 << " threads\n";
+
+		// Queries are new photos of people in the library
+		const size_t queries = std::min(SEARCH_QUERIES, count);
+		std::vector<float> query(queries * FACE_DESCRIPTOR_SIZE);
+		for (size_t q = 0; q < queries; q++) {
+			const float* centre = &centres[(q * 7919 % people) * FACE_DESCRIPTOR_SIZE];
+			for (uint32_t i = 0; i < FACE_DESCRIPTOR_SIZE; i++) {
+				query[q * FACE_DESCRIPTOR_SIZE + i] = centre[i] + spread * normal(random);
+			}
+		}
+
+		for (size_t candidates : { 32u, 64u, 128u }) {
+			std::vector<std::vector<std::pair<float, uint32_t>>> results(queries);
+			start = std::chrono::high_resolution_clock::now();
+			for (size_t q = 0; q < queries; q++) {
+				results[q] = index.Search(&query[q * FACE_DESCRIPTOR_SIZE], SEARCH_RESULTS, candidates);
+			}
+			end = std::chrono::high_resolution_clock::now();
+
+			// The exact answer of a sample of the queries, a full scan of a million faces takes a while
+			size_t found = 0, expected = 0;
+			for (size_t q = 0; q < queries; q += 10) {
+				std::vector<std::pair<float, uint32_t>> exact(count);
+				for (size_t face = 0; face < count; face++) {
+					float distance = 0.0f;
+					for (uint32_t i = 0; i < FACE_DESCRIPTOR_SIZE; i++) {
+						const float d = query[q * FACE_DESCRIPTOR_SIZE + i] - descriptors[face * FACE_DESCRIPTOR_SIZE + i];
+						distance += d * d;
+					}
+					exact[face] = { distance, static_cast<uint32_t>(face) };
+				}
+				const size_t k = std::min(SEARCH_RESULTS, count);
+				std::partial_sort(exact.begin(), exact.begin() + k, exact.end());
+				for (size_t i = 0; i < k; i++) {
+					for (const auto& result : results[q]) {
+						found += result.second == exact[i].second;
+					}
+				}
+				expected += k;
+			}
+			std::cout << candidates << " candidates: " << std::chrono::duration<double, std::milli>(end - start).count() / queries
+				<< " ms per query, recall@" << SEARCH_RESULTS << " " << 100.0 * found / expected << "%\n";
+		}
+		return 0;
+	}
+}
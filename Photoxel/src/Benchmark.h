@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+
+namespace Photoxel
+{
+	// Command line benchmarks, run with "Photoxel --bench-faces image.jpg"
+	int RunFaceDetectionBenchmark(const std::string& imagePath);
+	// "Photoxel --bench-lut grade.cube image.jpg [graded.png]" times the CPU paths of a 3D LUT
+	// and optionally writes the tetrahedral result
+	int RunLutBenchmark(const std::string& lutPath, const std::string& imagePath, const std::string& outputPath);
+	// "Photoxel --bench-denoise image.jpg" prints the per megapixel cost of the median and bilateral filters
+	int RunDenoiseBenchmark(const std::string& imagePath);
+	// "Photoxel --bench-detectors image.jpg [faces.txt]" compares the throughput and recall of the HOG
+	// and CNN face detectors at several detection resolutions. faces.txt holds one "left top width
+	// height" line per face, without it recall is measured against the faces either model finds
+	int RunDetectorBenchmark(const std::string& imagePath, const std::string& facesPath);
+	// "Photoxel --bench-face-search [count]" builds the face index over count synthetic descriptors,
+	// a million by default, and prints the query time and the recall against an exact search
+	int RunFaceSearchBenchmark(size_t count);
+}
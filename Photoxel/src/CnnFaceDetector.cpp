@@ -0,0 +1,201 @@
+#include "CnnFaceDetector.h"
+#include "ThreadPool.h"
+#include <dlib/dnn.h>
+#include <algorithm>
+
+namespace Photoxel
+{
+	// Layout of mmod_human_face_detector.dat, the network has to match the file layer for layer
+	template <long Filters, typename Subnet> using Conv5Down = dlib::con<Filters, 5, 5, 2, 2, Subnet>;
+	template <long Filters, typename Subnet> using Conv5 = dlib::con<Filters, 5, 5, 1, 1, Subnet>;
+	template <typename Subnet> using Downsampler = dlib::relu<dlib::affine<Conv5Down<32, dlib::relu<dlib::affine<
+		Conv5Down<32, dlib::relu<dlib::affine<Conv5Down<16, Subnet>>>>>>>>>;
+	template <typename Subnet> using Block5 = dlib::relu<dlib::affine<Conv5<45, Subnet>>>;
+	using FaceNetwork = dlib::loss_mmod<dlib::con<1, 9, 9, 1, 1, Block5<Block5<Block5<
+		Downsampler<dlib::input_rgb_image_pyramid<dlib::pyramid_down<6>>>>>>>>;
+
+	// Images per forward pass, more only costs memory once the convolutions are this wide
+	static constexpr size_t CNN_BATCH_SIZE = 8;
+	// Side of the tiles a large image is cut into, and how much neighbouring tiles share by default
+	static constexpr long CNN_TILE_SIZE = 512;
+	static constexpr long CNN_TILE_OVERLAP = 160;
+
+	struct CnnFaceDetector::Network {
+		FaceNetwork Net;
+	};
+
+	CnnFaceDetector::CnnFaceDetector() = default;
+
+	CnnFaceDetector::~CnnFaceDetector() = default;
+
+	bool CnnFaceDetector::Load(const std::string& path, std::string& error)
+	{
+		auto network = std::make_unique<Network>();
+		try {
+			dlib::deserialize(path) >> network->Net;
+		}
+		catch (const std::exception& e) {
+			error = "Could not load " + path + ": " + e.what();
+			return false;
+		}
+
+		m_WindowSize = 0;
+		for (const auto& window : network->Net.loss_details().get_options().detector_windows) {
+			const long side = static_cast<long>(std::max(window.width, window.height));
+			m_WindowSize = (m_WindowSize == 0) ? side : std::min(m_WindowSize, side);
+		}
+		m_Networks.clear();
+		m_Networks.push_back(std::move(network));
+		return true;
+	}
+
+	bool CnnFaceDetector::IsLoaded() const
+	{
+		return !m_Networks.empty();
+	}
+
+	long CnnFaceDetector::GetWindowSize() const
+	{
+		return m_WindowSize;
+	}
+
+	std::vector<std::vector<dlib::mmod_rect>> CnnFaceDetector::Run(std::vector<dlib::matrix<dlib::rgb_pixel>>& images,
+		uint32_t threads)
+	{
+		std::vector<std::vector<dlib::mmod_rect>> results(images.size());
+		if (images.empty() || m_Networks.empty()) {
+			return results;
+		}
+
+		if (threads == 0) {
+			threads = ThreadPool::Get().GetThreadCount() + 1;
+		}
+		const size_t workers = std::min<size_t>(threads, images.size());
+		while (m_Networks.size() < workers) {
+			m_Networks.push_back(std::make_unique<Network>(*m_Networks.front()));
+		}
+
+		// Every worker takes a contiguous share of the images and batches it through its own network
+		ThreadPool::Get().ParallelFor(workers, [&](size_t worker) {
+			const size_t begin = worker * images.size() / workers;
+			const size_t end = (worker + 1) * images.size() / workers;
+			std::vector<dlib::matrix<dlib::rgb_pixel>> share(std::make_move_iterator(images.begin() + begin),
+				std::make_move_iterator(images.begin() + end));
+			std::vector<std::vector<dlib::mmod_rect>> dets = m_Networks[worker]->Net(share, CNN_BATCH_SIZE);
+			std::move(dets.begin(), dets.end(), results.begin() + begin);
+		}, static_cast<uint32_t>(workers));
+		return results;
+	}
+
+	std::vector<std::vector<dlib::rectangle>> CnnFaceDetector::DetectBatch(std::vector<dlib::matrix<dlib::rgb_pixel>> images,
+		uint32_t threads)
+	{
+		std::vector<std::vector<dlib::mmod_rect>> results = Run(images, threads);
+		std::vector<std::vector<dlib::rectangle>> dets(results.size());
+		for (size_t i = 0; i < results.size(); i++) {
+			for (const dlib::mmod_rect& det : results[i]) {
+				dets[i].push_back(det.rect);
+			}
+		}
+		return dets;
+	}
+
+	std::vector<dlib::rectangle> CnnFaceDetector::Detect(const dlib::array2d<dlib::rgb_pixel>& image, uint32_t threads, long maxFace)
+	{
+		if (m_Networks.empty()) {
+			return {};
+		}
+
+		const long width = image.nc();
+		const long height = image.nr();
+		if (threads == 0) {
+			threads = ThreadPool::Get().GetThreadCount() + 1;
+		}
+
+		// A face is whole in at least one tile when the tiles share more than its size
+		const long overlap = std::max(m_WindowSize, maxFace > 0 ? maxFace : CNN_TILE_OVERLAP);
+		const long tileSize = std::max(CNN_TILE_SIZE, overlap * 2);
+		if (threads <= 1 || (width <= tileSize && height <= tileSize)) {
+			std::vector<dlib::matrix<dlib::rgb_pixel>> whole(1);
+			whole[0] = dlib::mat(image);
+			std::vector<dlib::mmod_rect> candidates = std::move(Run(whole, 1).front());
+			return Suppress(candidates);
+		}
+
+		auto tileStarts = [&](long length) {
+			std::vector<long> starts;
+			const long size = std::min(tileSize, length);
+			for (long start = 0; ; start += tileSize - overlap) {
+				starts.push_back(std::min(start, length - size));
+				if (start + size >= length) break;
+			}
+			return starts;
+		};
+
+		std::vector<dlib::rectangle> tiles;
+		std::vector<dlib::matrix<dlib::rgb_pixel>> crops;
+		for (long top : tileStarts(height)) {
+			for (long left : tileStarts(width)) {
+				const dlib::rectangle tile(left, top, std::min(left + tileSize, width) - 1, std::min(top + tileSize, height) - 1);
+				tiles.push_back(tile);
+				crops.emplace_back();
+				crops.back() = dlib::subm(dlib::mat(image), tile);
+			}
+		}
+
+		std::vector<dlib::mmod_rect> candidates;
+		std::vector<std::vector<dlib::mmod_rect>> results = Run(crops, threads);
+		for (size_t i = 0; i < tiles.size(); i++) {
+			const dlib::rectangle& tile = tiles[i];
+			for (dlib::mmod_rect det : results[i]) {
+				det.rect = dlib::translate_rect(det.rect, tile.left(), tile.top());
+				// A box on a cut through the image is half a face, the tile next to it has all of it
+				if ((tile.left() > 0 && det.rect.left() <= tile.left()) || (tile.top() > 0 && det.rect.top() <= tile.top()) ||
+					(tile.right() < width - 1 && det.rect.right() >= tile.right()) ||
+					(tile.bottom() < height - 1 && det.rect.bottom() >= tile.bottom())) {
+					continue;
+				}
+				candidates.push_back(det);
+			}
+		}
+
+		// Faces larger than the overlap can span two tiles, a copy shrunk until they fit the window finds them
+		const double scale = static_cast<double>(m_WindowSize) / overlap;
+		if (maxFace <= 0 && scale < 1.0) {
+			dlib::array2d<dlib::rgb_pixel> shrunk(std::max(1L, std::lround(height * scale)), std::max(1L, std::lround(width * scale)));
+			dlib::resize_image(image, shrunk);
+			std::vector<dlib::matrix<dlib::rgb_pixel>> coarse(1);
+			coarse[0] = dlib::mat(shrunk);
+			for (dlib::mmod_rect det : Run(coarse, 1).front()) {
+				det.rect = dlib::rectangle(std::lround(det.rect.left() / scale), std::lround(det.rect.top() / scale),
+					std::lround(det.rect.right() / scale), std::lround(det.rect.bottom() / scale));
+				candidates.push_back(det);
+			}
+		}
+		return Suppress(candidates);
+	}
+
+	std::vector<dlib::rectangle> CnnFaceDetector::Suppress(std::vector<dlib::mmod_rect>& candidates) const
+	{
+		// Same greedy non-max suppression loss_mmod runs inside a single image
+		std::sort(candidates.begin(), candidates.end(), [](const dlib::mmod_rect& a, const dlib::mmod_rect& b) {
+			return a.detection_confidence > b.detection_confidence;
+		});
+
+		const auto& overlaps = m_Networks.front()->Net.loss_details().get_options().overlaps_nms;
+		std::vector<dlib::rectangle> dets;
+		for (const dlib::mmod_rect& candidate : candidates) {
+			bool suppressed = false;
+			for (const dlib::rectangle& kept : dets) {
+				if (overlaps(candidate.rect, kept)) {
+					suppressed = true;
+					break;
+				}
+			}
+			if (!suppressed) {
+				dets.push_back(candidate.rect);
+			}
+		}
+		return dets;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/image_processing.h>
+#include <dlib/matrix.h>
+
+namespace Photoxel
+{
+	// dlib's max-margin (MMOD) CNN face model on the CPU. It finds the profile and small faces the
+	// HOG detector misses at several times the cost. Every worker thread runs its own copy of the
+	// network, a network keeps its activations between calls and cannot be shared
+	class CnnFaceDetector
+	{
+	public:
+		CnnFaceDetector();
+		~CnnFaceDetector();
+
+		CnnFaceDetector(const CnnFaceDetector&) = delete;
+		CnnFaceDetector& operator=(const CnnFaceDetector&) = delete;
+
+		// Returns false and fills error when the model file is missing or is not an MMOD face model
+		bool Load(const std::string& path, std::string& error);
+		bool IsLoaded() const;
+		// Side of the smallest face the model finds, in image pixels
+		long GetWindowSize() const;
+
+		// Runs every image through the network in batches, all of them have to share one size. The
+		// images are split over threads workers, 0 uses the whole pool
+		std::vector<std::vector<dlib::rectangle>> DetectBatch(std::vector<dlib::matrix<dlib::rgb_pixel>> images,
+			uint32_t threads);
+		// Cuts an image into overlapping tiles that run as one batch. Faces up to maxFace pixels are
+		// found in the tiles and larger ones on a downscaled copy, maxFace 0 has no limit
+		std::vector<dlib::rectangle> Detect(const dlib::array2d<dlib::rgb_pixel>& image, uint32_t threads, long maxFace);
+	private:
+		struct Network;
+
+		std::vector<std::vector<dlib::mmod_rect>> Run(std::vector<dlib::matrix<dlib::rgb_pixel>>& images, uint32_t threads);
+		std::vector<dlib::rectangle> Suppress(std::vector<dlib::mmod_rect>& candidates) const;
+
+		// The first one is loaded, the rest are copies made when more threads ask for one
+		std::vector<std::unique_ptr<Network>> m_Networks;
+		long m_WindowSize = 0;
+	};
+}
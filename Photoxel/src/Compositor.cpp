@@ -0,0 +1,533 @@
+#include "Compositor.h"
+#include "Renderer.h"
+#include "Image.h"
+#include "ThreadPool.h"
+#include <glad/glad.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <string>
+
+namespace Photoxel
+{
+	// FNV-1a over the bytes of value
+	template <typename T>
+	static uint64_t Hash(uint64_t seed, const T& value)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		for (size_t i = 0; i < sizeof(T); i++) {
+			seed = (seed ^ bytes[i]) * 0x100000001B3ull;
+		}
+		return seed;
+	}
+
+	static inline __m128 LoadPixel(const uint8_t* pixel)
+	{
+		int32_t value;
+		std::memcpy(&value, pixel, 4);
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(value), zero), zero);
+		return _mm_mul_ps(_mm_cvtepi32_ps(wide), _mm_set1_ps(1.0f / 255.0f));
+	}
+
+	static inline void StorePixel(uint8_t* pixel, __m128 colour)
+	{
+		__m128i value = _mm_cvtps_epi32(_mm_mul_ps(colour, _mm_set1_ps(255.0f)));
+		value = _mm_packs_epi32(value, value);
+		value = _mm_packus_epi16(value, value);
+		const int32_t packed = _mm_cvtsi128_si32(value);
+		std::memcpy(pixel, &packed, 4);
+	}
+
+	template <BlendMode Mode>
+	static inline __m128 BlendColour(__m128 base, __m128 layer)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		switch (Mode)
+		{
+			case BlendMode::Multiply:	return _mm_mul_ps(base, layer);
+			case BlendMode::Screen:		return _mm_sub_ps(_mm_add_ps(base, layer), _mm_mul_ps(base, layer));
+			case BlendMode::Add:		return _mm_min_ps(_mm_add_ps(base, layer), one);
+			case BlendMode::Overlay:
+			{
+				const __m128 two = _mm_set1_ps(2.0f);
+				const __m128 dark = _mm_mul_ps(two, _mm_mul_ps(base, layer));
+				const __m128 light = _mm_sub_ps(one, _mm_mul_ps(two, _mm_mul_ps(_mm_sub_ps(one, base), _mm_sub_ps(one, layer))));
+				const __m128 bright = _mm_cmpgt_ps(base, _mm_set1_ps(0.5f));
+				return _mm_or_ps(_mm_and_ps(bright, light), _mm_andnot_ps(bright, dark));
+			}
+			default:					return layer;
+		}
+	}
+
+	// Separable blend modes over straight alpha, as in the W3C compositing spec: where the base is
+	// transparent the layer shows unblended, and the result is source over the base
+	template <BlendMode Mode>
+	static void BlendRow(float* base, const uint8_t* layer, const uint8_t* mask, float opacity, uint32_t count)
+	{
+		const __m128 one = _mm_set1_ps(1.0f);
+		const __m128 epsilon = _mm_set1_ps(1e-6f);
+		const __m128 alphaLane = _mm_castsi128_ps(_mm_set_epi32(-1, 0, 0, 0));
+		for (uint32_t x = 0; x < count; x++) {
+			const float coverage = mask ? opacity * mask[x] * (1.0f / 255.0f) : opacity;
+			if (coverage <= 0.0f) continue;
+
+			const __m128 source = LoadPixel(layer + x * 4);
+			const __m128 below = _mm_load_ps(base + x * 4);
+			const __m128 sourceAlpha = _mm_mul_ps(_mm_shuffle_ps(source, source, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(coverage));
+			const __m128 baseAlpha = _mm_shuffle_ps(below, below, _MM_SHUFFLE(3, 3, 3, 3));
+
+			const __m128 blended = BlendColour<Mode>(below, source);
+			const __m128 mixed = _mm_add_ps(source, _mm_mul_ps(_mm_sub_ps(blended, source), baseAlpha));
+			const __m128 remaining = _mm_mul_ps(baseAlpha, _mm_sub_ps(one, sourceAlpha));
+			const __m128 alpha = _mm_add_ps(sourceAlpha, remaining);
+			const __m128 colour = _mm_div_ps(_mm_add_ps(_mm_mul_ps(mixed, sourceAlpha), _mm_mul_ps(below, remaining)),
+				_mm_max_ps(alpha, epsilon));
+			_mm_store_ps(base + x * 4, _mm_or_ps(_mm_and_ps(alphaLane, alpha), _mm_andnot_ps(alphaLane, colour)));
+		}
+	}
+
+	static void BlendRow(BlendMode mode, float* base, const uint8_t* layer, const uint8_t* mask, float opacity, uint32_t count)
+	{
+		switch (mode)
+		{
+			case BlendMode::Multiply:	BlendRow<BlendMode::Multiply>(base, layer, mask, opacity, count); break;
+			case BlendMode::Screen:		BlendRow<BlendMode::Screen>(base, layer, mask, opacity, count); break;
+			case BlendMode::Overlay:	BlendRow<BlendMode::Overlay>(base, layer, mask, opacity, count); break;
+			case BlendMode::Add:		BlendRow<BlendMode::Add>(base, layer, mask, opacity, count); break;
+			default:					BlendRow<BlendMode::Normal>(base, layer, mask, opacity, count); break;
+		}
+	}
+
+	void TileCompositor::Composite(const std::vector<CompositeLayer>& layers, uint32_t width, uint32_t height, uint8_t* dst)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		const uint32_t columns = (width + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+		const uint32_t rows = (height + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+		if (width != m_Width || height != m_Height || dst != m_Target) {
+			Invalidate();
+			m_Width = width;
+			m_Height = height;
+			m_Target = dst;
+		}
+		m_TileKeys.resize(static_cast<size_t>(columns) * rows, 0);
+
+		std::atomic<uint32_t> blendedTiles = 0;
+		const size_t stride = static_cast<size_t>(width) * 4;
+		ThreadPool::Get().ParallelFor(m_TileKeys.size(), [&](size_t tile) {
+			const uint32_t x0 = static_cast<uint32_t>(tile % columns) * LAYER_TILE_SIZE;
+			const uint32_t y0 = static_cast<uint32_t>(tile / columns) * LAYER_TILE_SIZE;
+			const uint32_t x1 = std::min(x0 + LAYER_TILE_SIZE, width), y1 = std::min(y0 + LAYER_TILE_SIZE, height);
+
+			// Layers that show on the tile, and a key of everything the tile reads from them
+			struct Shown {
+				const CompositeLayer* Layer;
+				bool Masked;
+			};
+			std::vector<Shown> shown;
+			uint64_t key = 0xCBF29CE484222325ull;
+			for (const CompositeLayer& layer : layers) {
+				const TileCoverage coverage = layer.Mask ? layer.Mask->GetTileCoverage(static_cast<uint32_t>(tile)) : TileCoverage::Full;
+				if (layer.Opacity <= 0.0f || coverage == TileCoverage::Empty) continue;
+
+				shown.push_back({ &layer, coverage == TileCoverage::Partial });
+				key = Hash(Hash(Hash(key, layer.Key), layer.Opacity), layer.Blend);
+				key = Hash(Hash(key, layer.Mask), layer.Mask ? layer.Mask->GetTileRevision(static_cast<uint32_t>(tile)) : 0);
+			}
+			if (key == m_TileKeys[tile]) {
+				return;
+			}
+			m_TileKeys[tile] = key;
+			blendedTiles++;
+
+			alignas(16) float row[LAYER_TILE_SIZE * 4];
+			const uint32_t count = x1 - x0;
+			for (uint32_t y = y0; y < y1; y++) {
+				const size_t offset = y * stride + static_cast<size_t>(x0) * 4;
+				std::fill(row, row + count * 4, 0.0f);
+				for (const Shown& entry : shown) {
+					const CompositeLayer& layer = *entry.Layer;
+					const uint8_t* mask = entry.Masked ? layer.Mask->GetPixels() + static_cast<size_t>(y) * width + x0 : nullptr;
+					BlendRow(layer.Blend, row, layer.Pixels + offset, mask, layer.Opacity, count);
+				}
+				for (uint32_t x = 0; x < count; x++) {
+					StorePixel(dst + offset + static_cast<size_t>(x) * 4, _mm_load_ps(row + x * 4));
+				}
+			}
+		});
+
+		m_LastBlendedTiles = blendedTiles;
+		m_LastSkippedTiles = static_cast<uint32_t>(m_TileKeys.size()) - m_LastBlendedTiles;
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void TileCompositor::Invalidate()
+	{
+		m_TileKeys.clear();
+		m_Target = nullptr;
+	}
+
+	uint32_t TileCompositor::GetLastBlendedTiles() const
+	{
+		return m_LastBlendedTiles;
+	}
+
+	uint32_t TileCompositor::GetLastSkippedTiles() const
+	{
+		return m_LastSkippedTiles;
+	}
+
+	double TileCompositor::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+
+	Compositor::Compositor(Renderer& renderer)
+		: m_Renderer(renderer)
+	{
+		m_Program = std::make_unique<Shader>(std::initializer_list<ShaderProperties>{
+			{ "VertexShader", ShaderType::Vertex },
+			{ "CompositePixelShader", ShaderType::Pixel }
+		});
+		m_SelectionProgram = std::make_unique<Shader>(std::initializer_list<ShaderProperties>{
+			{ "VertexShader", ShaderType::Vertex },
+			{ "SelectionPixelShader", ShaderType::Pixel }
+		});
+	}
+
+	void Compositor::RenderLayer(Layer& layer, Framebuffer& target, const glm::vec4& region)
+	{
+		if (layer.Graph->GetChain() != layer.Filters) {
+			layer.Graph->SetChain(layer.Filters);
+		}
+		if (layer.Selection && !layer.Filters.empty()) {
+			RenderSelection(layer, target, region);
+			return;
+		}
+		layer.Graph->Execute(layer.Source->GetRendererID(), layer.Source->GetWidth(), layer.Source->GetHeight(), layer.Revision,
+			layer.Parameters, target, region);
+	}
+
+	void Compositor::RenderSelection(Layer& layer, Framebuffer& target, const glm::vec4& region)
+	{
+		const LayerMask& selection = *layer.Selection;
+		const uint32_t width = target.GetWidth(), height = target.GetHeight();
+		const glm::vec2 imageSize(static_cast<float>(selection.GetWidth()), static_cast<float>(selection.GetHeight()));
+		const glm::vec2 regionSize(region.z - region.x, region.w - region.y);
+		// Image pixels to target pixels
+		const auto toTarget = [&](const glm::vec2& pixel) {
+			return (pixel / imageSize - glm::vec2(region.x, region.y)) / regionSize * glm::vec2(width, height);
+		};
+
+		// Target pixels the filters have to cover, snapped so their output maps one to one on the target
+		const glm::uvec4 bounds = selection.GetBounds();
+		const glm::vec2 low = glm::clamp(glm::floor(toTarget(glm::vec2(bounds.x, bounds.y))), glm::vec2(0.0f), glm::vec2(width, height));
+		const glm::vec2 high = glm::clamp(glm::ceil(toTarget(glm::vec2(bounds.z, bounds.w))), glm::vec2(0.0f), glm::vec2(width, height));
+		m_LastSelectionTiles = 0;
+		m_LastSelectionCoverage = (high.x - low.x) * (high.y - low.y) / (static_cast<float>(width) * height);
+
+		// Outside the selection the layer shows its source as it is
+		target.Begin();
+		m_SelectionProgram->Bind();
+		m_SelectionProgram->SetFloat4("u_TexRect", glm::vec4(region.x, region.y, regionSize.x, regionSize.y));
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, layer.Source->GetRendererID());
+		m_SelectionProgram->SetInt("u_Source", 0);
+		m_SelectionProgram->SetInt("u_Filtering", 0);
+		m_Renderer.OnRender();
+		if (high.x <= low.x || high.y <= low.y) {
+			return;
+		}
+
+		const glm::vec4 area(glm::vec2(region.x, region.y) + low / glm::vec2(width, height) * regionSize,
+			glm::vec2(region.x, region.y) + high / glm::vec2(width, height) * regionSize);
+		Framebuffer* filtered = m_Pool.Acquire(static_cast<uint32_t>(high.x - low.x), static_cast<uint32_t>(high.y - low.y));
+		layer.Graph->Execute(layer.Source->GetRendererID(), layer.Source->GetWidth(), layer.Source->GetHeight(), layer.Revision,
+			layer.Parameters, *filtered, area);
+
+		target.Begin();
+		m_SelectionProgram->Bind();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, layer.Source->GetRendererID());
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, filtered->GetColorAttachment());
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, selection.GetTexture());
+		m_SelectionProgram->SetInt("u_Filtered", 1);
+		m_SelectionProgram->SetInt("u_Selection", 2);
+		m_SelectionProgram->SetFloat4("u_FilteredRect", glm::vec4(area.x, area.y, area.z - area.x, area.w - area.y));
+		m_SelectionProgram->SetInt("u_Filtering", 1);
+
+		// Runs of tiles that are not empty along each row of tiles, one scissored draw per run
+		glEnable(GL_SCISSOR_TEST);
+		const uint32_t columns = selection.GetTileColumns();
+		const uint32_t rows = (selection.GetHeight() + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+		for (uint32_t row = bounds.y / LAYER_TILE_SIZE; row < rows && row * LAYER_TILE_SIZE < bounds.w; row++) {
+			for (uint32_t column = bounds.x / LAYER_TILE_SIZE; column < columns;) {
+				if (selection.GetTileCoverage(row * columns + column) == TileCoverage::Empty) {
+					column++;
+					continue;
+				}
+				const uint32_t first = column;
+				while (column < columns && selection.GetTileCoverage(row * columns + column) != TileCoverage::Empty) {
+					column++;
+				}
+
+				const glm::vec2 from = glm::max(glm::floor(toTarget(glm::vec2(first, row) * static_cast<float>(LAYER_TILE_SIZE))), low);
+				const glm::vec2 to = glm::min(glm::ceil(toTarget(glm::min(glm::vec2(column, row + 1) * static_cast<float>(LAYER_TILE_SIZE), imageSize))), high);
+				if (to.x <= from.x || to.y <= from.y) continue;
+				glScissor(static_cast<GLint>(from.x), static_cast<GLint>(from.y), static_cast<GLsizei>(to.x - from.x), static_cast<GLsizei>(to.y - from.y));
+				m_Renderer.OnRender();
+				m_LastSelectionTiles += column - first;
+			}
+		}
+		glDisable(GL_SCISSOR_TEST);
+
+		glActiveTexture(GL_TEXTURE2);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		glActiveTexture(GL_TEXTURE0);
+		m_Pool.Release(filtered);
+	}
+
+	Compositor::~Compositor()
+	{
+		CancelRefinement();
+	}
+
+	std::vector<Layer*> Compositor::GetVisibleLayers(LayerStack& layers)
+	{
+		std::vector<Layer*> visible;
+		for (size_t i = 0; i < layers.GetCount(); i++) {
+			Layer& layer = layers.Get(i);
+			if (!layer.Visible || layer.Opacity <= 0.0f) continue;
+			if (layer.Mask) {
+				bool empty = true;
+				const uint32_t tiles = layer.Mask->GetTileColumns() * ((layer.Mask->GetHeight() + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE);
+				for (uint32_t tile = 0; tile < tiles && empty; tile++) {
+					empty = layer.Mask->GetTileCoverage(tile) == TileCoverage::Empty;
+				}
+				if (empty) continue;
+			}
+			visible.push_back(&layer);
+		}
+		return visible;
+	}
+
+	bool Compositor::IsDirect(const std::vector<Layer*>& visible)
+	{
+		// Over nothing every blend mode shows the layer as it is
+		return visible.size() == 1 && visible.front()->Opacity >= 1.0f && !visible.front()->Mask;
+	}
+
+	void Compositor::Execute(LayerStack& layers, Framebuffer& target, const glm::vec4& region)
+	{
+		CancelRefinement();
+		const std::vector<Layer*> visible = GetVisibleLayers(layers);
+		m_LastBatchCount = 0;
+		if (visible.empty()) {
+			target.Begin();
+			glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+			glClear(GL_COLOR_BUFFER_BIT);
+			return;
+		}
+		if (IsDirect(visible)) {
+			RenderLayer(*visible.front(), target, region);
+			return;
+		}
+		Composite(visible, target, region);
+	}
+
+	void Compositor::BeginRefinement(LayerStack& layers, Framebuffer& target, const glm::vec4& region)
+	{
+		CancelRefinement();
+		const std::vector<Layer*> visible = GetVisibleLayers(layers);
+		if (!IsDirect(visible)) {
+			Execute(layers, target, region);
+			return;
+		}
+
+		Layer& layer = *visible.front();
+		// Selections keep the render small enough to do at once
+		if (layer.Selection) {
+			Execute(layers, target, region);
+			return;
+		}
+		if (layer.Graph->GetChain() != layer.Filters) {
+			layer.Graph->SetChain(layer.Filters);
+		}
+		layer.Graph->BeginRefinement(layer.Source->GetRendererID(), layer.Source->GetWidth(), layer.Source->GetHeight(),
+			layer.Revision, layer.Parameters, target, region);
+		m_Refining = layer.Graph.get();
+		m_LastBatchCount = 0;
+	}
+
+	bool Compositor::StepRefinement(uint32_t tiles)
+	{
+		if (!m_Refining) {
+			return true;
+		}
+		if (m_Refining->StepRefinement(tiles)) {
+			m_Refining = nullptr;
+			return true;
+		}
+		return false;
+	}
+
+	void Compositor::CancelRefinement()
+	{
+		if (m_Refining) {
+			m_Refining->CancelRefinement();
+			m_Refining = nullptr;
+		}
+	}
+
+	bool Compositor::IsRefining() const
+	{
+		return m_Refining && m_Refining->IsRefining();
+	}
+
+	float Compositor::GetRefinementProgress() const
+	{
+		return m_Refining ? m_Refining->GetRefinementProgress() : 1.0f;
+	}
+
+	void Compositor::Composite(const std::vector<Layer*>& visible, Framebuffer& target, const glm::vec4& region)
+	{
+		const uint32_t width = target.GetWidth();
+		const uint32_t height = target.GetHeight();
+		// The quad covers the region, so the shader works in texture coordinates of the image
+		const glm::vec4 rect(region.x, region.y, region.z - region.x, region.w - region.y);
+
+		// Layers with filters render the region at the size of the target, the rest are read
+		// straight from their source
+		std::vector<Framebuffer*> rendered(visible.size(), nullptr);
+		for (size_t i = 0; i < visible.size(); i++) {
+			if (visible[i]->Filters.empty()) continue;
+			rendered[i] = m_Pool.Acquire(width, height);
+			RenderLayer(*visible[i], *rendered[i], region);
+		}
+
+		Framebuffer* below = nullptr;
+		m_LastBatchCount = 0;
+		for (size_t first = 0; first < visible.size(); first += MAX_BATCH_LAYERS) {
+			const uint32_t count = static_cast<uint32_t>(std::min<size_t>(MAX_BATCH_LAYERS, visible.size() - first));
+			const bool last = (first + count == visible.size());
+			Framebuffer* output = last ? &target : m_Pool.Acquire(width, height);
+
+			output->Begin();
+			m_Program->Bind();
+			m_Program->SetFloat4("u_TexRect", rect);
+			glActiveTexture(GL_TEXTURE0);
+			glBindTexture(GL_TEXTURE_2D, below ? below->GetColorAttachment() : 0);
+			m_Program->SetInt("u_Base", 0);
+			m_Program->SetInt("u_HasBase", below ? 1 : 0);
+			m_Program->SetFloat4("u_BaseRect", rect);
+			m_Program->SetInt("u_LayerCount", count);
+			for (uint32_t j = 0; j < count; j++) {
+				const Layer& layer = *visible[first + j];
+				const Framebuffer* colour = rendered[first + j];
+				const std::string index = "[" + std::to_string(j) + "]";
+
+				glActiveTexture(GL_TEXTURE1 + j);
+				glBindTexture(GL_TEXTURE_2D, colour ? colour->GetColorAttachment() : layer.Source->GetRendererID());
+				glActiveTexture(GL_TEXTURE1 + MAX_BATCH_LAYERS + j);
+				glBindTexture(GL_TEXTURE_2D, layer.Mask ? layer.Mask->GetTexture() : 0);
+
+				m_Program->SetInt("u_Layers" + index, 1 + j);
+				m_Program->SetInt("u_Masks" + index, 1 + MAX_BATCH_LAYERS + j);
+				m_Program->SetFloat4("u_LayerRects" + index, colour ? rect : glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+				m_Program->SetFloat("u_Opacities" + index, layer.Opacity);
+				m_Program->SetInt("u_BlendModes" + index, static_cast<int>(layer.Blend));
+				m_Program->SetInt("u_HasMasks" + index, layer.Mask ? 1 : 0);
+			}
+			m_Renderer.OnRender();
+
+			if (below) {
+				m_Pool.Release(below);
+			}
+			below = last ? nullptr : output;
+			m_LastBatchCount++;
+		}
+
+		for (uint32_t unit = 1; unit <= 2 * MAX_BATCH_LAYERS; unit++) {
+			glActiveTexture(GL_TEXTURE0 + unit);
+			glBindTexture(GL_TEXTURE_2D, 0);
+		}
+		glActiveTexture(GL_TEXTURE0);
+		for (Framebuffer* framebuffer : rendered) {
+			if (framebuffer) {
+				m_Pool.Release(framebuffer);
+			}
+		}
+		target.Begin();
+	}
+
+	std::vector<uint8_t> Compositor::Export(LayerStack& layers)
+	{
+		CancelRefinement();
+		const uint32_t width = layers.GetWidth();
+		const uint32_t height = layers.GetHeight();
+		if (!m_ExportTarget) {
+			m_ExportTarget = std::make_unique<Framebuffer>(width, height);
+		}
+		m_ExportTarget->Resize(width, height);
+
+		// Layers that are gone or hidden drop out of the cache
+		std::unordered_map<uint64_t, ExportedLayer> exported;
+		std::vector<CompositeLayer> inputs;
+		for (Layer* layer : GetVisibleLayers(layers)) {
+			const uint64_t revision = layer->UpdateContentRevision();
+			CompositeLayer input;
+			input.Mask = layer->Mask.get();
+			input.Opacity = layer->Opacity;
+			input.Blend = layer->Blend;
+			input.Key = Hash(Hash(0xCBF29CE484222325ull, layer->Id), revision);
+
+			if (layer->Filters.empty()) {
+				input.Pixels = layer->GetSourcePixels();
+			}
+			else {
+				auto found = m_ExportedLayers.find(layer->Id);
+				ExportedLayer entry = found != m_ExportedLayers.end() ? std::move(found->second) : ExportedLayer();
+				if (entry.Pixels.empty() || entry.ContentRevision != revision) {
+					RenderLayer(*layer, *m_ExportTarget, glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+					entry.Pixels = m_ExportTarget->GetData();
+					entry.ContentRevision = revision;
+				}
+				input.Pixels = (exported[layer->Id] = std::move(entry)).Pixels.data();
+			}
+			inputs.push_back(input);
+		}
+		m_ExportedLayers = std::move(exported);
+
+		m_ExportPixels.resize(static_cast<size_t>(width) * height * 4);
+		m_TileCompositor.Composite(inputs, width, height, m_ExportPixels.data());
+		return m_ExportPixels;
+	}
+
+	uint32_t Compositor::GetLastSelectionTiles() const
+	{
+		return m_LastSelectionTiles;
+	}
+
+	float Compositor::GetLastSelectionCoverage() const
+	{
+		return m_LastSelectionCoverage;
+	}
+
+	uint32_t Compositor::GetLastBatchCount() const
+	{
+		return m_LastBatchCount;
+	}
+
+	const TileCompositor& Compositor::GetTileCompositor() const
+	{
+		return m_TileCompositor;
+	}
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Layer.h"
+#include "RenderGraph.h"
+
+namespace Photoxel
+{
+	class Renderer;
+	class Shader;
+
+	// Layers blended by one composite pass. Every layer takes a texture unit for its colour and one
+	// for its mask next to the unit of the layers below, 13 of the 16 units GL 3.3 guarantees
+	static constexpr uint32_t MAX_BATCH_LAYERS = 6;
+
+	// Input of a CPU composite, pixels are RGBA and masks one byte per pixel at the size of the image
+	struct CompositeLayer {
+		const uint8_t* Pixels = nullptr;
+		// Null when the whole layer shows
+		const LayerMask* Mask = nullptr;
+		float Opacity = 1.0f;
+		BlendMode Blend = BlendMode::Normal;
+		// Has to change whenever the pixels do
+		uint64_t Key = 0;
+	};
+
+	// Blends layers bottom to top on 256 x 256 tiles spread over the thread pool, four channels at a
+	// time with SSE2. Tiles only blend the layers that show on them, and tiles none of whose layers
+	// changed since the last call keep what the output already holds
+	class TileCompositor
+	{
+	public:
+		TileCompositor() = default;
+
+		// dst has to be the same buffer from call to call for the unchanged tiles to be skipped
+		void Composite(const std::vector<CompositeLayer>& layers, uint32_t width, uint32_t height, uint8_t* dst);
+		void Invalidate();
+
+		uint32_t GetLastBlendedTiles() const;
+		uint32_t GetLastSkippedTiles() const;
+		double GetLastTime() const;
+	private:
+		std::vector<uint64_t> m_TileKeys;
+		uint32_t m_Width = 0, m_Height = 0;
+		const uint8_t* m_Target = nullptr;
+		uint32_t m_LastBlendedTiles = 0, m_LastSkippedTiles = 0;
+		double m_LastTime = 0.0;
+	};
+
+	// Renders a layer stack. Every visible layer with filters runs through its own render graph,
+	// then all of them are blended in as few passes of the composite shader as the texture units
+	// allow. A lone layer renders straight into the target and keeps its progressive refinement
+	class Compositor
+	{
+	public:
+		Compositor(Renderer& renderer);
+		~Compositor();
+
+		// Same contract as RenderGraph::Execute, region is in texture coordinates of the image
+		void Execute(LayerStack& layers, Framebuffer& target, const glm::vec4& region = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		// Stacks of more than one layer are rendered whole right away
+		void BeginRefinement(LayerStack& layers, Framebuffer& target, const glm::vec4& region = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		bool StepRefinement(uint32_t tiles);
+		void CancelRefinement();
+		bool IsRefining() const;
+		float GetRefinementProgress() const;
+
+		// Full resolution RGBA of the whole image. Layers are read back from their graphs only when
+		// their content changed since the last export and blended on the CPU
+		std::vector<uint8_t> Export(LayerStack& layers);
+
+		// Composite passes of the last render, 0 when a lone layer rendered straight into the target
+		uint32_t GetLastBatchCount() const;
+		// Selection tiles the filters were blended in on, and the share of the rendered region the
+		// filters ran over, for the last layer rendered with a selection
+		uint32_t GetLastSelectionTiles() const;
+		float GetLastSelectionCoverage() const;
+		const TileCompositor& GetTileCompositor() const;
+	private:
+		// Layers that show at all, bottom first
+		static std::vector<Layer*> GetVisibleLayers(LayerStack& layers);
+		static bool IsDirect(const std::vector<Layer*>& visible);
+		void Composite(const std::vector<Layer*>& visible, Framebuffer& target, const glm::vec4& region);
+		// Renders the filters of a layer over its source into target
+		void RenderLayer(Layer& layer, Framebuffer& target, const glm::vec4& region);
+		// Runs the filters over the part of region inside the bounds of the selection only, and
+		// blends them in under a scissor on the selection tiles that are not empty
+		void RenderSelection(Layer& layer, Framebuffer& target, const glm::vec4& region);
+
+		Renderer& m_Renderer;
+		std::unique_ptr<Shader> m_Program;
+		std::unique_ptr<Shader> m_SelectionProgram;
+		FramebufferPool m_Pool;
+		RenderGraph* m_Refining = nullptr;
+		uint32_t m_LastBatchCount = 0;
+		uint32_t m_LastSelectionTiles = 0;
+		float m_LastSelectionCoverage = 0.0f;
+
+		struct ExportedLayer {
+			uint64_t ContentRevision = 0;
+			std::vector<uint8_t> Pixels;
+		};
+		// Keyed by layer id
+		std::unordered_map<uint64_t, ExportedLayer> m_ExportedLayers;
+		std::unique_ptr<Framebuffer> m_ExportTarget;
+		std::vector<uint8_t> m_ExportPixels;
+		TileCompositor m_TileCompositor;
+	};
+}
@@ -0,0 +1,234 @@
+#include "ConnectedComponents.h"
+#include "ThreadPool.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Photoxel
+{
+	// Bands thinner than this cost more in scheduling than they save
+	static constexpr uint32_t MIN_BAND_ROWS = 64;
+	static constexpr uint32_t NO_BLOB = 0xFFFFFFFF;
+
+	static inline uint32_t CountTrailingZeros(uint32_t value)
+	{
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward(&index, value);
+		return index;
+#else
+		return __builtin_ctz(value);
+#endif
+	}
+
+	// First x >= start whose pixel is (foreground ? set : clear), 16 pixels per step
+	static uint32_t FindNext(const uint8_t* row, uint32_t x, uint32_t width, bool foreground)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		while (x + 16 <= width) {
+			const __m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+			const uint32_t zeros = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero)));
+			const uint32_t hits = foreground ? (~zeros & 0xFFFF) : zeros;
+			if (hits) {
+				return x + CountTrailingZeros(hits);
+			}
+			x += 16;
+		}
+		while (x < width && (row[x] != 0) != foreground) {
+			x++;
+		}
+		return x;
+	}
+
+	const std::vector<Blob>& ConnectedComponents::Label(const uint8_t* mask, uint32_t width, uint32_t height,
+		uint32_t stride, uint32_t minArea)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		m_Blobs.clear();
+		m_ForegroundArea = 0;
+		if (width == 0 || height == 0) {
+			m_LastLabelTime = 0.0;
+			return m_Blobs;
+		}
+
+		ThreadPool& pool = ThreadPool::Get();
+		const uint32_t bandCount = std::clamp(height / MIN_BAND_ROWS, 1u, pool.GetThreadCount() + 1);
+		const uint32_t bandRows = (height + bandCount - 1) / bandCount;
+
+		m_Bands.resize(bandCount);
+		for (uint32_t i = 0; i < bandCount; i++) {
+			m_Bands[i].FirstRow = std::min(i * bandRows, height);
+			m_Bands[i].LastRow = std::min((i + 1) * bandRows, height);
+		}
+
+		pool.ParallelFor(bandCount, [&](size_t i) {
+			ExtractRuns(mask, width, stride, m_Bands[i]);
+		});
+
+		uint32_t runCount = 0;
+		for (auto& band : m_Bands) {
+			band.Offset = runCount;
+			runCount += static_cast<uint32_t>(band.Runs.size());
+		}
+		m_Parents.resize(runCount);
+
+		// Inside a band every union only touches that band's runs, so bands never race
+		pool.ParallelFor(bandCount, [&](size_t i) {
+			const Band& band = m_Bands[i];
+			for (uint32_t run = 0; run < band.Runs.size(); run++) {
+				m_Parents[band.Offset + run] = band.Offset + run;
+			}
+
+			const uint32_t rows = band.LastRow - band.FirstRow;
+			for (uint32_t row = 1; row < rows; row++) {
+				const uint32_t above = band.RowStarts[row - 1], current = band.RowStarts[row];
+				LinkRows(band.Runs.data() + above, band.Offset + above, current - above,
+					band.Runs.data() + current, band.Offset + current, band.RowStarts[row + 1] - current);
+			}
+		});
+
+		// Seams are merged pairwise: round k joins groups of 2^k bands, the pairs of a round
+		// cover disjoint bands so their unions run in parallel without locking
+		std::vector<uint32_t> seams;
+		for (uint32_t step = 1; step < bandCount; step *= 2) {
+			seams.clear();
+			for (uint32_t seam = step - 1; seam + 1 < bandCount; seam += 2 * step) {
+				seams.push_back(seam);
+			}
+
+			pool.ParallelFor(seams.size(), [&](size_t i) {
+				const Band& upper = m_Bands[seams[i]];
+				const Band& lower = m_Bands[seams[i] + 1];
+				if (upper.LastRow == upper.FirstRow || lower.LastRow == lower.FirstRow) return;
+
+				const uint32_t upperRows = upper.LastRow - upper.FirstRow;
+				const uint32_t above = upper.RowStarts[upperRows - 1];
+				LinkRows(upper.Runs.data() + above, upper.Offset + above, upper.RowStarts[upperRows] - above,
+					lower.Runs.data(), lower.Offset, lower.RowStarts[1]);
+			});
+		}
+
+		// Roots are the smallest run of their set, so walking runs in order meets the root first
+		m_BlobIndex.assign(runCount, NO_BLOB);
+		m_SumX.clear();
+		m_SumY.clear();
+		for (const auto& band : m_Bands) {
+			for (uint32_t i = 0; i < band.Runs.size(); i++) {
+				const Run& run = band.Runs[i];
+				const uint32_t root = Find(band.Offset + i);
+				if (m_BlobIndex[root] == NO_BLOB) {
+					m_BlobIndex[root] = static_cast<uint32_t>(m_Blobs.size());
+					m_Blobs.push_back({ 0, run.Start, run.Row, run.End, run.Row, 0.0f, 0.0f });
+					m_SumX.push_back(0.0);
+					m_SumY.push_back(0.0);
+				}
+
+				const uint32_t index = m_BlobIndex[root];
+				Blob& blob = m_Blobs[index];
+				const uint32_t length = run.End - run.Start + 1;
+				blob.Area += length;
+				blob.MinX = std::min(blob.MinX, run.Start);
+				blob.MaxX = std::max(blob.MaxX, run.End);
+				blob.MinY = std::min(blob.MinY, run.Row);
+				blob.MaxY = std::max(blob.MaxY, run.Row);
+				m_SumX[index] += (static_cast<double>(run.Start) + run.End) * 0.5 * length;
+				m_SumY[index] += static_cast<double>(run.Row) * length;
+				m_ForegroundArea += length;
+			}
+		}
+
+		size_t kept = 0;
+		for (size_t i = 0; i < m_Blobs.size(); i++) {
+			Blob blob = m_Blobs[i];
+			if (blob.Area < minArea) continue;
+			blob.CentroidX = static_cast<float>(m_SumX[i] / blob.Area);
+			blob.CentroidY = static_cast<float>(m_SumY[i] / blob.Area);
+			m_Blobs[kept++] = blob;
+		}
+		m_Blobs.resize(kept);
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastLabelTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return m_Blobs;
+	}
+
+	const std::vector<Blob>& ConnectedComponents::GetBlobs() const
+	{
+		return m_Blobs;
+	}
+
+	uint32_t ConnectedComponents::GetForegroundArea() const
+	{
+		return m_ForegroundArea;
+	}
+
+	double ConnectedComponents::GetLastLabelTime() const
+	{
+		return m_LastLabelTime;
+	}
+
+	void ConnectedComponents::ExtractRuns(const uint8_t* mask, uint32_t width, uint32_t stride, Band& band)
+	{
+		band.Runs.clear();
+		band.RowStarts.clear();
+
+		for (uint32_t y = band.FirstRow; y < band.LastRow; y++) {
+			band.RowStarts.push_back(static_cast<uint32_t>(band.Runs.size()));
+			const uint8_t* row = mask + static_cast<size_t>(y) * stride;
+
+			uint32_t x = 0;
+			while (x < width) {
+				const uint32_t start = FindNext(row, x, width, true);
+				if (start >= width) break;
+				x = FindNext(row, start, width, false);
+				band.Runs.push_back({ start, x - 1, y });
+			}
+		}
+		band.RowStarts.push_back(static_cast<uint32_t>(band.Runs.size()));
+	}
+
+	void ConnectedComponents::LinkRows(const Run* above, uint32_t aboveBase, uint32_t aboveCount,
+		const Run* below, uint32_t belowBase, uint32_t belowCount)
+	{
+		uint32_t i = 0, j = 0;
+		while (i < aboveCount && j < belowCount) {
+			const Run& a = above[i];
+			const Run& b = below[j];
+			// 8-connectivity, runs that only touch on a diagonal still join
+			if (a.End + 1 < b.Start) {
+				i++;
+				continue;
+			}
+			if (b.End + 1 < a.Start) {
+				j++;
+				continue;
+			}
+
+			Unite(aboveBase + i, belowBase + j);
+			if (a.End < b.End) i++;
+			else j++;
+		}
+	}
+
+	uint32_t ConnectedComponents::Find(uint32_t run)
+	{
+		while (m_Parents[run] != run) {
+			m_Parents[run] = m_Parents[m_Parents[run]];
+			run = m_Parents[run];
+		}
+		return run;
+	}
+
+	void ConnectedComponents::Unite(uint32_t a, uint32_t b)
+	{
+		a = Find(a);
+		b = Find(b);
+		if (a == b) return;
+		if (a < b) m_Parents[b] = a;
+		else m_Parents[a] = b;
+	}
+}
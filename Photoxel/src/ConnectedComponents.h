@@ -0,0 +1,57 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+
+namespace Photoxel
+{
+	struct Blob {
+		uint32_t Area;
+		uint32_t MinX, MinY, MaxX, MaxY;
+		float CentroidX, CentroidY;
+	};
+
+	// Run based 8-connected labelling. Row bands are labelled on the thread pool with
+	// union-find over their runs and the band seams are merged pairwise in log2(bands) rounds
+	class ConnectedComponents
+	{
+	public:
+		ConnectedComponents() = default;
+
+		// Any non zero byte is foreground, rows are stride bytes apart. Blobs smaller than
+		// minArea are dropped from the result but still counted by GetForegroundArea()
+		const std::vector<Blob>& Label(const uint8_t* mask, uint32_t width, uint32_t height,
+			uint32_t stride, uint32_t minArea = 1);
+
+		const std::vector<Blob>& GetBlobs() const;
+		uint32_t GetForegroundArea() const;
+		double GetLastLabelTime() const;
+	private:
+		struct Run {
+			uint32_t Start, End;
+			uint32_t Row;
+		};
+
+		struct Band {
+			uint32_t FirstRow, LastRow;
+			std::vector<Run> Runs;
+			// First run of every row in the band plus one past the end, relative to Runs
+			std::vector<uint32_t> RowStarts;
+			uint32_t Offset = 0;
+		};
+
+		void ExtractRuns(const uint8_t* mask, uint32_t width, uint32_t stride, Band& band);
+		void LinkRows(const Run* above, uint32_t aboveBase, uint32_t aboveCount,
+			const Run* below, uint32_t belowBase, uint32_t belowCount);
+		uint32_t Find(uint32_t run);
+		void Unite(uint32_t a, uint32_t b);
+
+		std::vector<Band> m_Bands;
+		std::vector<uint32_t> m_Parents;
+		std::vector<uint32_t> m_BlobIndex;
+		std::vector<Blob> m_Blobs;
+		std::vector<double> m_SumX, m_SumY;
+		uint32_t m_ForegroundArea = 0;
+		double m_LastLabelTime = 0.0;
+	};
+}
@@ -0,0 +1,583 @@
+#include "Convolution.h"
+#include "ThreadPool.h"
+#include <emmintrin.h>
+#include <immintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// The AVX2 loops are compiled for every build and only called when the processor has the
+// instructions, GCC and Clang need to be told per function
+#if defined(_MSC_VER)
+#define PHOTOXEL_AVX2
+#else
+#define PHOTOXEL_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace Photoxel
+{
+	// Output pixels per side of a direct tile, the inputs of a tile stay in L2
+	static constexpr uint32_t DIRECT_TILE = 64;
+	// Output rows of a separable band, each band filters its own halo rows horizontally
+	static constexpr uint32_t SEPARABLE_BAND = 32;
+	static constexpr uint32_t MIN_FFT_TILE = 128;
+
+	ConvolutionKernel ConvolutionKernel::FromPreset(KernelPreset preset, uint32_t size)
+	{
+		ConvolutionKernel kernel;
+		kernel.Size = std::clamp(size | 1u, 1u, MAX_KERNEL_SIZE);
+		kernel.Weights.assign(kernel.Size * kernel.Size, 0.0f);
+		const uint32_t centre = kernel.Size / 2;
+
+		// The classic 3x3 kernels sit in the middle of a larger one
+		auto place = [&](const float (&weights)[9]) {
+			if (kernel.Size < 3) {
+				kernel.Size = 3;
+				kernel.Weights.assign(9, 0.0f);
+			}
+			const uint32_t first = kernel.Size / 2 - 1;
+			for (uint32_t j = 0; j < 3; j++) {
+				for (uint32_t i = 0; i < 3; i++) {
+					kernel.Weights[(first + j) * kernel.Size + first + i] = weights[j * 3 + i];
+				}
+			}
+		};
+
+		switch (preset)
+		{
+			case KernelPreset::Sharpen:		place({ 0, -1, 0, -1, 5, -1, 0, -1, 0 }); break;
+			case KernelPreset::Emboss:		place({ -2, -1, 0, -1, 1, 1, 0, 1, 2 }); break;
+			case KernelPreset::SobelX:		place({ -1, 0, 1, -2, 0, 2, -1, 0, 1 }); kernel.Bias = 0.5f; break;
+			case KernelPreset::SobelY:		place({ -1, -2, -1, 0, 0, 0, 1, 2, 1 }); kernel.Bias = 0.5f; break;
+			case KernelPreset::Laplacian:	place({ 1, 1, 1, 1, -8, 1, 1, 1, 1 }); break;
+			case KernelPreset::Box:
+				std::fill(kernel.Weights.begin(), kernel.Weights.end(), 1.0f / kernel.Weights.size());
+				break;
+			case KernelPreset::Gaussian:
+			{
+				const float sigma = std::max(kernel.Size / 6.0f, 0.5f);
+				float sum = 0.0f;
+				for (uint32_t j = 0; j < kernel.Size; j++) {
+					for (uint32_t i = 0; i < kernel.Size; i++) {
+						const float dx = static_cast<float>(i) - centre, dy = static_cast<float>(j) - centre;
+						kernel.Weights[j * kernel.Size + i] = std::exp(-(dx * dx + dy * dy) / (2.0f * sigma * sigma));
+						sum += kernel.Weights[j * kernel.Size + i];
+					}
+				}
+				for (float& weight : kernel.Weights) {
+					weight /= sum;
+				}
+				break;
+			}
+			default:
+				kernel.Weights[centre * kernel.Size + centre] = 1.0f;
+				break;
+		}
+		return kernel;
+	}
+
+	ConvolutionKernel ConvolutionKernel::Scale(float scale) const
+	{
+		if (std::abs(scale - 1.0f) < 1e-3f || Weights.size() != static_cast<size_t>(Size) * Size) {
+			return *this;
+		}
+		const uint32_t radius = GetRadius();
+		const uint32_t scaledRadius = static_cast<uint32_t>(std::max(0.0f, std::ceil((radius + 0.5f) * scale - 0.5f)));
+		ConvolutionKernel scaled;
+		scaled.Size = 2 * scaledRadius + 1;
+		scaled.Bias = Bias;
+
+		// Share of every tap along one axis that falls on each scaled tap, the same for both axes
+		std::vector<float> overlap(static_cast<size_t>(scaled.Size) * Size);
+		for (uint32_t i = 0; i < scaled.Size; i++) {
+			const float pixel = static_cast<float>(i) - scaledRadius;
+			for (uint32_t k = 0; k < Size; k++) {
+				const float tap = (static_cast<float>(k) - radius) * scale;
+				const float covered = std::min(tap + 0.5f * scale, pixel + 0.5f) - std::max(tap - 0.5f * scale, pixel - 0.5f);
+				overlap[static_cast<size_t>(i) * Size + k] = std::max(covered, 0.0f) / scale;
+			}
+		}
+
+		// Rows first, then columns, so wide kernels stay cheap to scale
+		std::vector<float> rows(static_cast<size_t>(Size) * scaled.Size, 0.0f);
+		for (uint32_t l = 0; l < Size; l++) {
+			for (uint32_t i = 0; i < scaled.Size; i++) {
+				float sum = 0.0f;
+				for (uint32_t k = 0; k < Size; k++) {
+					sum += Weights[l * Size + k] * overlap[static_cast<size_t>(i) * Size + k];
+				}
+				rows[static_cast<size_t>(l) * scaled.Size + i] = sum;
+			}
+		}
+		scaled.Weights.assign(static_cast<size_t>(scaled.Size) * scaled.Size, 0.0f);
+		for (uint32_t j = 0; j < scaled.Size; j++) {
+			for (uint32_t l = 0; l < Size; l++) {
+				const float share = overlap[static_cast<size_t>(j) * Size + l];
+				if (share == 0.0f) continue;
+				for (uint32_t i = 0; i < scaled.Size; i++) {
+					scaled.Weights[static_cast<size_t>(j) * scaled.Size + i] += share * rows[static_cast<size_t>(l) * scaled.Size + i];
+				}
+			}
+		}
+		return scaled;
+	}
+
+	// Sums count output pixels of one row. input points at the top left tap of the first one,
+	// weights holds rows x columns taps. Four accumulators keep the adds from waiting on each other
+	static void ConvolveRowSSE(const float* input, size_t stride, const float* weights, uint32_t columns, uint32_t rows,
+		float* output, uint32_t count)
+	{
+		uint32_t x = 0;
+		for (; x + 4 <= count; x += 4) {
+			__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), a2 = _mm_setzero_ps(), a3 = _mm_setzero_ps();
+			for (uint32_t j = 0; j < rows; j++) {
+				const float* row = input + j * stride + x * 4;
+				for (uint32_t i = 0; i < columns; i++) {
+					const __m128 w = _mm_set1_ps(weights[j * columns + i]);
+					const float* p = row + i * 4;
+					a0 = _mm_add_ps(a0, _mm_mul_ps(w, _mm_loadu_ps(p)));
+					a1 = _mm_add_ps(a1, _mm_mul_ps(w, _mm_loadu_ps(p + 4)));
+					a2 = _mm_add_ps(a2, _mm_mul_ps(w, _mm_loadu_ps(p + 8)));
+					a3 = _mm_add_ps(a3, _mm_mul_ps(w, _mm_loadu_ps(p + 12)));
+				}
+			}
+			_mm_storeu_ps(output + x * 4, a0);
+			_mm_storeu_ps(output + x * 4 + 4, a1);
+			_mm_storeu_ps(output + x * 4 + 8, a2);
+			_mm_storeu_ps(output + x * 4 + 12, a3);
+		}
+		for (; x < count; x++) {
+			__m128 a = _mm_setzero_ps();
+			for (uint32_t j = 0; j < rows; j++) {
+				const float* row = input + j * stride + x * 4;
+				for (uint32_t i = 0; i < columns; i++) {
+					a = _mm_add_ps(a, _mm_mul_ps(_mm_set1_ps(weights[j * columns + i]), _mm_loadu_ps(row + i * 4)));
+				}
+			}
+			_mm_storeu_ps(output + x * 4, a);
+		}
+	}
+
+	// Same sums two pixels per register with fused multiply adds
+	PHOTOXEL_AVX2 static void ConvolveRowAVX2(const float* input, size_t stride, const float* weights, uint32_t columns,
+		uint32_t rows, float* output, uint32_t count)
+	{
+		uint32_t x = 0;
+		for (; x + 8 <= count; x += 8) {
+			__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), a2 = _mm256_setzero_ps(), a3 = _mm256_setzero_ps();
+			for (uint32_t j = 0; j < rows; j++) {
+				const float* row = input + j * stride + x * 4;
+				for (uint32_t i = 0; i < columns; i++) {
+					const __m256 w = _mm256_set1_ps(weights[j * columns + i]);
+					const float* p = row + i * 4;
+					a0 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p), a0);
+					a1 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + 8), a1);
+					a2 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + 16), a2);
+					a3 = _mm256_fmadd_ps(w, _mm256_loadu_ps(p + 24), a3);
+				}
+			}
+			_mm256_storeu_ps(output + x * 4, a0);
+			_mm256_storeu_ps(output + x * 4 + 8, a1);
+			_mm256_storeu_ps(output + x * 4 + 16, a2);
+			_mm256_storeu_ps(output + x * 4 + 24, a3);
+		}
+		if (x < count) {
+			ConvolveRowSSE(input + x * 4, stride, weights, columns, rows, output + x * 4, count - x);
+		}
+	}
+
+	static void ConvolveRow(const float* input, size_t stride, const float* weights, uint32_t columns, uint32_t rows,
+		float* output, uint32_t count)
+	{
+		if (ConvolutionEngine::HasAVX2()) {
+			ConvolveRowAVX2(input, stride, weights, columns, rows, output, count);
+		}
+		else {
+			ConvolveRowSSE(input, stride, weights, columns, rows, output, count);
+		}
+	}
+
+	// Radix 2 transforms of one power of two size on split real and imaginary arrays, so the
+	// butterflies of the wider stages run four at a time
+	struct FFTPlan {
+		uint32_t Size = 0;
+		std::vector<uint32_t> Reverse;
+		// Twiddles of every stage back to back, the stage of half length h starts at h - 1
+		std::vector<float> TwiddleRe, TwiddleIm;
+
+		explicit FFTPlan(uint32_t size)
+			: Size(size), Reverse(size), TwiddleRe(size), TwiddleIm(size)
+		{
+			uint32_t bits = 0;
+			while ((1u << bits) < size) bits++;
+			for (uint32_t i = 0; i < size; i++) {
+				uint32_t reversed = 0;
+				for (uint32_t b = 0; b < bits; b++) {
+					reversed |= ((i >> b) & 1u) << (bits - 1 - b);
+				}
+				Reverse[i] = reversed;
+			}
+			for (uint32_t half = 1; half < size; half <<= 1) {
+				for (uint32_t k = 0; k < half; k++) {
+					const double angle = -3.14159265358979323846 * k / half;
+					TwiddleRe[half - 1 + k] = static_cast<float>(std::cos(angle));
+					TwiddleIm[half - 1 + k] = static_cast<float>(std::sin(angle));
+				}
+			}
+		}
+
+		void Transform(float* re, float* im, bool inverse) const
+		{
+			for (uint32_t i = 0; i < Size; i++) {
+				if (i < Reverse[i]) {
+					std::swap(re[i], re[Reverse[i]]);
+					std::swap(im[i], im[Reverse[i]]);
+				}
+			}
+
+			const float sign = inverse ? -1.0f : 1.0f;
+			for (uint32_t half = 1; half < Size && half < 4; half <<= 1) {
+				for (uint32_t i = 0; i < Size; i += 2 * half) {
+					for (uint32_t k = 0; k < half; k++) {
+						const float wr = TwiddleRe[half - 1 + k], wi = sign * TwiddleIm[half - 1 + k];
+						const uint32_t a = i + k, b = a + half;
+						const float tr = re[b] * wr - im[b] * wi, ti = re[b] * wi + im[b] * wr;
+						re[b] = re[a] - tr;
+						im[b] = im[a] - ti;
+						re[a] += tr;
+						im[a] += ti;
+					}
+				}
+			}
+
+			const __m128 signs = _mm_set1_ps(sign);
+			for (uint32_t half = 4; half < Size; half <<= 1) {
+				const float* twiddleRe = TwiddleRe.data() + half - 1;
+				const float* twiddleIm = TwiddleIm.data() + half - 1;
+				for (uint32_t i = 0; i < Size; i += 2 * half) {
+					float* ar = re + i, * ai = im + i, * br = re + i + half, * bi = im + i + half;
+					for (uint32_t k = 0; k < half; k += 4) {
+						const __m128 wr = _mm_loadu_ps(twiddleRe + k);
+						const __m128 wi = _mm_mul_ps(signs, _mm_loadu_ps(twiddleIm + k));
+						const __m128 xr = _mm_loadu_ps(br + k), xi = _mm_loadu_ps(bi + k);
+						const __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, wr), _mm_mul_ps(xi, wi));
+						const __m128 ti = _mm_add_ps(_mm_mul_ps(xr, wi), _mm_mul_ps(xi, wr));
+						const __m128 yr = _mm_loadu_ps(ar + k), yi = _mm_loadu_ps(ai + k);
+						_mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+						_mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+						_mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+						_mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+					}
+				}
+			}
+		}
+
+		void TransformRows(float* re, float* im, bool inverse) const
+		{
+			for (uint32_t row = 0; row < Size; row++) {
+				Transform(re + static_cast<size_t>(row) * Size, im + static_cast<size_t>(row) * Size, inverse);
+			}
+		}
+
+		void Transpose(const float* src, float* dst) const
+		{
+			for (uint32_t y0 = 0; y0 < Size; y0 += 16) {
+				for (uint32_t x0 = 0; x0 < Size; x0 += 16) {
+					for (uint32_t y = y0; y < y0 + 16; y++) {
+						for (uint32_t x = x0; x < x0 + 16; x++) {
+							dst[static_cast<size_t>(x) * Size + y] = src[static_cast<size_t>(y) * Size + x];
+						}
+					}
+				}
+			}
+		}
+
+		// Leaves the spectrum transposed in the scratch arrays, which is all a pointwise product needs
+		void Forward2D(float* re, float* im, float* scratchRe, float* scratchIm) const
+		{
+			TransformRows(re, im, false);
+			Transpose(re, scratchRe);
+			Transpose(im, scratchIm);
+			TransformRows(scratchRe, scratchIm, false);
+		}
+
+		// Takes a transposed spectrum from the scratch arrays back, scaled. Only the real part
+		// is transposed back when the imaginary one is not needed
+		void Inverse2D(float* scratchRe, float* scratchIm, float* re, float* im) const
+		{
+			TransformRows(scratchRe, scratchIm, true);
+			Transpose(scratchRe, re);
+			Transpose(scratchIm, im);
+			TransformRows(re, im, true);
+			const float scale = 1.0f / (static_cast<float>(Size) * Size);
+			for (size_t i = 0; i < static_cast<size_t>(Size) * Size; i++) {
+				re[i] *= scale;
+				im[i] *= scale;
+			}
+		}
+	};
+
+	bool ConvolutionEngine::HasAVX2()
+	{
+		static const bool supported = [] {
+#if defined(_MSC_VER)
+			int info[4];
+			__cpuid(info, 0);
+			if (info[0] < 7) return false;
+			__cpuid(info, 1);
+			const bool fma = (info[2] & (1 << 12)) != 0;
+			const bool osxsave = (info[2] & (1 << 27)) != 0;
+			if (!fma || !osxsave || (_xgetbv(0) & 6) != 6) return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+		}();
+		return supported;
+	}
+
+	bool ConvolutionEngine::Separate(const ConvolutionKernel& kernel, std::vector<float>& column, std::vector<float>& row)
+	{
+		const uint32_t size = kernel.Size;
+		const auto& weights = kernel.Weights;
+
+		// Pivot on the largest weight, a rank 1 kernel is its column times its row
+		size_t pivot = 0;
+		for (size_t i = 1; i < weights.size(); i++) {
+			if (std::abs(weights[i]) > std::abs(weights[pivot])) pivot = i;
+		}
+		const float largest = std::abs(weights[pivot]);
+		column.assign(size, 0.0f);
+		row.assign(size, 0.0f);
+		if (largest == 0.0f) {
+			return true;
+		}
+
+		const uint32_t pivotRow = static_cast<uint32_t>(pivot) / size, pivotColumn = static_cast<uint32_t>(pivot) % size;
+		for (uint32_t j = 0; j < size; j++) {
+			column[j] = weights[j * size + pivotColumn];
+		}
+		for (uint32_t i = 0; i < size; i++) {
+			row[i] = weights[pivotRow * size + i] / weights[pivot];
+		}
+
+		const float tolerance = largest * 1e-5f;
+		for (uint32_t j = 0; j < size; j++) {
+			for (uint32_t i = 0; i < size; i++) {
+				if (std::abs(weights[j * size + i] - column[j] * row[i]) > tolerance) {
+					return false;
+				}
+			}
+		}
+		return true;
+	}
+
+	ConvolutionPath ConvolutionEngine::ChoosePath(const ConvolutionKernel& kernel)
+	{
+		std::vector<float> column, row;
+		if (kernel.Size > 1 && Separate(kernel, column, row)) {
+			return ConvolutionPath::Separable;
+		}
+		return kernel.Size >= FFT_KERNEL_SIZE ? ConvolutionPath::FFT : ConvolutionPath::Direct;
+	}
+
+	void ConvolutionEngine::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, const ConvolutionKernel& kernel)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (width == 0 || height == 0 || kernel.Weights.size() != static_cast<size_t>(kernel.Size) * kernel.Size) return;
+		const uint32_t radius = kernel.GetRadius();
+		Pad(src, width, height, radius);
+		m_Output.resize(static_cast<size_t>(width) * height * 4);
+
+		if (kernel.Size > 1 && Separate(kernel, m_Column, m_Row)) {
+			m_LastPath = ConvolutionPath::Separable;
+			RunSeparable(width, height, radius, m_Column, m_Row);
+		}
+		else if (kernel.Size >= FFT_KERNEL_SIZE) {
+			m_LastPath = ConvolutionPath::FFT;
+			RunFFT(width, height, kernel);
+		}
+		else {
+			m_LastPath = ConvolutionPath::Direct;
+			RunDirect(width, height, kernel);
+		}
+		Store(src, dst, width, height, kernel.Bias);
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastConvolutionTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	ConvolutionPath ConvolutionEngine::GetLastPath() const
+	{
+		return m_LastPath;
+	}
+
+	double ConvolutionEngine::GetLastConvolutionTime() const
+	{
+		return m_LastConvolutionTime;
+	}
+
+	void ConvolutionEngine::Pad(const uint8_t* src, uint32_t width, uint32_t height, uint32_t radius)
+	{
+		m_PaddedWidth = width + 2 * radius;
+		const uint32_t paddedHeight = height + 2 * radius;
+		m_Padded.resize(static_cast<size_t>(m_PaddedWidth) * paddedHeight * 4);
+
+		ThreadPool::Get().ParallelFor(paddedHeight, [&](size_t py) {
+			const uint32_t y = static_cast<uint32_t>(std::clamp<int64_t>(static_cast<int64_t>(py) - radius, 0, height - 1));
+			const uint8_t* row = src + static_cast<size_t>(y) * width * 4;
+			float* out = m_Padded.data() + py * m_PaddedWidth * 4;
+			const __m128i zero = _mm_setzero_si128();
+			for (uint32_t px = 0; px < m_PaddedWidth; px++) {
+				const uint32_t x = static_cast<uint32_t>(std::clamp<int64_t>(static_cast<int64_t>(px) - radius, 0, width - 1));
+				const __m128i pixel = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(row + x * 4));
+				const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(pixel, zero), zero);
+				_mm_storeu_ps(out + px * 4, _mm_cvtepi32_ps(wide));
+			}
+		});
+	}
+
+	void ConvolutionEngine::RunDirect(uint32_t width, uint32_t height, const ConvolutionKernel& kernel)
+	{
+		const uint32_t tilesX = (width + DIRECT_TILE - 1) / DIRECT_TILE;
+		const uint32_t tilesY = (height + DIRECT_TILE - 1) / DIRECT_TILE;
+		const size_t stride = static_cast<size_t>(m_PaddedWidth) * 4;
+
+		ThreadPool::Get().ParallelFor(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+			const uint32_t x0 = static_cast<uint32_t>(tile % tilesX) * DIRECT_TILE;
+			const uint32_t y0 = static_cast<uint32_t>(tile / tilesX) * DIRECT_TILE;
+			const uint32_t count = std::min(DIRECT_TILE, width - x0);
+			const uint32_t y1 = std::min(y0 + DIRECT_TILE, height);
+			for (uint32_t y = y0; y < y1; y++) {
+				ConvolveRow(m_Padded.data() + y * stride + x0 * 4, stride, kernel.Weights.data(), kernel.Size, kernel.Size,
+					m_Output.data() + (static_cast<size_t>(y) * width + x0) * 4, count);
+			}
+		});
+	}
+
+	void ConvolutionEngine::RunSeparable(uint32_t width, uint32_t height, uint32_t radius,
+		const std::vector<float>& column, const std::vector<float>& row)
+	{
+		const uint32_t size = static_cast<uint32_t>(row.size());
+		const uint32_t bands = (height + SEPARABLE_BAND - 1) / SEPARABLE_BAND;
+		const size_t stride = static_cast<size_t>(m_PaddedWidth) * 4;
+		const size_t bandStride = static_cast<size_t>(width) * 4;
+
+		ThreadPool::Get().ParallelFor(bands, [&](size_t band) {
+			const uint32_t y0 = static_cast<uint32_t>(band) * SEPARABLE_BAND;
+			const uint32_t y1 = std::min(y0 + SEPARABLE_BAND, height);
+			const uint32_t rows = y1 - y0 + 2 * radius;
+
+			// Horizontal pass over the band and its halo rows, then the vertical pass out of it
+			std::vector<float> filtered(rows * bandStride);
+			for (uint32_t r = 0; r < rows; r++) {
+				ConvolveRow(m_Padded.data() + (y0 + r) * stride, stride, row.data(), size, 1,
+					filtered.data() + r * bandStride, width);
+			}
+			for (uint32_t y = y0; y < y1; y++) {
+				ConvolveRow(filtered.data() + (y - y0) * bandStride, bandStride, column.data(), 1, size,
+					m_Output.data() + y * bandStride, width);
+			}
+		});
+	}
+
+	void ConvolutionEngine::RunFFT(uint32_t width, uint32_t height, const ConvolutionKernel& kernel)
+	{
+		// Overlap save, every tile yields the outputs its kernel never wraps around for
+		const uint32_t size = kernel.Size;
+		uint32_t tileSize = MIN_FFT_TILE;
+		while (tileSize < 4 * size) tileSize <<= 1;
+		const uint32_t valid = tileSize - size + 1;
+		const FFTPlan plan(tileSize);
+		const size_t area = static_cast<size_t>(tileSize) * tileSize;
+
+		// Flipped and wrapped so the circular convolution applies the kernel as shown
+		std::vector<float> spectrum(area * 4, 0.0f);
+		float* spectrumRe = spectrum.data();
+		float* spectrumIm = spectrumRe + area;
+		for (uint32_t j = 0; j < size; j++) {
+			for (uint32_t i = 0; i < size; i++) {
+				const uint32_t u = (tileSize - i) % tileSize, v = (tileSize - j) % tileSize;
+				spectrumRe[static_cast<size_t>(v) * tileSize + u] = kernel.Weights[j * size + i];
+			}
+		}
+		plan.Forward2D(spectrumRe, spectrumIm, spectrumRe + 2 * area, spectrumIm + 2 * area);
+		spectrumRe += 2 * area;
+		spectrumIm += 2 * area;
+
+		const uint32_t tilesX = (width + valid - 1) / valid;
+		const uint32_t tilesY = (height + valid - 1) / valid;
+		const uint32_t paddedHeight = height + 2 * kernel.GetRadius();
+
+		ThreadPool::Get().ParallelFor(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+			const uint32_t x0 = static_cast<uint32_t>(tile % tilesX) * valid;
+			const uint32_t y0 = static_cast<uint32_t>(tile / tilesX) * valid;
+			const uint32_t countX = std::min(valid, width - x0);
+			const uint32_t countY = std::min(valid, height - y0);
+
+			// Red and green share one complex transform as its real and imaginary parts, blue
+			// goes alone and alpha is never filtered
+			std::vector<float> buffers(area * 6, 0.0f);
+			float* planes[4] = { buffers.data(), buffers.data() + area, buffers.data() + 2 * area, buffers.data() + 3 * area };
+			float* workRe = buffers.data() + 4 * area;
+			float* workIm = buffers.data() + 5 * area;
+			const uint32_t rows = std::min(tileSize, paddedHeight - y0);
+			const uint32_t columns = std::min(tileSize, m_PaddedWidth - x0);
+			for (uint32_t v = 0; v < rows; v++) {
+				const float* pixel = m_Padded.data() + (static_cast<size_t>(y0 + v) * m_PaddedWidth + x0) * 4;
+				const size_t row = static_cast<size_t>(v) * tileSize;
+				for (uint32_t u = 0; u < columns; u++, pixel += 4) {
+					planes[0][row + u] = pixel[0];
+					planes[1][row + u] = pixel[1];
+					planes[2][row + u] = pixel[2];
+				}
+			}
+
+			for (int pair = 0; pair < 2; pair++) {
+				float* re = planes[pair * 2];
+				float* im = planes[pair * 2 + 1];
+				plan.Forward2D(re, im, workRe, workIm);
+				for (size_t i = 0; i < area; i += 4) {
+					const __m128 ar = _mm_loadu_ps(workRe + i), ai = _mm_loadu_ps(workIm + i);
+					const __m128 br = _mm_loadu_ps(spectrumRe + i), bi = _mm_loadu_ps(spectrumIm + i);
+					_mm_storeu_ps(workRe + i, _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi)));
+					_mm_storeu_ps(workIm + i, _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br)));
+				}
+				plan.Inverse2D(workRe, workIm, re, im);
+			}
+
+			for (uint32_t v = 0; v < countY; v++) {
+				const size_t row = static_cast<size_t>(v) * tileSize;
+				float* out = m_Output.data() + (static_cast<size_t>(y0 + v) * width + x0) * 4;
+				for (uint32_t u = 0; u < countX; u++) {
+					out[u * 4 + 0] = planes[0][row + u];
+					out[u * 4 + 1] = planes[1][row + u];
+					out[u * 4 + 2] = planes[2][row + u];
+					out[u * 4 + 3] = 0.0f;
+				}
+			}
+		});
+	}
+
+	void ConvolutionEngine::Store(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, float bias)
+	{
+		const __m128 offset = _mm_set1_ps(bias * 255.0f);
+		ThreadPool::Get().ParallelFor(height, [&](size_t y) {
+			const size_t first = y * width * 4;
+			for (size_t i = first; i < first + static_cast<size_t>(width) * 4; i += 4) {
+				const uint8_t alpha = src[i + 3];
+				const __m128i value = _mm_cvtps_epi32(_mm_add_ps(_mm_loadu_ps(m_Output.data() + i), offset));
+				const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(value, value), value);
+				*reinterpret_cast<int*>(dst + i) = _mm_cvtsi128_si32(packed);
+				dst[i + 3] = alpha;
+			}
+		});
+	}
+}
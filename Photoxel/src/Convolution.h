@@ -0,0 +1,92 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+
+namespace Photoxel
+{
+	static constexpr uint32_t MAX_KERNEL_SIZE = 63;
+	// Non separable kernels at least this wide go through the FFT path, below it the direct
+	// sums win (measured on 1080p frames with AVX2)
+	static constexpr uint32_t FFT_KERNEL_SIZE = 25;
+
+	enum class KernelPreset {
+		Identity,
+		Sharpen,
+		Emboss,
+		SobelX,
+		SobelY,
+		Laplacian,
+		Box,
+		Gaussian,
+		Custom
+	};
+
+	// Square kernel of odd size, row major. Applied as shown, out(x, y) is the sum of
+	// Weights[j * Size + i] * in(x + i - Size / 2, y + j - Size / 2)
+	struct ConvolutionKernel {
+		uint32_t Size = 3;
+		std::vector<float> Weights = { 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f };
+		// Added to the colour after the sum, 0.5 keeps signed results like an emboss visible
+		float Bias = 0.0f;
+
+		bool operator==(const ConvolutionKernel& other) const
+		{
+			return Size == other.Size && Weights == other.Weights && Bias == other.Bias;
+		}
+
+		bool operator!=(const ConvolutionKernel& other) const
+		{
+			return !(*this == other);
+		}
+
+		uint32_t GetRadius() const { return Size / 2; }
+		// The kernel for the image resampled by scale, every weight is spread over the pixels its own
+		// pixel covers. The sum is kept, so flat areas come out the same at every scale
+		ConvolutionKernel Scale(float scale) const;
+
+		static ConvolutionKernel FromPreset(KernelPreset preset, uint32_t size = 3);
+	};
+
+	enum class ConvolutionPath {
+		Direct,
+		Separable,
+		FFT
+	};
+
+	// Convolves RGBA8 images with arbitrary kernels. Alpha is passed through untouched.
+	// Rank 1 kernels run as a horizontal and a vertical pass, wide kernels are multiplied in
+	// the frequency domain one tile at a time and everything else is summed directly over
+	// cache sized tiles. The inner loops use AVX2 FMA when the processor has it
+	class ConvolutionEngine
+	{
+	public:
+		ConvolutionEngine() = default;
+
+		// src and dst may be the same buffer, borders are replicated
+		void Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, const ConvolutionKernel& kernel);
+
+		// Splits the kernel into a column and a row whose outer product gives it back, returns
+		// false when the kernel is not rank 1
+		static bool Separate(const ConvolutionKernel& kernel, std::vector<float>& column, std::vector<float>& row);
+		static ConvolutionPath ChoosePath(const ConvolutionKernel& kernel);
+		static bool HasAVX2();
+
+		ConvolutionPath GetLastPath() const;
+		double GetLastConvolutionTime() const;
+	private:
+		void Pad(const uint8_t* src, uint32_t width, uint32_t height, uint32_t radius);
+		void RunDirect(uint32_t width, uint32_t height, const ConvolutionKernel& kernel);
+		void RunSeparable(uint32_t width, uint32_t height, uint32_t radius,
+			const std::vector<float>& column, const std::vector<float>& row);
+		void RunFFT(uint32_t width, uint32_t height, const ConvolutionKernel& kernel);
+		void Store(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, float bias);
+
+		// Four floats per pixel. The padded copy has radius replicated pixels on every side
+		std::vector<float> m_Padded, m_Output;
+		uint32_t m_PaddedWidth = 0;
+		std::vector<float> m_Column, m_Row;
+		ConvolutionPath m_LastPath = ConvolutionPath::Direct;
+		double m_LastConvolutionTime = 0.0;
+	};
+}
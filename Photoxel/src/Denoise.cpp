@@ -0,0 +1,333 @@
+#include "Denoise.h"
+#include "ThreadPool.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace Photoxel
+{
+	// Output pixels per side of a median tile. Every tile builds its column histograms over its
+	// own halo, larger tiles spend less on that and more on cache misses
+	static constexpr uint32_t MEDIAN_TILE = 128;
+	// 256 fine bins followed by 16 coarse bins per channel, a multiple of the 8 lanes of an SSE add
+	static constexpr uint32_t MEDIAN_BINS = 256 + 16;
+	static constexpr uint32_t MEDIAN_CHANNEL_BINS = MEDIAN_BINS * 3;
+	// Empty cells around the bilateral grid so the blur and the slice never leave it
+	static constexpr int GRID_PADDING = 2;
+
+	// A 16 bin segment of a histogram is two SSE registers
+	static inline void AddSegment(uint16_t* target, const uint16_t* add, const uint16_t* remove)
+	{
+		for (uint32_t i = 0; i < 16; i += 8) {
+			__m128i value = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+			value = _mm_add_epi16(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(add + i)));
+			value = _mm_sub_epi16(value, _mm_loadu_si128(reinterpret_cast<const __m128i*>(remove + i)));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), value);
+		}
+	}
+
+	static inline uint32_t LowestSetBit(uint32_t mask)
+	{
+#if defined(_MSC_VER)
+		unsigned long index;
+		_BitScanForward(&index, mask);
+		return index;
+#else
+		return __builtin_ctz(mask);
+#endif
+	}
+
+	// First of 16 bins whose running total goes past target, without a loop. before receives the
+	// total of the bins ahead of it. Totals stay far below the signed 16 bit limit
+	static inline uint32_t FindBin(const uint16_t* bins, uint32_t target, uint32_t& before)
+	{
+		__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bins));
+		__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bins + 8));
+		low = _mm_add_epi16(low, _mm_slli_si128(low, 2));
+		high = _mm_add_epi16(high, _mm_slli_si128(high, 2));
+		low = _mm_add_epi16(low, _mm_slli_si128(low, 4));
+		high = _mm_add_epi16(high, _mm_slli_si128(high, 4));
+		low = _mm_add_epi16(low, _mm_slli_si128(low, 8));
+		high = _mm_add_epi16(high, _mm_slli_si128(high, 8));
+		const __m128i lowTotal = _mm_shufflehi_epi16(low, 0xFF);
+		high = _mm_add_epi16(high, _mm_unpackhi_epi64(lowTotal, lowTotal));
+
+		const __m128i threshold = _mm_set1_epi16(static_cast<short>(target));
+		const uint32_t mask = _mm_movemask_epi8(_mm_packs_epi16(_mm_cmpgt_epi16(low, threshold), _mm_cmpgt_epi16(high, threshold)));
+		const uint32_t bin = LowestSetBit(mask);
+
+		alignas(16) uint16_t totals[16];
+		_mm_store_si128(reinterpret_cast<__m128i*>(totals), low);
+		_mm_store_si128(reinterpret_cast<__m128i*>(totals + 8), high);
+		before = bin ? totals[bin - 1] : 0;
+		return bin;
+	}
+
+	static inline void CountPixel(uint16_t* histogram, const uint8_t* pixel, int delta)
+	{
+		for (uint32_t c = 0; c < 3; c++, histogram += MEDIAN_BINS) {
+			histogram[pixel[c]] += delta;
+			histogram[256 + (pixel[c] >> 4)] += delta;
+		}
+	}
+
+	void MedianFilter::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels, uint32_t radius)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (width == 0 || height == 0) return;
+		const size_t size = static_cast<size_t>(width) * height * channels;
+		radius = std::min(radius, MAX_MEDIAN_RADIUS);
+		if (radius == 0) {
+			if (src != dst) std::memcpy(dst, src, size);
+			return;
+		}
+		// The tiles read rows the ones above them already wrote
+		if (src == dst) {
+			m_Source.assign(src, src + size);
+			src = m_Source.data();
+		}
+
+		const int r = static_cast<int>(radius);
+		const uint32_t half = ((2 * radius + 1) * (2 * radius + 1)) / 2;
+		const uint32_t tilesX = (width + MEDIAN_TILE - 1) / MEDIAN_TILE;
+		const uint32_t tilesY = (height + MEDIAN_TILE - 1) / MEDIAN_TILE;
+		const size_t stride = static_cast<size_t>(width) * channels;
+
+		ThreadPool::Get().ParallelFor(static_cast<size_t>(tilesX) * tilesY, [&](size_t tile) {
+			const int x0 = static_cast<int>(tile % tilesX * MEDIAN_TILE);
+			const int y0 = static_cast<int>(tile / tilesX * MEDIAN_TILE);
+			const int x1 = std::min(x0 + static_cast<int>(MEDIAN_TILE), static_cast<int>(width));
+			const int y1 = std::min(y0 + static_cast<int>(MEDIAN_TILE), static_cast<int>(height));
+			const int columns = x1 - x0 + 2 * r;
+
+			auto pixel = [&](int x, int y) {
+				x = std::clamp(x, 0, static_cast<int>(width) - 1);
+				y = std::clamp(y, 0, static_cast<int>(height) - 1);
+				return src + y * stride + static_cast<size_t>(x) * channels;
+			};
+
+			thread_local std::vector<uint16_t> columnHistograms;
+			thread_local std::vector<uint16_t> window;
+			columnHistograms.assign(static_cast<size_t>(columns) * MEDIAN_CHANNEL_BINS, 0);
+			window.resize(MEDIAN_CHANNEL_BINS);
+			auto column = [&](int c) {
+				return columnHistograms.data() + static_cast<size_t>(c) * MEDIAN_CHANNEL_BINS;
+			};
+			static const uint16_t zeros[16] = {};
+			// Column of the window each fine segment was last valid at, per channel
+			int synced[3 * 16];
+
+			for (int c = 0; c < columns; c++) {
+				uint16_t* histogram = columnHistograms.data() + static_cast<size_t>(c) * MEDIAN_CHANNEL_BINS;
+				for (int y = y0 - r; y <= y0 + r; y++) {
+					CountPixel(histogram, pixel(x0 - r + c, y), 1);
+				}
+			}
+
+			for (int y = y0; y < y1; y++) {
+				if (y > y0) {
+					for (int c = 0; c < columns; c++) {
+						uint16_t* histogram = columnHistograms.data() + static_cast<size_t>(c) * MEDIAN_CHANNEL_BINS;
+						CountPixel(histogram, pixel(x0 - r + c, y - r - 1), -1);
+						CountPixel(histogram, pixel(x0 - r + c, y + r), 1);
+					}
+				}
+
+				// Only the coarse bins of the window follow every step. A fine segment is brought up to
+				// date when the median lands in it, stepped from the column it was last valid at or summed
+				// again when that is cheaper
+				const int span = 2 * r + 1;
+				std::fill(window.begin(), window.end(), 0);
+				std::fill(std::begin(synced), std::end(synced), -1);
+				for (int c = 0; c < span; c++) {
+					const uint16_t* histogram = column(c);
+					for (uint32_t ch = 0; ch < 3; ch++) {
+						for (uint32_t bin = 256; bin < MEDIAN_BINS; bin++) {
+							window[ch * MEDIAN_BINS + bin] += histogram[ch * MEDIAN_BINS + bin];
+						}
+					}
+				}
+
+				uint8_t* out = dst + y * stride + static_cast<size_t>(x0) * channels;
+				for (int x = x0; x < x1; x++, out += channels) {
+					const int c = x - x0;
+					for (uint32_t ch = 0; ch < 3; ch++) {
+						uint16_t* histogram = window.data() + ch * MEDIAN_BINS;
+						const size_t offset = ch * MEDIAN_BINS;
+						if (c > 0) {
+							AddSegment(histogram + 256, column(c + 2 * r) + offset + 256, column(c - 1) + offset + 256);
+						}
+
+						uint32_t sum;
+						const uint32_t bin = FindBin(histogram + 256, half, sum);
+
+						uint16_t* segment = histogram + bin * 16;
+						const size_t segmentOffset = offset + bin * 16;
+						int& last = synced[ch * 16 + bin];
+						if (last < 0 || 2 * (c - last) > span) {
+							std::fill(segment, segment + 16, 0);
+							for (int k = c; k < c + span; k++) {
+								AddSegment(segment, column(k) + segmentOffset, zeros);
+							}
+						}
+						else {
+							for (int k = last + 1; k <= c; k++) {
+								AddSegment(segment, column(k + 2 * r) + segmentOffset, column(k - 1) + segmentOffset);
+							}
+						}
+						last = c;
+
+						uint32_t unused;
+						out[ch] = static_cast<uint8_t>(bin * 16 + FindBin(segment, half - sum, unused));
+					}
+					if (channels == 4) {
+						out[3] = pixel(x, y)[3];
+					}
+				}
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	double MedianFilter::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+
+	static inline float Luminance(const uint8_t* pixel)
+	{
+		return (0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2]) * (1.0f / 255.0f);
+	}
+
+	// [1 4 6 4 1] / 16, a Gaussian of one cell, over count cells step floats apart. Cells past
+	// the ends are empty
+	static void BlurGridLine(float* cells, size_t step, uint32_t count, std::vector<float>& line)
+	{
+		line.resize(static_cast<size_t>(count + 4) * 4);
+		std::fill(line.begin(), line.begin() + 8, 0.0f);
+		std::fill(line.end() - 8, line.end(), 0.0f);
+		for (uint32_t i = 0; i < count; i++) {
+			_mm_storeu_ps(line.data() + (i + 2) * 4, _mm_loadu_ps(cells + i * step));
+		}
+
+		const __m128 four = _mm_set1_ps(4.0f), six = _mm_set1_ps(6.0f), scale = _mm_set1_ps(1.0f / 16.0f);
+		for (uint32_t i = 0; i < count; i++) {
+			const float* window = line.data() + i * 4;
+			__m128 sum = _mm_add_ps(_mm_loadu_ps(window), _mm_loadu_ps(window + 16));
+			sum = _mm_add_ps(sum, _mm_mul_ps(four, _mm_add_ps(_mm_loadu_ps(window + 4), _mm_loadu_ps(window + 12))));
+			sum = _mm_add_ps(sum, _mm_mul_ps(six, _mm_loadu_ps(window + 8)));
+			_mm_storeu_ps(cells + i * step, _mm_mul_ps(sum, scale));
+		}
+	}
+
+	void BilateralGrid::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels,
+		float spatialSigma, float rangeSigma)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (width == 0 || height == 0) return;
+		const float spatial = std::max(spatialSigma, MIN_BILATERAL_SPATIAL);
+		const float range = std::clamp(rangeSigma, MIN_BILATERAL_RANGE, 1.0f);
+		const uint32_t gridWidth = static_cast<uint32_t>((width - 1) / spatial + 0.5f) + 1 + 2 * GRID_PADDING;
+		const uint32_t gridHeight = static_cast<uint32_t>((height - 1) / spatial + 0.5f) + 1 + 2 * GRID_PADDING;
+		const uint32_t gridDepth = static_cast<uint32_t>(1.0f / range + 0.5f) + 1 + 2 * GRID_PADDING;
+		// Luminance changes fastest, then x, then y
+		const size_t stepX = static_cast<size_t>(gridDepth) * 4, stepY = stepX * gridWidth;
+		m_Grid.assign(stepY * gridHeight, 0.0f);
+		const size_t stride = static_cast<size_t>(width) * channels;
+		ThreadPool& pool = ThreadPool::Get();
+
+		// Every grid row gathers the image rows nearest to it, so no two tasks write the same cell
+		pool.ParallelFor(gridHeight - 2 * GRID_PADDING, [&](size_t row) {
+			const uint32_t first = static_cast<uint32_t>(std::ceil(std::max(0.0f, (row - 0.5f) * spatial)));
+			const uint32_t last = std::min(height, static_cast<uint32_t>(std::ceil((row + 0.5f) * spatial)));
+			float* cells = m_Grid.data() + (row + GRID_PADDING) * stepY;
+			for (uint32_t y = first; y < last; y++) {
+				const uint8_t* pixel = src + y * stride;
+				for (uint32_t x = 0; x < width; x++, pixel += channels) {
+					const size_t gx = static_cast<size_t>(x / spatial + 0.5f) + GRID_PADDING;
+					const size_t gz = static_cast<size_t>(Luminance(pixel) / range + 0.5f) + GRID_PADDING;
+					float* cell = cells + gx * stepX + gz * 4;
+					cell[0] += pixel[0];
+					cell[1] += pixel[1];
+					cell[2] += pixel[2];
+					cell[3] += 1.0f;
+				}
+			}
+		});
+
+		pool.ParallelFor(gridHeight, [&](size_t gy) {
+			thread_local std::vector<float> line;
+			float* plane = m_Grid.data() + gy * stepY;
+			for (uint32_t gx = 0; gx < gridWidth; gx++) {
+				BlurGridLine(plane + gx * stepX, 4, gridDepth, line);
+			}
+			for (uint32_t gz = 0; gz < gridDepth; gz++) {
+				BlurGridLine(plane + gz * 4, stepX, gridWidth, line);
+			}
+		});
+		pool.ParallelFor(gridWidth, [&](size_t gx) {
+			thread_local std::vector<float> line;
+			for (uint32_t gz = 0; gz < gridDepth; gz++) {
+				BlurGridLine(m_Grid.data() + gx * stepX + gz * 4, stepY, gridHeight, line);
+			}
+		});
+
+		// Trilinear read of the blurred grid, the colour sums divided by the weight
+		pool.ParallelFor(height, [&](size_t y) {
+			const float fy = y / spatial + GRID_PADDING;
+			const size_t gy = static_cast<size_t>(fy);
+			const __m128 ty = _mm_set1_ps(fy - gy);
+			uint8_t* out = dst + y * stride;
+			const uint8_t* in = src + y * stride;
+			for (uint32_t x = 0; x < width; x++, in += channels, out += channels) {
+				const float fx = x / spatial + GRID_PADDING;
+				const float fz = Luminance(in) / range + GRID_PADDING;
+				const size_t gx = static_cast<size_t>(fx), gz = static_cast<size_t>(fz);
+				const __m128 tx = _mm_set1_ps(fx - gx), tz = _mm_set1_ps(fz - gz);
+
+				const float* c000 = m_Grid.data() + gy * stepY + gx * stepX + gz * 4;
+				auto lerpZ = [&](const float* cell) {
+					const __m128 a = _mm_loadu_ps(cell);
+					return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(cell + 4), a), tz));
+				};
+				auto lerp = [](__m128 a, __m128 b, __m128 t) {
+					return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+				};
+				const __m128 row0 = lerp(lerpZ(c000), lerpZ(c000 + stepX), tx);
+				const __m128 row1 = lerp(lerpZ(c000 + stepY), lerpZ(c000 + stepY + stepX), tx);
+				alignas(16) float result[4];
+				_mm_store_ps(result, lerp(row0, row1, ty));
+
+				if (result[3] > 1e-6f) {
+					const float inverse = 1.0f / result[3];
+					for (uint32_t c = 0; c < 3; c++) {
+						out[c] = static_cast<uint8_t>(std::min(result[c] * inverse + 0.5f, 255.0f));
+					}
+				}
+				else if (out != in) {
+					std::memcpy(out, in, 3);
+				}
+				if (channels == 4 && out != in) {
+					out[3] = in[3];
+				}
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	double BilateralGrid::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+}
@@ -0,0 +1,382 @@
+#include "DuplicateFinder.h"
+#include "ImageFolder.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+
+namespace Photoxel
+{
+	static constexpr char HASH_FILE_MAGIC[4] = { 'P', 'X', 'I', 'H' };
+	static constexpr uint32_t HASH_FILE_VERSION = 1;
+	static constexpr const char* HASH_FILE_NAME = "photoxel.hashes";
+	// Bytes of a record with an empty path
+	static constexpr uint64_t HASH_RECORD_SIZE = 4 * sizeof(uint64_t) + sizeof(uint32_t);
+	// Images hashed per pool task
+	static constexpr size_t HASH_CHUNK = 16;
+	// Images hashed between two saves of the index, the most a crash can lose
+	static constexpr size_t SAVE_INTERVAL = 20000;
+	static constexpr size_t MATCH_CHUNK = 1024;
+
+	bool ImageHashIndex::Load(const std::string& path, std::string& error)
+	{
+		m_Images.clear();
+		std::ifstream reader(path, std::ios::binary);
+		if (!reader) {
+			return true;
+		}
+
+		char magic[4];
+		uint32_t version = 0;
+		uint64_t count = 0;
+		if (!reader.read(magic, sizeof(magic)) || std::memcmp(magic, HASH_FILE_MAGIC, sizeof(magic)) != 0
+			|| !reader.read(reinterpret_cast<char*>(&version), sizeof(version)) || version != HASH_FILE_VERSION
+			|| !reader.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+			error = path + " is not an image hash index";
+			return false;
+		}
+		// Sizes are bounded by the file before anything is allocated, a damaged one would throw on
+		// the scan thread
+		std::error_code sizeError;
+		const uintmax_t size = std::filesystem::file_size(path, sizeError);
+		const uintmax_t remaining = sizeError ? 0 : size - static_cast<uintmax_t>(reader.tellg());
+		if (sizeError || count > remaining / HASH_RECORD_SIZE) {
+			error = path + " is damaged";
+			return false;
+		}
+		m_Images.resize(static_cast<size_t>(count));
+		for (HashedImage& image : m_Images) {
+			uint32_t length = 0;
+			reader.read(reinterpret_cast<char*>(&image.Size), sizeof(image.Size));
+			reader.read(reinterpret_cast<char*>(&image.Modified), sizeof(image.Modified));
+			reader.read(reinterpret_cast<char*>(&image.Hash.Perceptual), sizeof(image.Hash.Perceptual));
+			reader.read(reinterpret_cast<char*>(&image.Hash.Difference), sizeof(image.Hash.Difference));
+			reader.read(reinterpret_cast<char*>(&length), sizeof(length));
+			if (length > remaining) {
+				reader.setstate(std::ios::failbit);
+			}
+			if (!reader) break;
+			image.Path.resize(length);
+			reader.read(image.Path.data(), length);
+		}
+		if (!reader) {
+			error = path + " is damaged";
+			m_Images.clear();
+			return false;
+		}
+		return true;
+	}
+
+	bool ImageHashIndex::Save(const std::string& path) const
+	{
+		// Written aside and swapped in, a crash while saving keeps the previous index
+		const std::string temporary = path + ".tmp";
+		std::error_code error;
+		{
+			std::ofstream writer(temporary, std::ios::binary | std::ios::trunc);
+			const uint64_t count = m_Images.size();
+			writer.write(HASH_FILE_MAGIC, sizeof(HASH_FILE_MAGIC));
+			writer.write(reinterpret_cast<const char*>(&HASH_FILE_VERSION), sizeof(HASH_FILE_VERSION));
+			writer.write(reinterpret_cast<const char*>(&count), sizeof(count));
+			for (const HashedImage& image : m_Images) {
+				const uint32_t length = static_cast<uint32_t>(image.Path.size());
+				writer.write(reinterpret_cast<const char*>(&image.Size), sizeof(image.Size));
+				writer.write(reinterpret_cast<const char*>(&image.Modified), sizeof(image.Modified));
+				writer.write(reinterpret_cast<const char*>(&image.Hash.Perceptual), sizeof(image.Hash.Perceptual));
+				writer.write(reinterpret_cast<const char*>(&image.Hash.Difference), sizeof(image.Hash.Difference));
+				writer.write(reinterpret_cast<const char*>(&length), sizeof(length));
+				writer.write(image.Path.data(), length);
+			}
+			writer.close();
+			if (!writer) {
+				std::filesystem::remove(temporary, error);
+				return false;
+			}
+		}
+		std::filesystem::rename(temporary, path, error);
+		if (error) {
+			std::filesystem::remove(temporary, error);
+			return false;
+		}
+		return true;
+	}
+
+	std::vector<HashedImage>& ImageHashIndex::GetImages()
+	{
+		return m_Images;
+	}
+
+	const std::vector<HashedImage>& ImageHashIndex::GetImages() const
+	{
+		return m_Images;
+	}
+
+	static uint32_t FindRoot(std::vector<uint32_t>& parents, uint32_t image)
+	{
+		while (parents[image] != image) {
+			parents[image] = parents[parents[image]];
+			image = parents[image];
+		}
+		return image;
+	}
+
+	std::vector<DuplicateGroup> FindDuplicates(const std::vector<HashedImage>& images, uint32_t maxDistance)
+	{
+		std::vector<uint64_t> hashes(images.size());
+		for (size_t i = 0; i < images.size(); i++) {
+			hashes[i] = images[i].Hash.Perceptual;
+		}
+		HammingIndex index;
+		index.Build(std::move(hashes));
+
+		// The perceptual hash finds the candidates, the difference hash confirms them, which drops
+		// the flat or dark images that only look alike in their low frequencies. Matches are joined
+		// as soon as they are found, so a burst of identical frames never holds its quadratic number
+		// of pairs
+		std::vector<uint32_t> parents(images.size());
+		std::iota(parents.begin(), parents.end(), 0u);
+		std::mutex parentsMutex;
+		const size_t chunks = (images.size() + MATCH_CHUNK - 1) / MATCH_CHUNK;
+		ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+			std::vector<uint32_t> found;
+			const size_t end = std::min(images.size(), (chunk + 1) * MATCH_CHUNK);
+			for (size_t image = chunk * MATCH_CHUNK; image < end; image++) {
+				found.clear();
+				index.Search(images[image].Hash.Perceptual, maxDistance, found);
+				found.erase(std::remove_if(found.begin(), found.end(), [&](uint32_t other) {
+					return other <= image || GetHammingDistance(images[image].Hash.Difference, images[other].Hash.Difference) > maxDistance;
+				}), found.end());
+				if (found.empty()) continue;
+
+				std::lock_guard<std::mutex> lock(parentsMutex);
+				for (uint32_t other : found) {
+					const uint32_t root = FindRoot(parents, static_cast<uint32_t>(image));
+					const uint32_t otherRoot = FindRoot(parents, other);
+					if (root != otherRoot) {
+						parents[otherRoot] = root;
+					}
+				}
+			}
+		});
+
+		std::unordered_map<uint32_t, size_t> groupOf;
+		std::vector<DuplicateGroup> groups;
+		for (uint32_t image = 0; image < images.size(); image++) {
+			auto [it, added] = groupOf.try_emplace(FindRoot(parents, image), groups.size());
+			if (added) {
+				groups.emplace_back();
+			}
+			groups[it->second].push_back(image);
+		}
+		groups.erase(std::remove_if(groups.begin(), groups.end(), [](const DuplicateGroup& group) { return group.size() < 2; }),
+			groups.end());
+		return groups;
+	}
+
+	DuplicateFinder::~DuplicateFinder()
+	{
+		Cancel();
+	}
+
+	void DuplicateFinder::Start(const std::string& folder, const DuplicateOptions& options)
+	{
+		Cancel();
+		m_Cancelled = false;
+		m_ImagesHashed = 0;
+		m_ImageCount = 0;
+		m_ImagesReused = 0;
+		Fail("");
+		Warn("");
+		m_Running = true;
+		m_Thread = std::thread(&DuplicateFinder::Run, this, folder, options);
+	}
+
+	void DuplicateFinder::Cancel()
+	{
+		m_Cancelled = true;
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void DuplicateFinder::Fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Error = error;
+	}
+
+	void DuplicateFinder::Warn(const std::string& warning)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Warning = warning;
+	}
+
+	void DuplicateFinder::Run(std::string folder, DuplicateOptions options)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		const std::string indexPath = (std::filesystem::path(folder) / HASH_FILE_NAME).string();
+		ImageHashIndex previous;
+		std::string error;
+		if (!previous.Load(indexPath, error)) {
+			Fail(error);
+			m_Running = false;
+			return;
+		}
+		std::unordered_map<std::string, const HashedImage*> known;
+		for (const HashedImage& image : previous.GetImages()) {
+			known[image.Path] = &image;
+		}
+
+		// Images that did not change since the last scan keep their hash, the rest are decoded
+		const std::vector<std::string> paths = FindImages(folder);
+		std::vector<HashedImage> images(paths.size());
+		std::vector<uint8_t> hashed(paths.size(), 0);
+		std::vector<size_t> pending;
+		for (size_t i = 0; i < paths.size(); i++) {
+			HashedImage& image = images[i];
+			std::error_code fileError;
+			image.Path = paths[i];
+			image.Size = std::filesystem::file_size(image.Path, fileError);
+			image.Modified = std::filesystem::last_write_time(image.Path, fileError).time_since_epoch().count();
+			const auto it = known.find(image.Path);
+			if (it != known.end() && it->second->Size == image.Size && it->second->Modified == image.Modified) {
+				image.Hash = it->second->Hash;
+				hashed[i] = 1;
+			}
+			else {
+				pending.push_back(i);
+			}
+		}
+		m_ImagesReused = static_cast<int64_t>(paths.size() - pending.size());
+		m_ImageCount = static_cast<int64_t>(pending.size());
+
+		// Images that cannot be decoded stay out of the index and are tried again by the next scan.
+		// The saved index only speeds up the next scan, a folder that cannot be written to (a share,
+		// a card, an archive) is scanned all the same and simply hashed again next time
+		ImageHashIndex index;
+		bool saving = true;
+		const auto collect = [&]() {
+			std::vector<HashedImage>& kept = index.GetImages();
+			kept.clear();
+			for (size_t i = 0; i < images.size(); i++) {
+				if (hashed[i]) {
+					kept.push_back(images[i]);
+				}
+			}
+			if (saving && !index.Save(indexPath)) {
+				saving = false;
+				Warn("Could not write " + indexPath + ", the hashes are not kept for the next scan");
+			}
+		};
+		for (size_t begin = 0; begin < pending.size() && !m_Cancelled; begin += SAVE_INTERVAL) {
+			const size_t end = std::min(pending.size(), begin + SAVE_INTERVAL);
+			const size_t chunks = (end - begin + HASH_CHUNK - 1) / HASH_CHUNK;
+			ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+				const size_t last = std::min(end, begin + (chunk + 1) * HASH_CHUNK);
+				for (size_t i = begin + chunk * HASH_CHUNK; i < last && !m_Cancelled; i++) {
+					HashedImage& image = images[pending[i]];
+					hashed[pending[i]] = ComputeImageHash(image.Path, image.Hash) ? 1 : 0;
+					m_ImagesHashed++;
+				}
+			});
+			collect();
+		}
+		if (pending.empty()) {
+			collect();
+		}
+		if (m_Cancelled) {
+			m_Running = false;
+			return;
+		}
+
+		m_Groups = FindDuplicates(index.GetImages(), options.MaxDistance);
+		m_Index = std::move(index);
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_Time = std::chrono::duration<double>(end - start).count();
+		m_Running = false;
+	}
+
+	bool DuplicateFinder::IsRunning() const
+	{
+		return m_Running;
+	}
+
+	float DuplicateFinder::GetProgress() const
+	{
+		const int64_t count = m_ImageCount;
+		return count > 0 ? std::min(1.0f, static_cast<float>(m_ImagesHashed) / count) : 0.0f;
+	}
+
+	int64_t DuplicateFinder::GetImagesHashed() const
+	{
+		return m_ImagesHashed;
+	}
+
+	int64_t DuplicateFinder::GetImagesReused() const
+	{
+		return m_ImagesReused;
+	}
+
+	std::string DuplicateFinder::GetError() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Error;
+	}
+
+	std::string DuplicateFinder::GetWarning() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Warning;
+	}
+
+	const std::vector<HashedImage>& DuplicateFinder::GetImages() const
+	{
+		return m_Index.GetImages();
+	}
+
+	const std::vector<DuplicateGroup>& DuplicateFinder::GetGroups() const
+	{
+		return m_Groups;
+	}
+
+	double DuplicateFinder::GetTime() const
+	{
+		return m_Time;
+	}
+
+	int RunDuplicateFinder(const std::string& folder, uint32_t maxDistance)
+	{
+		DuplicateFinder finder;
+		DuplicateOptions options;
+		options.MaxDistance = maxDistance;
+		finder.Start(folder, options);
+		while (finder.IsRunning()) {
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+			std::cout << finder.GetImagesHashed() << " images hashed (" << static_cast<int>(finder.GetProgress() * 100.0f)
+				<< "%), " << finder.GetImagesReused() << " from the last scan" << std::endl;
+		}
+		if (!finder.GetError().empty()) {
+			std::cerr << finder.GetError() << std::endl;
+			return 1;
+		}
+		if (!finder.GetWarning().empty()) {
+			std::cerr << finder.GetWarning() << std::endl;
+		}
+
+		const std::vector<HashedImage>& images = finder.GetImages();
+		for (const DuplicateGroup& group : finder.GetGroups()) {
+			for (uint32_t image : group) {
+				std::cout << images[image].Path << '\n';
+			}
+			std::cout << '\n';
+		}
+		std::cout << images.size() << " images, " << finder.GetGroups().size() << " groups of duplicates, "
+			<< finder.GetTime() << " s" << std::endl;
+		return 0;
+	}
+}
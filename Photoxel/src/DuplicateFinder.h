@@ -0,0 +1,94 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ImageHash.h"
+
+namespace Photoxel
+{
+	struct HashedImage {
+		std::string Path;
+		// A file keeps its hash for as long as its size and modification time stay the same
+		uint64_t Size = 0;
+		int64_t Modified = 0;
+		ImageHash Hash;
+	};
+
+	// The hashes of a folder, kept between scans in a small binary file so a rescan only decodes the
+	// images that are new or changed
+	class ImageHashIndex
+	{
+	public:
+		// A missing file is an empty index, false only when the file is not an index
+		bool Load(const std::string& path, std::string& error);
+		bool Save(const std::string& path) const;
+
+		std::vector<HashedImage>& GetImages();
+		const std::vector<HashedImage>& GetImages() const;
+	private:
+		std::vector<HashedImage> m_Images;
+	};
+
+	struct DuplicateOptions {
+		// Bits two perceptual hashes may differ by for the images to count as the same picture
+		uint32_t MaxDistance = 6;
+	};
+
+	// Images that look the same, indices into the images of the index, in path order
+	using DuplicateGroup = std::vector<uint32_t>;
+
+	// Hashes every image of a folder on the thread pool and groups the near duplicates, on a thread
+	// of its own. The hashes are saved next to the images, at folder/photoxel.hashes, when the folder
+	// can be written to
+	class DuplicateFinder
+	{
+	public:
+		DuplicateFinder() = default;
+		~DuplicateFinder();
+
+		DuplicateFinder(const DuplicateFinder&) = delete;
+		DuplicateFinder& operator=(const DuplicateFinder&) = delete;
+
+		// A scan still running is cancelled. The hashes computed before a cancel are saved
+		void Start(const std::string& folder, const DuplicateOptions& options = DuplicateOptions());
+		void Cancel();
+
+		bool IsRunning() const;
+		// Fraction of the new images hashed
+		float GetProgress() const;
+		int64_t GetImagesHashed() const;
+		// Images whose hash came from the last scan
+		int64_t GetImagesReused() const;
+		// Empty unless the last scan failed
+		std::string GetError() const;
+		// Empty unless the last scan could not save its hashes, its results are still valid
+		std::string GetWarning() const;
+		// The images and groups of the last scan that completed, only valid while nothing runs
+		const std::vector<HashedImage>& GetImages() const;
+		const std::vector<DuplicateGroup>& GetGroups() const;
+		double GetTime() const;
+	private:
+		void Run(std::string folder, DuplicateOptions options);
+		void Fail(const std::string& error);
+		void Warn(const std::string& warning);
+
+		std::thread m_Thread;
+		std::atomic<bool> m_Running{ false }, m_Cancelled{ false };
+		std::atomic<int64_t> m_ImagesHashed{ 0 }, m_ImageCount{ 0 }, m_ImagesReused{ 0 };
+		mutable std::mutex m_ErrorMutex;
+		std::string m_Error, m_Warning;
+		ImageHashIndex m_Index;
+		std::vector<DuplicateGroup> m_Groups;
+		double m_Time = 0.0;
+	};
+
+	// Every pair of hashes within maxDistance bits in both hashes, joined into groups
+	std::vector<DuplicateGroup> FindDuplicates(const std::vector<HashedImage>& images, uint32_t maxDistance);
+
+	// "Photoxel --find-duplicates photos [distance]" prints the groups of near duplicate images
+	int RunDuplicateFinder(const std::string& folder, uint32_t maxDistance);
+}
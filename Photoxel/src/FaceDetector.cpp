@@ -0,0 +1,456 @@
+#include "FaceDetector.h"
+#include "CnnFaceDetector.h"
+#include "ThreadPool.h"
+#include <stb_image_resize.h>
+#include <chrono>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+namespace Photoxel
+{
+	// dlib's scan_fhog_pyramid default, effectively "every level"
+	static constexpr unsigned long MAX_PYRAMID_LEVELS = 1000;
+	// Bands shorter than this spend more time on their halo than on their own rows
+	static constexpr long MIN_BAND_ROWS = 128;
+	// dlib's MMOD face model, looked up next to the shaders
+	static constexpr const char* CNN_MODEL_PATH = "mmod_human_face_detector.dat";
+
+	FaceDetector::FaceDetector()
+	{
+		m_BaseDetector = dlib::get_frontal_face_detector();
+		RebuildDetector(MAX_PYRAMID_LEVELS);
+	}
+
+	FaceDetector::~FaceDetector() = default;
+
+	void FaceDetector::SetProfile(const DetectionProfile& profile)
+	{
+		m_Profile = profile;
+		m_Profile.MinFaceSize = std::max(m_Profile.MinFaceSize, 1u);
+
+		// Only tried once, a missing model file does not go away between two profile changes
+		if (m_Profile.Model == DetectionModel::Cnn && !m_Cnn && m_ModelError.empty()) {
+			auto cnn = std::make_unique<CnnFaceDetector>();
+			if (cnn->Load(CNN_MODEL_PATH, m_ModelError)) {
+				m_Cnn = std::move(cnn);
+			}
+		}
+	}
+
+	const DetectionProfile& FaceDetector::GetProfile() const
+	{
+		return m_Profile;
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::Detect(const uint8_t* data, uint32_t width, uint32_t height)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dlib::rectangle roi = GetSearchArea(width, height);
+		std::vector<dlib::rectangle> dets;
+		if (!roi.is_empty()) {
+			dets = DetectRegion(data, width, roi, ComputeScale(roi));
+		}
+
+		m_LastScannedArea = roi.area();
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastDetectionTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return dets;
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::DetectRegions(const uint8_t* data, uint32_t width, uint32_t height,
+		const std::vector<dlib::rectangle>& regions)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dlib::rectangle roi = GetSearchArea(width, height);
+		// Same scale as a full scan, so a face gets the same pyramid in both paths
+		const double scale = ComputeScale(roi);
+		const double upsample = (m_Profile.Upsample == DetectionUpsample::Pyramid2x) ? 2.0 : 1.0;
+		const long minSide = static_cast<long>(std::ceil(GetWindowSize() / (scale * upsample)));
+
+		// Grow every region to at least one detection window and fuse the ones that touch,
+		// scanning two overlapping boxes would pay for the shared pixels twice
+		std::vector<dlib::rectangle> areas;
+		for (const auto& region : regions) {
+			dlib::rectangle area = region;
+			if (area.width() < static_cast<unsigned long>(minSide) || area.height() < static_cast<unsigned long>(minSide)) {
+				const long grow = (minSide - std::min<long>(area.width(), area.height()) + 1) / 2;
+				area = dlib::grow_rect(area, grow);
+			}
+			area = area.intersect(roi);
+			if (!area.is_empty()) {
+				areas.push_back(area);
+			}
+		}
+
+		bool merged = true;
+		while (merged) {
+			merged = false;
+			for (size_t i = 0; i < areas.size() && !merged; i++) {
+				for (size_t j = i + 1; j < areas.size(); j++) {
+					if (!areas[i].intersect(areas[j]).is_empty()) {
+						areas[i] = areas[i] + areas[j];
+						areas.erase(areas.begin() + j);
+						merged = true;
+						break;
+					}
+				}
+			}
+		}
+
+		std::vector<dlib::rectangle> dets;
+		m_LastScannedArea = 0;
+		for (const auto& area : areas) {
+			m_LastScannedArea += area.area();
+			for (const auto& det : DetectRegion(data, width, area, scale)) {
+				dets.push_back(det);
+			}
+		}
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastDetectionTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return dets;
+	}
+
+	dlib::rectangle FaceDetector::GetSearchArea(uint32_t width, uint32_t height) const
+	{
+		if (width == 0 || height == 0) {
+			return dlib::rectangle();
+		}
+
+		dlib::rectangle frame(0, 0, width - 1, height - 1);
+		return m_Profile.UseROI ? frame.intersect(m_Profile.ROI) : frame;
+	}
+
+	double FaceDetector::GetWindowSize() const
+	{
+		if (GetActiveModel() == DetectionModel::Cnn) {
+			return static_cast<double>(m_Cnn->GetWindowSize());
+		}
+		return m_BaseDetector.get_scanner().get_detection_window_width();
+	}
+
+	double FaceDetector::ComputeScale(const dlib::rectangle& roi) const
+	{
+		const double window = GetWindowSize();
+		const double upsample = (m_Profile.Upsample == DetectionUpsample::Pyramid2x) ? 2.0 : 1.0;
+
+		// Shrink the frame so the smallest face we care about just fills the detection
+		// window, every pyramid level below that would only find faces we don't want
+		double scale = std::min(1.0, window / (m_Profile.MinFaceSize * upsample));
+		if (m_Profile.DetectionResolution > 0) {
+			const double longest = std::max(roi.width(), roi.height());
+			scale = std::min(scale, m_Profile.DetectionResolution / longest);
+		}
+		return scale;
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::DetectRegion(const uint8_t* data, uint32_t width,
+		const dlib::rectangle& roi, double scale)
+	{
+		const double upsample = (m_Profile.Upsample == DetectionUpsample::Pyramid2x) ? 2.0 : 1.0;
+		PrepareScale(roi, scale);
+		PrepareImage(data, width, roi, m_DetectionImage);
+
+		std::vector<dlib::rectangle> dets = DetectScaled(m_DetectionImage, scale * upsample);
+		ToFrame(dets, roi, scale * upsample);
+		return dets;
+	}
+
+	std::vector<std::vector<dlib::rectangle>> FaceDetector::DetectBatch(const std::vector<const uint8_t*>& frames,
+		uint32_t width, uint32_t height)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		dlib::rectangle roi = GetSearchArea(width, height);
+		std::vector<std::vector<dlib::rectangle>> dets(frames.size());
+		if (roi.is_empty() || frames.empty()) {
+			return dets;
+		}
+
+		const double scale = ComputeScale(roi);
+		if (GetActiveModel() != DetectionModel::Cnn) {
+			for (size_t i = 0; i < frames.size(); i++) {
+				dets[i] = DetectRegion(frames[i], width, roi, scale);
+			}
+		}
+		else {
+			const double upsample = (m_Profile.Upsample == DetectionUpsample::Pyramid2x) ? 2.0 : 1.0;
+			PrepareScale(roi, scale);
+			std::vector<dlib::matrix<dlib::rgb_pixel>> images(frames.size());
+			ThreadPool::Get().ParallelFor(frames.size(), [&](size_t i) {
+				dlib::array2d<dlib::rgb_pixel> image;
+				PrepareImage(frames[i], width, roi, image);
+				images[i] = dlib::mat(image);
+			}, GetThreads());
+
+			m_ActiveLevels = 0;
+			dets = m_Cnn->DetectBatch(std::move(images), GetThreads());
+			for (auto& frameDets : dets) {
+				ToFrame(frameDets, roi, scale * upsample);
+			}
+		}
+
+		m_LastScannedArea = roi.area() * frames.size();
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastDetectionTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return dets;
+	}
+
+	void FaceDetector::PrepareScale(const dlib::rectangle& roi, double scale)
+	{
+		const double window = GetWindowSize();
+		const double upsample = (m_Profile.Upsample == DetectionUpsample::Pyramid2x) ? 2.0 : 1.0;
+
+		m_DetectionWidth = std::max(1u, static_cast<uint32_t>(std::lround(roi.width() * scale)));
+		m_DetectionHeight = std::max(1u, static_cast<uint32_t>(std::lround(roi.height() * scale)));
+
+		unsigned long levels = MAX_PYRAMID_LEVELS;
+		if (m_Profile.MaxFaceSize > 0) {
+			// pyramid_down<6> shrinks every level by 5/6, so level n finds faces window * 1.2^n big
+			const double maxFace = m_Profile.MaxFaceSize * scale * upsample;
+			const double steps = std::ceil(std::log(std::max(maxFace / window, 1.0)) / std::log(6.0 / 5.0));
+			levels = static_cast<unsigned long>(steps) + 1;
+		}
+		if (levels != m_PyramidLevels) {
+			RebuildDetector(levels);
+		}
+	}
+
+	void FaceDetector::PrepareImage(const uint8_t* data, uint32_t width, const dlib::rectangle& roi,
+		dlib::array2d<dlib::rgb_pixel>& image) const
+	{
+		const uint8_t* source = data + (static_cast<size_t>(roi.top()) * width + roi.left()) * 3;
+		image.set_size(m_DetectionHeight, m_DetectionWidth);
+		if (m_DetectionWidth == roi.width() && m_DetectionHeight == roi.height()) {
+			for (long row = 0; row < roi.height(); row++) {
+				memcpy(&image[row][0], source + static_cast<size_t>(row) * width * 3, roi.width() * 3);
+			}
+		}
+		else {
+			stbir_resize_uint8(source, roi.width(), roi.height(), width * 3,
+				reinterpret_cast<uint8_t*>(&image[0][0]), m_DetectionWidth, m_DetectionHeight,
+				m_DetectionWidth * 3, 3);
+		}
+
+		if (m_Profile.Upsample == DetectionUpsample::Pyramid2x) {
+			dlib::pyramid_up(image);
+		}
+	}
+
+	void FaceDetector::ToFrame(std::vector<dlib::rectangle>& dets, const dlib::rectangle& roi, double scale) const
+	{
+		const double toFrame = 1.0 / scale;
+		for (auto& det : dets) {
+			det = dlib::rectangle(
+				roi.left() + std::lround(det.left() * toFrame),
+				roi.top() + std::lround(det.top() * toFrame),
+				roi.left() + std::lround(det.right() * toFrame),
+				roi.top() + std::lround(det.bottom() * toFrame)
+			);
+		}
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::DetectImage(const dlib::array2d<dlib::rgb_pixel>& image)
+	{
+		return DetectScaled(image, 1.0);
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::DetectScaled(const dlib::array2d<dlib::rgb_pixel>& image, double scale)
+	{
+		if (GetActiveModel() == DetectionModel::Cnn) {
+			m_ActiveLevels = 0;
+			const long maxFace = m_Profile.MaxFaceSize > 0 ? std::lround(m_Profile.MaxFaceSize * scale) : 0;
+			return m_Cnn->Detect(image, GetThreads(), maxFace);
+		}
+
+		// Same level count rule scan_fhog_pyramid::load uses
+		const auto& scanner = m_Detector.get_scanner();
+		dlib::pyramid_down<6> pyr;
+		dlib::rectangle level = dlib::get_rect(image);
+		m_ActiveLevels = 0;
+		do {
+			level = pyr.rect_down(level);
+			m_ActiveLevels++;
+		} while (level.width() >= scanner.get_min_pyramid_layer_width() &&
+			level.height() >= scanner.get_min_pyramid_layer_height() && m_ActiveLevels < m_PyramidLevels);
+
+		const uint32_t threads = GetThreads();
+		if (threads <= 1) {
+			return m_Detector(image);
+		}
+		return DetectParallel(image, threads);
+	}
+
+	std::vector<dlib::rectangle> FaceDetector::DetectParallel(const dlib::array2d<dlib::rgb_pixel>& image, uint32_t threads)
+	{
+		using PixelImage = dlib::array2d<dlib::rgb_pixel>;
+		const Scanner& scanner = m_Detector.get_scanner();
+		dlib::pyramid_down<6> pyr;
+
+		// Build the pyramid exactly like create_fhog_pyramid, every level from the previous one
+		std::vector<const PixelImage*> levels(m_ActiveLevels);
+		m_PyramidImages.resize(m_ActiveLevels - 1);
+		levels[0] = &image;
+		for (uint32_t i = 1; i < m_ActiveLevels; i++) {
+			pyr(*levels[i - 1], m_PyramidImages[i - 1]);
+			levels[i] = &m_PyramidImages[i - 1];
+		}
+
+		// Split every level into row bands. A band is scanned together with a halo of one
+		// detection window plus the cells HOG normalisation reaches into, cut on the cell grid,
+		// so the features under every window it keeps are bit identical to the full level
+		struct Band {
+			uint32_t Level;
+			long Begin, End;
+			long CropBegin, CropEnd;
+		};
+
+		const long cellSize = scanner.get_cell_size();
+		const long halo = ((scanner.get_detection_window_height() + 3 * cellSize + cellSize - 1) / cellSize) * cellSize;
+
+		size_t totalArea = 0;
+		for (auto level : levels) {
+			totalArea += level->size();
+		}
+		const size_t targetArea = totalArea / (threads * 2) + 1;
+
+		std::vector<Band> bands;
+		for (uint32_t l = 0; l < m_ActiveLevels; l++) {
+			const long height = levels[l]->nr();
+			const long width = std::max(levels[l]->nc(), 1L);
+			long rows = std::max<long>(MIN_BAND_ROWS, static_cast<long>(targetArea / width));
+			rows = ((rows + cellSize - 1) / cellSize) * cellSize;
+			for (long begin = 0; begin < height; begin += rows) {
+				const long end = std::min(begin + rows, height);
+				bands.push_back({ l, begin, end, std::max(0L, begin - halo), std::min(height, end + halo) });
+			}
+		}
+
+		std::vector<std::vector<dlib::rect_detection>> results(bands.size());
+		ThreadPool::Get().ParallelFor(bands.size(), [&](size_t index) {
+			const Band& band = bands[index];
+			const PixelImage& level = *levels[band.Level];
+
+			PixelImage crop;
+			const PixelImage* input = &level;
+			if (band.CropBegin > 0 || band.CropEnd < level.nr()) {
+				crop.set_size(band.CropEnd - band.CropBegin, level.nc());
+				for (long row = band.CropBegin; row < band.CropEnd; row++) {
+					memcpy(&crop[row - band.CropBegin][0], &level[row][0], level.nc() * sizeof(dlib::rgb_pixel));
+				}
+				input = &crop;
+			}
+
+			Scanner bandScanner = scanner;
+			bandScanner.set_max_pyramid_levels(1);
+			bandScanner.load(*input);
+
+			// Windows hanging off the real image edge belong to the first and last band
+			const bool firstBand = band.Begin == 0;
+			const bool lastBand = band.End == level.nr();
+
+			std::vector<std::pair<double, dlib::rectangle>> dets;
+			for (size_t i = 0; i < m_FilterBanks.size(); i++) {
+				bandScanner.detect(m_FilterBanks[i], dets, m_Thresholds[i]);
+				for (const auto& [score, rect] : dets) {
+					dlib::rectangle levelRect = dlib::translate_rect(rect, 0, band.CropBegin);
+					if ((!firstBand && levelRect.top() < band.Begin) || (!lastBand && levelRect.top() >= band.End))
+						continue;
+
+					dlib::rect_detection det;
+					det.detection_confidence = score - m_Thresholds[i];
+					det.weight_index = i;
+					det.rect = pyr.rect_up(levelRect, band.Level);
+					results[index].push_back(det);
+				}
+			}
+		}, threads);
+
+		// Same greedy non-max suppression as object_detector::operator()
+		std::vector<dlib::rect_detection> candidates;
+		for (auto& result : results) {
+			candidates.insert(candidates.end(), result.begin(), result.end());
+		}
+		std::sort(candidates.rbegin(), candidates.rend());
+
+		const auto& overlaps = m_Detector.get_overlap_tester();
+		std::vector<dlib::rectangle> dets;
+		for (const auto& candidate : candidates) {
+			bool suppressed = false;
+			for (const auto& kept : dets) {
+				if (overlaps(candidate.rect, kept)) {
+					suppressed = true;
+					break;
+				}
+			}
+			if (!suppressed) {
+				dets.push_back(candidate.rect);
+			}
+		}
+		return dets;
+	}
+
+	uint32_t FaceDetector::GetThreads() const
+	{
+		return m_Profile.ThreadCount > 0 ? m_Profile.ThreadCount : ThreadPool::Get().GetThreadCount() + 1;
+	}
+
+	DetectionModel FaceDetector::GetActiveModel() const
+	{
+		return (m_Profile.Model == DetectionModel::Cnn && m_Cnn) ? DetectionModel::Cnn : DetectionModel::Hog;
+	}
+
+	const std::string& FaceDetector::GetModelError() const
+	{
+		return m_ModelError;
+	}
+
+	double FaceDetector::GetLastDetectionTime() const
+	{
+		return m_LastDetectionTime;
+	}
+
+	unsigned long FaceDetector::GetLastScannedArea() const
+	{
+		return m_LastScannedArea;
+	}
+
+	uint32_t FaceDetector::GetPyramidLevels() const
+	{
+		return m_ActiveLevels;
+	}
+
+	uint32_t FaceDetector::GetDetectionWidth() const
+	{
+		return m_DetectionWidth;
+	}
+
+	uint32_t FaceDetector::GetDetectionHeight() const
+	{
+		return m_DetectionHeight;
+	}
+
+	void FaceDetector::RebuildDetector(unsigned long pyramidLevels)
+	{
+		auto scanner = m_BaseDetector.get_scanner();
+		scanner.set_max_pyramid_levels(pyramidLevels);
+
+		std::vector<dlib::matrix<double, 0, 1>> weights;
+		for (unsigned long i = 0; i < m_BaseDetector.num_detectors(); i++) {
+			weights.push_back(m_BaseDetector.get_w(i));
+		}
+
+		m_Detector = dlib::frontal_face_detector(scanner, m_BaseDetector.get_overlap_tester(), weights);
+		m_PyramidLevels = pyramidLevels;
+
+		m_FilterBanks.clear();
+		m_Thresholds.clear();
+		for (const auto& w : weights) {
+			m_FilterBanks.push_back(scanner.build_fhog_filterbank(w));
+			m_Thresholds.push_back(w(scanner.get_num_dimensions()));
+		}
+	}
+}
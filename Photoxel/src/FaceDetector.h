@@ -0,0 +1,104 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/image_processing/frontal_face_detector.h>
+#include <dlib/image_processing.h>
+#include "Filters.h"
+
+namespace Photoxel
+{
+	class CnnFaceDetector;
+
+	enum class DetectionUpsample {
+		None = 0,
+		Pyramid2x = 1
+	};
+
+	struct DetectionProfile {
+		// Longest side of the image handed to the detector, 0 keeps the frame size
+		uint32_t DetectionResolution = 512;
+		// Smallest face (in frame pixels) we search for, trims the bottom of the pyramid
+		uint32_t MinFaceSize = 80;
+		// Largest face (in frame pixels) we search for, 0 scans every pyramid level
+		uint32_t MaxFaceSize = 0;
+		bool UseROI = false;
+		dlib::rectangle ROI;
+		DetectionUpsample Upsample = DetectionUpsample::None;
+		// Worker threads scanning the pyramid, 0 uses the whole pool and 1 runs dlib's serial detector
+		uint32_t ThreadCount = 0;
+		// The CNN model is loaded the first time it is picked, the detector stays on HOG when it cannot be
+		DetectionModel Model = DetectionModel::Hog;
+	};
+
+	class FaceDetector
+	{
+	public:
+		FaceDetector();
+		~FaceDetector();
+
+		void SetProfile(const DetectionProfile& profile);
+		const DetectionProfile& GetProfile() const;
+
+		// Runs the detector over an RGB24 frame and returns boxes in frame coordinates
+		std::vector<dlib::rectangle> Detect(const uint8_t* data, uint32_t width, uint32_t height);
+		// Same as Detect but only scans the given frame rectangles, used to follow motion
+		std::vector<dlib::rectangle> DetectRegions(const uint8_t* data, uint32_t width, uint32_t height,
+			const std::vector<dlib::rectangle>& regions);
+		// Runs the detector over frames of the same size at once, the CNN batches them through the
+		// network and spreads them over the threads, HOG scans them one after the other
+		std::vector<std::vector<dlib::rectangle>> DetectBatch(const std::vector<const uint8_t*>& frames,
+			uint32_t width, uint32_t height);
+		// Runs the detector over an image already prepared at detection resolution
+		std::vector<dlib::rectangle> DetectImage(const dlib::array2d<dlib::rgb_pixel>& image);
+
+		// The model the detections come from, HOG when the CNN was asked for but could not be loaded
+		DetectionModel GetActiveModel() const;
+		// Empty unless loading the CNN model failed
+		const std::string& GetModelError() const;
+		double GetLastDetectionTime() const;
+		// Frame pixels the last call had to scan
+		unsigned long GetLastScannedArea() const;
+		uint32_t GetPyramidLevels() const;
+		uint32_t GetDetectionWidth() const;
+		uint32_t GetDetectionHeight() const;
+	private:
+		dlib::rectangle GetSearchArea(uint32_t width, uint32_t height) const;
+		double GetWindowSize() const;
+		double ComputeScale(const dlib::rectangle& roi) const;
+		std::vector<dlib::rectangle> DetectRegion(const uint8_t* data, uint32_t width,
+			const dlib::rectangle& roi, double scale);
+		// Sets the detection size for roi and scale and picks the pyramid levels MaxFaceSize allows
+		void PrepareScale(const dlib::rectangle& roi, double scale);
+		// Copies roi into image at the detection size, upsampled when the profile asks for it
+		void PrepareImage(const uint8_t* data, uint32_t width, const dlib::rectangle& roi,
+			dlib::array2d<dlib::rgb_pixel>& image) const;
+		void ToFrame(std::vector<dlib::rectangle>& dets, const dlib::rectangle& roi, double scale) const;
+		// scale maps frame pixels to image pixels, the CNN sizes MaxFaceSize with it
+		std::vector<dlib::rectangle> DetectScaled(const dlib::array2d<dlib::rgb_pixel>& image, double scale);
+		uint32_t GetThreads() const;
+		void RebuildDetector(unsigned long pyramidLevels);
+		std::vector<dlib::rectangle> DetectParallel(const dlib::array2d<dlib::rgb_pixel>& image, uint32_t threads);
+
+		using Scanner = dlib::frontal_face_detector::image_scanner_type;
+
+		dlib::frontal_face_detector m_BaseDetector;
+		dlib::frontal_face_detector m_Detector;
+		DetectionProfile m_Profile;
+		unsigned long m_PyramidLevels = 0;
+		uint32_t m_ActiveLevels = 0;
+		std::vector<Scanner::fhog_filterbank> m_FilterBanks;
+		std::vector<double> m_Thresholds;
+		dlib::array<dlib::array2d<dlib::rgb_pixel>> m_PyramidImages;
+
+		dlib::array2d<dlib::rgb_pixel> m_DetectionImage;
+		uint32_t m_DetectionWidth = 0, m_DetectionHeight = 0;
+		double m_LastDetectionTime = 0.0;
+		unsigned long m_LastScannedArea = 0;
+
+		std::unique_ptr<CnnFaceDetector> m_Cnn;
+		std::string m_ModelError;
+	};
+}
@@ -0,0 +1,128 @@
+#include "FaceEncoder.h"
+#include "ThreadPool.h"
+#include <dlib/dnn.h>
+#include <algorithm>
+#include <cmath>
+
+namespace Photoxel
+{
+	// Layout of dlib_face_recognition_resnet_model_v1.dat, a 29 layer ResNet
+	template <template <int, template <typename> class, int, typename> class Block, int N,
+		template <typename> class Norm, typename Subnet>
+	using Residual = dlib::add_prev1<Block<N, Norm, 1, dlib::tag1<Subnet>>>;
+	template <template <int, template <typename> class, int, typename> class Block, int N,
+		template <typename> class Norm, typename Subnet>
+	using ResidualDown = dlib::add_prev2<dlib::avg_pool<2, 2, 2, 2, dlib::skip1<dlib::tag2<Block<N, Norm, 2, dlib::tag1<Subnet>>>>>>;
+	template <int N, template <typename> class Norm, int Stride, typename Subnet>
+	using ConvBlock = Norm<dlib::con<N, 3, 3, 1, 1, dlib::relu<Norm<dlib::con<N, 3, 3, Stride, Stride, Subnet>>>>>;
+	template <int N, typename Subnet> using Res = dlib::relu<Residual<ConvBlock, N, dlib::affine, Subnet>>;
+	template <int N, typename Subnet> using ResDown = dlib::relu<ResidualDown<ConvBlock, N, dlib::affine, Subnet>>;
+	template <typename Subnet> using Level0 = ResDown<256, Subnet>;
+	template <typename Subnet> using Level1 = Res<256, Res<256, ResDown<256, Subnet>>>;
+	template <typename Subnet> using Level2 = Res<128, Res<128, ResDown<128, Subnet>>>;
+	template <typename Subnet> using Level3 = Res<64, Res<64, Res<64, ResDown<64, Subnet>>>>;
+	template <typename Subnet> using Level4 = Res<32, Res<32, Res<32, Subnet>>>;
+	using DescriptorNetwork = dlib::loss_metric<dlib::fc_no_bias<128, dlib::avg_pool_everything<
+		Level0<Level1<Level2<Level3<Level4<dlib::max_pool<3, 3, 2, 2, dlib::relu<dlib::affine<
+		dlib::con<32, 7, 7, 2, 2, dlib::input_rgb_image_sized<150>>>>>>>>>>>>>;
+
+	// Both from dlib.net, looked up next to the shaders like the CNN detector model
+	static constexpr const char* LANDMARKS_PATH = "shape_predictor_5_face_landmarks.dat";
+	static constexpr const char* DESCRIPTOR_NETWORK_PATH = "dlib_face_recognition_resnet_model_v1.dat";
+	// Side of the aligned chip the network takes and the margin around the landmarks it was trained with
+	static constexpr unsigned long CHIP_SIZE = 150;
+	static constexpr double CHIP_PADDING = 0.25;
+	static constexpr size_t ENCODE_BATCH_SIZE = 16;
+
+	struct FaceEncoder::Network {
+		DescriptorNetwork Net;
+	};
+
+	FaceEncoder::FaceEncoder() = default;
+
+	FaceEncoder::~FaceEncoder() = default;
+
+	bool FaceEncoder::Load(std::string& error)
+	{
+		auto network = std::make_unique<Network>();
+		try {
+			dlib::deserialize(LANDMARKS_PATH) >> m_Landmarks;
+			dlib::deserialize(DESCRIPTOR_NETWORK_PATH) >> network->Net;
+		}
+		catch (const std::exception& e) {
+			error = std::string("Could not load the face recognition model: ") + e.what();
+			return false;
+		}
+		m_Networks.clear();
+		m_Networks.push_back(std::move(network));
+		return true;
+	}
+
+	bool FaceEncoder::IsLoaded() const
+	{
+		return !m_Networks.empty();
+	}
+
+	std::vector<dlib::matrix<dlib::rgb_pixel>> FaceEncoder::ExtractChips(const uint8_t* rgb, uint32_t width, uint32_t height,
+		const std::vector<dlib::rectangle>& faces) const
+	{
+		std::vector<dlib::matrix<dlib::rgb_pixel>> chips;
+		if (faces.empty()) {
+			return chips;
+		}
+
+		dlib::array2d<dlib::rgb_pixel> image(height, width);
+		std::copy(rgb, rgb + static_cast<size_t>(width) * height * 3, reinterpret_cast<uint8_t*>(&image[0][0]));
+		for (const dlib::rectangle& face : faces) {
+			const dlib::full_object_detection shape = m_Landmarks(image, face);
+			chips.emplace_back();
+			dlib::extract_image_chip(image, dlib::get_face_chip_details(shape, CHIP_SIZE, CHIP_PADDING), chips.back());
+		}
+		return chips;
+	}
+
+	std::vector<FaceDescriptor> FaceEncoder::Encode(std::vector<dlib::matrix<dlib::rgb_pixel>> chips, uint32_t threads)
+	{
+		std::vector<FaceDescriptor> descriptors(chips.size());
+		if (chips.empty() || m_Networks.empty()) {
+			return descriptors;
+		}
+
+		if (threads == 0) {
+			threads = ThreadPool::Get().GetThreadCount() + 1;
+		}
+		// A worker is only worth its network copy with a batch of its own
+		const size_t workers = std::max<size_t>(1, std::min<size_t>(threads, chips.size() / ENCODE_BATCH_SIZE));
+		while (m_Networks.size() < workers) {
+			m_Networks.push_back(std::make_unique<Network>(*m_Networks.front()));
+		}
+
+		ThreadPool::Get().ParallelFor(workers, [&](size_t worker) {
+			const size_t begin = worker * chips.size() / workers;
+			const size_t end = (worker + 1) * chips.size() / workers;
+			std::vector<dlib::matrix<dlib::rgb_pixel>> share(std::make_move_iterator(chips.begin() + begin),
+				std::make_move_iterator(chips.begin() + end));
+			const std::vector<dlib::matrix<float, 0, 1>> outputs = m_Networks[worker]->Net(share, ENCODE_BATCH_SIZE);
+			for (size_t i = 0; i < outputs.size(); i++) {
+				std::copy(outputs[i].begin(), outputs[i].end(), descriptors[begin + i].begin());
+			}
+		}, static_cast<uint32_t>(workers));
+		return descriptors;
+	}
+
+	std::vector<FaceDescriptor> FaceEncoder::Encode(const uint8_t* rgb, uint32_t width, uint32_t height,
+		const std::vector<dlib::rectangle>& faces)
+	{
+		return Encode(ExtractChips(rgb, width, height, faces));
+	}
+
+	float FaceEncoder::Distance(const FaceDescriptor& a, const FaceDescriptor& b)
+	{
+		float sum = 0.0f;
+		for (size_t i = 0; i < a.size(); i++) {
+			const float d = a[i] - b[i];
+			sum += d * d;
+		}
+		return std::sqrt(sum);
+	}
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <inttypes.h>
+#include <array>
+#include <memory>
+#include <string>
+#include <vector>
+#include <dlib/image_processing.h>
+#include <dlib/matrix.h>
+#include "FaceVectorFile.h"
+
+namespace Photoxel
+{
+	// Two faces of the same person are usually closer than this, the threshold dlib's model was trained for
+	static constexpr float SAME_PERSON_DISTANCE = 0.6f;
+
+	using FaceDescriptor = std::array<float, FACE_DESCRIPTOR_SIZE>;
+
+	// dlib's ResNet face recognition model. Every face is aligned on five landmarks into a 150 pixel
+	// chip, and the network turns each chip into a 128 value descriptor where the euclidean distance
+	// says how alike two faces are. Like the CNN detector, every worker runs its own network copy
+	class FaceEncoder
+	{
+	public:
+		FaceEncoder();
+		~FaceEncoder();
+
+		FaceEncoder(const FaceEncoder&) = delete;
+		FaceEncoder& operator=(const FaceEncoder&) = delete;
+
+		// Loads the landmark and network files from the assets, returns false and fills error when
+		// one of them is missing
+		bool Load(std::string& error);
+		bool IsLoaded() const;
+
+		// Aligned chips of the faces of an RGB24 image, safe to call from several threads at once
+		std::vector<dlib::matrix<dlib::rgb_pixel>> ExtractChips(const uint8_t* rgb, uint32_t width, uint32_t height,
+			const std::vector<dlib::rectangle>& faces) const;
+		// Runs the chips through the network in batches split over threads workers, 0 uses the whole pool
+		std::vector<FaceDescriptor> Encode(std::vector<dlib::matrix<dlib::rgb_pixel>> chips, uint32_t threads = 0);
+		// Both steps for the faces of one image
+		std::vector<FaceDescriptor> Encode(const uint8_t* rgb, uint32_t width, uint32_t height,
+			const std::vector<dlib::rectangle>& faces);
+
+		static float Distance(const FaceDescriptor& a, const FaceDescriptor& b);
+	private:
+		struct Network;
+
+		dlib::shape_predictor m_Landmarks;
+		std::vector<std::unique_ptr<Network>> m_Networks;
+	};
+}
@@ -0,0 +1,422 @@
+#include "FaceLibrary.h"
+#include "FaceDetector.h"
+#include "ImageFolder.h"
+#include "ThreadPool.h"
+#include "stb_image.h"
+#include <dlib/clustering.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace Photoxel
+{
+	static constexpr char PEOPLE_FILE_MAGIC[4] = { 'P', 'X', 'P', 'L' };
+	// Neighbours every face is compared with when the people are grouped
+	static constexpr size_t CLUSTER_NEIGHBOURS = 16;
+	static constexpr size_t CLUSTER_CANDIDATES = 64;
+	static constexpr uint32_t CLUSTER_ITERATIONS = 100;
+	static constexpr size_t CLUSTER_CHUNK = 1024;
+	// Aligned faces handed to the network at once, enough for every network copy to get a batch
+	static constexpr size_t ENCODE_BATCH = 128;
+	// Scanned images waiting for the encoder before the workers hold off
+	static constexpr size_t MAX_PENDING_IMAGES = 64;
+	// Images between two flushes of the library, the most a crash can lose
+	static constexpr size_t FLUSH_INTERVAL = 256;
+
+	static bool LoadPeople(const std::string& path, size_t count, std::vector<uint32_t>& labels)
+	{
+		std::ifstream reader(path, std::ios::binary);
+		char magic[4];
+		uint64_t stored = 0;
+		if (!reader.read(magic, sizeof(magic)) || std::memcmp(magic, PEOPLE_FILE_MAGIC, sizeof(magic)) != 0
+			|| !reader.read(reinterpret_cast<char*>(&stored), sizeof(stored)) || stored != count) {
+			return false;
+		}
+		labels.resize(count);
+		return static_cast<bool>(reader.read(reinterpret_cast<char*>(labels.data()), count * sizeof(uint32_t)));
+	}
+
+	static bool SavePeople(const std::string& path, const std::vector<uint32_t>& labels)
+	{
+		std::ofstream writer(path, std::ios::binary | std::ios::trunc);
+		const uint64_t count = labels.size();
+		writer.write(PEOPLE_FILE_MAGIC, sizeof(PEOPLE_FILE_MAGIC));
+		writer.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		writer.write(reinterpret_cast<const char*>(labels.data()), labels.size() * sizeof(uint32_t));
+		return static_cast<bool>(writer);
+	}
+
+	// Links every face to its neighbours closer than SAME_PERSON_DISTANCE and lets Chinese whispers
+	// find the groups, which needs no number of people up front and stays linear in the faces
+	static std::vector<uint32_t> ClusterFaces(const FaceVectorFile& faces, const HnswIndex& index)
+	{
+		const size_t count = faces.GetCount();
+		const float maxDistance = SAME_PERSON_DISTANCE * SAME_PERSON_DISTANCE;
+		const size_t chunks = (count + CLUSTER_CHUNK - 1) / CLUSTER_CHUNK;
+		std::vector<std::vector<dlib::sample_pair>> chunkEdges(chunks);
+		ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+			std::vector<dlib::sample_pair>& edges = chunkEdges[chunk];
+			const size_t end = std::min(count, (chunk + 1) * CLUSTER_CHUNK);
+			for (size_t face = chunk * CLUSTER_CHUNK; face < end; face++) {
+				const unsigned long id = static_cast<unsigned long>(face);
+				// Every face links to itself so the lonely ones still get a label of their own
+				edges.emplace_back(id, id);
+				for (const auto& [distance, neighbour] : index.Search(faces.GetRecord(face).Descriptor, CLUSTER_NEIGHBOURS, CLUSTER_CANDIDATES)) {
+					if (distance > maxDistance) break;
+					if (neighbour != id) {
+						edges.emplace_back(id, static_cast<unsigned long>(neighbour));
+					}
+				}
+			}
+		});
+
+		std::vector<dlib::sample_pair> edges;
+		for (std::vector<dlib::sample_pair>& chunk : chunkEdges) {
+			edges.insert(edges.end(), chunk.begin(), chunk.end());
+			std::vector<dlib::sample_pair>().swap(chunk);
+		}
+		// A pair found from both of its faces is only kept once
+		std::sort(edges.begin(), edges.end(), dlib::order_by_index<dlib::sample_pair>);
+		edges.erase(std::unique(edges.begin(), edges.end(), [](const dlib::sample_pair& a, const dlib::sample_pair& b) {
+			return a.index1() == b.index1() && a.index2() == b.index2();
+		}), edges.end());
+
+		std::vector<unsigned long> labels;
+		dlib::rand random;
+		dlib::chinese_whispers(edges, labels, CLUSTER_ITERATIONS, random);
+		return std::vector<uint32_t>(labels.begin(), labels.end());
+	}
+
+	bool FaceLibrary::Open(const std::string& path, std::string& error)
+	{
+		Close();
+		if (!m_Faces.Open(path, error)) {
+			return false;
+		}
+
+		VectorView vectors;
+		vectors.Data = m_Faces.GetDescriptors();
+		vectors.Stride = m_Faces.GetStride();
+		vectors.Count = m_Faces.GetCount();
+		vectors.Dimension = FACE_DESCRIPTOR_SIZE;
+		// Both files are rebuilt when faces were added since they were written
+		if (!m_Index.Load(path + ".hnsw", vectors)) {
+			m_Index.Build(vectors);
+			m_Index.Save(path + ".hnsw");
+		}
+		std::vector<uint32_t> labels;
+		if (!LoadPeople(path + ".people", vectors.Count, labels)) {
+			labels = ClusterFaces(m_Faces, m_Index);
+			SavePeople(path + ".people", labels);
+		}
+
+		std::unordered_map<uint32_t, std::vector<uint32_t>> people;
+		for (uint32_t face = 0; face < labels.size(); face++) {
+			people[labels[face]].push_back(face);
+		}
+		for (auto& [label, faces] : people) {
+			if (faces.size() > 1) {
+				m_People.push_back(std::move(faces));
+			}
+		}
+		std::sort(m_People.begin(), m_People.end(), [](const auto& a, const auto& b) {
+			return a.size() != b.size() ? a.size() > b.size() : a.front() < b.front();
+		});
+		m_Open = true;
+		return true;
+	}
+
+	void FaceLibrary::Close()
+	{
+		m_Faces.Close();
+		m_Index.Build(VectorView());
+		m_People.clear();
+		m_Open = false;
+	}
+
+	bool FaceLibrary::IsOpen() const
+	{
+		return m_Open;
+	}
+
+	size_t FaceLibrary::GetFaceCount() const
+	{
+		return m_Faces.GetCount();
+	}
+
+	const FaceRecord& FaceLibrary::GetFace(uint32_t face) const
+	{
+		return m_Faces.GetRecord(face);
+	}
+
+	const std::string& FaceLibrary::GetImage(uint32_t image) const
+	{
+		return m_Faces.GetImage(image);
+	}
+
+	size_t FaceLibrary::GetImageCount() const
+	{
+		return m_Faces.GetImageCount();
+	}
+
+	std::vector<FaceMatch> FaceLibrary::Find(const float* descriptor, size_t count, float maxDistance) const
+	{
+		std::vector<FaceMatch> matches;
+		for (const auto& [distance, face] : m_Index.Search(descriptor, count, std::max<size_t>(count, CLUSTER_CANDIDATES))) {
+			const float euclidean = std::sqrt(distance);
+			if (euclidean > maxDistance) break;
+			matches.push_back({ euclidean, face });
+		}
+		return matches;
+	}
+
+	const std::vector<std::vector<uint32_t>>& FaceLibrary::GetPeople() const
+	{
+		return m_People;
+	}
+
+	FaceLibraryBuilder::~FaceLibraryBuilder()
+	{
+		Cancel();
+	}
+
+	void FaceLibraryBuilder::Start(const std::string& folder, const std::string& libraryPath, const FaceLibraryOptions& options)
+	{
+		Cancel();
+		m_Cancelled = false;
+		m_Indexing = false;
+		m_ImagesScanned = 0;
+		m_ImageCount = 0;
+		m_FacesFound = 0;
+		Fail("");
+		m_Running = true;
+		m_Thread = std::thread(&FaceLibraryBuilder::Run, this, folder, libraryPath, options);
+	}
+
+	void FaceLibraryBuilder::Cancel()
+	{
+		m_Cancelled = true;
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void FaceLibraryBuilder::Fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Error = error;
+	}
+
+	struct ScannedImage {
+		std::string Path;
+		std::vector<dlib::rectangle> Faces;
+		std::vector<dlib::matrix<dlib::rgb_pixel>> Chips;
+	};
+
+	void FaceLibraryBuilder::Run(std::string folder, std::string libraryPath, FaceLibraryOptions options)
+	{
+		std::string error;
+		FaceVectorWriter writer;
+		FaceEncoder encoder;
+		if (!writer.Open(libraryPath, error) || !encoder.Load(error)) {
+			Fail(error);
+			m_Running = false;
+			return;
+		}
+
+		// Images already in the library are skipped, a cancelled scan carries on where it stopped
+		const std::unordered_set<std::string> known(writer.GetImages().begin(), writer.GetImages().end());
+		std::vector<std::string> images;
+		for (std::string& image : FindImages(folder)) {
+			if (known.count(image) == 0) {
+				images.push_back(std::move(image));
+			}
+		}
+		m_ImageCount = static_cast<int64_t>(images.size());
+
+		std::mutex queueMutex;
+		std::condition_variable queueReady, queueSpace;
+		std::deque<ScannedImage> queue;
+		std::atomic<size_t> nextImage{ 0 };
+		uint32_t finished = 0;
+
+		const uint32_t workers = std::max<uint32_t>(1, std::min<uint32_t>(
+			options.Workers > 0 ? options.Workers : std::max(1u, std::thread::hardware_concurrency()),
+			static_cast<uint32_t>(images.size())));
+		std::vector<std::thread> threads;
+		for (uint32_t worker = 0; worker < workers; worker++) {
+			threads.emplace_back([&]() {
+				// Every image goes through one worker, the detector needs no threads of its own
+				FaceDetector detector;
+				DetectionProfile profile;
+				profile.DetectionResolution = options.DetectionResolution;
+				profile.MinFaceSize = options.MinFaceSize;
+				profile.ThreadCount = 1;
+				profile.Model = options.Model;
+				detector.SetProfile(profile);
+				if (!detector.GetModelError().empty()) {
+					Fail(detector.GetModelError());
+					m_Cancelled = true;
+				}
+
+				for (size_t i = nextImage++; i < images.size() && !m_Cancelled; i = nextImage++) {
+					ScannedImage scanned;
+					scanned.Path = images[i];
+					int width, height, channels;
+					unsigned char* pixels = stbi_load(scanned.Path.c_str(), &width, &height, &channels, 3);
+					// Images that cannot be read are still listed, the next scan does not try them again
+					if (pixels) {
+						scanned.Faces = detector.Detect(pixels, width, height);
+						scanned.Chips = encoder.ExtractChips(pixels, width, height, scanned.Faces);
+						stbi_image_free(pixels);
+					}
+
+					std::unique_lock<std::mutex> lock(queueMutex);
+					queueSpace.wait(lock, [&]() { return queue.size() < MAX_PENDING_IMAGES || m_Cancelled; });
+					queue.push_back(std::move(scanned));
+					queueReady.notify_one();
+				}
+
+				std::lock_guard<std::mutex> lock(queueMutex);
+				finished++;
+				queueReady.notify_one();
+			});
+		}
+
+		// The descriptors are worked out here, in batches large enough to keep every core on the network
+		std::vector<ScannedImage> pending;
+		size_t pendingChips = 0, sinceFlush = 0;
+		bool done = false;
+		while (!done) {
+			{
+				std::unique_lock<std::mutex> lock(queueMutex);
+				queueReady.wait(lock, [&]() { return !queue.empty() || finished == workers; });
+				while (!queue.empty()) {
+					pendingChips += queue.front().Chips.size();
+					pending.push_back(std::move(queue.front()));
+					queue.pop_front();
+				}
+				done = finished == workers;
+				queueSpace.notify_all();
+			}
+			if (pendingChips < ENCODE_BATCH && !done) continue;
+
+			std::vector<dlib::matrix<dlib::rgb_pixel>> chips;
+			chips.reserve(pendingChips);
+			for (ScannedImage& image : pending) {
+				std::move(image.Chips.begin(), image.Chips.end(), std::back_inserter(chips));
+			}
+			const std::vector<FaceDescriptor> descriptors = encoder.Encode(std::move(chips));
+			size_t next = 0;
+			for (const ScannedImage& image : pending) {
+				FaceRecord record;
+				record.Image = writer.AddImage(image.Path);
+				for (const dlib::rectangle& face : image.Faces) {
+					record.Left = static_cast<int32_t>(face.left());
+					record.Top = static_cast<int32_t>(face.top());
+					record.Right = static_cast<int32_t>(face.right());
+					record.Bottom = static_cast<int32_t>(face.bottom());
+					std::copy(descriptors[next].begin(), descriptors[next].end(), record.Descriptor);
+					writer.Append(record);
+					next++;
+				}
+			}
+			m_ImagesScanned += static_cast<int64_t>(pending.size());
+			m_FacesFound += static_cast<int64_t>(descriptors.size());
+			sinceFlush += pending.size();
+			pending.clear();
+			pendingChips = 0;
+			if (sinceFlush >= FLUSH_INTERVAL) {
+				writer.Flush();
+				sinceFlush = 0;
+			}
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+
+		if (!writer.Close()) {
+			Fail("Could not write " + libraryPath);
+		}
+		else if (!m_Cancelled && writer.GetCount() > 0) {
+			// Opening the library rebuilds the index and the people over the faces it now has
+			m_Indexing = true;
+			FaceLibrary library;
+			if (!library.Open(libraryPath, error)) {
+				Fail(error);
+			}
+		}
+		m_Running = false;
+	}
+
+	bool FaceLibraryBuilder::IsRunning() const
+	{
+		return m_Running;
+	}
+
+	float FaceLibraryBuilder::GetProgress() const
+	{
+		const int64_t count = m_ImageCount;
+		return count > 0 ? std::min(1.0f, static_cast<float>(m_ImagesScanned) / count) : 0.0f;
+	}
+
+	int64_t FaceLibraryBuilder::GetImagesScanned() const
+	{
+		return m_ImagesScanned;
+	}
+
+	int64_t FaceLibraryBuilder::GetFacesFound() const
+	{
+		return m_FacesFound;
+	}
+
+	bool FaceLibraryBuilder::IsIndexing() const
+	{
+		return m_Indexing;
+	}
+
+	std::string FaceLibraryBuilder::GetError() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Error;
+	}
+
+	int RunFaceLibrary(const std::string& folder, const std::string& libraryPath)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		FaceLibraryBuilder builder;
+		builder.Start(folder, libraryPath);
+		while (builder.IsRunning()) {
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+			if (builder.IsIndexing()) {
+				std::cout << "Indexing " << builder.GetFacesFound() << " new faces" << std::endl;
+				continue;
+			}
+			std::cout << builder.GetImagesScanned() << " images (" << static_cast<int>(builder.GetProgress() * 100.0f)
+				<< "%), " << builder.GetFacesFound() << " faces" << std::endl;
+		}
+		if (!builder.GetError().empty()) {
+			std::cerr << builder.GetError() << std::endl;
+			return 1;
+		}
+
+		FaceLibrary library;
+		std::string error;
+		if (!library.Open(libraryPath, error)) {
+			std::cerr << error << std::endl;
+			return 1;
+		}
+		const auto end = std::chrono::high_resolution_clock::now();
+		std::cout << library.GetImageCount() << " images, " << library.GetFaceCount() << " faces, "
+			<< library.GetPeople().size() << " people seen more than once, "
+			<< std::chrono::duration<double>(end - start).count() << " s" << std::endl;
+		return 0;
+	}
+}
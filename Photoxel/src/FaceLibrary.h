@@ -0,0 +1,100 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "FaceEncoder.h"
+#include "FaceVectorFile.h"
+#include "Filters.h"
+#include "HnswIndex.h"
+
+namespace Photoxel
+{
+	struct FaceLibraryOptions {
+		// Images loaded and scanned at once, 0 runs one per core
+		uint32_t Workers = 0;
+		// Long side of the image the detector scans
+		uint32_t DetectionResolution = 1024;
+		// Smallest face, in image pixels, worth a descriptor
+		uint32_t MinFaceSize = 40;
+		DetectionModel Model = DetectionModel::Hog;
+	};
+
+	struct FaceMatch {
+		// Euclidean distance between the descriptors, under SAME_PERSON_DISTANCE is likely the same person
+		float Distance = 0.0f;
+		uint32_t Face = 0;
+	};
+
+	// A face library on disk is three files next to each other: the face vector file at its path,
+	// the graph of the nearest neighbour index at path + ".hnsw" and the person every face was
+	// grouped into at path + ".people"
+	class FaceLibrary
+	{
+	public:
+		// Builds the index when its file is missing or stale. Returns false and fills error when the
+		// library cannot be read
+		bool Open(const std::string& path, std::string& error);
+		void Close();
+		bool IsOpen() const;
+
+		size_t GetFaceCount() const;
+		const FaceRecord& GetFace(uint32_t face) const;
+		const std::string& GetImage(uint32_t image) const;
+		size_t GetImageCount() const;
+
+		// Up to count faces closest to descriptor, the closest first, none further than maxDistance
+		std::vector<FaceMatch> Find(const float* descriptor, size_t count, float maxDistance = SAME_PERSON_DISTANCE) const;
+		// Faces of every person seen more than once, the largest group first
+		const std::vector<std::vector<uint32_t>>& GetPeople() const;
+	private:
+		FaceVectorFile m_Faces;
+		HnswIndex m_Index;
+		std::vector<std::vector<uint32_t>> m_People;
+		bool m_Open = false;
+	};
+
+	// Walks a folder of photos on a thread of its own and adds the faces of every image the library
+	// does not have yet. Workers load, detect and align the faces of one image each, the descriptors
+	// are computed in batches as the faces come in. Once the scan is over the nearest neighbour index
+	// is rebuilt and the faces are grouped into people with Chinese whispers over their neighbours
+	class FaceLibraryBuilder
+	{
+	public:
+		FaceLibraryBuilder() = default;
+		~FaceLibraryBuilder();
+
+		FaceLibraryBuilder(const FaceLibraryBuilder&) = delete;
+		FaceLibraryBuilder& operator=(const FaceLibraryBuilder&) = delete;
+
+		// A scan still running is cancelled. The faces found before a cancel are kept and the next
+		// scan of the same library carries on from there
+		void Start(const std::string& folder, const std::string& libraryPath, const FaceLibraryOptions& options = FaceLibraryOptions());
+		void Cancel();
+
+		bool IsRunning() const;
+		// Fraction of the new images scanned
+		float GetProgress() const;
+		int64_t GetImagesScanned() const;
+		int64_t GetFacesFound() const;
+		// True once the scan is over and the index and people are being built
+		bool IsIndexing() const;
+		// Empty unless the last scan failed
+		std::string GetError() const;
+	private:
+		void Run(std::string folder, std::string libraryPath, FaceLibraryOptions options);
+		void Fail(const std::string& error);
+
+		std::thread m_Thread;
+		std::atomic<bool> m_Running{ false }, m_Cancelled{ false }, m_Indexing{ false };
+		std::atomic<int64_t> m_ImagesScanned{ 0 }, m_ImageCount{ 0 }, m_FacesFound{ 0 };
+		mutable std::mutex m_ErrorMutex;
+		std::string m_Error;
+	};
+
+	// "Photoxel --face-library photos library.faces" scans a folder from the command line
+	int RunFaceLibrary(const std::string& folder, const std::string& libraryPath);
+}
@@ -0,0 +1,296 @@
+#include "FaceVectorFile.h"
+#include <cstring>
+#include <filesystem>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Photoxel
+{
+	static constexpr char FACE_FILE_MAGIC[4] = { 'P', 'X', 'F', 'V' };
+	static constexpr uint32_t FACE_FILE_VERSION = 1;
+
+	struct FaceFileHeader {
+		char Magic[4];
+		uint32_t Version;
+		uint32_t Dimension;
+		uint32_t RecordSize;
+		uint64_t Count;
+		uint64_t ImageCount;
+	};
+
+	MappedFile::~MappedFile()
+	{
+		Close();
+	}
+
+	bool MappedFile::Open(const std::string& path)
+	{
+		Close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+		if (file == INVALID_HANDLE_VALUE) {
+			return false;
+		}
+		LARGE_INTEGER size;
+		if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+			CloseHandle(file);
+			return false;
+		}
+		HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		const void* data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+		if (!data) {
+			if (mapping) {
+				CloseHandle(mapping);
+			}
+			CloseHandle(file);
+			return false;
+		}
+		m_File = file;
+		m_Mapping = mapping;
+		m_Size = static_cast<size_t>(size.QuadPart);
+#else
+		const int file = open(path.c_str(), O_RDONLY);
+		struct stat info;
+		if (file < 0 || fstat(file, &info) != 0 || info.st_size == 0) {
+			if (file >= 0) {
+				close(file);
+			}
+			return false;
+		}
+		void* data = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, file, 0);
+		if (data == MAP_FAILED) {
+			close(file);
+			return false;
+		}
+		m_File = file;
+		m_Size = static_cast<size_t>(info.st_size);
+#endif
+		m_Data = static_cast<const uint8_t*>(data);
+		return true;
+	}
+
+	void MappedFile::Close()
+	{
+#ifdef _WIN32
+		if (m_Data) {
+			UnmapViewOfFile(m_Data);
+			CloseHandle(m_Mapping);
+			CloseHandle(m_File);
+		}
+		m_File = m_Mapping = nullptr;
+#else
+		if (m_Data) {
+			munmap(const_cast<uint8_t*>(m_Data), m_Size);
+			close(m_File);
+		}
+		m_File = -1;
+#endif
+		m_Data = nullptr;
+		m_Size = 0;
+	}
+
+	const uint8_t* MappedFile::GetData() const
+	{
+		return m_Data;
+	}
+
+	size_t MappedFile::GetSize() const
+	{
+		return m_Size;
+	}
+
+	static bool IsValidHeader(const FaceFileHeader& header)
+	{
+		return std::memcmp(header.Magic, FACE_FILE_MAGIC, sizeof(FACE_FILE_MAGIC)) == 0 && header.Version == FACE_FILE_VERSION
+			&& header.Dimension == FACE_DESCRIPTOR_SIZE && header.RecordSize == sizeof(FaceRecord);
+	}
+
+	// Lines past the count of the header were added by a scan that never flushed
+	static std::vector<std::string> LoadImageList(const std::string& path, uint64_t count)
+	{
+		std::vector<std::string> images;
+		std::ifstream reader(path + ".images");
+		std::string line;
+		while (images.size() < count && std::getline(reader, line)) {
+			images.push_back(line);
+		}
+		return images;
+	}
+
+	bool FaceVectorFile::Open(const std::string& path, std::string& error)
+	{
+		Close();
+		if (!m_File.Open(path)) {
+			error = "Could not open " + path;
+			return false;
+		}
+
+		FaceFileHeader header;
+		if (m_File.GetSize() < sizeof(header)) {
+			error = path + " is not a face library";
+			Close();
+			return false;
+		}
+		std::memcpy(&header, m_File.GetData(), sizeof(header));
+		// Records past the count belong to a scan that never flushed, they are ignored. The count is
+		// divided into the size rather than multiplied, a damaged one would wrap around
+		if (!IsValidHeader(header) || header.Count > (m_File.GetSize() - sizeof(header)) / sizeof(FaceRecord)) {
+			error = path + " is not a face library or is damaged";
+			Close();
+			return false;
+		}
+
+		m_Records = reinterpret_cast<const FaceRecord*>(m_File.GetData() + sizeof(header));
+		m_Count = static_cast<size_t>(header.Count);
+		m_Images = LoadImageList(path, header.ImageCount);
+		return true;
+	}
+
+	void FaceVectorFile::Close()
+	{
+		m_File.Close();
+		m_Records = nullptr;
+		m_Count = 0;
+		m_Images.clear();
+	}
+
+	size_t FaceVectorFile::GetCount() const
+	{
+		return m_Count;
+	}
+
+	const FaceRecord& FaceVectorFile::GetRecord(size_t face) const
+	{
+		return m_Records[face];
+	}
+
+	const std::string& FaceVectorFile::GetImage(uint32_t image) const
+	{
+		static const std::string missing;
+		return image < m_Images.size() ? m_Images[image] : missing;
+	}
+
+	size_t FaceVectorFile::GetImageCount() const
+	{
+		return m_Images.size();
+	}
+
+	const float* FaceVectorFile::GetDescriptors() const
+	{
+		return m_Records ? m_Records->Descriptor : nullptr;
+	}
+
+	size_t FaceVectorFile::GetStride() const
+	{
+		return sizeof(FaceRecord);
+	}
+
+	FaceVectorWriter::~FaceVectorWriter()
+	{
+		Close();
+	}
+
+	bool FaceVectorWriter::Open(const std::string& path, std::string& error)
+	{
+		Close();
+		FaceFileHeader header;
+		if (std::filesystem::exists(path)) {
+			m_File.open(path, std::ios::in | std::ios::out | std::ios::binary);
+			std::error_code sizeError;
+			const uintmax_t size = std::filesystem::file_size(path, sizeError);
+			if (!m_File.read(reinterpret_cast<char*>(&header), sizeof(header)) || !IsValidHeader(header)
+				|| sizeError || header.Count > (size - sizeof(header)) / sizeof(FaceRecord)) {
+				error = path + " is not a face library or is damaged";
+				m_File.close();
+				return false;
+			}
+			m_Count = header.Count;
+			m_Images = LoadImageList(path, header.ImageCount);
+			// Faces written after the last flush are dropped and written again by the next scan
+			m_File.seekp(sizeof(header) + m_Count * sizeof(FaceRecord));
+			std::ofstream list(path + ".images", std::ios::trunc);
+			for (const std::string& image : m_Images) {
+				list << image << '\n';
+			}
+		}
+		else {
+			m_File.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+			std::memcpy(header.Magic, FACE_FILE_MAGIC, sizeof(FACE_FILE_MAGIC));
+			header.Version = FACE_FILE_VERSION;
+			header.Dimension = FACE_DESCRIPTOR_SIZE;
+			header.RecordSize = sizeof(FaceRecord);
+			header.Count = 0;
+			header.ImageCount = 0;
+			m_File.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			m_Count = 0;
+			m_Images.clear();
+		}
+
+		m_ImageList.open(path + ".images", std::ios::app);
+		if (!m_File || !m_ImageList) {
+			error = "Could not write " + path;
+			Close();
+			return false;
+		}
+		return true;
+	}
+
+	uint32_t FaceVectorWriter::AddImage(const std::string& image)
+	{
+		m_Images.push_back(image);
+		m_ImageList << image << '\n';
+		return static_cast<uint32_t>(m_Images.size() - 1);
+	}
+
+	void FaceVectorWriter::Append(const FaceRecord& record)
+	{
+		m_File.write(reinterpret_cast<const char*>(&record), sizeof(record));
+		m_Count++;
+	}
+
+	bool FaceVectorWriter::Flush()
+	{
+		if (!m_File.is_open()) {
+			return false;
+		}
+		// The image list goes first, the header never counts a line that is not on disk yet
+		m_ImageList.flush();
+		m_File.flush();
+		const std::streampos end = m_File.tellp();
+		const uint64_t imageCount = m_Images.size();
+		m_File.seekp(offsetof(FaceFileHeader, Count));
+		m_File.write(reinterpret_cast<const char*>(&m_Count), sizeof(m_Count));
+		m_File.write(reinterpret_cast<const char*>(&imageCount), sizeof(imageCount));
+		m_File.seekp(end);
+		m_File.flush();
+		return static_cast<bool>(m_File) && static_cast<bool>(m_ImageList);
+	}
+
+	bool FaceVectorWriter::Close()
+	{
+		if (!m_File.is_open()) {
+			return true;
+		}
+		const bool flushed = Flush();
+		m_File.close();
+		m_ImageList.close();
+		return flushed;
+	}
+
+	size_t FaceVectorWriter::GetCount() const
+	{
+		return static_cast<size_t>(m_Count);
+	}
+
+	const std::vector<std::string>& FaceVectorWriter::GetImages() const
+	{
+		return m_Images;
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <inttypes.h>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace Photoxel
+{
+	// Length of a dlib ResNet face descriptor
+	static constexpr uint32_t FACE_DESCRIPTOR_SIZE = 128;
+
+	// One face of the library as it sits on disk, the box is in pixels of its image
+	struct FaceRecord {
+		uint32_t Image = 0;
+		int32_t Left = 0, Top = 0, Right = 0, Bottom = 0;
+		float Descriptor[FACE_DESCRIPTOR_SIZE] = {};
+	};
+
+	// Read only view of a whole file mapped into memory. The pages load on first touch, so opening
+	// a library of a million faces costs nothing until they are searched
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		bool Open(const std::string& path);
+		void Close();
+
+		const uint8_t* GetData() const;
+		size_t GetSize() const;
+	private:
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+#ifdef _WIN32
+		void* m_File = nullptr;
+		void* m_Mapping = nullptr;
+#else
+		int m_File = -1;
+#endif
+	};
+
+	// The face records of a library, memory mapped. The images the faces come from are listed one
+	// path per line in a text file next to it, path + ".images"
+	class FaceVectorFile
+	{
+	public:
+		// Returns false and fills error when the file is missing or is not a face vector file
+		bool Open(const std::string& path, std::string& error);
+		void Close();
+
+		size_t GetCount() const;
+		const FaceRecord& GetRecord(size_t face) const;
+		const std::string& GetImage(uint32_t image) const;
+		size_t GetImageCount() const;
+		// Descriptors sit at a fixed distance from each other, for the index to read them in place
+		const float* GetDescriptors() const;
+		size_t GetStride() const;
+	private:
+		MappedFile m_File;
+		const FaceRecord* m_Records = nullptr;
+		size_t m_Count = 0;
+		std::vector<std::string> m_Images;
+	};
+
+	// Appends faces to a face vector file, creating it when it does not exist. The record count in
+	// the header is only written by Flush and Close, a crash loses the faces after the last flush
+	class FaceVectorWriter
+	{
+	public:
+		FaceVectorWriter() = default;
+		~FaceVectorWriter();
+
+		bool Open(const std::string& path, std::string& error);
+		// Returns the id the records of that image refer to
+		uint32_t AddImage(const std::string& image);
+		void Append(const FaceRecord& record);
+		bool Flush();
+		bool Close();
+
+		size_t GetCount() const;
+		// Images already in the file, so a scan can skip them
+		const std::vector<std::string>& GetImages() const;
+	private:
+		std::fstream m_File;
+		std::ofstream m_ImageList;
+		std::vector<std::string> m_Images;
+		uint64_t m_Count = 0;
+	};
+}
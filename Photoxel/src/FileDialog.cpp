@@ -2,6 +2,7 @@
 
 #include <Windows.h>
 #include <commdlg.h>
+#include <shlobj.h>
 #include <GLFW/glfw3.h>
 #define GLFW_EXPOSE_NATIVE_WIN32
 #include <GLFW/glfw3native.h>
@@ -40,7 +41,7 @@ namespace Photoxel {
 
 	std::string FileDialog::SaveFile(const Window& window, const std::string& filter) {
 		OPENFILENAMEA ofn;
-		CHAR szFile[260] = { "image.jpg"};
+		CHAR szFile[260] = { 0 };
 		CHAR currentDir[256] = { 0 };
 		ZeroMemory(&ofn, sizeof(OPENFILENAME));
 		ofn.lStructSize = sizeof(OPENFILENAME);
@@ -49,15 +50,54 @@ namespace Photoxel {
 		ofn.nMaxFile = sizeof(szFile);
 		if (GetCurrentDirectoryA(256, currentDir))
 			ofn.lpstrInitialDir = currentDir;
-		ofn.lpstrFilter = "JPG (.jpg)\0*.jpg\0PNG (.png)\0*.png";
 		ofn.nFilterIndex = 1;
+
+		std::vector<char> filterData;
+		filterData.reserve(filter.size() + 1);
+		for (auto& c : filter) {
+			filterData.emplace_back(c == '|' ? '\0' : c);
+		}
+		filterData.emplace_back('\0');
+
+		ofn.lpstrFilter = filterData.data();
 		ofn.Flags = OFN_PATHMUSTEXIST | OFN_OVERWRITEPROMPT | OFN_NOCHANGEDIR;
 
-		ofn.lpstrDefExt = strchr(filter.c_str(), '\0') + 1;
+		// The first pattern of the filter gives the extension added to a name typed without one
+		std::string extension;
+		const size_t pattern = filter.find("|*.");
+		if (pattern != std::string::npos) {
+			const size_t end = filter.find_first_of(";|", pattern + 3);
+			extension = filter.substr(pattern + 3, end == std::string::npos ? std::string::npos : end - pattern - 3);
+		}
+		if (!extension.empty())
+			ofn.lpstrDefExt = extension.c_str();
 
 		if (GetSaveFileNameA(&ofn) == TRUE)
 			return ofn.lpstrFile;
 
 		return std::string();
 	}
+
+	std::string FileDialog::OpenFolder(const Window& window) {
+		CHAR szFolder[MAX_PATH] = { 0 };
+		BROWSEINFOA bi;
+		ZeroMemory(&bi, sizeof(BROWSEINFOA));
+		bi.hwndOwner = glfwGetWin32Window((GLFWwindow*)window.GetNativeHandler());
+		bi.pszDisplayName = szFolder;
+		bi.lpszTitle = "Select a folder";
+		bi.ulFlags = BIF_RETURNONLYFSDIRS | BIF_NEWDIALOGSTYLE;
+
+		// The new style dialog needs COM on the calling thread
+		const HRESULT com = CoInitializeEx(nullptr, COINIT_APARTMENTTHREADED);
+		std::string folder;
+		if (PIDLIST_ABSOLUTE list = SHBrowseForFolderA(&bi)) {
+			if (SHGetPathFromIDListA(list, szFolder))
+				folder = szFolder;
+			CoTaskMemFree(list);
+		}
+		if (SUCCEEDED(com))
+			CoUninitialize();
+
+		return folder;
+	}
 }
\ No newline at end of file
@@ -9,8 +9,11 @@ namespace Photoxel
 	class FileDialog
 	{
 	public:
+		// Filters are "Description|*.ext;*.ext|..." with a trailing '|'
 		static std::string OpenFile(const Window& window, const std::string& filter);
+		// The first pattern of the filter is the default extension
 		static std::string SaveFile(const Window& window, const std::string& filter);
+		static std::string OpenFolder(const Window& window);
 	private:
 	};
 
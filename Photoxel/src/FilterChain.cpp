@@ -0,0 +1,408 @@
+#include "FilterChain.h"
+#include "Anonymise.h"
+#include "FaceDetector.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace Photoxel
+{
+	static constexpr char CHAIN_FILE_MAGIC[4] = { 'P', 'X', 'F', 'C' };
+	static constexpr uint32_t CHAIN_FILE_VERSION = 1;
+	static constexpr const char* LUT_EXTENSION = ".cube";
+	// Faces are searched for on a copy of the image this large, smaller faces are missed
+	static constexpr uint32_t FACE_DETECTION_SIZE = 1024;
+	static constexpr uint32_t MIN_FACE_SIZE = 40;
+	// Rows per pool task of the pointwise filters and the edge detection
+	static constexpr uint32_t ROW_CHUNK = 32;
+
+	template <typename T>
+	static void WriteValue(std::string& bytes, const T& value)
+	{
+		bytes.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	template <typename T>
+	static bool ReadValue(const std::string& bytes, size_t& offset, T& value)
+	{
+		if (bytes.size() - offset < sizeof(T)) {
+			return false;
+		}
+		std::memcpy(&value, bytes.data() + offset, sizeof(T));
+		offset += sizeof(T);
+		return true;
+	}
+
+	// Everything but the LUT table, in the layout of the file
+	static std::string SerialiseChain(const FilterChain& chain)
+	{
+		const FilterParameters& parameters = chain.Parameters;
+		std::string bytes(CHAIN_FILE_MAGIC, sizeof(CHAIN_FILE_MAGIC));
+		WriteValue(bytes, CHAIN_FILE_VERSION);
+		WriteValue(bytes, static_cast<uint32_t>(chain.Filters.size()));
+		for (Filter filter : chain.Filters) {
+			WriteValue(bytes, static_cast<uint32_t>(filter));
+		}
+		WriteValue(bytes, parameters.Brightness);
+		WriteValue(bytes, parameters.Contrast);
+		WriteValue(bytes, parameters.Thresehold);
+		WriteValue(bytes, static_cast<int32_t>(parameters.Mosaic));
+		WriteValue(bytes, parameters.StartColour);
+		WriteValue(bytes, parameters.EndColour);
+		WriteValue(bytes, parameters.Angle);
+		WriteValue(bytes, parameters.Intensity);
+		WriteValue(bytes, parameters.BlurSigma);
+		WriteValue(bytes, parameters.Kernel.Size);
+		WriteValue(bytes, parameters.Kernel.Bias);
+		bytes.append(reinterpret_cast<const char*>(parameters.Kernel.Weights.data()), parameters.Kernel.Weights.size() * sizeof(float));
+		WriteValue(bytes, static_cast<uint8_t>(parameters.Lut != nullptr));
+		WriteValue(bytes, static_cast<uint32_t>(parameters.Interpolation));
+		WriteValue(bytes, static_cast<int32_t>(parameters.MedianRadius));
+		WriteValue(bytes, parameters.BilateralSpatial);
+		WriteValue(bytes, parameters.BilateralRange);
+		WriteValue(bytes, parameters.LevelsClip);
+		WriteValue(bytes, static_cast<int32_t>(parameters.ClaheTiles));
+		WriteValue(bytes, parameters.ClaheClip);
+		WriteValue(bytes, static_cast<uint32_t>(parameters.Anonymise));
+		WriteValue(bytes, static_cast<int32_t>(parameters.FaceMosaic));
+		WriteValue(bytes, parameters.FaceBlurSigma);
+		WriteValue(bytes, parameters.FacePadding);
+		WriteValue(bytes, static_cast<uint32_t>(parameters.FaceModel));
+		return bytes;
+	}
+
+	bool FilterChain::Load(const std::string& path, std::string& error)
+	{
+		std::ifstream reader(path, std::ios::binary);
+		if (!reader) {
+			error = "Could not open " + path;
+			return false;
+		}
+		const std::string bytes((std::istreambuf_iterator<char>(reader)), std::istreambuf_iterator<char>());
+		uint32_t version = 0, count = 0;
+		size_t offset = sizeof(CHAIN_FILE_MAGIC);
+		if (bytes.size() < offset || std::memcmp(bytes.data(), CHAIN_FILE_MAGIC, sizeof(CHAIN_FILE_MAGIC)) != 0
+			|| !ReadValue(bytes, offset, version) || version != CHAIN_FILE_VERSION || !ReadValue(bytes, offset, count)) {
+			error = path + " is not a filter chain";
+			return false;
+		}
+
+		FilterChain chain;
+		FilterParameters& parameters = chain.Parameters;
+		bool valid = true;
+		for (uint32_t i = 0; i < count && valid; i++) {
+			uint32_t filter = 0;
+			valid = ReadValue(bytes, offset, filter) && filter >= static_cast<uint32_t>(Filter::Negative)
+				&& filter <= static_cast<uint32_t>(Filter::Anonymise);
+			chain.Filters.push_back(static_cast<Filter>(filter));
+		}
+		int32_t mosaic = 0, medianRadius = 0, claheTiles = 0, faceMosaic = 0;
+		uint32_t interpolation = 0, anonymise = 0, faceModel = 0;
+		uint8_t hasLut = 0;
+		valid = valid && ReadValue(bytes, offset, parameters.Brightness) && ReadValue(bytes, offset, parameters.Contrast)
+			&& ReadValue(bytes, offset, parameters.Thresehold) && ReadValue(bytes, offset, mosaic)
+			&& ReadValue(bytes, offset, parameters.StartColour) && ReadValue(bytes, offset, parameters.EndColour)
+			&& ReadValue(bytes, offset, parameters.Angle) && ReadValue(bytes, offset, parameters.Intensity)
+			&& ReadValue(bytes, offset, parameters.BlurSigma) && ReadValue(bytes, offset, parameters.Kernel.Size)
+			&& ReadValue(bytes, offset, parameters.Kernel.Bias)
+			&& parameters.Kernel.Size % 2 == 1 && parameters.Kernel.Size <= MAX_KERNEL_SIZE;
+		if (valid) {
+			parameters.Kernel.Weights.resize(static_cast<size_t>(parameters.Kernel.Size) * parameters.Kernel.Size);
+			for (float& weight : parameters.Kernel.Weights) {
+				valid = valid && ReadValue(bytes, offset, weight);
+			}
+		}
+		valid = valid && ReadValue(bytes, offset, hasLut) && ReadValue(bytes, offset, interpolation)
+			&& ReadValue(bytes, offset, medianRadius) && ReadValue(bytes, offset, parameters.BilateralSpatial)
+			&& ReadValue(bytes, offset, parameters.BilateralRange) && ReadValue(bytes, offset, parameters.LevelsClip)
+			&& ReadValue(bytes, offset, claheTiles) && ReadValue(bytes, offset, parameters.ClaheClip)
+			&& ReadValue(bytes, offset, anonymise) && ReadValue(bytes, offset, faceMosaic)
+			&& ReadValue(bytes, offset, parameters.FaceBlurSigma) && ReadValue(bytes, offset, parameters.FacePadding)
+			&& ReadValue(bytes, offset, faceModel);
+		if (!valid) {
+			error = path + " is damaged";
+			return false;
+		}
+		parameters.Mosaic = mosaic;
+		parameters.MedianRadius = medianRadius;
+		parameters.ClaheTiles = claheTiles;
+		parameters.FaceMosaic = faceMosaic;
+		parameters.Interpolation = interpolation == 0 ? LutInterpolation::Trilinear : LutInterpolation::Tetrahedral;
+		parameters.Anonymise = anonymise == 0 ? AnonymiseMode::Pixelate : AnonymiseMode::Blur;
+		parameters.FaceModel = faceModel == 0 ? DetectionModel::Hog : DetectionModel::Cnn;
+		if (hasLut) {
+			parameters.Lut = Lut3D::LoadCube(path + LUT_EXTENSION, error);
+			if (!parameters.Lut) {
+				return false;
+			}
+		}
+		*this = std::move(chain);
+		return true;
+	}
+
+	bool FilterChain::Save(const std::string& path) const
+	{
+		if (Parameters.Lut && !Parameters.Lut->SaveCube(path + LUT_EXTENSION)) {
+			return false;
+		}
+		const std::string bytes = SerialiseChain(*this);
+		std::ofstream writer(path, std::ios::binary | std::ios::trunc);
+		writer.write(bytes.data(), bytes.size());
+		return static_cast<bool>(writer);
+	}
+
+	uint64_t FilterChain::GetHash() const
+	{
+		// FNV-1a
+		uint64_t hash = 0xCBF29CE484222325ull;
+		const auto add = [&](const char* data, size_t size) {
+			for (size_t i = 0; i < size; i++) {
+				hash = (hash ^ static_cast<uint8_t>(data[i])) * 0x100000001B3ull;
+			}
+		};
+		const std::string bytes = SerialiseChain(*this);
+		add(bytes.data(), bytes.size());
+		if (Parameters.Lut) {
+			const std::vector<float>& table = Parameters.Lut->GetTable();
+			add(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(float));
+		}
+		return hash;
+	}
+
+	FilterChainRenderer::FilterChainRenderer() = default;
+
+	FilterChainRenderer::~FilterChainRenderer() = default;
+
+	void FilterChainRenderer::Apply(const FilterChain& chain, uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		const FilterParameters& parameters = chain.Parameters;
+		std::vector<Filter> run;
+		for (size_t i = 0; i <= chain.Filters.size(); i++) {
+			// The LUT works on the bytes, so it ends a run like the filters that read their neighbours
+			const bool end = i == chain.Filters.size();
+			if (!end && IsPointwise(chain.Filters[i]) && chain.Filters[i] != Filter::Lut) {
+				run.push_back(chain.Filters[i]);
+				continue;
+			}
+			if (!run.empty()) {
+				ApplyPointwise(run, parameters, pixels, width, height);
+				run.clear();
+			}
+			if (end) break;
+
+			switch (chain.Filters[i])
+			{
+				case Filter::Lut:
+				{
+					if (parameters.Lut) {
+						parameters.Lut->Apply(pixels, pixels, width, height, parameters.Interpolation);
+					}
+					break;
+				}
+				case Filter::EdgeDetection:
+				{
+					ApplyEdgeDetection(pixels, width, height);
+					break;
+				}
+				case Filter::Pixelate:
+				{
+					// The shader takes the texel at the corner of every block of the grid
+					const uint32_t block = static_cast<uint32_t>(std::max(parameters.Mosaic, 1));
+					const uint32_t bands = (height + block - 1) / block;
+					ThreadPool::Get().ParallelFor(bands, [&](size_t band) {
+						const uint32_t top = static_cast<uint32_t>(band) * block;
+						const uint32_t bottom = std::min(height, top + block);
+						const uint8_t* corner = pixels + static_cast<size_t>(top) * width * 4;
+						for (uint32_t y = bottom; y-- > top;) {
+							uint8_t* row = pixels + static_cast<size_t>(y) * width * 4;
+							for (uint32_t x = width; x-- > 0;) {
+								std::memcpy(row + x * 4, corner + (x / block * block) * 4, 4);
+							}
+						}
+					});
+					break;
+				}
+				case Filter::GaussianBlur:
+				{
+					if (parameters.BlurSigma >= MIN_GAUSSIAN_SIGMA) {
+						m_Blur.Apply(pixels, pixels, width, height, parameters.BlurSigma);
+					}
+					break;
+				}
+				case Filter::Convolution:
+				{
+					m_Convolution.Apply(pixels, pixels, width, height, parameters.Kernel);
+					break;
+				}
+				case Filter::Median:
+				{
+					const uint32_t radius = static_cast<uint32_t>(std::clamp(parameters.MedianRadius, 0, static_cast<int>(MAX_MEDIAN_RADIUS)));
+					if (radius > 0) {
+						m_Median.Apply(pixels, pixels, width, height, 4, radius);
+					}
+					break;
+				}
+				case Filter::Bilateral:
+				{
+					m_Bilateral.Apply(pixels, pixels, width, height, 4, std::max(parameters.BilateralSpatial, MIN_BILATERAL_SPATIAL),
+						std::max(parameters.BilateralRange, MIN_BILATERAL_RANGE));
+					break;
+				}
+				case Filter::AutoLevels:
+				{
+					Histogram histogram;
+					histogram.Compute(pixels, width, height, 4);
+					ApplyLevels(pixels, pixels, width, height, 4, ComputeAutoLevels(histogram, parameters.LevelsClip));
+					break;
+				}
+				case Filter::Clahe:
+				{
+					const uint32_t tiles = std::clamp(static_cast<uint32_t>(std::max(parameters.ClaheTiles, 0)), MIN_CLAHE_TILES, MAX_CLAHE_TILES);
+					m_Clahe.Analyse(pixels, width, height, 4, tiles, parameters.ClaheClip);
+					m_Clahe.Apply(pixels, pixels, width, height, 4);
+					break;
+				}
+				case Filter::Anonymise:
+				{
+					ApplyAnonymise(parameters, pixels, width, height);
+					break;
+				}
+				default:
+					break;
+			}
+		}
+	}
+
+	// Same formulas as PixelShader.glsl, on colours in [0, 1] that stay unclamped within the run
+	void FilterChainRenderer::ApplyPointwise(const std::vector<Filter>& filters, const FilterParameters& parameters,
+		uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		const float contrast = (1.0156f * (parameters.Contrast + 1.0f)) / (1.0156f - parameters.Contrast);
+		const float angle = glm::radians(parameters.Angle);
+		const uint32_t chunks = (height + ROW_CHUNK - 1) / ROW_CHUNK;
+		ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+			const uint32_t last = std::min(height, static_cast<uint32_t>(chunk + 1) * ROW_CHUNK);
+			for (uint32_t y = static_cast<uint32_t>(chunk) * ROW_CHUNK; y < last; y++) {
+				uint8_t* row = pixels + static_cast<size_t>(y) * width * 4;
+				for (uint32_t x = 0; x < width; x++) {
+					uint8_t* pixel = row + x * 4;
+					glm::vec4 colour = glm::vec4(pixel[0], pixel[1], pixel[2], pixel[3]) / 255.0f;
+					for (Filter filter : filters) {
+						switch (filter)
+						{
+							case Filter::Negative:
+								colour = glm::vec4(1.0f - glm::vec3(colour), colour.a);
+								break;
+							case Filter::Grayscale:
+							{
+								const float gray = 0.2199f * colour.r + 0.7152f * colour.g + 0.0722f * colour.b;
+								colour = glm::vec4(gray, gray, gray, colour.a);
+								break;
+							}
+							case Filter::Sepia:
+								colour.r = std::min(255.0f, colour.r * 0.393f + colour.g * 0.769f + colour.b * 0.189f);
+								colour.g = std::min(255.0f, colour.r * 0.349f + colour.g * 0.686f + colour.b * 0.168f);
+								colour.b = std::min(255.0f, colour.r * 0.272f + colour.g * 0.534f + colour.b * 0.131f);
+								break;
+							case Filter::Brightness:
+								colour = glm::vec4(glm::clamp(glm::vec3(colour) * parameters.Brightness, 0.0f, 1.0f), colour.a);
+								break;
+							case Filter::Contrast:
+								colour = glm::vec4(glm::clamp(contrast * (glm::vec3(colour) - 0.5f) + 0.5f, 0.0f, 1.0f), colour.a);
+								break;
+							case Filter::Binary:
+							{
+								const float gray = 0.2199f * colour.r + 0.7152f * colour.g + 0.0722f * colour.b;
+								colour = glm::length(glm::vec4(gray, gray, gray, colour.a)) > parameters.Thresehold
+									? glm::vec4(1.0f) : glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+								break;
+							}
+							case Filter::Gradient:
+							{
+								const glm::vec2 uv = (glm::vec2((x + 0.5f) / width, (y + 0.5f) / height) - 0.5f) * 2.0f;
+								const float position = std::cos(angle + std::atan2(uv.y, uv.x)) * glm::length(uv) + 0.5f;
+								const glm::vec4 gradient = glm::mix(glm::vec4(parameters.StartColour, 1.0f), glm::vec4(parameters.EndColour, 1.0f),
+									glm::smoothstep(0.0f, 1.0f, position));
+								colour = glm::mix(colour, gradient, parameters.Intensity);
+								break;
+							}
+							default:
+								break;
+						}
+					}
+					colour = glm::clamp(colour, 0.0f, 1.0f) * 255.0f + 0.5f;
+					pixel[0] = static_cast<uint8_t>(colour.r);
+					pixel[1] = static_cast<uint8_t>(colour.g);
+					pixel[2] = static_cast<uint8_t>(colour.b);
+					pixel[3] = static_cast<uint8_t>(colour.a);
+				}
+			}
+		});
+	}
+
+	// Laplacian of the colour with the texels past the border reading as black, alpha becomes opaque
+	void FilterChainRenderer::ApplyEdgeDetection(uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		m_Scratch.assign(pixels, pixels + static_cast<size_t>(width) * height * 4);
+		const uint8_t* source = m_Scratch.data();
+		const uint32_t chunks = (height + ROW_CHUNK - 1) / ROW_CHUNK;
+		ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+			const uint32_t last = std::min(height, static_cast<uint32_t>(chunk + 1) * ROW_CHUNK);
+			for (uint32_t y = static_cast<uint32_t>(chunk) * ROW_CHUNK; y < last; y++) {
+				for (uint32_t x = 0; x < width; x++) {
+					int sums[3] = { 0, 0, 0 };
+					for (int dy = -1; dy <= 1; dy++) {
+						const int64_t sy = static_cast<int64_t>(y) + dy;
+						if (sy < 0 || sy >= height) continue;
+						for (int dx = -1; dx <= 1; dx++) {
+							const int64_t sx = static_cast<int64_t>(x) + dx;
+							if (sx < 0 || sx >= width) continue;
+							const uint8_t* sample = source + (static_cast<size_t>(sy) * width + static_cast<size_t>(sx)) * 4;
+							const int weight = dx == 0 && dy == 0 ? -8 : 1;
+							for (int c = 0; c < 3; c++) {
+								sums[c] += weight * sample[c];
+							}
+						}
+					}
+					uint8_t* pixel = pixels + (static_cast<size_t>(y) * width + x) * 4;
+					for (int c = 0; c < 3; c++) {
+						pixel[c] = static_cast<uint8_t>(std::clamp(sums[c], 0, 255));
+					}
+					pixel[3] = 255;
+				}
+			}
+		});
+	}
+
+	void FilterChainRenderer::ApplyAnonymise(const FilterParameters& parameters, uint8_t* pixels, uint32_t width, uint32_t height)
+	{
+		if (!m_FaceDetector) {
+			m_FaceDetector = std::make_unique<FaceDetector>();
+		}
+		if (m_FaceDetector->GetProfile().Model != parameters.FaceModel || m_FaceDetector->GetProfile().ThreadCount != 1) {
+			DetectionProfile profile;
+			profile.DetectionResolution = FACE_DETECTION_SIZE;
+			profile.MinFaceSize = MIN_FACE_SIZE;
+			// The callers already keep every core busy with other images
+			profile.ThreadCount = 1;
+			profile.Model = parameters.FaceModel;
+			m_FaceDetector->SetProfile(profile);
+		}
+
+		const size_t count = static_cast<size_t>(width) * height;
+		m_Scratch.resize(count * 3);
+		for (size_t i = 0; i < count; i++) {
+			m_Scratch[i * 3 + 0] = pixels[i * 4 + 0];
+			m_Scratch[i * 3 + 1] = pixels[i * 4 + 1];
+			m_Scratch[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+		std::vector<glm::vec4> bounds;
+		for (const dlib::rectangle& face : m_FaceDetector->Detect(m_Scratch.data(), width, height)) {
+			bounds.push_back(PadFace(face, parameters.FacePadding));
+		}
+		AnonymiseFaces(pixels, width, height, 4, bounds, parameters, 1.0f, m_Blur);
+	}
+}
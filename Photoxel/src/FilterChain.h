@@ -0,0 +1,58 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Filters.h"
+#include "Convolution.h"
+#include "Denoise.h"
+#include "GaussianBlur.h"
+#include "Histogram.h"
+
+namespace Photoxel
+{
+	class FaceDetector;
+
+	// The filters of a layer and their parameters, saved to a small binary file so a look built in
+	// the editor can be applied to other images. A LUT in the chain is saved next to it as a .cube
+	struct FilterChain {
+		std::vector<Filter> Filters;
+		FilterParameters Parameters;
+
+		bool Load(const std::string& path, std::string& error);
+		bool Save(const std::string& path) const;
+		// Changes with the filters and every parameter, a LUT by its table
+		uint64_t GetHash() const;
+	};
+
+	// Runs a filter chain on the CPU over RGBA8 pixels at full resolution, without a GL context, so
+	// any number of them can work in parallel. Runs of pointwise filters go through the shader
+	// formulas in float and are clamped at the end of the run like a render target would, the rest
+	// use the CPU engines of the render graph. Not thread safe, keep one per thread
+	class FilterChainRenderer
+	{
+	public:
+		FilterChainRenderer();
+		~FilterChainRenderer();
+
+		FilterChainRenderer(const FilterChainRenderer&) = delete;
+		FilterChainRenderer& operator=(const FilterChainRenderer&) = delete;
+
+		void Apply(const FilterChain& chain, uint8_t* pixels, uint32_t width, uint32_t height);
+	private:
+		void ApplyPointwise(const std::vector<Filter>& filters, const FilterParameters& parameters,
+			uint8_t* pixels, uint32_t width, uint32_t height);
+		void ApplyEdgeDetection(uint8_t* pixels, uint32_t width, uint32_t height);
+		void ApplyAnonymise(const FilterParameters& parameters, uint8_t* pixels, uint32_t width, uint32_t height);
+
+		GaussianBlur m_Blur;
+		ConvolutionEngine m_Convolution;
+		MedianFilter m_Median;
+		BilateralGrid m_Bilateral;
+		Clahe m_Clahe;
+		// Created the first time a chain anonymises faces
+		std::unique_ptr<FaceDetector> m_FaceDetector;
+		std::vector<uint8_t> m_Scratch;
+	};
+}
@@ -1,5 +1,12 @@
 #pragma once
 
+#include <vector>
+#include <algorithm>
+#include <memory>
+#include <glm/glm.hpp>
+#include "Convolution.h"
+#include "Lut3D.h"
+
 namespace Photoxel {
 
 	enum class Filter {
@@ -12,7 +19,108 @@ namespace Photoxel {
 		Binary = 7,
 		GaussianBlur = 8,
 		Gradient = 9,
-		Pixelate = 10
+		Pixelate = 10,
+		Convolution = 11,
+		Lut = 12,
+		Median = 13,
+		Bilateral = 14,
+		AutoLevels = 15,
+		Clahe = 16,
+		Anonymise = 17
+	};
+
+	enum class AnonymiseMode {
+		Pixelate,
+		Blur
+	};
+
+	// HOG is fast and finds frontal faces, the CNN also finds profile and small faces at a few times the cost
+	enum class DetectionModel {
+		Hog = 0,
+		Cnn = 1
+	};
+
+	// Values read by the filter uniforms, every section keeps its own set
+	struct FilterParameters {
+		float Brightness = 0.0f;
+		float Contrast = 0.0f;
+		float Thresehold = 0.0f;
+		int Mosaic = 10;
+		glm::vec3 StartColour = glm::vec3(1, 0, 0), EndColour = glm::vec3(0, 1, 0);
+		float Angle = 90.0f, Intensity = 0.5f;
+		float BlurSigma = 2.0f;
+		ConvolutionKernel Kernel = ConvolutionKernel::FromPreset(KernelPreset::Sharpen);
+		// Shared with the copies taken for rendering, an empty table renders as the identity
+		std::shared_ptr<const Lut3D> Lut;
+		LutInterpolation Interpolation = LutInterpolation::Tetrahedral;
+		// In source pixels like the blur sigma, the range is a fraction of the intensity range
+		int MedianRadius = 2;
+		float BilateralSpatial = 8.0f, BilateralRange = 0.1f;
+		// Percentage of the samples clipped at each end, and the tile grid and contrast limit of CLAHE
+		float LevelsClip = 0.5f;
+		int ClaheTiles = 8;
+		float ClaheClip = 2.0f;
+		// Detected faces are pixelated or blurred, block size and sigma in source pixels. Padding
+		// grows every face by a fraction of its size so hair and chin are covered too
+		AnonymiseMode Anonymise = AnonymiseMode::Pixelate;
+		int FaceMosaic = 16;
+		float FaceBlurSigma = 12.0f;
+		float FacePadding = 0.2f;
+		DetectionModel FaceModel = DetectionModel::Hog;
+
+		bool operator==(const FilterParameters& other) const
+		{
+			return Brightness == other.Brightness && Contrast == other.Contrast && Thresehold == other.Thresehold
+				&& Mosaic == other.Mosaic && StartColour == other.StartColour && EndColour == other.EndColour
+				&& Angle == other.Angle && Intensity == other.Intensity && BlurSigma == other.BlurSigma
+				&& Kernel == other.Kernel && Lut == other.Lut && Interpolation == other.Interpolation
+				&& MedianRadius == other.MedianRadius && BilateralSpatial == other.BilateralSpatial
+				&& BilateralRange == other.BilateralRange && LevelsClip == other.LevelsClip
+				&& ClaheTiles == other.ClaheTiles && ClaheClip == other.ClaheClip
+				&& Anonymise == other.Anonymise && FaceMosaic == other.FaceMosaic
+				&& FaceBlurSigma == other.FaceBlurSigma && FacePadding == other.FacePadding
+				&& FaceModel == other.FaceModel;
+		}
+
+		bool operator!=(const FilterParameters& other) const
+		{
+			return !(*this == other);
+		}
 	};
 
+	// Pointwise filters only read the pixel they write, so a run of them fits in one shader.
+	// The rest sample their neighbours and need the previous filters already rendered
+	inline bool IsPointwise(Filter filter)
+	{
+		switch (filter)
+		{
+			case Filter::EdgeDetection:
+			case Filter::GaussianBlur:
+			case Filter::Pixelate:
+			case Filter::Convolution:
+			case Filter::Median:
+			case Filter::Bilateral:
+			// Both read statistics of the whole image
+			case Filter::AutoLevels:
+			case Filter::Clahe:
+			// Finds the faces in the whole image first
+			case Filter::Anonymise:
+				return false;
+			default:
+				return true;
+		}
+	}
+
+	// Pointwise filters whose result depends on the colour alone, a run of them can be baked
+	// into a single 3D LUT. The gradient also reads the position of the pixel
+	inline bool IsColourOnly(Filter filter)
+	{
+		return IsPointwise(filter) && filter != Filter::Gradient;
+	}
+
+	inline bool HasFilter(const std::vector<Filter>& chain, Filter filter)
+	{
+		return std::find(chain.begin(), chain.end(), filter) != chain.end();
+	}
+
 }
\ No newline at end of file
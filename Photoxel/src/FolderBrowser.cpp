@@ -0,0 +1,203 @@
+#include "FolderBrowser.h"
+#include "ImageFolder.h"
+#include "stb_image.h"
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+namespace Photoxel
+{
+	FolderBrowser::FolderBrowser()
+	{
+		m_Thread = std::thread(&FolderBrowser::PrefetchLoop, this);
+	}
+
+	FolderBrowser::~FolderBrowser()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+		m_Moved.notify_all();
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void FolderBrowser::Open(const std::string& path)
+	{
+		std::error_code error;
+		const std::string current = std::filesystem::absolute(path, error).string();
+		std::vector<std::string> images = FindImages(std::filesystem::path(current).parent_path().string(), false);
+		auto found = std::lower_bound(images.begin(), images.end(), current);
+		if (found == images.end() || *found != current) {
+			found = images.insert(found, current);
+		}
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Index = static_cast<size_t>(found - images.begin());
+			m_Images = std::move(images);
+			m_Direction = 1;
+			m_Generation++;
+		}
+		m_Moved.notify_all();
+	}
+
+	bool FolderBrowser::Step(int offset)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			if (m_Images.empty() || offset == 0) {
+				return false;
+			}
+			const int64_t index = std::clamp<int64_t>(static_cast<int64_t>(m_Index) + offset, 0, static_cast<int64_t>(m_Images.size()) - 1);
+			if (static_cast<size_t>(index) == m_Index) {
+				return false;
+			}
+			m_Index = static_cast<size_t>(index);
+			m_Direction = offset > 0 ? 1 : -1;
+			m_Generation++;
+		}
+		m_Moved.notify_all();
+		return true;
+	}
+
+	std::shared_ptr<const DecodedImage> FolderBrowser::Acquire()
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		std::string path;
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			if (m_Images.empty()) {
+				return nullptr;
+			}
+			path = m_Images[m_Index];
+			m_Prefetched.wait(lock, [&]() { return m_Prefetching != path; });
+		}
+
+		std::shared_ptr<const DecodedImage> image = m_Cache.Find(path);
+		if (image && image->Modified == GetModifiedTime(path)) {
+			m_Hits++;
+		}
+		else {
+			m_Misses++;
+			image = DecodeImageFile(path);
+			if (image) {
+				m_Cache.Insert(image);
+			}
+		}
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_LastAcquireTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return image;
+	}
+
+	void FolderBrowser::PrefetchLoop()
+	{
+		uint64_t finished = 0;
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		while (true) {
+			m_Moved.wait(lock, [&]() { return m_Stop || m_Generation != finished; });
+			if (m_Stop) {
+				return;
+			}
+
+			// Nearest first, alternating ahead and behind
+			const uint64_t generation = m_Generation;
+			std::vector<std::string> wanted = { m_Images[m_Index] };
+			for (size_t step = 1; step <= std::max(PREFETCH_AHEAD, PREFETCH_BEHIND); step++) {
+				for (const int64_t direction : { static_cast<int64_t>(m_Direction), static_cast<int64_t>(-m_Direction) }) {
+					const int64_t index = static_cast<int64_t>(m_Index) + direction * static_cast<int64_t>(step);
+					if (step <= (direction == m_Direction ? PREFETCH_AHEAD : PREFETCH_BEHIND)
+						&& index >= 0 && index < static_cast<int64_t>(m_Images.size())) {
+						wanted.push_back(m_Images[static_cast<size_t>(index)]);
+					}
+				}
+			}
+			lock.unlock();
+
+			// Touched least wanted first, so the cache drops the images that are not wanted at all
+			// and then the farthest ones
+			for (auto it = wanted.rbegin(); it != wanted.rend(); ++it) {
+				m_Cache.Find(*it);
+			}
+			size_t wantedBytes = 0;
+			for (size_t i = 0; i < wanted.size() && m_Generation == generation; i++) {
+				std::shared_ptr<const DecodedImage> cached = m_Cache.Peek(wanted[i]);
+				size_t bytes = 0;
+				int width = 0, height = 0, channels = 0;
+				if (cached) {
+					bytes = cached->GetSize();
+				}
+				else if (stbi_info(wanted[i].c_str(), &width, &height, &channels)) {
+					bytes = static_cast<size_t>(width) * height * 4;
+				}
+				else {
+					continue;
+				}
+				if (wantedBytes + bytes > m_Cache.GetBudget()) break;
+				wantedBytes += bytes;
+				// The current image is decoded by Acquire
+				if (cached || i == 0) continue;
+
+				lock.lock();
+				m_Prefetching = wanted[i];
+				lock.unlock();
+				std::shared_ptr<const DecodedImage> image = DecodeImageFile(wanted[i]);
+				if (image) {
+					m_Cache.Insert(image);
+				}
+				lock.lock();
+				m_Prefetching.clear();
+				m_Prefetched.notify_all();
+				lock.unlock();
+			}
+
+			lock.lock();
+			finished = generation;
+		}
+	}
+
+	bool FolderBrowser::IsOpen() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return !m_Images.empty();
+	}
+
+	size_t FolderBrowser::GetIndex() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Index;
+	}
+
+	std::string FolderBrowser::GetPath() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Images.empty() ? std::string() : m_Images[m_Index];
+	}
+
+	size_t FolderBrowser::GetCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Images.size();
+	}
+
+	ImageCache& FolderBrowser::GetCache()
+	{
+		return m_Cache;
+	}
+
+	uint64_t FolderBrowser::GetHits() const
+	{
+		return m_Hits;
+	}
+
+	uint64_t FolderBrowser::GetMisses() const
+	{
+		return m_Misses;
+	}
+
+	double FolderBrowser::GetLastAcquireTime() const
+	{
+		return m_LastAcquireTime;
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "ImageCache.h"
+
+namespace Photoxel
+{
+	// Images decoded ahead of the current one in the direction the user is moving, and behind it
+	static constexpr size_t PREFETCH_AHEAD = 3;
+	static constexpr size_t PREFETCH_BEHIND = 1;
+
+	// Steps through the images of a folder in name order. A thread of its own decodes the neighbours
+	// of the current image into the cache, nearest first, as long as they fit in its budget along
+	// with the current one, so stepping to them only uploads the pixels
+	class FolderBrowser
+	{
+	public:
+		FolderBrowser();
+		~FolderBrowser();
+
+		FolderBrowser(const FolderBrowser&) = delete;
+		FolderBrowser& operator=(const FolderBrowser&) = delete;
+
+		// Lists the images next to path, which becomes the current one
+		void Open(const std::string& path);
+		// Moves by offset within the folder, false when already at that end
+		bool Step(int offset);
+		// The current image, from the cache when it was prefetched and decoded on the calling thread
+		// otherwise. A prefetch of it already under way is waited for. Null when it cannot be read
+		std::shared_ptr<const DecodedImage> Acquire();
+
+		bool IsOpen() const;
+		size_t GetIndex() const;
+		// Path of the current image, empty when no folder is open
+		std::string GetPath() const;
+		size_t GetCount() const;
+		ImageCache& GetCache();
+		// Acquires served by the cache and the ones that had to decode
+		uint64_t GetHits() const;
+		uint64_t GetMisses() const;
+		double GetLastAcquireTime() const;
+	private:
+		void PrefetchLoop();
+
+		ImageCache m_Cache;
+		std::thread m_Thread;
+		mutable std::mutex m_Mutex;
+		// Wakes the prefetcher when the current image moves, and Acquire when a prefetch finished
+		std::condition_variable m_Moved, m_Prefetched;
+		std::vector<std::string> m_Images;
+		size_t m_Index = 0;
+		int m_Direction = 1;
+		// Bumped by every move, a prefetch pass for an older one stops early
+		std::atomic<uint64_t> m_Generation{ 0 };
+		// Path the prefetcher is decoding, empty when idle
+		std::string m_Prefetching;
+		bool m_Stop = false;
+		uint64_t m_Hits = 0, m_Misses = 0;
+		double m_LastAcquireTime = 0.0;
+	};
+}
@@ -0,0 +1,191 @@
+#include "GaussianBlur.h"
+#include "ThreadPool.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace Photoxel
+{
+	// Rows handed to one pool task, and the pixel block size of the transposes
+	static constexpr uint32_t ROWS_PER_TASK = 16;
+	static constexpr uint32_t TRANSPOSE_BLOCK = 32;
+
+	struct RecursiveCoefficients {
+		float B, C1, C2, C3;
+	};
+
+	// "Recursive implementation of the Gaussian filter", Young and van Vliet 1995
+	static RecursiveCoefficients ComputeCoefficients(float sigma)
+	{
+		const double s = sigma;
+		const double q = s >= 2.5 ? 0.98711 * s - 0.96330 : 3.97156 - 4.14554 * std::sqrt(1.0 - 0.26891 * s);
+		const double q2 = q * q, q3 = q2 * q;
+		const double b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+		const double b1 = 2.44413 * q + 2.85619 * q2 + 1.26661 * q3;
+		const double b2 = -(1.4281 * q2 + 1.26661 * q3);
+		const double b3 = 0.422205 * q3;
+
+		RecursiveCoefficients coefficients;
+		coefficients.C1 = static_cast<float>(b1 / b0);
+		coefficients.C2 = static_cast<float>(b2 / b0);
+		coefficients.C3 = static_cast<float>(b3 / b0);
+		coefficients.B = 1.0f - (coefficients.C1 + coefficients.C2 + coefficients.C3);
+		return coefficients;
+	}
+
+	// Filters LINES lines of RGBA float pixels in place. The lines are interleaved so their
+	// recursions, each one a long dependency chain, overlap in the pipeline. The edges start
+	// from the steady state of a constant signal, as if the border pixel was replicated forever
+	template <uint32_t LINES>
+	static void FilterLines(float* const* lines, uint32_t count, const RecursiveCoefficients& coefficients)
+	{
+		const __m128 b = _mm_set1_ps(coefficients.B);
+		const __m128 c1 = _mm_set1_ps(coefficients.C1);
+		const __m128 c2 = _mm_set1_ps(coefficients.C2);
+		const __m128 c3 = _mm_set1_ps(coefficients.C3);
+
+		__m128 w1[LINES], w2[LINES], w3[LINES];
+		for (uint32_t l = 0; l < LINES; l++) {
+			w1[l] = w2[l] = w3[l] = _mm_loadu_ps(lines[l]);
+		}
+		for (uint32_t i = 0; i < count; i++) {
+			for (uint32_t l = 0; l < LINES; l++) {
+				__m128 w = _mm_mul_ps(b, _mm_loadu_ps(lines[l] + i * 4));
+				w = _mm_add_ps(w, _mm_add_ps(_mm_mul_ps(c1, w1[l]), _mm_add_ps(_mm_mul_ps(c2, w2[l]), _mm_mul_ps(c3, w3[l]))));
+				_mm_storeu_ps(lines[l] + i * 4, w);
+				w3[l] = w2[l];
+				w2[l] = w1[l];
+				w1[l] = w;
+			}
+		}
+
+		for (uint32_t l = 0; l < LINES; l++) {
+			w2[l] = w3[l] = w1[l];
+		}
+		for (uint32_t i = count; i-- > 0;) {
+			for (uint32_t l = 0; l < LINES; l++) {
+				__m128 w = _mm_mul_ps(b, _mm_loadu_ps(lines[l] + i * 4));
+				w = _mm_add_ps(w, _mm_add_ps(_mm_mul_ps(c1, w1[l]), _mm_add_ps(_mm_mul_ps(c2, w2[l]), _mm_mul_ps(c3, w3[l]))));
+				_mm_storeu_ps(lines[l] + i * 4, w);
+				w3[l] = w2[l];
+				w2[l] = w1[l];
+				w1[l] = w;
+			}
+		}
+	}
+
+	static void FilterImage(float* pixels, uint32_t length, uint32_t lines, const RecursiveCoefficients& coefficients)
+	{
+		const uint32_t tasks = (lines + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+		ThreadPool::Get().ParallelFor(tasks, [&](size_t task) {
+			const uint32_t first = static_cast<uint32_t>(task) * ROWS_PER_TASK;
+			const uint32_t last = std::min(first + ROWS_PER_TASK, lines);
+			float* group[4];
+			uint32_t line = first;
+			for (; line + 4 <= last; line += 4) {
+				for (uint32_t l = 0; l < 4; l++) {
+					group[l] = pixels + static_cast<size_t>(line + l) * length * 4;
+				}
+				FilterLines<4>(group, length, coefficients);
+			}
+			for (; line < last; line++) {
+				group[0] = pixels + static_cast<size_t>(line) * length * 4;
+				FilterLines<1>(group, length, coefficients);
+			}
+		});
+	}
+
+	// Transposes a width x height image of float4 pixels one block at a time so both the
+	// reads and the writes stay within a few cache lines
+	static void Transpose(const float* src, float* dst, uint32_t width, uint32_t height)
+	{
+		const uint32_t blockRows = (height + TRANSPOSE_BLOCK - 1) / TRANSPOSE_BLOCK;
+		ThreadPool::Get().ParallelFor(blockRows, [&](size_t block) {
+			const uint32_t y0 = static_cast<uint32_t>(block) * TRANSPOSE_BLOCK;
+			const uint32_t y1 = std::min(y0 + TRANSPOSE_BLOCK, height);
+			for (uint32_t x0 = 0; x0 < width; x0 += TRANSPOSE_BLOCK) {
+				const uint32_t x1 = std::min(x0 + TRANSPOSE_BLOCK, width);
+				for (uint32_t y = y0; y < y1; y++) {
+					const float* row = src + static_cast<size_t>(y) * width * 4;
+					for (uint32_t x = x0; x < x1; x++) {
+						_mm_storeu_ps(dst + (static_cast<size_t>(x) * height + y) * 4, _mm_loadu_ps(row + x * 4));
+					}
+				}
+			}
+		});
+	}
+
+	void ComputeGaussianTaps(float sigma, std::vector<float>& offsets, std::vector<float>& weights)
+	{
+		sigma = std::clamp(sigma, MIN_GAUSSIAN_SIGMA, MAX_GPU_GAUSSIAN_SIGMA);
+		const int radius = static_cast<int>(std::ceil(sigma * 3.0f));
+
+		std::vector<float> kernel(radius + 1);
+		float sum = 0.0f;
+		for (int i = 0; i <= radius; i++) {
+			kernel[i] = std::exp(-static_cast<float>(i * i) / (2.0f * sigma * sigma));
+			sum += (i == 0) ? kernel[i] : 2.0f * kernel[i];
+		}
+		for (float& weight : kernel) {
+			weight /= sum;
+		}
+
+		offsets.assign(1, 0.0f);
+		weights.assign(1, kernel[0]);
+		for (int i = 1; i <= radius; i += 2) {
+			const float a = kernel[i];
+			const float b = (i + 1 <= radius) ? kernel[i + 1] : 0.0f;
+			offsets.push_back((i * a + (i + 1) * b) / (a + b));
+			weights.push_back(a + b);
+		}
+	}
+
+	void GaussianBlur::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, float sigma)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		if (width == 0 || height == 0) return;
+		const RecursiveCoefficients coefficients = ComputeCoefficients(std::max(sigma, MIN_GAUSSIAN_SIGMA));
+		const size_t size = static_cast<size_t>(width) * height * 4;
+		m_Pixels.resize(size);
+		m_Transposed.resize(size);
+
+		ThreadPool& pool = ThreadPool::Get();
+		const uint32_t tasks = (height + ROWS_PER_TASK - 1) / ROWS_PER_TASK;
+		pool.ParallelFor(tasks, [&](size_t task) {
+			const size_t first = task * ROWS_PER_TASK * width * 4;
+			const size_t last = std::min(first + static_cast<size_t>(ROWS_PER_TASK) * width * 4, size);
+			const __m128i zero = _mm_setzero_si128();
+			for (size_t i = first; i < last; i += 4) {
+				const __m128i pixel = _mm_cvtsi32_si128(*reinterpret_cast<const int*>(src + i));
+				const __m128i wide = _mm_unpacklo_epi16(_mm_unpacklo_epi8(pixel, zero), zero);
+				_mm_storeu_ps(m_Pixels.data() + i, _mm_cvtepi32_ps(wide));
+			}
+		});
+
+		// Rows, then the columns as rows of the transposed image
+		FilterImage(m_Pixels.data(), width, height, coefficients);
+		Transpose(m_Pixels.data(), m_Transposed.data(), width, height);
+		FilterImage(m_Transposed.data(), height, width, coefficients);
+		Transpose(m_Transposed.data(), m_Pixels.data(), height, width);
+
+		pool.ParallelFor(tasks, [&](size_t task) {
+			const size_t first = task * ROWS_PER_TASK * width * 4;
+			const size_t last = std::min(first + static_cast<size_t>(ROWS_PER_TASK) * width * 4, size);
+			for (size_t i = first; i < last; i += 4) {
+				const __m128i value = _mm_cvtps_epi32(_mm_loadu_ps(m_Pixels.data() + i));
+				const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(value, value), value);
+				*reinterpret_cast<int*>(dst + i) = _mm_cvtsi128_si32(packed);
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastBlurTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	double GaussianBlur::GetLastBlurTime() const
+	{
+		return m_LastBlurTime;
+	}
+}
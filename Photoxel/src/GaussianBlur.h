@@ -0,0 +1,36 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+
+namespace Photoxel
+{
+	// Must match the uniform arrays in BlurPixelShader.glsl
+	static constexpr int MAX_GAUSSIAN_TAPS = 32;
+	static constexpr float MIN_GAUSSIAN_SIGMA = 0.5f;
+	// Largest sigma whose 3 sigma kernel still fits in MAX_GAUSSIAN_TAPS linear taps,
+	// wider blurs run on the CPU engine
+	static constexpr float MAX_GPU_GAUSSIAN_SIGMA = 20.0f;
+
+	// Taps for one separable GPU pass. Tap 0 is the centre texel, every other tap sits between
+	// two texels so bilinear filtering fetches both with a single read
+	void ComputeGaussianTaps(float sigma, std::vector<float>& offsets, std::vector<float>& weights);
+
+	// Young - van Vliet recursive Gaussian. Each pass is a third order forward and backward
+	// filter, so the cost per pixel does not depend on sigma. Rows run on the thread pool and
+	// columns are filtered as rows of a block transposed copy
+	class GaussianBlur
+	{
+	public:
+		GaussianBlur() = default;
+
+		// RGBA8 in and out, src and dst may be the same buffer
+		void Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, float sigma);
+
+		double GetLastBlurTime() const;
+	private:
+		// Four floats per pixel, RGBA
+		std::vector<float> m_Pixels, m_Transposed;
+		double m_LastBlurTime = 0.0;
+	};
+}
@@ -0,0 +1,216 @@
+#include "Histogram.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+
+namespace Photoxel
+{
+	// Rows counted by one task of the histogram, the merge costs 4 x 256 adds per band
+	static constexpr uint32_t HISTOGRAM_BAND = 64;
+
+	// Integer BT.601 weights, they sum to 256
+	static inline uint8_t Luma(const uint8_t* pixel)
+	{
+		return static_cast<uint8_t>((77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> 8);
+	}
+
+	void Histogram::Compute(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels)
+	{
+		*this = Histogram();
+		Count = static_cast<uint64_t>(width) * height;
+
+		std::mutex mutex;
+		const size_t stride = static_cast<size_t>(width) * channels;
+		const uint32_t bands = (height + HISTOGRAM_BAND - 1) / HISTOGRAM_BAND;
+		ThreadPool::Get().ParallelFor(bands, [&](size_t band) {
+			Histogram local;
+			const uint32_t y0 = static_cast<uint32_t>(band) * HISTOGRAM_BAND;
+			const uint32_t y1 = std::min(y0 + HISTOGRAM_BAND, height);
+			for (uint32_t y = y0; y < y1; y++) {
+				const uint8_t* pixel = pixels + y * stride;
+				for (uint32_t x = 0; x < width; x++, pixel += channels) {
+					local.Red[pixel[0]]++;
+					local.Green[pixel[1]]++;
+					local.Blue[pixel[2]]++;
+					local.Luminance[Luma(pixel)]++;
+				}
+			}
+
+			std::lock_guard<std::mutex> lock(mutex);
+			for (uint32_t i = 0; i < 256; i++) {
+				Red[i] += local.Red[i];
+				Green[i] += local.Green[i];
+				Blue[i] += local.Blue[i];
+				Luminance[i] += local.Luminance[i];
+			}
+		});
+	}
+
+	uint8_t Histogram::Percentile(const HistogramBins& bins, uint64_t count, float fraction)
+	{
+		const uint64_t target = static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0f, 1.0f) * count));
+		uint64_t sum = 0;
+		for (uint32_t i = 0; i < 256; i++) {
+			sum += bins[i];
+			if (sum >= target && sum > 0) return static_cast<uint8_t>(i);
+		}
+		return 255;
+	}
+
+	LevelsTable ComputeAutoLevels(const Histogram& histogram, float clip)
+	{
+		const float fraction = std::clamp(clip, 0.0f, 49.0f) / 100.0f;
+		const HistogramBins* channels[] = { &histogram.Red, &histogram.Green, &histogram.Blue };
+		LevelsTable table;
+		for (uint32_t c = 0; c < 3; c++) {
+			const int black = Histogram::Percentile(*channels[c], histogram.Count, fraction);
+			const int white = Histogram::Percentile(*channels[c], histogram.Count, 1.0f - fraction);
+			for (int value = 0; value < 256; value++) {
+				// A flat channel has nothing to stretch
+				if (white <= black) {
+					table[c][value] = static_cast<uint8_t>(value);
+					continue;
+				}
+				const float stretched = (value - black) * 255.0f / (white - black);
+				table[c][value] = static_cast<uint8_t>(std::clamp(stretched + 0.5f, 0.0f, 255.0f));
+			}
+		}
+		return table;
+	}
+
+	void ApplyLevels(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels, const LevelsTable& table)
+	{
+		const size_t stride = static_cast<size_t>(width) * channels;
+		ThreadPool::Get().ParallelFor(height, [&](size_t y) {
+			const uint8_t* in = src + y * stride;
+			uint8_t* out = dst + y * stride;
+			for (uint32_t x = 0; x < width; x++, in += channels, out += channels) {
+				out[0] = table[0][in[0]];
+				out[1] = table[1][in[1]];
+				out[2] = table[2][in[2]];
+				if (channels == 4) out[3] = in[3];
+			}
+		});
+	}
+
+	void Clahe::Analyse(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels, uint32_t tiles, float clipLimit)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		tiles = std::clamp(tiles, MIN_CLAHE_TILES, MAX_CLAHE_TILES);
+		m_TilesX = std::min(tiles, width);
+		m_TilesY = std::min(tiles, height);
+		m_Curves.resize(static_cast<size_t>(m_TilesX) * m_TilesY * 256);
+		const size_t stride = static_cast<size_t>(width) * channels;
+
+		ThreadPool::Get().ParallelFor(static_cast<size_t>(m_TilesX) * m_TilesY, [&](size_t tile) {
+			const uint32_t tx = static_cast<uint32_t>(tile % m_TilesX), ty = static_cast<uint32_t>(tile / m_TilesX);
+			const uint32_t x0 = tx * width / m_TilesX, x1 = (tx + 1) * width / m_TilesX;
+			const uint32_t y0 = ty * height / m_TilesY, y1 = (ty + 1) * height / m_TilesY;
+
+			HistogramBins bins{};
+			for (uint32_t y = y0; y < y1; y++) {
+				const uint8_t* pixel = pixels + y * stride + static_cast<size_t>(x0) * channels;
+				for (uint32_t x = x0; x < x1; x++, pixel += channels) {
+					bins[Luma(pixel)]++;
+				}
+			}
+
+			// Whatever goes over the limit is spread over every bin, the remainder one bin at a time
+			const uint32_t count = (x1 - x0) * (y1 - y0);
+			const uint32_t limit = std::max(1u, static_cast<uint32_t>(std::max(clipLimit, 1.0f) * count / 256.0f));
+			uint32_t excess = 0;
+			for (uint32_t& bin : bins) {
+				if (bin > limit) {
+					excess += bin - limit;
+					bin = limit;
+				}
+			}
+			const uint32_t spread = excess / 256;
+			const uint32_t step = std::max(1u, 256 / std::max(1u, excess % 256));
+			uint32_t remainder = excess % 256;
+			for (uint32_t i = 0; i < 256; i++) {
+				bins[i] += spread;
+			}
+			for (uint32_t i = 0; i < 256 && remainder > 0; i += step, remainder--) {
+				bins[i]++;
+			}
+
+			uint8_t* curve = m_Curves.data() + tile * 256;
+			// sum * 255 overflows 32 bits once a tile passes 16.8 megapixels, full resolution runs get there
+			uint64_t sum = 0;
+			for (uint32_t i = 0; i < 256; i++) {
+				sum += bins[i];
+				curve[i] = static_cast<uint8_t>(std::min<uint64_t>(255, (sum * 255 + count / 2) / std::max(count, 1u)));
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastAnalysisTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void Clahe::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels,
+		const glm::vec4& rect)
+	{
+		if (m_Curves.empty()) return;
+
+		auto start = std::chrono::high_resolution_clock::now();
+
+		// Curves sit at the tile centres, beyond the outer centres the nearest curve is used alone
+		struct Blend {
+			uint32_t First, Second;
+			float Weight;
+		};
+		auto blend = [](float position, uint32_t tiles) {
+			const float t = std::clamp(position * tiles - 0.5f, 0.0f, tiles - 1.0f);
+			const uint32_t first = std::min(static_cast<uint32_t>(t), tiles - 1);
+			return Blend{ first, std::min(first + 1, tiles - 1), t - first };
+		};
+
+		std::vector<Blend> columns(width);
+		for (uint32_t x = 0; x < width; x++) {
+			columns[x] = blend(rect.x + (x + 0.5f) / width * (rect.z - rect.x), m_TilesX);
+		}
+
+		const size_t stride = static_cast<size_t>(width) * channels;
+		ThreadPool::Get().ParallelFor(height, [&](size_t y) {
+			const Blend row = blend(rect.y + (y + 0.5f) / height * (rect.w - rect.y), m_TilesY);
+			const uint8_t* top = m_Curves.data() + static_cast<size_t>(row.First) * m_TilesX * 256;
+			const uint8_t* bottom = m_Curves.data() + static_cast<size_t>(row.Second) * m_TilesX * 256;
+			const uint8_t* in = src + y * stride;
+			uint8_t* out = dst + y * stride;
+			for (uint32_t x = 0; x < width; x++, in += channels, out += channels) {
+				const Blend& column = columns[x];
+				const uint8_t luma = Luma(in);
+				const float upper = top[column.First * 256 + luma] + (top[column.Second * 256 + luma] - top[column.First * 256 + luma]) * column.Weight;
+				const float lower = bottom[column.First * 256 + luma] + (bottom[column.Second * 256 + luma] - bottom[column.First * 256 + luma]) * column.Weight;
+				const float mapped = upper + (lower - upper) * row.Weight;
+
+				if (luma == 0) {
+					out[0] = out[1] = out[2] = static_cast<uint8_t>(mapped + 0.5f);
+				}
+				else {
+					const float gain = mapped / luma;
+					for (uint32_t c = 0; c < 3; c++) {
+						out[c] = static_cast<uint8_t>(std::min(in[c] * gain + 0.5f, 255.0f));
+					}
+				}
+				if (channels == 4) out[3] = in[3];
+			}
+		});
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	double Clahe::GetLastAnalysisTime() const
+	{
+		return m_LastAnalysisTime;
+	}
+
+	double Clahe::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <inttypes.h>
+#include <array>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace Photoxel
+{
+	static constexpr uint32_t MIN_CLAHE_TILES = 2;
+	static constexpr uint32_t MAX_CLAHE_TILES = 16;
+
+	using HistogramBins = std::array<uint32_t, 256>;
+
+	// 256 bin histograms of the colour channels and of the luminance of packed RGB (channels = 3)
+	// or RGBA (channels = 4) pixels. Bands of rows are counted on the thread pool and merged
+	struct Histogram {
+		HistogramBins Red{}, Green{}, Blue{}, Luminance{};
+		uint64_t Count = 0;
+
+		void Compute(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels);
+
+		// Smallest value with at least fraction of the samples at or below it
+		static uint8_t Percentile(const HistogramBins& bins, uint64_t count, float fraction);
+	};
+
+	// Per channel tables stretching the values between the clip and 100 - clip percentiles to the
+	// full range, clip is a percentage
+	using LevelsTable = std::array<std::array<uint8_t, 256>, 3>;
+	LevelsTable ComputeAutoLevels(const Histogram& histogram, float clip);
+	void ApplyLevels(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels, const LevelsTable& table);
+
+	// Contrast limited adaptive histogram equalization of the luminance. Every tile of a grid gets
+	// its own equalization curve, clipped at clipLimit times the flat histogram, and pixels blend
+	// the curves of the four tiles around them. Colours are scaled with their luminance
+	class Clahe
+	{
+	public:
+		Clahe() = default;
+
+		// Builds the curves from the whole image, one tile per task
+		void Analyse(const uint8_t* pixels, uint32_t width, uint32_t height, uint32_t channels, uint32_t tiles, float clipLimit);
+		// Maps an image of any size covering rect (x0, y0, x1, y1) of the analysed one in texture
+		// coordinates, so crops and proxies blend the same curves at the same places
+		void Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, uint32_t channels,
+			const glm::vec4& rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+
+		double GetLastAnalysisTime() const;
+		double GetLastTime() const;
+	private:
+		uint32_t m_TilesX = 0, m_TilesY = 0;
+		// 256 entries per tile, row major
+		std::vector<uint8_t> m_Curves;
+		double m_LastAnalysisTime = 0.0, m_LastTime = 0.0;
+	};
+}
@@ -0,0 +1,361 @@
+#include "History.h"
+#include "Image.h"
+#include "Lz4.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <unordered_set>
+
+namespace Photoxel
+{
+	HistoryTile::HistoryTile(std::vector<uint8_t> pixels, uint64_t revision)
+		: m_Data(std::move(pixels)), m_Size(m_Data.size()), m_Revision(revision)
+	{
+	}
+
+	void HistoryTile::Compress()
+	{
+		if (!m_Compressed) {
+			m_Data = Lz4Compress(m_Data.data(), m_Size);
+			m_Compressed = true;
+		}
+	}
+
+	void HistoryTile::Read(uint8_t* pixels) const
+	{
+		if (!m_Compressed) {
+			std::memcpy(pixels, m_Data.data(), m_Size);
+		}
+		else if (!Lz4Decompress(m_Data.data(), m_Data.size(), pixels, m_Size)) {
+			// Only a bug can get here, the streams never leave memory
+			std::memset(pixels, 0, m_Size);
+		}
+	}
+
+	bool HistoryTile::IsCompressed() const
+	{
+		return m_Compressed;
+	}
+
+	size_t HistoryTile::GetMemory() const
+	{
+		return m_Data.size();
+	}
+
+	uint64_t HistoryTile::GetRevision() const
+	{
+		return m_Revision;
+	}
+
+	// Both masks of a layer go through the same tile bookkeeping
+	template <typename Function>
+	static void ForEachMask(const LayerSnapshot& layer, Function function)
+	{
+		if (layer.Mask) function(*layer.Mask);
+		if (layer.Selection) function(*layer.Selection);
+	}
+
+	static void RestoreMask(const std::shared_ptr<MaskSnapshot>& snapshot, std::unique_ptr<LayerMask>& mask)
+	{
+		if (!snapshot) {
+			mask.reset();
+			return;
+		}
+		if (!mask || mask->GetWidth() != snapshot->Width || mask->GetHeight() != snapshot->Height) {
+			mask = std::make_unique<LayerMask>(snapshot->Width, snapshot->Height);
+		}
+		std::vector<uint64_t> revisions(snapshot->Tiles.size());
+		std::transform(snapshot->Tiles.begin(), snapshot->Tiles.end(), revisions.begin(), [](const std::shared_ptr<HistoryTile>& tile) {
+			return tile->GetRevision();
+		});
+		mask->RestoreTiles(revisions, [&](uint32_t tile, uint8_t* pixels) {
+			snapshot->Tiles[tile]->Read(pixels);
+		});
+	}
+
+	static size_t GetSourceMemory(const Image& image)
+	{
+		return static_cast<size_t>(image.GetWidth()) * image.GetHeight() * 4;
+	}
+
+	History::History(size_t budget)
+		: m_Budget(budget)
+	{
+	}
+
+	std::shared_ptr<MaskSnapshot> History::SaveMask(const LayerMask& mask, const std::shared_ptr<MaskSnapshot>& previous) const
+	{
+		const bool sameSize = previous && previous->Width == mask.GetWidth() && previous->Height == mask.GetHeight();
+		if (sameSize && previous->Revision == mask.GetRevision()) {
+			return previous;
+		}
+
+		auto snapshot = std::make_shared<MaskSnapshot>();
+		snapshot->Width = mask.GetWidth();
+		snapshot->Height = mask.GetHeight();
+		snapshot->Revision = mask.GetRevision();
+		snapshot->Tiles.resize(mask.GetTileCount());
+		ThreadPool::Get().ParallelFor(snapshot->Tiles.size(), [&](size_t index) {
+			const uint32_t tile = static_cast<uint32_t>(index);
+			const uint64_t revision = mask.GetTileRevision(tile);
+			if (sameSize && previous->Tiles[tile]->GetRevision() == revision) {
+				snapshot->Tiles[tile] = previous->Tiles[tile];
+				return;
+			}
+			std::vector<uint8_t> pixels(static_cast<size_t>(mask.GetTileWidth(tile)) * mask.GetTileHeight(tile));
+			mask.CopyTile(tile, pixels.data());
+			snapshot->Tiles[tile] = std::make_shared<HistoryTile>(std::move(pixels), revision);
+		});
+		return snapshot;
+	}
+
+	void History::Commit(const LayerStack& layers)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		const HistoryStep* previous = m_Steps.empty() ? nullptr : &m_Steps[m_Current];
+
+		HistoryStep step;
+		for (size_t i = 0; i < layers.GetCount(); i++) {
+			const Layer& layer = layers.Get(i);
+			LayerSnapshot& snapshot = step.Layers.emplace_back();
+			snapshot.Id = layer.Id;
+			snapshot.Name = layer.Name;
+			snapshot.Source = layer.Source;
+			snapshot.Pixels = layer.Pixels;
+			snapshot.Revision = layer.Revision;
+			snapshot.Filters = layer.Filters;
+			snapshot.Parameters = layer.Parameters;
+			snapshot.Preset = layer.Preset;
+			snapshot.Opacity = layer.Opacity;
+			snapshot.Blend = layer.Blend;
+			snapshot.Visible = layer.Visible;
+			const LayerSnapshot* before = nullptr;
+			if (previous) {
+				for (const LayerSnapshot& other : previous->Layers) {
+					if (other.Id == layer.Id) {
+						before = &other;
+					}
+				}
+			}
+			if (layer.Mask) {
+				snapshot.Mask = SaveMask(*layer.Mask, before ? before->Mask : nullptr);
+			}
+			if (layer.Selection) {
+				snapshot.Selection = SaveMask(*layer.Selection, before ? before->Selection : nullptr);
+			}
+		}
+		step.Active = layers.IsEmpty() ? 0 : layers.GetActiveIndex();
+
+		if (!m_Steps.empty()) {
+			m_Steps.erase(m_Steps.begin() + m_Current + 1, m_Steps.end());
+		}
+		m_Steps.push_back(std::move(step));
+		m_Current = m_Steps.size() - 1;
+		Trim();
+
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	bool History::Undo(LayerStack& layers)
+	{
+		if (!CanUndo()) {
+			return false;
+		}
+		const auto start = std::chrono::high_resolution_clock::now();
+		Restore(m_Steps[--m_Current], layers);
+		Trim();
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return true;
+	}
+
+	bool History::Redo(LayerStack& layers)
+	{
+		if (!CanRedo()) {
+			return false;
+		}
+		const auto start = std::chrono::high_resolution_clock::now();
+		Restore(m_Steps[++m_Current], layers);
+		Trim();
+		const auto end = std::chrono::high_resolution_clock::now();
+		m_LastTime = std::chrono::duration<double, std::milli>(end - start).count();
+		return true;
+	}
+
+	void History::Restore(const HistoryStep& step, LayerStack& layers)
+	{
+		std::vector<std::unique_ptr<Layer>> previous = layers.Release();
+		std::vector<std::unique_ptr<Layer>> restored;
+		for (const LayerSnapshot& snapshot : step.Layers) {
+			auto it = std::find_if(previous.begin(), previous.end(), [&](const std::unique_ptr<Layer>& layer) {
+				return layer && layer->Id == snapshot.Id;
+			});
+			// Layers still in the stack keep their render graph and its caches
+			std::unique_ptr<Layer> layer;
+			if (it != previous.end()) {
+				layer = std::move(*it);
+			}
+			else {
+				layer = std::make_unique<Layer>(layers.GetRenderer(), snapshot.Name, snapshot.Source);
+				layer->Id = snapshot.Id;
+			}
+
+			layer->Name = snapshot.Name;
+			layer->Source = snapshot.Source;
+			layer->Pixels = snapshot.Pixels;
+			layer->Revision = snapshot.Revision;
+			layer->Filters = snapshot.Filters;
+			layer->Parameters = snapshot.Parameters;
+			layer->Preset = snapshot.Preset;
+			layer->Opacity = snapshot.Opacity;
+			layer->Blend = snapshot.Blend;
+			layer->Visible = snapshot.Visible;
+			RestoreMask(snapshot.Mask, layer->Mask);
+			RestoreMask(snapshot.Selection, layer->Selection);
+			restored.push_back(std::move(layer));
+		}
+		layers.Assign(std::move(restored), step.Active);
+	}
+
+	void History::Trim()
+	{
+		// The step before the current one stays uncompressed so a single undo is quick
+		std::unordered_set<const HistoryTile*> hot;
+		for (size_t i = (m_Current > 0 ? m_Current - 1 : 0); i <= m_Current && i < m_Steps.size(); i++) {
+			for (const LayerSnapshot& layer : m_Steps[i].Layers) {
+				ForEachMask(layer, [&](const MaskSnapshot& mask) {
+					for (const auto& tile : mask.Tiles) {
+						hot.insert(tile.get());
+					}
+				});
+			}
+		}
+
+		std::unordered_set<const MaskSnapshot*> masks;
+		std::unordered_set<HistoryTile*> tiles;
+		std::vector<HistoryTile*> cold;
+		for (const HistoryStep& step : m_Steps) {
+			for (const LayerSnapshot& layer : step.Layers) {
+				ForEachMask(layer, [&](const MaskSnapshot& mask) {
+					if (!masks.insert(&mask).second) return;
+					for (const auto& tile : mask.Tiles) {
+						if (tiles.insert(tile.get()).second && !tile->IsCompressed() && hot.count(tile.get()) == 0) {
+							cold.push_back(tile.get());
+						}
+					}
+				});
+			}
+		}
+		ThreadPool::Get().ParallelFor(cold.size(), [&](size_t i) {
+			cold[i]->Compress();
+		});
+
+		UpdateUsage();
+		while (m_Steps.size() > 1 && (m_Usage > m_Budget || m_Steps.size() > MAX_HISTORY_STEPS)) {
+			// The oldest undo goes first, redo steps only once nothing is left to undo
+			if (m_Current > 0) {
+				m_Steps.pop_front();
+				m_Current--;
+			}
+			else {
+				m_Steps.pop_back();
+			}
+			UpdateUsage();
+		}
+	}
+
+	void History::UpdateUsage()
+	{
+		// Sources of the current step are the document itself, only the ones kept alive for other
+		// steps count against the budget
+		std::unordered_set<const Image*> sources;
+		if (!m_Steps.empty()) {
+			for (const LayerSnapshot& layer : m_Steps[m_Current].Layers) {
+				sources.insert(layer.Source.get());
+			}
+		}
+		std::unordered_set<const MaskSnapshot*> masks;
+		std::unordered_set<const HistoryTile*> tiles;
+		m_Usage = 0;
+		m_CompressedTiles = 0;
+		for (const HistoryStep& step : m_Steps) {
+			for (const LayerSnapshot& layer : step.Layers) {
+				if (layer.Source && sources.insert(layer.Source.get()).second) {
+					m_Usage += GetSourceMemory(*layer.Source);
+				}
+				ForEachMask(layer, [&](const MaskSnapshot& mask) {
+					if (!masks.insert(&mask).second) return;
+					for (const auto& tile : mask.Tiles) {
+						if (tiles.insert(tile.get()).second) {
+							m_Usage += tile->GetMemory();
+							m_CompressedTiles += tile->IsCompressed() ? 1 : 0;
+						}
+					}
+				});
+			}
+		}
+		m_TileCount = tiles.size();
+	}
+
+	void History::Clear()
+	{
+		m_Steps.clear();
+		m_Current = 0;
+		m_Usage = 0;
+		m_CompressedTiles = 0;
+		m_TileCount = 0;
+	}
+
+	bool History::CanUndo() const
+	{
+		return m_Current > 0;
+	}
+
+	bool History::CanRedo() const
+	{
+		return m_Current + 1 < m_Steps.size();
+	}
+
+	size_t History::GetStepCount() const
+	{
+		return m_Steps.size();
+	}
+
+	size_t History::GetPosition() const
+	{
+		return m_Current;
+	}
+
+	size_t History::GetUsage() const
+	{
+		return m_Usage;
+	}
+
+	size_t History::GetCompressedTiles() const
+	{
+		return m_CompressedTiles;
+	}
+
+	size_t History::GetTileCount() const
+	{
+		return m_TileCount;
+	}
+
+	size_t History::GetBudget() const
+	{
+		return m_Budget;
+	}
+
+	void History::SetBudget(size_t budget)
+	{
+		m_Budget = budget;
+		Trim();
+	}
+
+	double History::GetLastTime() const
+	{
+		return m_LastTime;
+	}
+}
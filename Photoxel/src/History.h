@@ -0,0 +1,110 @@
+#pragma once
+
+#include <inttypes.h>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Filters.h"
+#include "Layer.h"
+
+namespace Photoxel
+{
+	class Image;
+
+	static constexpr size_t DEFAULT_HISTORY_BUDGET = 256ull << 20;
+	static constexpr size_t MAX_HISTORY_STEPS = 1000;
+
+	// A tile of a mask as a history step saw it. Steps the tile did not change in share it, and once
+	// no step near the current one uses it the bytes are LZ4 compressed
+	class HistoryTile
+	{
+	public:
+		HistoryTile(std::vector<uint8_t> pixels, uint64_t revision);
+
+		void Compress();
+		// Packed rows, decompressed on the fly when the tile is cold
+		void Read(uint8_t* pixels) const;
+
+		bool IsCompressed() const;
+		size_t GetMemory() const;
+		uint64_t GetRevision() const;
+	private:
+		std::vector<uint8_t> m_Data;
+		size_t m_Size;
+		uint64_t m_Revision;
+		bool m_Compressed = false;
+	};
+
+	struct MaskSnapshot {
+		uint32_t Width = 0, Height = 0;
+		// Revision of the whole mask when it was saved
+		uint64_t Revision = 0;
+		std::vector<std::shared_ptr<HistoryTile>> Tiles;
+	};
+
+	// Everything about a layer an edit can change. Sources never change once loaded, steps keep a
+	// reference to them instead of a copy
+	struct LayerSnapshot {
+		uint64_t Id = 0;
+		std::string Name;
+		std::shared_ptr<Image> Source;
+		std::shared_ptr<std::vector<uint8_t>> Pixels;
+		uint64_t Revision = 0;
+		std::vector<Filter> Filters;
+		FilterParameters Parameters;
+		KernelPreset Preset = KernelPreset::Sharpen;
+		float Opacity = 1.0f;
+		BlendMode Blend = BlendMode::Normal;
+		bool Visible = true;
+		std::shared_ptr<MaskSnapshot> Mask;
+		std::shared_ptr<MaskSnapshot> Selection;
+	};
+
+	struct HistoryStep {
+		std::vector<LayerSnapshot> Layers;
+		size_t Active = 0;
+	};
+
+	// Undo and redo of a layer stack. A step only copies the mask tiles whose revision moved since
+	// the step before it, the rest are shared copy on write. Tiles no step next to the current one
+	// uses are compressed, and the oldest steps are dropped once the history holds more than the
+	// budget
+	class History
+	{
+	public:
+		History(size_t budget = DEFAULT_HISTORY_BUDGET);
+
+		// Saves the stack as the newest step, the steps that could be redone are dropped
+		void Commit(const LayerStack& layers);
+		bool Undo(LayerStack& layers);
+		bool Redo(LayerStack& layers);
+		void Clear();
+
+		bool CanUndo() const;
+		bool CanRedo() const;
+		size_t GetStepCount() const;
+		size_t GetPosition() const;
+		// Bytes of the tiles and of the sources no longer in the image the steps hold, each counted
+		// once however many steps share it
+		size_t GetUsage() const;
+		size_t GetCompressedTiles() const;
+		size_t GetTileCount() const;
+		size_t GetBudget() const;
+		void SetBudget(size_t budget);
+		double GetLastTime() const;
+	private:
+		std::shared_ptr<MaskSnapshot> SaveMask(const LayerMask& mask, const std::shared_ptr<MaskSnapshot>& previous) const;
+		void Restore(const HistoryStep& step, LayerStack& layers);
+		// Compresses the cold tiles and drops steps until the history fits the budget
+		void Trim();
+		void UpdateUsage();
+
+		std::deque<HistoryStep> m_Steps;
+		size_t m_Current = 0;
+		size_t m_Budget;
+		size_t m_Usage = 0;
+		size_t m_CompressedTiles = 0, m_TileCount = 0;
+		double m_LastTime = 0.0;
+	};
+}
@@ -0,0 +1,412 @@
+#include "HnswIndex.h"
+#include "ThreadPool.h"
+#include <xmmintrin.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <queue>
+
+namespace Photoxel
+{
+	static constexpr char HNSW_FILE_MAGIC[4] = { 'P', 'X', 'H', 'N' };
+	static constexpr uint32_t HNSW_FILE_VERSION = 1;
+	// Nodes share these locks by id, one mutex per node would cost more memory than the links
+	static constexpr size_t LOCK_STRIPES = 4096;
+	// Nodes a build task inserts before it takes the next batch
+	static constexpr size_t BUILD_CHUNK = 256;
+
+	struct HnswIndex::VisitedSet {
+		std::vector<uint32_t> Marks;
+		uint32_t Epoch = 0;
+
+		void Reset(size_t count)
+		{
+			if (Marks.size() != count) {
+				Marks.assign(count, 0);
+				Epoch = 0;
+			}
+			// Bumping the epoch clears the set without touching the marks, they only wrap every 4G searches
+			if (++Epoch == 0) {
+				std::fill(Marks.begin(), Marks.end(), 0);
+				Epoch = 1;
+			}
+		}
+
+		bool Visit(uint32_t node)
+		{
+			if (Marks[node] == Epoch) {
+				return false;
+			}
+			Marks[node] = Epoch;
+			return true;
+		}
+	};
+
+	HnswIndex::HnswIndex() = default;
+
+	HnswIndex::~HnswIndex() = default;
+
+	static float SquaredDistance(const float* a, const float* b, uint32_t dimension)
+	{
+		__m128 sum0 = _mm_setzero_ps();
+		__m128 sum1 = _mm_setzero_ps();
+		uint32_t i = 0;
+		for (; i + 8 <= dimension; i += 8) {
+			const __m128 d0 = _mm_sub_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i));
+			const __m128 d1 = _mm_sub_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4));
+			sum0 = _mm_add_ps(sum0, _mm_mul_ps(d0, d0));
+			sum1 = _mm_add_ps(sum1, _mm_mul_ps(d1, d1));
+		}
+		float lanes[4];
+		_mm_storeu_ps(lanes, _mm_add_ps(sum0, sum1));
+		float total = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+		for (; i < dimension; i++) {
+			const float d = a[i] - b[i];
+			total += d * d;
+		}
+		return total;
+	}
+
+	// Level of a node from a hash of its id, so a build gives the same graph on any thread count
+	static uint8_t DrawLevel(uint32_t node, double levelScale)
+	{
+		uint64_t x = node + 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		x ^= x >> 31;
+		const double uniform = (static_cast<double>(x >> 11) + 1.0) / 9007199254740993.0;
+		return static_cast<uint8_t>(std::min(-std::log(uniform) * levelScale, 255.0));
+	}
+
+	float HnswIndex::Distance(const float* a, uint32_t b) const
+	{
+		return SquaredDistance(a, m_Vectors[b], m_Vectors.Dimension);
+	}
+
+	uint32_t HnswIndex::GetMaxLinks(uint32_t level) const
+	{
+		return level == 0 ? m_Options.Links * 2 : m_Options.Links;
+	}
+
+	uint32_t* HnswIndex::GetLinks(uint32_t node, uint32_t level)
+	{
+		if (level == 0) {
+			return &m_BaseLinks[static_cast<size_t>(node) * (GetMaxLinks(0) + 1)];
+		}
+		return &m_UpperLinks[node][static_cast<size_t>(level - 1) * (GetMaxLinks(1) + 1)];
+	}
+
+	const uint32_t* HnswIndex::GetLinks(uint32_t node, uint32_t level) const
+	{
+		return const_cast<HnswIndex*>(this)->GetLinks(node, level);
+	}
+
+	std::mutex& HnswIndex::GetLock(uint32_t node) const
+	{
+		return m_Locks[node % LOCK_STRIPES];
+	}
+
+	std::unique_ptr<HnswIndex::VisitedSet> HnswIndex::AcquireVisited() const
+	{
+		std::lock_guard<std::mutex> lock(m_VisitedMutex);
+		if (m_VisitedPool.empty()) {
+			return std::make_unique<VisitedSet>();
+		}
+		std::unique_ptr<VisitedSet> visited = std::move(m_VisitedPool.back());
+		m_VisitedPool.pop_back();
+		return visited;
+	}
+
+	void HnswIndex::ReleaseVisited(std::unique_ptr<VisitedSet> visited) const
+	{
+		std::lock_guard<std::mutex> lock(m_VisitedMutex);
+		m_VisitedPool.push_back(std::move(visited));
+	}
+
+	uint32_t HnswIndex::Descend(const float* query, uint32_t entry, uint32_t level, bool locked) const
+	{
+		std::vector<uint32_t> links(GetMaxLinks(level) + 1);
+		uint32_t current = entry;
+		float currentDistance = Distance(query, current);
+		bool moved = true;
+		while (moved) {
+			moved = false;
+			if (locked) {
+				std::lock_guard<std::mutex> lock(GetLock(current));
+				const uint32_t* source = GetLinks(current, level);
+				std::copy(source, source + source[0] + 1, links.begin());
+			}
+			else {
+				const uint32_t* source = GetLinks(current, level);
+				std::copy(source, source + source[0] + 1, links.begin());
+			}
+			for (uint32_t i = 1; i <= links[0]; i++) {
+				const float distance = Distance(query, links[i]);
+				if (distance < currentDistance) {
+					currentDistance = distance;
+					current = links[i];
+					moved = true;
+				}
+			}
+		}
+		return current;
+	}
+
+	std::vector<HnswIndex::Candidate> HnswIndex::SearchLevel(const float* query, uint32_t entry, uint32_t level,
+		size_t candidates, VisitedSet& visited, bool locked) const
+	{
+		visited.Reset(m_Vectors.Count);
+		visited.Visit(entry);
+
+		// Nearest unexpanded node on top of one heap, farthest result on top of the other
+		std::priority_queue<Candidate, std::vector<Candidate>, std::greater<Candidate>> frontier;
+		std::priority_queue<Candidate> results;
+		const float entryDistance = Distance(query, entry);
+		frontier.push({ entryDistance, entry });
+		results.push({ entryDistance, entry });
+
+		std::vector<uint32_t> links(GetMaxLinks(level) + 1);
+		while (!frontier.empty()) {
+			const Candidate nearest = frontier.top();
+			if (nearest.first > results.top().first && results.size() >= candidates) break;
+			frontier.pop();
+
+			if (locked) {
+				std::lock_guard<std::mutex> lock(GetLock(nearest.second));
+				const uint32_t* source = GetLinks(nearest.second, level);
+				std::copy(source, source + source[0] + 1, links.begin());
+			}
+			else {
+				const uint32_t* source = GetLinks(nearest.second, level);
+				std::copy(source, source + source[0] + 1, links.begin());
+			}
+			for (uint32_t i = 1; i <= links[0]; i++) {
+				const uint32_t neighbour = links[i];
+				if (!visited.Visit(neighbour)) continue;
+				const float distance = Distance(query, neighbour);
+				if (results.size() < candidates || distance < results.top().first) {
+					frontier.push({ distance, neighbour });
+					results.push({ distance, neighbour });
+					if (results.size() > candidates) {
+						results.pop();
+					}
+				}
+			}
+		}
+
+		std::vector<Candidate> sorted(results.size());
+		for (size_t i = sorted.size(); i-- > 0; ) {
+			sorted[i] = results.top();
+			results.pop();
+		}
+		return sorted;
+	}
+
+	std::vector<uint32_t> HnswIndex::SelectNeighbours(std::vector<Candidate> candidates, uint32_t count) const
+	{
+		std::sort(candidates.begin(), candidates.end());
+		std::vector<uint32_t> kept;
+		for (const auto& [distance, node] : candidates) {
+			if (kept.size() >= count) break;
+			bool diverse = true;
+			for (uint32_t other : kept) {
+				if (SquaredDistance(m_Vectors[node], m_Vectors[other], m_Vectors.Dimension) < distance) {
+					diverse = false;
+					break;
+				}
+			}
+			if (diverse) {
+				kept.push_back(node);
+			}
+		}
+		return kept;
+	}
+
+	void HnswIndex::Connect(uint32_t node, uint32_t neighbour, uint32_t level)
+	{
+		std::lock_guard<std::mutex> lock(GetLock(node));
+		uint32_t* links = GetLinks(node, level);
+		const uint32_t maxLinks = GetMaxLinks(level);
+		if (links[0] < maxLinks) {
+			links[++links[0]] = neighbour;
+			return;
+		}
+
+		// Full, the new link has to earn its place against the ones already there
+		std::vector<Candidate> candidates;
+		const float* vector = m_Vectors[node];
+		candidates.push_back({ Distance(vector, neighbour), neighbour });
+		for (uint32_t i = 1; i <= links[0]; i++) {
+			candidates.push_back({ Distance(vector, links[i]), links[i] });
+		}
+		const std::vector<uint32_t> kept = SelectNeighbours(std::move(candidates), maxLinks);
+		links[0] = static_cast<uint32_t>(kept.size());
+		std::copy(kept.begin(), kept.end(), links + 1);
+	}
+
+	void HnswIndex::Insert(uint32_t node, VisitedSet& visited)
+	{
+		const float* query = m_Vectors[node];
+		const uint32_t level = m_Levels[node];
+		uint32_t entry, maxLevel;
+		{
+			std::lock_guard<std::mutex> lock(m_EntryMutex);
+			entry = m_Entry;
+			maxLevel = m_MaxLevel;
+		}
+
+		for (uint32_t l = maxLevel; l > level; l--) {
+			entry = Descend(query, entry, l, true);
+		}
+		for (uint32_t l = std::min(level, maxLevel) + 1; l-- > 0; ) {
+			const std::vector<Candidate> candidates = SearchLevel(query, entry, l, m_Options.BuildCandidates, visited, true);
+			const std::vector<uint32_t> neighbours = SelectNeighbours(candidates, m_Options.Links);
+			{
+				std::lock_guard<std::mutex> lock(GetLock(node));
+				uint32_t* links = GetLinks(node, l);
+				links[0] = static_cast<uint32_t>(neighbours.size());
+				std::copy(neighbours.begin(), neighbours.end(), links + 1);
+			}
+			for (uint32_t neighbour : neighbours) {
+				Connect(neighbour, node, l);
+			}
+			entry = candidates.front().second;
+		}
+
+		// Linked on every level before it can become the way in
+		if (level > maxLevel) {
+			std::lock_guard<std::mutex> lock(m_EntryMutex);
+			if (level > m_MaxLevel) {
+				m_MaxLevel = level;
+				m_Entry = node;
+			}
+		}
+	}
+
+	void HnswIndex::Build(const VectorView& vectors, const HnswOptions& options, uint32_t threads)
+	{
+		m_Vectors = vectors;
+		m_Options = options;
+		m_Options.Links = std::max(m_Options.Links, 2u);
+		m_Options.BuildCandidates = std::max(m_Options.BuildCandidates, m_Options.Links);
+		const size_t count = vectors.Count;
+
+		const double levelScale = 1.0 / std::log(static_cast<double>(m_Options.Links));
+		m_Levels.resize(count);
+		m_UpperLinks.assign(count, {});
+		for (size_t node = 0; node < count; node++) {
+			m_Levels[node] = DrawLevel(static_cast<uint32_t>(node), levelScale);
+			if (m_Levels[node] > 0) {
+				m_UpperLinks[node].assign(static_cast<size_t>(m_Levels[node]) * (GetMaxLinks(1) + 1), 0);
+			}
+		}
+		m_BaseLinks.assign(count * (GetMaxLinks(0) + 1), 0);
+		m_Entry = 0;
+		m_MaxLevel = count > 0 ? m_Levels[0] : 0;
+		if (count < 2) {
+			return;
+		}
+
+		m_Locks = std::make_unique<std::mutex[]>(LOCK_STRIPES);
+		m_Building = true;
+		const size_t chunks = (count - 1 + BUILD_CHUNK - 1) / BUILD_CHUNK;
+		ThreadPool::Get().ParallelFor(chunks, [&](size_t chunk) {
+			std::unique_ptr<VisitedSet> visited = AcquireVisited();
+			const size_t end = std::min(count, 1 + (chunk + 1) * BUILD_CHUNK);
+			for (size_t node = 1 + chunk * BUILD_CHUNK; node < end; node++) {
+				Insert(static_cast<uint32_t>(node), *visited);
+			}
+			ReleaseVisited(std::move(visited));
+		}, threads);
+		m_Building = false;
+	}
+
+	std::vector<std::pair<float, uint32_t>> HnswIndex::Search(const float* query, size_t count, size_t candidates) const
+	{
+		if (m_Levels.empty() || count == 0) {
+			return {};
+		}
+
+		uint32_t entry = m_Entry;
+		for (uint32_t l = m_MaxLevel; l > 0; l--) {
+			entry = Descend(query, entry, l, m_Building);
+		}
+		std::unique_ptr<VisitedSet> visited = AcquireVisited();
+		std::vector<Candidate> results = SearchLevel(query, entry, 0, std::max(candidates, count), *visited, m_Building);
+		ReleaseVisited(std::move(visited));
+		if (results.size() > count) {
+			results.resize(count);
+		}
+		return results;
+	}
+
+	size_t HnswIndex::GetCount() const
+	{
+		return m_Levels.size();
+	}
+
+	uint32_t HnswIndex::GetLevels() const
+	{
+		return m_Levels.empty() ? 0 : m_MaxLevel + 1;
+	}
+
+	bool HnswIndex::Save(const std::string& path) const
+	{
+		std::ofstream writer(path, std::ios::binary);
+		if (!writer) {
+			return false;
+		}
+
+		const uint32_t header[] = { HNSW_FILE_VERSION, m_Vectors.Dimension, m_Options.Links, m_Options.BuildCandidates,
+			m_Entry, m_MaxLevel };
+		const uint64_t count = m_Levels.size();
+		writer.write(HNSW_FILE_MAGIC, sizeof(HNSW_FILE_MAGIC));
+		writer.write(reinterpret_cast<const char*>(header), sizeof(header));
+		writer.write(reinterpret_cast<const char*>(&count), sizeof(count));
+		writer.write(reinterpret_cast<const char*>(m_Levels.data()), m_Levels.size());
+		writer.write(reinterpret_cast<const char*>(m_BaseLinks.data()), m_BaseLinks.size() * sizeof(uint32_t));
+		for (const auto& links : m_UpperLinks) {
+			writer.write(reinterpret_cast<const char*>(links.data()), links.size() * sizeof(uint32_t));
+		}
+		return static_cast<bool>(writer);
+	}
+
+	bool HnswIndex::Load(const std::string& path, const VectorView& vectors)
+	{
+		std::ifstream reader(path, std::ios::binary);
+		char magic[4];
+		uint32_t header[6];
+		uint64_t count;
+		if (!reader.read(magic, sizeof(magic)) || std::memcmp(magic, HNSW_FILE_MAGIC, sizeof(magic)) != 0 ||
+			!reader.read(reinterpret_cast<char*>(header), sizeof(header)) || header[0] != HNSW_FILE_VERSION ||
+			header[1] != vectors.Dimension || !reader.read(reinterpret_cast<char*>(&count), sizeof(count)) ||
+			count != vectors.Count) {
+			return false;
+		}
+
+		m_Vectors = vectors;
+		m_Options.Links = header[2];
+		m_Options.BuildCandidates = header[3];
+		m_Entry = header[4];
+		m_MaxLevel = header[5];
+		m_Levels.resize(count);
+		m_BaseLinks.resize(count * (GetMaxLinks(0) + 1));
+		reader.read(reinterpret_cast<char*>(m_Levels.data()), m_Levels.size());
+		reader.read(reinterpret_cast<char*>(m_BaseLinks.data()), m_BaseLinks.size() * sizeof(uint32_t));
+		m_UpperLinks.assign(count, {});
+		for (size_t node = 0; node < count; node++) {
+			if (m_Levels[node] > 0) {
+				m_UpperLinks[node].resize(static_cast<size_t>(m_Levels[node]) * (GetMaxLinks(1) + 1));
+				reader.read(reinterpret_cast<char*>(m_UpperLinks[node].data()), m_UpperLinks[node].size() * sizeof(uint32_t));
+			}
+		}
+		if (!reader) {
+			m_Levels.clear();
+			m_BaseLinks.clear();
+			m_UpperLinks.clear();
+			return false;
+		}
+		return true;
+	}
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <inttypes.h>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace Photoxel
+{
+	// Float vectors the index reads in place, Count of them Stride bytes apart
+	struct VectorView {
+		const float* Data = nullptr;
+		size_t Stride = 0;
+		size_t Count = 0;
+		uint32_t Dimension = 0;
+
+		const float* operator[](size_t i) const
+		{
+			return reinterpret_cast<const float*>(reinterpret_cast<const uint8_t*>(Data) + i * Stride);
+		}
+	};
+
+	struct HnswOptions {
+		// Links per node on the upper layers, twice as many on the bottom one
+		uint32_t Links = 16;
+		// Candidates kept while a node looks for its neighbours, more builds slower and finds better ones
+		uint32_t BuildCandidates = 100;
+	};
+
+	// Approximate nearest neighbour search over squared euclidean distance, a hierarchical navigable
+	// small world graph (Malkov and Yashunin). The vectors stay where they are, usually a mapped
+	// file, the index only keeps the links between them
+	class HnswIndex
+	{
+	public:
+		HnswIndex();
+		~HnswIndex();
+
+		HnswIndex(const HnswIndex&) = delete;
+		HnswIndex& operator=(const HnswIndex&) = delete;
+
+		// Inserts every vector, threads at a time, 0 uses the whole pool
+		void Build(const VectorView& vectors, const HnswOptions& options = HnswOptions(), uint32_t threads = 0);
+		// The vectors have to be the ones the graph was built over. Returns false on a missing file,
+		// one of another version or one built over a different number of vectors
+		bool Load(const std::string& path, const VectorView& vectors);
+		bool Save(const std::string& path) const;
+
+		// Up to count nearest vectors as (squared distance, index) pairs, the closest first. candidates
+		// is how many the search keeps in flight, the more the better the recall
+		std::vector<std::pair<float, uint32_t>> Search(const float* query, size_t count, size_t candidates = 64) const;
+		size_t GetCount() const;
+		uint32_t GetLevels() const;
+	private:
+		struct VisitedSet;
+		using Candidate = std::pair<float, uint32_t>;
+
+		float Distance(const float* a, uint32_t b) const;
+		uint32_t* GetLinks(uint32_t node, uint32_t level);
+		const uint32_t* GetLinks(uint32_t node, uint32_t level) const;
+		uint32_t GetMaxLinks(uint32_t level) const;
+		// Greedy walk towards query on one level, returns the closest node reached
+		uint32_t Descend(const float* query, uint32_t entry, uint32_t level, bool locked) const;
+		std::vector<Candidate> SearchLevel(const float* query, uint32_t entry, uint32_t level, size_t candidates,
+			VisitedSet& visited, bool locked) const;
+		// Keeps candidates that are closer to the node than to any neighbour already kept, so the links
+		// spread in every direction instead of bunching up in the nearest cluster
+		std::vector<uint32_t> SelectNeighbours(std::vector<Candidate> candidates, uint32_t count) const;
+		void Connect(uint32_t node, uint32_t neighbour, uint32_t level);
+		void Insert(uint32_t node, VisitedSet& visited);
+		std::unique_ptr<VisitedSet> AcquireVisited() const;
+		void ReleaseVisited(std::unique_ptr<VisitedSet> visited) const;
+		std::mutex& GetLock(uint32_t node) const;
+
+		VectorView m_Vectors;
+		HnswOptions m_Options;
+		std::vector<uint8_t> m_Levels;
+		// Bottom level links of every node, a count followed by the ids
+		std::vector<uint32_t> m_BaseLinks;
+		// Links of the levels above the bottom one, only the few nodes that reach them have any
+		std::vector<std::vector<uint32_t>> m_UpperLinks;
+		uint32_t m_Entry = 0;
+		uint32_t m_MaxLevel = 0;
+
+		// Only taken while building, the finished graph is read without locks
+		bool m_Building = false;
+		mutable std::unique_ptr<std::mutex[]> m_Locks;
+		std::mutex m_EntryMutex;
+		mutable std::mutex m_VisitedMutex;
+		mutable std::vector<std::unique_ptr<VisitedSet>> m_VisitedPool;
+	};
+}
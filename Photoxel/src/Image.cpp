@@ -1,4 +1,5 @@
 #include "Image.h"
+#include "ImageCache.h"
 #include <glad/glad.h>
 #include "stb_image.h"
 #include <filesystem>
@@ -78,6 +79,26 @@ namespace Photoxel
 		//glTexImage2D(GL_TEXTURE_2D, 1, GL_RGBA8, width >> 1, height >> 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 	}
 
+	Image::Image(std::shared_ptr<const DecodedImage> image)
+		: m_Decoded(std::move(image))
+	{
+		glGenTextures(1, &m_TextureID);
+		glBindTexture(GL_TEXTURE_2D, m_TextureID);
+
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+		m_Width = m_Decoded->Width;
+		m_Height = m_Decoded->Height;
+		m_Data = m_Decoded->Pixels.get();
+		m_Filename = GetImageName(m_Decoded->Path);
+
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_Data);
+	}
+
 	Image::~Image()
 	{
 		glDeleteTextures(1, &m_TextureID);
@@ -119,6 +140,11 @@ namespace Photoxel
 		return (void*)m_TextureID;
 	}
 
+	uint32_t Image::GetRendererID() const
+	{
+		return m_TextureID;
+	}
+
 	std::vector<uint8_t> Image::GetData2(int level)
 	{
 		std::vector<uint8_t> buffer(512 * 512 * 3);
@@ -155,4 +181,20 @@ namespace Photoxel
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, m_Width, m_Height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
 		Unbind();
 	}
+
+	void Image::SetLuminance(uint32_t width, uint32_t height, const void* data, uint32_t stride)
+	{
+		m_Width = width;
+		m_Height = height;
+		m_Data = data;
+		Bind();
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, stride);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_Width, m_Height, 0, GL_RED, GL_UNSIGNED_BYTE, data);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+		Unbind();
+	}
 }
\ No newline at end of file
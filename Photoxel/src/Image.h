@@ -1,16 +1,21 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 #include <inttypes.h>
 
 namespace Photoxel
 {
+	struct DecodedImage;
+
 	class Image
 	{
 	public:
 		Image(const std::string& path);
 		Image(uint32_t width, uint32_t height, const void* data);
+		// Uploads pixels decoded ahead of time and keeps them alive for GetData
+		Image(std::shared_ptr<const DecodedImage> image);
 		~Image();
 
 		void Bind(int slot = 0);
@@ -26,13 +31,17 @@ namespace Photoxel
 		}
 		void SetData(uint32_t width, uint32_t height, const void* data);
 		void SetData2(uint32_t width, uint32_t height, const void* data);
+		// Single channel upload, rows are stride bytes apart
+		void SetLuminance(uint32_t width, uint32_t height, const void* data, uint32_t stride);
 
 		void* GetTextureID() const;
+		uint32_t GetRendererID() const;
 		std::vector<uint8_t> GetData2(int level);
 	private:
 		uint32_t m_Width, m_Height, m_DataFormat;
 		uint32_t m_TextureID;
 		const void* m_Data;
 		std::string m_Filename;
+		std::shared_ptr<const DecodedImage> m_Decoded;
 	};
 }
\ No newline at end of file
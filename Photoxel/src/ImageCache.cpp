@@ -0,0 +1,113 @@
+#include "ImageCache.h"
+#include "stb_image.h"
+#include <filesystem>
+
+namespace Photoxel
+{
+	std::shared_ptr<const DecodedImage> DecodeImageFile(const std::string& path)
+	{
+		int width = 0, height = 0, channels = 0;
+		unsigned char* pixels = stbi_load(path.c_str(), &width, &height, &channels, 4);
+		if (!pixels) {
+			return nullptr;
+		}
+		auto image = std::make_shared<DecodedImage>();
+		image->Path = path;
+		image->Width = static_cast<uint32_t>(width);
+		image->Height = static_cast<uint32_t>(height);
+		image->Pixels = std::unique_ptr<uint8_t, void(*)(void*)>(pixels, stbi_image_free);
+		image->Modified = GetModifiedTime(path);
+		return image;
+	}
+
+	int64_t GetModifiedTime(const std::string& path)
+	{
+		std::error_code error;
+		const auto time = std::filesystem::last_write_time(path, error);
+		return error ? 0 : static_cast<int64_t>(time.time_since_epoch().count());
+	}
+
+	ImageCache::ImageCache(size_t budget)
+		: m_Budget(budget)
+	{
+	}
+
+	std::shared_ptr<const DecodedImage> ImageCache::Find(const std::string& path)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto found = m_Index.find(path);
+		if (found == m_Index.end()) {
+			return nullptr;
+		}
+		m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+		return *found->second;
+	}
+
+	std::shared_ptr<const DecodedImage> ImageCache::Peek(const std::string& path) const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto found = m_Index.find(path);
+		return found != m_Index.end() ? *found->second : nullptr;
+	}
+
+	bool ImageCache::Insert(std::shared_ptr<const DecodedImage> image)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		const size_t bytes = image->GetSize();
+		if (bytes > m_Budget) {
+			return false;
+		}
+
+		auto found = m_Index.find(image->Path);
+		if (found != m_Index.end()) {
+			m_Usage -= (*found->second)->GetSize();
+			m_Entries.erase(found->second);
+			m_Index.erase(found);
+		}
+		Evict(m_Budget - bytes);
+		m_Entries.push_front(std::move(image));
+		m_Index[m_Entries.front()->Path] = m_Entries.begin();
+		m_Usage += bytes;
+		return true;
+	}
+
+	void ImageCache::Clear()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		Evict(0);
+	}
+
+	void ImageCache::SetBudget(size_t budget)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Budget = budget;
+		Evict(budget);
+	}
+
+	size_t ImageCache::GetBudget() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Budget;
+	}
+
+	size_t ImageCache::GetUsage() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Usage;
+	}
+
+	size_t ImageCache::GetEntryCount() const
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Entries.size();
+	}
+
+	void ImageCache::Evict(size_t budget)
+	{
+		while (m_Usage > budget && !m_Entries.empty()) {
+			m_Usage -= m_Entries.back()->GetSize();
+			m_Index.erase(m_Entries.back()->Path);
+			m_Entries.pop_back();
+		}
+	}
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <inttypes.h>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace Photoxel
+{
+	// Enough for the current photo and its neighbours at 24 megapixels
+	static constexpr size_t DEFAULT_IMAGE_CACHE_BUDGET = 768ull << 20;
+
+	// RGBA8 pixels of an image file, decoded off the UI thread and shared with the images showing it
+	struct DecodedImage {
+		std::string Path;
+		uint32_t Width = 0, Height = 0;
+		// Kept in the buffer of the decoder rather than copied, freed by it as well
+		std::unique_ptr<uint8_t, void(*)(void*)> Pixels{ nullptr, nullptr };
+		// Modification time of the file when it was decoded, a newer file is decoded again
+		int64_t Modified = 0;
+
+		size_t GetSize() const { return static_cast<size_t>(Width) * Height * 4; }
+	};
+
+	// Null when the file cannot be read
+	std::shared_ptr<const DecodedImage> DecodeImageFile(const std::string& path);
+	// 0 when the file cannot be read
+	int64_t GetModifiedTime(const std::string& path);
+
+	// Decoded images keyed by path. Entries are dropped, least recently used first, once the memory
+	// budget is exceeded, an image still shown keeps its pixels through its own reference.
+	// Safe to use from several threads
+	class ImageCache
+	{
+	public:
+		ImageCache(size_t budget = DEFAULT_IMAGE_CACHE_BUDGET);
+
+		// Marks the entry as most recently used
+		std::shared_ptr<const DecodedImage> Find(const std::string& path);
+		// Leaves the order of the entries as it is
+		std::shared_ptr<const DecodedImage> Peek(const std::string& path) const;
+		// Replaces an entry of the same path, returns false if the image alone exceeds the budget
+		bool Insert(std::shared_ptr<const DecodedImage> image);
+		void Clear();
+
+		void SetBudget(size_t budget);
+		size_t GetBudget() const;
+		size_t GetUsage() const;
+		size_t GetEntryCount() const;
+	private:
+		void Evict(size_t budget);
+
+		mutable std::mutex m_Mutex;
+		size_t m_Budget;
+		size_t m_Usage = 0;
+		// Most recently used first
+		std::list<std::shared_ptr<const DecodedImage>> m_Entries;
+		std::unordered_map<std::string, std::list<std::shared_ptr<const DecodedImage>>::iterator> m_Index;
+	};
+}
@@ -0,0 +1,41 @@
+#include "ImageFolder.h"
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+
+namespace Photoxel
+{
+	bool IsImageFile(const std::string& path)
+	{
+		std::string extension = std::filesystem::path(path).extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		return extension == ".jpg" || extension == ".jpeg" || extension == ".png" || extension == ".bmp";
+	}
+
+	template <typename Iterator>
+	static void AddImages(Iterator it, std::vector<std::string>& images)
+	{
+		std::error_code error;
+		for (; !error && it != Iterator(); it.increment(error)) {
+			if (it->is_regular_file(error) && IsImageFile(it->path().string())) {
+				images.push_back(std::filesystem::absolute(it->path()).string());
+			}
+		}
+	}
+
+	std::vector<std::string> FindImages(const std::string& folder, bool recursive)
+	{
+		std::vector<std::string> images;
+		std::error_code error;
+		const auto options = std::filesystem::directory_options::skip_permission_denied;
+		if (recursive) {
+			AddImages(std::filesystem::recursive_directory_iterator(folder, options, error), images);
+		}
+		else {
+			AddImages(std::filesystem::directory_iterator(folder, options, error), images);
+		}
+		std::sort(images.begin(), images.end());
+		return images;
+	}
+}
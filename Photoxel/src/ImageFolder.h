@@ -0,0 +1,13 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace Photoxel
+{
+	// True for the extensions the image pipelines can load, whatever their case
+	bool IsImageFile(const std::string& path);
+	// Absolute paths of the images in folder, sorted, the subfolders too when recursive. Folders
+	// that cannot be read are skipped
+	std::vector<std::string> FindImages(const std::string& folder, bool recursive = true);
+}
@@ -0,0 +1,295 @@
+#include "ImageHash.h"
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavutil/dict.h>
+}
+#include "stb_image.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace Photoxel
+{
+	// Side of the thumbnails the hashes are taken from
+	static constexpr uint32_t PERCEPTUAL_SIZE = 32;
+	static constexpr uint32_t PERCEPTUAL_BITS = 8;
+	static constexpr uint32_t DIFFERENCE_WIDTH = 9;
+	static constexpr uint32_t DIFFERENCE_HEIGHT = 8;
+	// Short side a JPEG is decoded down to at least, twice the thumbnail so it still averages pixels
+	static constexpr int HASH_DECODE_SIZE = 64;
+	// The JPEG decoder scales by 1/2, 1/4 or 1/8 while it runs the inverse DCT
+	static constexpr int MAX_JPEG_LOWRES = 3;
+
+	// Box filter from any size down to width x height, every output pixel averages the pixels it covers
+	static void Downsample(const uint8_t* gray, uint32_t width, uint32_t height, uint32_t outWidth, uint32_t outHeight, float* out)
+	{
+		for (uint32_t oy = 0; oy < outHeight; oy++) {
+			const uint32_t y0 = static_cast<uint32_t>(static_cast<uint64_t>(oy) * height / outHeight);
+			const uint32_t y1 = std::max(y0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(oy + 1) * height / outHeight));
+			for (uint32_t ox = 0; ox < outWidth; ox++) {
+				const uint32_t x0 = static_cast<uint32_t>(static_cast<uint64_t>(ox) * width / outWidth);
+				const uint32_t x1 = std::max(x0 + 1, static_cast<uint32_t>(static_cast<uint64_t>(ox + 1) * width / outWidth));
+				uint32_t sum = 0;
+				for (uint32_t y = y0; y < y1; y++) {
+					for (uint32_t x = x0; x < x1; x++) {
+						sum += gray[static_cast<size_t>(y) * width + x];
+					}
+				}
+				out[oy * outWidth + ox] = static_cast<float>(sum) / ((y1 - y0) * (x1 - x0));
+			}
+		}
+	}
+
+	uint64_t ComputePerceptualHash(const uint8_t* gray, uint32_t width, uint32_t height)
+	{
+		float thumbnail[PERCEPTUAL_SIZE * PERCEPTUAL_SIZE];
+		Downsample(gray, width, height, PERCEPTUAL_SIZE, PERCEPTUAL_SIZE, thumbnail);
+
+		// Only the 8x8 lowest frequencies of the DCT are needed, rows then columns
+		static const std::vector<float> cosines = []() {
+			std::vector<float> table(PERCEPTUAL_BITS * PERCEPTUAL_SIZE);
+			for (uint32_t u = 0; u < PERCEPTUAL_BITS; u++) {
+				for (uint32_t x = 0; x < PERCEPTUAL_SIZE; x++) {
+					table[u * PERCEPTUAL_SIZE + x] = static_cast<float>(std::cos((2.0 * x + 1.0) * u * 3.14159265358979323846 / (2.0 * PERCEPTUAL_SIZE)));
+				}
+			}
+			return table;
+		}();
+		float rows[PERCEPTUAL_SIZE * PERCEPTUAL_BITS];
+		for (uint32_t y = 0; y < PERCEPTUAL_SIZE; y++) {
+			for (uint32_t u = 0; u < PERCEPTUAL_BITS; u++) {
+				float sum = 0.0f;
+				for (uint32_t x = 0; x < PERCEPTUAL_SIZE; x++) {
+					sum += thumbnail[y * PERCEPTUAL_SIZE + x] * cosines[u * PERCEPTUAL_SIZE + x];
+				}
+				rows[y * PERCEPTUAL_BITS + u] = sum;
+			}
+		}
+		float coefficients[PERCEPTUAL_BITS * PERCEPTUAL_BITS];
+		for (uint32_t v = 0; v < PERCEPTUAL_BITS; v++) {
+			for (uint32_t u = 0; u < PERCEPTUAL_BITS; u++) {
+				float sum = 0.0f;
+				for (uint32_t y = 0; y < PERCEPTUAL_SIZE; y++) {
+					sum += rows[y * PERCEPTUAL_BITS + u] * cosines[v * PERCEPTUAL_SIZE + y];
+				}
+				coefficients[v * PERCEPTUAL_BITS + u] = sum;
+			}
+		}
+
+		float sorted[PERCEPTUAL_BITS * PERCEPTUAL_BITS];
+		std::copy(std::begin(coefficients), std::end(coefficients), sorted);
+		std::nth_element(sorted, sorted + 32, std::end(sorted));
+		const float median = sorted[32];
+		uint64_t hash = 0;
+		for (uint32_t i = 0; i < PERCEPTUAL_BITS * PERCEPTUAL_BITS; i++) {
+			hash |= static_cast<uint64_t>(coefficients[i] > median) << i;
+		}
+		return hash;
+	}
+
+	uint64_t ComputeDifferenceHash(const uint8_t* gray, uint32_t width, uint32_t height)
+	{
+		float thumbnail[DIFFERENCE_WIDTH * DIFFERENCE_HEIGHT];
+		Downsample(gray, width, height, DIFFERENCE_WIDTH, DIFFERENCE_HEIGHT, thumbnail);
+		uint64_t hash = 0;
+		for (uint32_t y = 0; y < DIFFERENCE_HEIGHT; y++) {
+			for (uint32_t x = 0; x + 1 < DIFFERENCE_WIDTH; x++) {
+				const bool brighter = thumbnail[y * DIFFERENCE_WIDTH + x] > thumbnail[y * DIFFERENCE_WIDTH + x + 1];
+				hash |= static_cast<uint64_t>(brighter) << (y * (DIFFERENCE_WIDTH - 1) + x);
+			}
+		}
+		return hash;
+	}
+
+	// Decodes a JPEG at the smallest scale that keeps HASH_DECODE_SIZE pixels on its short side and
+	// keeps the luma plane, which is the gray image the hashes want. False for the few JPEGs that are
+	// not stored as YUV, like CMYK ones, they take the full decode
+	static bool DecodeJpegLuma(const std::vector<uint8_t>& file, std::vector<uint8_t>& gray, uint32_t& width, uint32_t& height)
+	{
+		int fileWidth, fileHeight, channels;
+		if (!stbi_info_from_memory(file.data(), static_cast<int>(file.size()), &fileWidth, &fileHeight, &channels)) {
+			return false;
+		}
+		int lowres = 0;
+		while (lowres < MAX_JPEG_LOWRES && (std::min(fileWidth, fileHeight) >> (lowres + 1)) >= HASH_DECODE_SIZE) {
+			lowres++;
+		}
+
+		const AVCodec* codec = avcodec_find_decoder(AV_CODEC_ID_MJPEG);
+		AVCodecContext* context = codec ? avcodec_alloc_context3(codec) : nullptr;
+		AVPacket* packet = av_packet_alloc();
+		AVFrame* frame = av_frame_alloc();
+		AVDictionary* options = nullptr;
+		av_dict_set_int(&options, "lowres", lowres, 0);
+		bool decoded = false;
+		if (context && packet && frame && avcodec_open2(context, codec, &options) >= 0
+			&& av_new_packet(packet, static_cast<int>(file.size())) >= 0) {
+			std::memcpy(packet->data, file.data(), file.size());
+			if (avcodec_send_packet(context, packet) >= 0) {
+				int result = avcodec_receive_frame(context, frame);
+				if (result == AVERROR(EAGAIN) && avcodec_send_packet(context, nullptr) >= 0) {
+					result = avcodec_receive_frame(context, frame);
+				}
+				decoded = result >= 0;
+			}
+		}
+
+		bool planar = false;
+		if (decoded) {
+			switch (frame->format) {
+			case AV_PIX_FMT_GRAY8:
+			case AV_PIX_FMT_YUV420P: case AV_PIX_FMT_YUVJ420P:
+			case AV_PIX_FMT_YUV422P: case AV_PIX_FMT_YUVJ422P:
+			case AV_PIX_FMT_YUV440P: case AV_PIX_FMT_YUVJ440P:
+			case AV_PIX_FMT_YUV444P: case AV_PIX_FMT_YUVJ444P:
+				planar = true;
+				break;
+			default:
+				break;
+			}
+		}
+		if (planar) {
+			width = static_cast<uint32_t>(frame->width);
+			height = static_cast<uint32_t>(frame->height);
+			gray.resize(static_cast<size_t>(width) * height);
+			for (uint32_t y = 0; y < height; y++) {
+				std::memcpy(&gray[static_cast<size_t>(y) * width], frame->data[0] + static_cast<ptrdiff_t>(y) * frame->linesize[0], width);
+			}
+		}
+
+		av_dict_free(&options);
+		av_frame_free(&frame);
+		av_packet_free(&packet);
+		avcodec_free_context(&context);
+		return planar;
+	}
+
+	bool ComputeImageHash(const std::string& path, ImageHash& hash)
+	{
+		std::ifstream reader(path, std::ios::binary | std::ios::ate);
+		if (!reader) {
+			return false;
+		}
+		std::vector<uint8_t> file(static_cast<size_t>(reader.tellg()));
+		reader.seekg(0);
+		if (file.empty() || !reader.read(reinterpret_cast<char*>(file.data()), file.size())) {
+			return false;
+		}
+
+		std::vector<uint8_t> gray;
+		uint32_t width = 0, height = 0;
+		std::string extension = std::filesystem::path(path).extension().string();
+		std::transform(extension.begin(), extension.end(), extension.begin(),
+			[](char c) { return static_cast<char>(std::tolower(static_cast<unsigned char>(c))); });
+		if ((extension != ".jpg" && extension != ".jpeg") || !DecodeJpegLuma(file, gray, width, height)) {
+			int fileWidth, fileHeight, channels;
+			unsigned char* pixels = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &fileWidth, &fileHeight, &channels, 1);
+			if (!pixels) {
+				return false;
+			}
+			width = static_cast<uint32_t>(fileWidth);
+			height = static_cast<uint32_t>(fileHeight);
+			gray.assign(pixels, pixels + static_cast<size_t>(width) * height);
+			stbi_image_free(pixels);
+		}
+
+		hash.Perceptual = ComputePerceptualHash(gray.data(), width, height);
+		hash.Difference = ComputeDifferenceHash(gray.data(), width, height);
+		return true;
+	}
+
+	uint32_t GetHammingDistance(uint64_t a, uint64_t b)
+	{
+#ifdef _MSC_VER
+		return static_cast<uint32_t>(__popcnt64(a ^ b));
+#else
+		return static_cast<uint32_t>(__builtin_popcountll(a ^ b));
+#endif
+	}
+
+	uint32_t HammingIndex::GetWord(uint64_t hash, uint32_t word)
+	{
+		return static_cast<uint32_t>(hash >> (word * WORD_BITS)) & ((1u << WORD_BITS) - 1);
+	}
+
+	void HammingIndex::Build(std::vector<uint64_t> hashes)
+	{
+		m_Hashes = std::move(hashes);
+		// A counting sort of the ids by each word
+		for (uint32_t word = 0; word < WORDS; word++) {
+			std::vector<uint32_t>& offsets = m_Offsets[word];
+			offsets.assign((1u << WORD_BITS) + 1, 0);
+			for (uint64_t hash : m_Hashes) {
+				offsets[GetWord(hash, word) + 1]++;
+			}
+			for (size_t i = 1; i < offsets.size(); i++) {
+				offsets[i] += offsets[i - 1];
+			}
+			std::vector<uint32_t> next(offsets.begin(), offsets.end() - 1);
+			m_Ids[word].resize(m_Hashes.size());
+			for (uint32_t id = 0; id < m_Hashes.size(); id++) {
+				m_Ids[word][next[GetWord(m_Hashes[id], word)]++] = id;
+			}
+		}
+	}
+
+	void HammingIndex::Search(uint64_t hash, uint32_t maxDistance, std::vector<uint32_t>& results) const
+	{
+		if (m_Hashes.empty()) {
+			return;
+		}
+		const uint32_t radius = maxDistance / WORDS;
+		uint32_t words[WORDS];
+		for (uint32_t word = 0; word < WORDS; word++) {
+			words[word] = GetWord(hash, word);
+		}
+
+		for (uint32_t word = 0; word < WORDS; word++) {
+			// Every value within radius bits of the word of the query, by flipping up to radius bits
+			// at increasing positions
+			uint32_t positions[WORD_BITS];
+			uint32_t flipped = 0;
+			positions[0] = 0;
+			while (true) {
+				uint32_t key = words[word];
+				for (uint32_t i = 0; i < flipped; i++) {
+					key ^= 1u << positions[i];
+				}
+				for (uint32_t i = m_Offsets[word][key]; i < m_Offsets[word][key + 1]; i++) {
+					const uint32_t id = m_Ids[word][i];
+					// A hash that also matches an earlier word was listed from there already
+					bool listed = false;
+					for (uint32_t earlier = 0; earlier < word && !listed; earlier++) {
+						listed = GetHammingDistance(GetWord(m_Hashes[id], earlier), words[earlier]) <= radius;
+					}
+					if (!listed && GetHammingDistance(m_Hashes[id], hash) <= maxDistance) {
+						results.push_back(id);
+					}
+				}
+
+				// Next combination: add a bit after the last one, or move the last one along
+				if (flipped < radius) {
+					positions[flipped] = flipped > 0 ? positions[flipped - 1] + 1 : 0;
+					if (positions[flipped] < WORD_BITS) {
+						flipped++;
+						continue;
+					}
+				}
+				while (flipped > 0 && ++positions[flipped - 1] >= WORD_BITS) {
+					flipped--;
+				}
+				if (flipped == 0) break;
+			}
+		}
+	}
+
+	size_t HammingIndex::GetCount() const
+	{
+		return m_Hashes.size();
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+namespace Photoxel
+{
+	// Two 64 bit perceptual hashes of an image, close in Hamming distance when the images look alike
+	// whatever their size, compression or small edits
+	struct ImageHash {
+		// Signs of the low frequencies of the DCT of a 32x32 thumbnail against their median
+		uint64_t Perceptual = 0;
+		// Whether each pixel of a 9x8 thumbnail is brighter than its right neighbour
+		uint64_t Difference = 0;
+	};
+
+	uint64_t ComputePerceptualHash(const uint8_t* gray, uint32_t width, uint32_t height);
+	uint64_t ComputeDifferenceHash(const uint8_t* gray, uint32_t width, uint32_t height);
+	// Decodes the file as small as its format allows, JPEGs are scaled down by the decoder itself
+	// before their pixels are ever produced, and hashes it. Returns false when it cannot be read
+	bool ComputeImageHash(const std::string& path, ImageHash& hash);
+	uint32_t GetHammingDistance(uint64_t a, uint64_t b);
+
+	// Finds every hash within a Hamming distance of another without comparing it to all of them.
+	// Multi-index hashing: the 64 bits are split into four 16 bit words with a table each, and two
+	// hashes within distance d of each other share at least one word within d / 4 bits, so only the
+	// table buckets around the words of the query need checking
+	class HammingIndex
+	{
+	public:
+		void Build(std::vector<uint64_t> hashes);
+		// Appends to results the ids of the hashes within maxDistance of hash, in no order
+		void Search(uint64_t hash, uint32_t maxDistance, std::vector<uint32_t>& results) const;
+		size_t GetCount() const;
+	private:
+		static constexpr uint32_t WORDS = 4;
+		static constexpr uint32_t WORD_BITS = 16;
+
+		static uint32_t GetWord(uint64_t hash, uint32_t word);
+
+		std::vector<uint64_t> m_Hashes;
+		// Ids of every table by word value, those of value v from m_Offsets[v] to m_Offsets[v + 1]
+		std::vector<uint32_t> m_Offsets[WORDS];
+		std::vector<uint32_t> m_Ids[WORDS];
+	};
+}
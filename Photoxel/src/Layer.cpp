@@ -1 +1,377 @@
 #include "Layer.h"
+#include "Image.h"
+#include "ThreadPool.h"
+#include <glad/glad.h>
+#include <stb_image.h>
+#include <stb_image_resize.h>
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <utility>
+
+namespace Photoxel
+{
+	static std::atomic<uint64_t> s_NextLayerId = 1;
+	static std::atomic<uint64_t> s_NextMaskRevision = 1;
+	// Layers the history recreates keep their id, so content revisions cannot start over per layer
+	static std::atomic<uint64_t> s_NextContentRevision = 1;
+
+	const char* GetBlendModeName(BlendMode mode)
+	{
+		switch (mode)
+		{
+			case BlendMode::Multiply:	return "Multiply";
+			case BlendMode::Screen:		return "Screen";
+			case BlendMode::Overlay:	return "Overlay";
+			case BlendMode::Add:		return "Add";
+			default:					return "Normal";
+		}
+	}
+
+	LayerMask::LayerMask(uint32_t width, uint32_t height, uint8_t value)
+		: m_Width(width), m_Height(height), m_Pixels(static_cast<size_t>(width) * height, value), m_Revision(s_NextMaskRevision++)
+	{
+		const uint32_t columns = GetTileColumns();
+		const uint32_t rows = (height + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+		m_Coverage.resize(static_cast<size_t>(columns) * rows);
+		m_TileRevisions.assign(m_Coverage.size(), m_Revision);
+		for (uint32_t tile = 0; tile < m_Coverage.size(); tile++) {
+			UpdateTile(tile);
+		}
+	}
+
+	LayerMask::~LayerMask()
+	{
+		if (m_Texture) {
+			glDeleteTextures(1, &m_Texture);
+		}
+	}
+
+	std::unique_ptr<LayerMask> LayerMask::Load(const std::string& path, uint32_t width, uint32_t height)
+	{
+		int fileWidth, fileHeight, channels;
+		uint8_t* data = stbi_load(path.c_str(), &fileWidth, &fileHeight, &channels, 1);
+		if (!data) {
+			return nullptr;
+		}
+
+		std::vector<uint8_t> pixels(static_cast<size_t>(width) * height);
+		stbir_resize_uint8(data, fileWidth, fileHeight, 0, pixels.data(), width, height, 0, 1);
+		stbi_image_free(data);
+
+		auto mask = std::make_unique<LayerMask>(width, height);
+		mask->SetPixels(pixels.data());
+		return mask;
+	}
+
+	void LayerMask::SetPixels(const uint8_t* pixels)
+	{
+		m_Revision = s_NextMaskRevision++;
+		const uint32_t columns = GetTileColumns();
+		ThreadPool::Get().ParallelFor(m_Coverage.size(), [&](size_t tile) {
+			const uint32_t x0 = static_cast<uint32_t>(tile % columns) * LAYER_TILE_SIZE;
+			const uint32_t y0 = static_cast<uint32_t>(tile / columns) * LAYER_TILE_SIZE;
+			const uint32_t x1 = std::min(x0 + LAYER_TILE_SIZE, m_Width), y1 = std::min(y0 + LAYER_TILE_SIZE, m_Height);
+
+			bool changed = false;
+			for (uint32_t y = y0; y < y1; y++) {
+				const size_t offset = static_cast<size_t>(y) * m_Width + x0;
+				if (std::memcmp(m_Pixels.data() + offset, pixels + offset, x1 - x0) != 0) {
+					std::memcpy(m_Pixels.data() + offset, pixels + offset, x1 - x0);
+					changed = true;
+				}
+			}
+			if (changed) {
+				m_TileRevisions[tile] = m_Revision;
+				UpdateTile(static_cast<uint32_t>(tile));
+			}
+		});
+	}
+
+	void LayerMask::Fill(uint8_t value)
+	{
+		std::vector<uint8_t> pixels(m_Pixels.size(), value);
+		SetPixels(pixels.data());
+	}
+
+	void LayerMask::Invert()
+	{
+		std::vector<uint8_t> pixels(m_Pixels.size());
+		std::transform(m_Pixels.begin(), m_Pixels.end(), pixels.begin(), [](uint8_t value) {
+			return static_cast<uint8_t>(255 - value);
+		});
+		SetPixels(pixels.data());
+	}
+
+	void LayerMask::CopyTile(uint32_t tile, uint8_t* pixels) const
+	{
+		const uint32_t columns = GetTileColumns();
+		const uint32_t x0 = (tile % columns) * LAYER_TILE_SIZE, y0 = (tile / columns) * LAYER_TILE_SIZE;
+		const uint32_t width = GetTileWidth(tile), height = GetTileHeight(tile);
+		for (uint32_t y = 0; y < height; y++) {
+			std::memcpy(pixels + static_cast<size_t>(y) * width, m_Pixels.data() + static_cast<size_t>(y0 + y) * m_Width + x0, width);
+		}
+	}
+
+	void LayerMask::RestoreTiles(const std::vector<uint64_t>& revisions, const std::function<void(uint32_t tile, uint8_t* pixels)>& readTile)
+	{
+		m_Revision = s_NextMaskRevision++;
+		const uint32_t columns = GetTileColumns();
+		ThreadPool::Get().ParallelFor(m_Coverage.size(), [&](size_t index) {
+			const uint32_t tile = static_cast<uint32_t>(index);
+			if (m_TileRevisions[tile] == revisions[tile]) {
+				return;
+			}
+
+			const uint32_t x0 = (tile % columns) * LAYER_TILE_SIZE, y0 = (tile / columns) * LAYER_TILE_SIZE;
+			const uint32_t width = GetTileWidth(tile), height = GetTileHeight(tile);
+			std::vector<uint8_t> pixels(static_cast<size_t>(width) * height);
+			readTile(tile, pixels.data());
+			for (uint32_t y = 0; y < height; y++) {
+				std::memcpy(m_Pixels.data() + static_cast<size_t>(y0 + y) * m_Width + x0, pixels.data() + static_cast<size_t>(y) * width, width);
+			}
+			m_TileRevisions[tile] = revisions[tile];
+			UpdateTile(tile);
+		});
+	}
+
+	void LayerMask::UpdateTile(uint32_t tile)
+	{
+		const uint32_t columns = GetTileColumns();
+		const uint32_t x0 = (tile % columns) * LAYER_TILE_SIZE, y0 = (tile / columns) * LAYER_TILE_SIZE;
+		const uint32_t x1 = std::min(x0 + LAYER_TILE_SIZE, m_Width), y1 = std::min(y0 + LAYER_TILE_SIZE, m_Height);
+
+		uint8_t lowest = 255, highest = 0;
+		for (uint32_t y = y0; y < y1; y++) {
+			const auto [minimum, maximum] = std::minmax_element(m_Pixels.begin() + static_cast<size_t>(y) * m_Width + x0,
+				m_Pixels.begin() + static_cast<size_t>(y) * m_Width + x1);
+			lowest = std::min(lowest, *minimum);
+			highest = std::max(highest, *maximum);
+		}
+		m_Coverage[tile] = highest == 0 ? TileCoverage::Empty : (lowest == 255 ? TileCoverage::Full : TileCoverage::Partial);
+	}
+
+	const uint8_t* LayerMask::GetPixels() const
+	{
+		return m_Pixels.data();
+	}
+
+	uint32_t LayerMask::GetWidth() const
+	{
+		return m_Width;
+	}
+
+	uint32_t LayerMask::GetHeight() const
+	{
+		return m_Height;
+	}
+
+	uint32_t LayerMask::GetTileColumns() const
+	{
+		return (m_Width + LAYER_TILE_SIZE - 1) / LAYER_TILE_SIZE;
+	}
+
+	uint32_t LayerMask::GetTileCount() const
+	{
+		return static_cast<uint32_t>(m_Coverage.size());
+	}
+
+	uint32_t LayerMask::GetTileWidth(uint32_t tile) const
+	{
+		return std::min(LAYER_TILE_SIZE, m_Width - (tile % GetTileColumns()) * LAYER_TILE_SIZE);
+	}
+
+	uint32_t LayerMask::GetTileHeight(uint32_t tile) const
+	{
+		return std::min(LAYER_TILE_SIZE, m_Height - (tile / GetTileColumns()) * LAYER_TILE_SIZE);
+	}
+
+	TileCoverage LayerMask::GetTileCoverage(uint32_t tile) const
+	{
+		return m_Coverage[tile];
+	}
+
+	uint64_t LayerMask::GetTileRevision(uint32_t tile) const
+	{
+		return m_TileRevisions[tile];
+	}
+
+	glm::uvec4 LayerMask::GetBounds() const
+	{
+		const uint32_t columns = GetTileColumns();
+		glm::uvec4 bounds(m_Width, m_Height, 0, 0);
+		for (uint32_t tile = 0; tile < m_Coverage.size(); tile++) {
+			if (m_Coverage[tile] == TileCoverage::Empty) continue;
+			const uint32_t x = (tile % columns) * LAYER_TILE_SIZE, y = (tile / columns) * LAYER_TILE_SIZE;
+			bounds = glm::uvec4(std::min(bounds.x, x), std::min(bounds.y, y),
+				std::max(bounds.z, x + GetTileWidth(tile)), std::max(bounds.w, y + GetTileHeight(tile)));
+		}
+		return bounds.z > bounds.x ? bounds : glm::uvec4(0);
+	}
+
+	uint64_t LayerMask::GetRevision() const
+	{
+		return m_Revision;
+	}
+
+	uint32_t LayerMask::GetTexture() const
+	{
+		if (m_Texture == 0) {
+			glGenTextures(1, &m_Texture);
+			glBindTexture(GL_TEXTURE_2D, m_Texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		}
+		if (m_TextureRevision != m_Revision) {
+			glBindTexture(GL_TEXTURE_2D, m_Texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, m_Width, m_Height, 0, GL_RED, GL_UNSIGNED_BYTE, m_Pixels.data());
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			m_TextureRevision = m_Revision;
+		}
+		return m_Texture;
+	}
+
+	Layer::Layer(Renderer& renderer, const std::string& name, std::shared_ptr<Image> source)
+		: Id(s_NextLayerId++), Name(name), Source(std::move(source)), Graph(std::make_unique<RenderGraph>(renderer))
+	{
+	}
+
+	const uint8_t* Layer::GetSourcePixels() const
+	{
+		return Pixels ? Pixels->data() : static_cast<const uint8_t*>(Source->GetData());
+	}
+
+	uint64_t Layer::UpdateContentRevision()
+	{
+		if (Revision != m_LastRevision || Filters != m_LastFilters || Parameters != m_LastParameters) {
+			m_LastRevision = Revision;
+			m_LastFilters = Filters;
+			m_LastParameters = Parameters;
+			m_ContentRevision = s_NextContentRevision++;
+		}
+		return m_ContentRevision;
+	}
+
+	LayerStack::LayerStack(Renderer& renderer)
+		: m_Renderer(renderer)
+	{
+	}
+
+	Layer& LayerStack::Add(const std::string& name, std::shared_ptr<Image> source)
+	{
+		auto layer = std::make_unique<Layer>(m_Renderer, name, std::move(source));
+		const Image& image = *layer->Source;
+		if (!m_Layers.empty() && (image.GetWidth() != GetWidth() || image.GetHeight() != GetHeight())) {
+			const uint32_t width = GetWidth(), height = GetHeight();
+			const uint8_t* pixels = static_cast<const uint8_t*>(image.GetData());
+			layer->Pixels = std::make_shared<std::vector<uint8_t>>(static_cast<size_t>(width) * height * 4, 0);
+
+			// Centred, whatever falls outside the image is cut off
+			const int offsetX = (static_cast<int>(width) - static_cast<int>(image.GetWidth())) / 2;
+			const int offsetY = (static_cast<int>(height) - static_cast<int>(image.GetHeight())) / 2;
+			const int x0 = std::max(offsetX, 0), x1 = std::min(offsetX + static_cast<int>(image.GetWidth()), static_cast<int>(width));
+			const int y0 = std::max(offsetY, 0), y1 = std::min(offsetY + static_cast<int>(image.GetHeight()), static_cast<int>(height));
+			for (int y = y0; y < y1; y++) {
+				std::memcpy(layer->Pixels->data() + (static_cast<size_t>(y) * width + x0) * 4,
+					pixels + (static_cast<size_t>(y - offsetY) * image.GetWidth() + (x0 - offsetX)) * 4, static_cast<size_t>(x1 - x0) * 4);
+			}
+			layer->Source = std::make_shared<Image>(width, height, layer->Pixels->data());
+		}
+
+		m_Layers.push_back(std::move(layer));
+		m_Active = m_Layers.size() - 1;
+		return *m_Layers.back();
+	}
+
+	void LayerStack::Remove(size_t index)
+	{
+		m_Layers.erase(m_Layers.begin() + index);
+		m_Active = std::min(m_Active, m_Layers.empty() ? 0 : m_Layers.size() - 1);
+	}
+
+	void LayerStack::Move(size_t index, int direction)
+	{
+		const size_t other = index + direction;
+		if (other >= m_Layers.size()) {
+			return;
+		}
+		std::swap(m_Layers[index], m_Layers[other]);
+		if (m_Active == index) {
+			m_Active = other;
+		}
+		else if (m_Active == other) {
+			m_Active = index;
+		}
+	}
+
+	void LayerStack::Clear()
+	{
+		m_Layers.clear();
+		m_Active = 0;
+	}
+
+	bool LayerStack::IsEmpty() const
+	{
+		return m_Layers.empty();
+	}
+
+	size_t LayerStack::GetCount() const
+	{
+		return m_Layers.size();
+	}
+
+	Layer& LayerStack::Get(size_t index)
+	{
+		return *m_Layers[index];
+	}
+
+	const Layer& LayerStack::Get(size_t index) const
+	{
+		return *m_Layers[index];
+	}
+
+	Layer& LayerStack::GetActive()
+	{
+		return *m_Layers[m_Active];
+	}
+
+	size_t LayerStack::GetActiveIndex() const
+	{
+		return m_Active;
+	}
+
+	void LayerStack::SetActive(size_t index)
+	{
+		m_Active = std::min(index, m_Layers.size() - 1);
+	}
+
+	uint32_t LayerStack::GetWidth() const
+	{
+		return m_Layers.empty() ? 0 : m_Layers.front()->Source->GetWidth();
+	}
+
+	uint32_t LayerStack::GetHeight() const
+	{
+		return m_Layers.empty() ? 0 : m_Layers.front()->Source->GetHeight();
+	}
+
+	std::vector<std::unique_ptr<Layer>> LayerStack::Release()
+	{
+		m_Active = 0;
+		return std::exchange(m_Layers, {});
+	}
+
+	void LayerStack::Assign(std::vector<std::unique_ptr<Layer>> layers, size_t active)
+	{
+		m_Layers = std::move(layers);
+		m_Active = std::min(active, m_Layers.empty() ? 0 : m_Layers.size() - 1);
+	}
+
+	Renderer& LayerStack::GetRenderer()
+	{
+		return m_Renderer;
+	}
+}
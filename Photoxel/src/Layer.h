@@ -1,13 +1,160 @@
 #pragma once
 
+#include <inttypes.h>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Filters.h"
+#include "RenderGraph.h"
+
 namespace Photoxel
 {
-	class Layer
+	class Image;
+	class Renderer;
+
+	// Side of the tiles the CPU compositor works on and masks keep their bookkeeping in
+	static constexpr uint32_t LAYER_TILE_SIZE = 256;
+
+	enum class BlendMode {
+		Normal,
+		Multiply,
+		Screen,
+		Overlay,
+		Add
+	};
+
+	const char* GetBlendModeName(BlendMode mode);
+
+	enum class TileCoverage : uint8_t {
+		Empty,
+		Partial,
+		Full
+	};
+
+	// Coverage of a layer, one byte per pixel at the size of the image. Every tile keeps a revision
+	// and whether it is empty, full or partial, so the compositor can skip the tiles a change did
+	// not touch and the ones the layer does not show on. Revisions are unique across masks, two
+	// tiles at the same place with the same revision hold the same bytes
+	class LayerMask
+	{
+	public:
+		LayerMask(uint32_t width, uint32_t height, uint8_t value = 255);
+		~LayerMask();
+
+		LayerMask(const LayerMask&) = delete;
+		LayerMask& operator=(const LayerMask&) = delete;
+
+		// Grey levels of an image file stretched to the size of the image, null if it cannot be read
+		static std::unique_ptr<LayerMask> Load(const std::string& path, uint32_t width, uint32_t height);
+
+		// Only the tiles whose bytes differ get a new revision
+		void SetPixels(const uint8_t* pixels);
+		void Fill(uint8_t value);
+		void Invert();
+		// Packed rows of a tile, GetTileWidth x GetTileHeight bytes
+		void CopyTile(uint32_t tile, uint8_t* pixels) const;
+		// Puts back tiles of an earlier state with the revisions they had. Only the tiles whose
+		// revision differs are read, readTile fills the packed rows of one and runs on the thread pool
+		void RestoreTiles(const std::vector<uint64_t>& revisions, const std::function<void(uint32_t tile, uint8_t* pixels)>& readTile);
+
+		const uint8_t* GetPixels() const;
+		uint32_t GetWidth() const;
+		uint32_t GetHeight() const;
+		uint32_t GetTileColumns() const;
+		uint32_t GetTileCount() const;
+		uint32_t GetTileWidth(uint32_t tile) const;
+		uint32_t GetTileHeight(uint32_t tile) const;
+		TileCoverage GetTileCoverage(uint32_t tile) const;
+		uint64_t GetTileRevision(uint32_t tile) const;
+		// Pixel bounds (x0, y0, x1, y1) of the tiles that are not empty, all zero when every tile is
+		glm::uvec4 GetBounds() const;
+		// Moves with every tile revision
+		uint64_t GetRevision() const;
+		// Single channel texture, uploaded again when the mask changed since the last call
+		uint32_t GetTexture() const;
+	private:
+		void UpdateTile(uint32_t tile);
+
+		uint32_t m_Width, m_Height;
+		std::vector<uint8_t> m_Pixels;
+		std::vector<TileCoverage> m_Coverage;
+		std::vector<uint64_t> m_TileRevisions;
+		uint64_t m_Revision;
+		mutable uint32_t m_Texture = 0;
+		mutable uint64_t m_TextureRevision = 0;
+	};
+
+	// One layer of an image, with its own source, filter chain and render graph. The compositor
+	// blends it over the layers below it with its opacity, blend mode and mask
+	struct Layer {
+		Layer(Renderer& renderer, const std::string& name, std::shared_ptr<Image> source);
+
+		// Unique for the lifetime of the process, caches outside the layer key on it
+		uint64_t Id;
+		std::string Name;
+		std::shared_ptr<Image> Source;
+		// Owns the pixels of the source when it had to be fitted to the size of the image, shared
+		// with the history steps that keep the source alive
+		std::shared_ptr<std::vector<uint8_t>> Pixels;
+		// Bumped whenever the pixels of the source change, the pass caches key on it
+		uint64_t Revision = 0;
+		std::vector<Filter> Filters;
+		FilterParameters Parameters;
+		KernelPreset Preset = KernelPreset::Sharpen;
+		std::unique_ptr<RenderGraph> Graph;
+		float Opacity = 1.0f;
+		BlendMode Blend = BlendMode::Normal;
+		bool Visible = true;
+		// Null when the whole layer shows
+		std::unique_ptr<LayerMask> Mask;
+		// Restricts the filters, outside of it the layer shows its source. Null when they apply everywhere
+		std::unique_ptr<LayerMask> Selection;
+
+		// RGBA pixels of the unfiltered source
+		const uint8_t* GetSourcePixels() const;
+		// Changes whenever the filtered pixels of the layer can, by comparing the source revision,
+		// the chain and the parameters with the ones of the last call
+		uint64_t UpdateContentRevision();
+	private:
+		uint64_t m_ContentRevision = 0;
+		uint64_t m_LastRevision = ~0ull;
+		std::vector<Filter> m_LastFilters;
+		FilterParameters m_LastParameters;
+	};
+
+	// Layers of the image, bottom first. The first one sets the size of the image, later ones are
+	// centred on it and cropped or padded with transparency to fit
+	class LayerStack
 	{
 	public:
-		virtual void OnAttach() = 0;
-		virtual void OnDetach() = 0;
-		virtual void OnUIRender() = 0;
-		virtual void OnUpdate() = 0;
+		LayerStack(Renderer& renderer);
+
+		Layer& Add(const std::string& name, std::shared_ptr<Image> source);
+		void Remove(size_t index);
+		// Swaps the layer with the one above or below it
+		void Move(size_t index, int direction);
+		void Clear();
+
+		bool IsEmpty() const;
+		size_t GetCount() const;
+		Layer& Get(size_t index);
+		const Layer& Get(size_t index) const;
+		Layer& GetActive();
+		size_t GetActiveIndex() const;
+		void SetActive(size_t index);
+		uint32_t GetWidth() const;
+		uint32_t GetHeight() const;
+
+		// Used by the history to put back an earlier state, the layers that are still in it are
+		// taken out of Release and handed back to Assign along with the ones it recreated
+		std::vector<std::unique_ptr<Layer>> Release();
+		void Assign(std::vector<std::unique_ptr<Layer>> layers, size_t active);
+		Renderer& GetRenderer();
+	private:
+		Renderer& m_Renderer;
+		std::vector<std::unique_ptr<Layer>> m_Layers;
+		size_t m_Active = 0;
 	};
-}
\ No newline at end of file
+}
@@ -0,0 +1,252 @@
+#include "Lut3D.h"
+#include "ThreadPool.h"
+#include <glad/glad.h>
+#include <emmintrin.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+namespace Photoxel
+{
+	static std::atomic<uint64_t> s_NextLutId = 1;
+
+	Lut3D::Lut3D(uint32_t size)
+		: m_Size(std::clamp(size, MIN_LUT_SIZE, MAX_LUT_SIZE)), m_Id(s_NextLutId++)
+	{
+		const float last = static_cast<float>(m_Size - 1);
+		m_Table.resize(static_cast<size_t>(m_Size) * m_Size * m_Size * 4);
+		float* entry = m_Table.data();
+		for (uint32_t b = 0; b < m_Size; b++) {
+			for (uint32_t g = 0; g < m_Size; g++) {
+				for (uint32_t r = 0; r < m_Size; r++, entry += 4) {
+					entry[0] = r / last;
+					entry[1] = g / last;
+					entry[2] = b / last;
+					entry[3] = 0.0f;
+				}
+			}
+		}
+	}
+
+	Lut3D::Lut3D(uint32_t size, std::vector<float> table, const std::string& title)
+		: m_Size(size), m_Table(std::move(table)), m_Title(title), m_Id(s_NextLutId++)
+	{
+	}
+
+	Lut3D::~Lut3D()
+	{
+		if (m_Texture) {
+			glDeleteTextures(1, &m_Texture);
+		}
+	}
+
+	std::shared_ptr<Lut3D> Lut3D::LoadCube(const std::string& path, std::string& error)
+	{
+		std::ifstream reader(path);
+		if (!reader) {
+			error = "Could not open " + path;
+			return nullptr;
+		}
+
+		uint32_t size = 0;
+		std::string title;
+		glm::vec3 domainMin(0.0f), domainMax(1.0f);
+		std::vector<float> table;
+		std::string line;
+		while (std::getline(reader, line)) {
+			const size_t comment = line.find('#');
+			if (comment != std::string::npos) {
+				line.erase(comment);
+			}
+
+			std::istringstream stream(line);
+			std::string keyword;
+			if (!(stream >> keyword)) continue;
+
+			if (keyword == "TITLE") {
+				const size_t open = line.find('"'), close = line.rfind('"');
+				if (open != std::string::npos && close > open) {
+					title = line.substr(open + 1, close - open - 1);
+				}
+			}
+			else if (keyword == "LUT_3D_SIZE") {
+				if (!(stream >> size) || size < MIN_LUT_SIZE || size > MAX_LUT_SIZE) {
+					error = "LUT_3D_SIZE must be between " + std::to_string(MIN_LUT_SIZE) + " and " + std::to_string(MAX_LUT_SIZE);
+					return nullptr;
+				}
+				table.reserve(static_cast<size_t>(size) * size * size * 4);
+			}
+			else if (keyword == "LUT_1D_SIZE") {
+				error = "1D tables are not supported";
+				return nullptr;
+			}
+			else if (keyword == "DOMAIN_MIN") {
+				stream >> domainMin.r >> domainMin.g >> domainMin.b;
+			}
+			else if (keyword == "DOMAIN_MAX") {
+				stream >> domainMax.r >> domainMax.g >> domainMax.b;
+			}
+			else if (keyword == "LUT_3D_INPUT_RANGE") {
+				float low = 0.0f, high = 1.0f;
+				stream >> low >> high;
+				domainMin = glm::vec3(low);
+				domainMax = glm::vec3(high);
+			}
+			else if (std::isalpha(static_cast<unsigned char>(keyword[0]))) {
+				// Keywords of other tools, like LUT_IN_VIDEO_RANGE
+				continue;
+			}
+			else {
+				float r, g, b;
+				std::istringstream entry(line);
+				if (!(entry >> r >> g >> b)) {
+					error = "Could not read the entry \"" + line + "\"";
+					return nullptr;
+				}
+				if (size == 0) {
+					error = "Entries found before LUT_3D_SIZE";
+					return nullptr;
+				}
+				table.insert(table.end(), { r, g, b, 0.0f });
+			}
+		}
+
+		if (size == 0) {
+			error = "Missing LUT_3D_SIZE";
+			return nullptr;
+		}
+		const size_t expected = static_cast<size_t>(size) * size * size;
+		if (table.size() != expected * 4) {
+			error = "Expected " + std::to_string(expected) + " entries, found " + std::to_string(table.size() / 4);
+			return nullptr;
+		}
+		if (glm::any(glm::lessThanEqual(domainMax, domainMin))) {
+			error = "DOMAIN_MAX must be above DOMAIN_MIN";
+			return nullptr;
+		}
+
+		auto lut = std::make_shared<Lut3D>(size, std::move(table), title);
+		lut->m_DomainMin = domainMin;
+		lut->m_DomainMax = domainMax;
+		return lut;
+	}
+
+	bool Lut3D::SaveCube(const std::string& path) const
+	{
+		std::ofstream writer(path);
+		if (!writer) {
+			return false;
+		}
+
+		writer << "# Created by Photoxel\n";
+		if (!m_Title.empty()) {
+			writer << "TITLE \"" << m_Title << "\"\n";
+		}
+		writer << "LUT_3D_SIZE " << m_Size << '\n';
+		writer << std::fixed << std::setprecision(6);
+		if (m_DomainMin != glm::vec3(0.0f) || m_DomainMax != glm::vec3(1.0f)) {
+			writer << "DOMAIN_MIN " << m_DomainMin.r << ' ' << m_DomainMin.g << ' ' << m_DomainMin.b << '\n';
+			writer << "DOMAIN_MAX " << m_DomainMax.r << ' ' << m_DomainMax.g << ' ' << m_DomainMax.b << '\n';
+		}
+		for (size_t i = 0; i < m_Table.size(); i += 4) {
+			writer << m_Table[i] << ' ' << m_Table[i + 1] << ' ' << m_Table[i + 2] << '\n';
+		}
+		return static_cast<bool>(writer);
+	}
+
+	static inline __m128 Lerp(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	void Lut3D::Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, LutInterpolation interpolation) const
+	{
+		// Maps a byte straight to lattice coordinates
+		const float last = static_cast<float>(m_Size - 1);
+		const glm::vec3 scale = last / (255.0f * (m_DomainMax - m_DomainMin));
+		const glm::vec3 offset = -m_DomainMin * last / (m_DomainMax - m_DomainMin);
+		const size_t strideG = m_Size, strideB = static_cast<size_t>(m_Size) * m_Size;
+		const float* table = m_Table.data();
+
+		ThreadPool::Get().ParallelFor(height, [&](size_t y) {
+			const __m128 vScale = _mm_setr_ps(scale.r, scale.g, scale.b, 0.0f);
+			const __m128 vOffset = _mm_setr_ps(offset.r, offset.g, offset.b, 0.0f);
+			const __m128 vLast = _mm_set1_ps(last);
+			const __m128 vLastCell = _mm_set1_ps(last - 1.0f);
+			const __m128 vZero = _mm_setzero_ps();
+			const __m128 v255 = _mm_set1_ps(255.0f);
+			const __m128 vHalf = _mm_set1_ps(0.5f);
+			const __m128i zero = _mm_setzero_si128();
+			const int32_t* in = reinterpret_cast<const int32_t*>(src + y * width * 4);
+			int32_t* out = reinterpret_cast<int32_t*>(dst + y * width * 4);
+			alignas(16) float fraction[4];
+			alignas(16) int32_t cell[4];
+
+			for (uint32_t x = 0; x < width; x++) {
+				const int32_t source = in[x];
+				const __m128i pixel = _mm_cvtsi32_si128(source);
+				const __m128 colour = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(pixel, zero), zero));
+				const __m128 position = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(colour, vScale), vOffset), vZero), vLast);
+				// The last lattice point belongs to the cell below it
+				const __m128 base = _mm_min_ps(_mm_cvtepi32_ps(_mm_cvttps_epi32(position)), vLastCell);
+				_mm_store_ps(fraction, _mm_sub_ps(position, base));
+				_mm_store_si128(reinterpret_cast<__m128i*>(cell), _mm_cvttps_epi32(base));
+
+				const float* c000 = table + (cell[0] + cell[1] * strideG + cell[2] * strideB) * 4;
+				__m128 result;
+				if (interpolation == LutInterpolation::Tetrahedral) {
+					// Walks from c000 to c111 along the axes with the largest fractions first
+					const float fr = fraction[0], fg = fraction[1], fb = fraction[2];
+					size_t first, second;
+					float high, middle, low;
+					if (fr >= fg) {
+						if (fg >= fb)		{ first = 1;		second = 1 + strideG;		high = fr; middle = fg; low = fb; }
+						else if (fr >= fb)	{ first = 1;		second = 1 + strideB;		high = fr; middle = fb; low = fg; }
+						else				{ first = strideB;	second = strideB + 1;		high = fb; middle = fr; low = fg; }
+					}
+					else {
+						if (fb >= fg)		{ first = strideB;	second = strideB + strideG;	high = fb; middle = fg; low = fr; }
+						else if (fb >= fr)	{ first = strideG;	second = strideG + strideB;	high = fg; middle = fb; low = fr; }
+						else				{ first = strideG;	second = strideG + 1;		high = fg; middle = fr; low = fb; }
+					}
+					result = _mm_mul_ps(_mm_loadu_ps(c000), _mm_set1_ps(1.0f - high));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(c000 + first * 4), _mm_set1_ps(high - middle)));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(c000 + second * 4), _mm_set1_ps(middle - low)));
+					result = _mm_add_ps(result, _mm_mul_ps(_mm_loadu_ps(c000 + (1 + strideG + strideB) * 4), _mm_set1_ps(low)));
+				}
+				else {
+					const __m128 fr = _mm_set1_ps(fraction[0]), fg = _mm_set1_ps(fraction[1]), fb = _mm_set1_ps(fraction[2]);
+					const float* c001 = c000 + strideB * 4;
+					const __m128 c00 = Lerp(_mm_loadu_ps(c000), _mm_loadu_ps(c000 + 4), fr);
+					const __m128 c10 = Lerp(_mm_loadu_ps(c000 + strideG * 4), _mm_loadu_ps(c000 + (strideG + 1) * 4), fr);
+					const __m128 c01 = Lerp(_mm_loadu_ps(c001), _mm_loadu_ps(c001 + 4), fr);
+					const __m128 c11 = Lerp(_mm_loadu_ps(c001 + strideG * 4), _mm_loadu_ps(c001 + (strideG + 1) * 4), fr);
+					result = Lerp(Lerp(c00, c10, fg), Lerp(c01, c11, fg), fb);
+				}
+
+				result = _mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(result, v255), vHalf), vZero), v255);
+				const __m128i bytes = _mm_cvttps_epi32(result);
+				const int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(_mm_packs_epi32(bytes, zero), zero));
+				out[x] = (packed & 0x00FFFFFF) | (source & static_cast<int32_t>(0xFF000000));
+			}
+		});
+	}
+
+	uint32_t Lut3D::GetTexture() const
+	{
+		if (m_Texture == 0) {
+			glGenTextures(1, &m_Texture);
+			glBindTexture(GL_TEXTURE_3D, m_Texture);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+			glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, m_Size, m_Size, m_Size, 0, GL_RGBA, GL_FLOAT, m_Table.data());
+		}
+		return m_Texture;
+	}
+}
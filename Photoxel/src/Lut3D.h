@@ -0,0 +1,60 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+
+namespace Photoxel
+{
+	static constexpr uint32_t MIN_LUT_SIZE = 2;
+	static constexpr uint32_t MAX_LUT_SIZE = 256;
+
+	enum class LutInterpolation {
+		Trilinear,
+		// Splits every lattice cell into six tetrahedra and blends four corners instead of eight,
+		// which keeps the grey axis exact and is what most grading tools use
+		Tetrahedral
+	};
+
+	// Colour lookup table over a size^3 lattice. Entries are stored as the .cube format lists
+	// them, red changing fastest, padded to four floats so a corner is a single SSE load.
+	// The table is immutable, a new grade is a new Lut3D
+	class Lut3D
+	{
+	public:
+		// Identity table
+		Lut3D(uint32_t size);
+		// table holds size^3 RGBA entries
+		Lut3D(uint32_t size, std::vector<float> table, const std::string& title = "");
+		~Lut3D();
+
+		Lut3D(const Lut3D&) = delete;
+		Lut3D& operator=(const Lut3D&) = delete;
+
+		// Returns nullptr and fills error when the file is not a 3D .cube table
+		static std::shared_ptr<Lut3D> LoadCube(const std::string& path, std::string& error);
+		bool SaveCube(const std::string& path) const;
+
+		// RGBA8 images, src and dst may be the same buffer. Alpha is passed through untouched
+		void Apply(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t height, LutInterpolation interpolation) const;
+
+		uint32_t GetSize() const { return m_Size; }
+		const std::vector<float>& GetTable() const { return m_Table; }
+		const std::string& GetTitle() const { return m_Title; }
+		const glm::vec3& GetDomainMin() const { return m_DomainMin; }
+		const glm::vec3& GetDomainMax() const { return m_DomainMax; }
+		// Unique for the lifetime of the process, the render graph keys its cache on it
+		uint64_t GetId() const { return m_Id; }
+		// RGBA16F 3D texture, uploaded the first time it is asked for
+		uint32_t GetTexture() const;
+	private:
+		uint32_t m_Size;
+		std::vector<float> m_Table;
+		std::string m_Title;
+		glm::vec3 m_DomainMin = glm::vec3(0.0f), m_DomainMax = glm::vec3(1.0f);
+		uint64_t m_Id;
+		mutable uint32_t m_Texture = 0;
+	};
+}
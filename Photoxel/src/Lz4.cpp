@@ -0,0 +1,156 @@
+#include "Lz4.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Photoxel
+{
+	static constexpr uint32_t HASH_BITS = 12;
+	static constexpr size_t MIN_MATCH = 4;
+	// The format ends every block with at least this many literals
+	static constexpr size_t LAST_LITERALS = 5;
+	// and starts no match closer than this to the end
+	static constexpr size_t MATCH_FIND_LIMIT = 12;
+	static constexpr size_t MAX_OFFSET = 65535;
+
+	static uint32_t Read32(const uint8_t* data)
+	{
+		uint32_t value;
+		std::memcpy(&value, data, sizeof(value));
+		return value;
+	}
+
+	static uint32_t HashSequence(uint32_t sequence)
+	{
+		return (sequence * 2654435761u) >> (32 - HASH_BITS);
+	}
+
+	static void WriteLength(std::vector<uint8_t>& dst, size_t length)
+	{
+		for (; length >= 255; length -= 255) {
+			dst.push_back(255);
+		}
+		dst.push_back(static_cast<uint8_t>(length));
+	}
+
+	static void WriteSequence(std::vector<uint8_t>& dst, const uint8_t* literals, size_t literalLength, size_t offset, size_t matchLength)
+	{
+		const size_t matchCode = matchLength - MIN_MATCH;
+		dst.push_back(static_cast<uint8_t>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15)));
+		if (literalLength >= 15) {
+			WriteLength(dst, literalLength - 15);
+		}
+		dst.insert(dst.end(), literals, literals + literalLength);
+		dst.push_back(static_cast<uint8_t>(offset & 0xFF));
+		dst.push_back(static_cast<uint8_t>(offset >> 8));
+		if (matchCode >= 15) {
+			WriteLength(dst, matchCode - 15);
+		}
+	}
+
+	std::vector<uint8_t> Lz4Compress(const uint8_t* src, size_t size)
+	{
+		std::vector<uint8_t> dst;
+		dst.reserve(size + size / 255 + 16);
+
+		size_t anchor = 0;
+		if (size > MATCH_FIND_LIMIT) {
+			// Positions are stored plus one so zero means empty
+			std::vector<uint32_t> table(static_cast<size_t>(1) << HASH_BITS, 0);
+			const size_t matchEnd = size - LAST_LITERALS;
+			const size_t searchEnd = size - MATCH_FIND_LIMIT;
+			size_t position = 0;
+			while (position < searchEnd) {
+				const uint32_t sequence = Read32(src + position);
+				uint32_t& entry = table[HashSequence(sequence)];
+				const size_t candidate = entry;
+				entry = static_cast<uint32_t>(position + 1);
+
+				if (candidate == 0 || position + 1 - candidate > MAX_OFFSET || Read32(src + candidate - 1) != sequence) {
+					// Skip faster through data that does not compress
+					position += 1 + ((position - anchor) >> 6);
+					continue;
+				}
+
+				const size_t match = candidate - 1;
+				size_t length = MIN_MATCH;
+				while (position + length < matchEnd && src[match + length] == src[position + length]) {
+					length++;
+				}
+				WriteSequence(dst, src + anchor, position - anchor, position - match, length);
+				position += length;
+				anchor = position;
+			}
+		}
+
+		const size_t literalLength = size - anchor;
+		dst.push_back(static_cast<uint8_t>(std::min<size_t>(literalLength, 15) << 4));
+		if (literalLength >= 15) {
+			WriteLength(dst, literalLength - 15);
+		}
+		dst.insert(dst.end(), src + anchor, src + size);
+		dst.shrink_to_fit();
+		return dst;
+	}
+
+	static bool ReadLength(const uint8_t* src, size_t srcSize, size_t& in, size_t& length)
+	{
+		uint8_t value;
+		do {
+			if (in >= srcSize) {
+				return false;
+			}
+			value = src[in++];
+			length += value;
+		} while (value == 255);
+		return true;
+	}
+
+	bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t size)
+	{
+		size_t in = 0, out = 0;
+		while (in < srcSize) {
+			const uint8_t token = src[in++];
+			size_t literalLength = token >> 4;
+			if (literalLength == 15 && !ReadLength(src, srcSize, in, literalLength)) {
+				return false;
+			}
+			if (literalLength > srcSize - in || literalLength > size - out) {
+				return false;
+			}
+			std::memcpy(dst + out, src + in, literalLength);
+			in += literalLength;
+			out += literalLength;
+
+			// The last sequence has no match
+			if (in == srcSize) {
+				break;
+			}
+			if (srcSize - in < 2) {
+				return false;
+			}
+			const size_t offset = src[in] | (static_cast<size_t>(src[in + 1]) << 8);
+			in += 2;
+			size_t matchLength = token & 15;
+			if (matchLength == 15 && !ReadLength(src, srcSize, in, matchLength)) {
+				return false;
+			}
+			matchLength += MIN_MATCH;
+			if (offset == 0 || offset > out || matchLength > size - out) {
+				return false;
+			}
+
+			// Matches may overlap what they write, byte by byte repeats the pattern
+			const uint8_t* match = dst + out - offset;
+			if (offset >= matchLength) {
+				std::memcpy(dst + out, match, matchLength);
+			}
+			else {
+				for (size_t i = 0; i < matchLength; i++) {
+					dst[out + i] = match[i];
+				}
+			}
+			out += matchLength;
+		}
+		return out == size;
+	}
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <inttypes.h>
+#include <cstddef>
+#include <vector>
+
+namespace Photoxel
+{
+	// Block format of LZ4, with a greedy single probe matcher. Fast enough to compress history
+	// tiles on every edit, the streams decode with any LZ4 block decoder
+	std::vector<uint8_t> Lz4Compress(const uint8_t* src, size_t size);
+	// False when the stream is malformed or does not decode to exactly size bytes
+	bool Lz4Decompress(const uint8_t* src, size_t srcSize, uint8_t* dst, size_t size);
+}
@@ -0,0 +1,257 @@
+#include "MotionDetector.h"
+#include <emmintrin.h>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace Photoxel
+{
+	// 3 tap min (erode) or max (dilate) along a row, border pixels are replicated
+	static void MorphologyRow(const uint8_t* src, uint8_t* dst, uint32_t width, uint32_t stride,
+		bool erode, std::vector<uint8_t>& row)
+	{
+		row.resize(stride + 32);
+		memset(row.data(), src[0], 16);
+		memcpy(row.data() + 16, src, width);
+		memset(row.data() + 16 + width, src[width - 1], row.size() - 16 - width);
+
+		const uint8_t* padded = row.data() + 16;
+		for (uint32_t x = 0; x < stride; x += 16) {
+			__m128i left = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded + x - 1));
+			__m128i center = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded + x));
+			__m128i right = _mm_loadu_si128(reinterpret_cast<const __m128i*>(padded + x + 1));
+			__m128i result = erode
+				? _mm_min_epu8(_mm_min_epu8(left, center), right)
+				: _mm_max_epu8(_mm_max_epu8(left, center), right);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), result);
+		}
+	}
+
+	static void MorphologyColumns(const uint8_t* src, uint8_t* dst, uint32_t height, uint32_t stride, bool erode)
+	{
+		for (uint32_t y = 0; y < height; y++) {
+			const uint8_t* above = src + static_cast<size_t>(y > 0 ? y - 1 : y) * stride;
+			const uint8_t* center = src + static_cast<size_t>(y) * stride;
+			const uint8_t* below = src + static_cast<size_t>(y + 1 < height ? y + 1 : y) * stride;
+			uint8_t* out = dst + static_cast<size_t>(y) * stride;
+			for (uint32_t x = 0; x < stride; x += 16) {
+				__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+				__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(center + x));
+				__m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+				__m128i result = erode
+					? _mm_min_epu8(_mm_min_epu8(a, b), c)
+					: _mm_max_epu8(_mm_max_epu8(a, b), c);
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), result);
+			}
+		}
+	}
+
+	void MotionDetector::SetSettings(const MotionSettings& settings)
+	{
+		if (settings.Downscale != m_Settings.Downscale) {
+			m_HasBackground = false;
+		}
+		m_Settings = settings;
+		m_Settings.Downscale = std::max(m_Settings.Downscale, 1u);
+	}
+
+	const MotionSettings& MotionDetector::GetSettings() const
+	{
+		return m_Settings;
+	}
+
+	void MotionDetector::Process(const uint8_t* data, uint32_t width, uint32_t height)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+
+		m_Scale = m_Settings.Downscale;
+		const uint32_t maskWidth = width / m_Scale;
+		const uint32_t maskHeight = height / m_Scale;
+		if (maskWidth == 0 || maskHeight == 0) {
+			return;
+		}
+
+		if (maskWidth != m_Width || maskHeight != m_Height) {
+			m_Width = maskWidth;
+			m_Height = maskHeight;
+			// Rows are padded to whole SSE registers, padding stays zero
+			m_Stride = (maskWidth + 15) & ~15u;
+			const size_t size = static_cast<size_t>(m_Stride) * m_Height;
+			m_Luma.assign(size, 0);
+			m_Background.assign(size, 0.0f);
+			m_Mask.assign(size, 0);
+			m_Scratch.assign(size, 0);
+			m_HasBackground = false;
+		}
+
+		ComputeLuma(data, width);
+		UpdateBackground();
+		if (m_Settings.Cleanup) {
+			CleanupMask();
+		}
+		ExtractRegions();
+
+		auto end = std::chrono::high_resolution_clock::now();
+		m_LastProcessTime = std::chrono::duration<double, std::milli>(end - start).count();
+	}
+
+	void MotionDetector::Reset()
+	{
+		m_HasBackground = false;
+		std::fill(m_Mask.begin(), m_Mask.end(), 0);
+		m_Regions.clear();
+		m_MotionRatio = 0.0f;
+	}
+
+	const uint8_t* MotionDetector::GetMask() const
+	{
+		return m_Mask.data();
+	}
+
+	uint32_t MotionDetector::GetMaskWidth() const
+	{
+		return m_Width;
+	}
+
+	uint32_t MotionDetector::GetMaskHeight() const
+	{
+		return m_Height;
+	}
+
+	uint32_t MotionDetector::GetMaskStride() const
+	{
+		return m_Stride;
+	}
+
+	const std::vector<MotionRegion>& MotionDetector::GetRegions() const
+	{
+		return m_Regions;
+	}
+
+	float MotionDetector::GetMotionRatio() const
+	{
+		return m_MotionRatio;
+	}
+
+	double MotionDetector::GetLastProcessTime() const
+	{
+		return m_LastProcessTime;
+	}
+
+	double MotionDetector::GetLastLabelTime() const
+	{
+		return m_Components.GetLastLabelTime();
+	}
+
+	void MotionDetector::ComputeLuma(const uint8_t* data, uint32_t width)
+	{
+		// Box filter while converting, every mask pixel averages a Scale x Scale block
+		const uint32_t scale = m_Scale;
+		const uint32_t shift = 8;
+		const uint32_t divisor = scale * scale;
+		std::vector<uint32_t> sums(m_Width);
+
+		for (uint32_t y = 0; y < m_Height; y++) {
+			std::fill(sums.begin(), sums.end(), 0u);
+			for (uint32_t row = 0; row < scale; row++) {
+				const uint8_t* pixel = data + (static_cast<size_t>(y * scale + row) * width) * 3;
+				for (uint32_t x = 0; x < m_Width; x++) {
+					uint32_t sum = 0;
+					for (uint32_t col = 0; col < scale; col++, pixel += 3) {
+						sum += (77 * pixel[0] + 150 * pixel[1] + 29 * pixel[2]) >> shift;
+					}
+					sums[x] += sum;
+				}
+			}
+
+			uint8_t* luma = m_Luma.data() + static_cast<size_t>(y) * m_Stride;
+			for (uint32_t x = 0; x < m_Width; x++) {
+				luma[x] = static_cast<uint8_t>(sums[x] / divisor);
+			}
+		}
+	}
+
+	void MotionDetector::UpdateBackground()
+	{
+		const size_t size = m_Luma.size();
+		if (!m_HasBackground) {
+			for (size_t i = 0; i < size; i++) {
+				m_Background[i] = m_Luma[i];
+			}
+			std::fill(m_Mask.begin(), m_Mask.end(), 0);
+			m_HasBackground = true;
+			return;
+		}
+
+		const __m128i zero = _mm_setzero_si128();
+		const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+		const __m128 threshold = _mm_set1_ps(m_Settings.Threshold);
+		const __m128 fastRate = _mm_set1_ps(m_Settings.LearningRate);
+		const __m128 slowRate = _mm_set1_ps(m_Settings.LearningRate * 0.1f);
+
+		const uint8_t* luma = m_Luma.data();
+		float* background = m_Background.data();
+		uint8_t* mask = m_Mask.data();
+
+		for (size_t i = 0; i < size; i += 16) {
+			__m128i pixels = _mm_loadu_si128(reinterpret_cast<const __m128i*>(luma + i));
+			__m128i low = _mm_unpacklo_epi8(pixels, zero);
+			__m128i high = _mm_unpackhi_epi8(pixels, zero);
+			__m128 values[4] = {
+				_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)),
+				_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)),
+				_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)),
+				_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero))
+			};
+
+			__m128i moving[4];
+			for (int k = 0; k < 4; k++) {
+				__m128 model = _mm_loadu_ps(background + i + k * 4);
+				__m128 diff = _mm_sub_ps(values[k], model);
+				__m128 isMoving = _mm_cmpgt_ps(_mm_and_ps(diff, absMask), threshold);
+				__m128 rate = _mm_or_ps(_mm_and_ps(isMoving, slowRate), _mm_andnot_ps(isMoving, fastRate));
+				_mm_storeu_ps(background + i + k * 4, _mm_add_ps(model, _mm_mul_ps(diff, rate)));
+				moving[k] = _mm_castps_si128(isMoving);
+			}
+
+			__m128i packed = _mm_packs_epi16(_mm_packs_epi32(moving[0], moving[1]), _mm_packs_epi32(moving[2], moving[3]));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(mask + i), packed);
+		}
+	}
+
+	void MotionDetector::CleanupMask()
+	{
+		// Opening drops isolated noise, closing glues the pieces of one moving object together
+		const bool passes[4] = { true, false, false, true };
+		for (bool erode : passes) {
+			for (uint32_t y = 0; y < m_Height; y++) {
+				const size_t offset = static_cast<size_t>(y) * m_Stride;
+				MorphologyRow(m_Mask.data() + offset, m_Scratch.data() + offset, m_Width, m_Stride, erode, m_Row);
+			}
+			MorphologyColumns(m_Scratch.data(), m_Mask.data(), m_Height, m_Stride, erode);
+		}
+
+		// Keep the SIMD padding out of the mask
+		for (uint32_t y = 0; y < m_Height; y++) {
+			memset(m_Mask.data() + static_cast<size_t>(y) * m_Stride + m_Width, 0, m_Stride - m_Width);
+		}
+	}
+
+	void MotionDetector::ExtractRegions()
+	{
+		m_Regions.clear();
+		const auto& blobs = m_Components.Label(m_Mask.data(), m_Width, m_Height, m_Stride, m_Settings.MinRegionArea);
+
+		const float scale = static_cast<float>(m_Scale);
+		for (const auto& blob : blobs) {
+			m_Regions.push_back({
+				blob.MinX * m_Scale, blob.MinY * m_Scale,
+				(blob.MaxX - blob.MinX + 1) * m_Scale, (blob.MaxY - blob.MinY + 1) * m_Scale,
+				blob.Area,
+				(blob.CentroidX + 0.5f) * scale, (blob.CentroidY + 0.5f) * scale
+			});
+		}
+
+		m_MotionRatio = static_cast<float>(m_Components.GetForegroundArea()) / (static_cast<float>(m_Width) * m_Height);
+	}
+}
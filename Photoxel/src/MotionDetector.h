@@ -0,0 +1,75 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+#include "ConnectedComponents.h"
+
+namespace Photoxel
+{
+	struct MotionRegion {
+		// Bounding box in frame pixels
+		uint32_t X, Y, Width, Height;
+		// Moving pixels inside the box, in mask pixels
+		uint32_t Area;
+		// Centre of mass in frame pixels
+		float CentroidX, CentroidY;
+	};
+
+	struct MotionSettings {
+		// The model runs on a luma plane this many times smaller than the frame
+		uint32_t Downscale = 4;
+		// Background adaptation speed for still pixels, moving pixels adapt 10 times slower
+		float LearningRate = 0.05f;
+		// Luma difference (0 - 255) that counts as motion
+		float Threshold = 20.0f;
+		// Regions with fewer mask pixels are dropped as noise
+		uint32_t MinRegionArea = 6;
+		bool Cleanup = true;
+	};
+
+	// Running-average background subtraction. Keeps one model per stream and
+	// never touches the GPU, so several cameras can be processed side by side
+	class MotionDetector
+	{
+	public:
+		MotionDetector() = default;
+
+		void SetSettings(const MotionSettings& settings);
+		const MotionSettings& GetSettings() const;
+
+		// Feeds an RGB24 frame and updates the mask and regions
+		void Process(const uint8_t* data, uint32_t width, uint32_t height);
+		void Reset();
+
+		// 0 or 255 per mask pixel, rows are GetMaskStride() bytes apart
+		const uint8_t* GetMask() const;
+		uint32_t GetMaskWidth() const;
+		uint32_t GetMaskHeight() const;
+		uint32_t GetMaskStride() const;
+
+		const std::vector<MotionRegion>& GetRegions() const;
+		// Fraction of the mask flagged as moving
+		float GetMotionRatio() const;
+		double GetLastProcessTime() const;
+		double GetLastLabelTime() const;
+	private:
+		void ComputeLuma(const uint8_t* data, uint32_t width);
+		void UpdateBackground();
+		void CleanupMask();
+		void ExtractRegions();
+
+		MotionSettings m_Settings;
+		uint32_t m_Width = 0, m_Height = 0, m_Stride = 0;
+		uint32_t m_Scale = 1;
+		bool m_HasBackground = false;
+
+		std::vector<uint8_t> m_Luma;
+		std::vector<float> m_Background;
+		std::vector<uint8_t> m_Mask, m_Scratch, m_Row;
+		ConnectedComponents m_Components;
+
+		std::vector<MotionRegion> m_Regions;
+		float m_MotionRatio = 0.0f;
+		double m_LastProcessTime = 0.0;
+	};
+}
@@ -0,0 +1,87 @@
+#include "MotionEventLog.h"
+#include <algorithm>
+#include <ctime>
+
+namespace Photoxel
+{
+	MotionEventLog::MotionEventLog(uint32_t startFrames, uint32_t stopFrames, size_t capacity)
+		: m_StartFrames(startFrames), m_StopFrames(stopFrames), m_Capacity(capacity)
+	{
+	}
+
+	void MotionEventLog::Update(uint32_t blobCount, uint32_t area)
+	{
+		if (blobCount > 0) {
+			m_MovingFrames++;
+			m_StillFrames = 0;
+		}
+		else {
+			m_StillFrames++;
+			m_MovingFrames = 0;
+		}
+
+		if (!m_Active && m_MovingFrames >= m_StartFrames) {
+			m_Active = true;
+			m_EventStart = std::chrono::steady_clock::now();
+
+			MotionEvent event;
+			event.Start = GetTimestamp(std::chrono::system_clock::now());
+			m_Events.push_front(event);
+			if (m_Events.size() > m_Capacity) {
+				m_Events.pop_back();
+			}
+		}
+
+		if (m_Active) {
+			MotionEvent& event = m_Events.front();
+			event.PeakBlobs = std::max(event.PeakBlobs, blobCount);
+			event.PeakArea = std::max(event.PeakArea, area);
+			event.Duration = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_EventStart).count();
+
+			if (m_StillFrames >= m_StopFrames) {
+				Close();
+			}
+		}
+	}
+
+	void MotionEventLog::Close()
+	{
+		if (!m_Active) return;
+
+		m_Active = false;
+		m_Events.front().End = GetTimestamp(std::chrono::system_clock::now());
+		m_MovingFrames = 0;
+	}
+
+	void MotionEventLog::Clear()
+	{
+		m_Events.clear();
+		m_Active = false;
+		m_MovingFrames = 0;
+		m_StillFrames = 0;
+	}
+
+	bool MotionEventLog::IsActive() const
+	{
+		return m_Active;
+	}
+
+	const std::deque<MotionEvent>& MotionEventLog::GetEvents() const
+	{
+		return m_Events;
+	}
+
+	std::string MotionEventLog::GetTimestamp(std::chrono::system_clock::time_point time)
+	{
+		std::time_t seconds = std::chrono::system_clock::to_time_t(time);
+		std::tm local = {};
+#ifdef _MSC_VER
+		localtime_s(&local, &seconds);
+#else
+		localtime_r(&seconds, &local);
+#endif
+		char buffer[32];
+		std::strftime(buffer, sizeof(buffer), "%H:%M:%S", &local);
+		return buffer;
+	}
+}
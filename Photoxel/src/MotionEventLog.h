@@ -0,0 +1,41 @@
+#pragma once
+
+#include <inttypes.h>
+#include <string>
+#include <deque>
+#include <chrono>
+
+namespace Photoxel
+{
+	struct MotionEvent {
+		std::string Start, End;
+		double Duration = 0.0;
+		uint32_t PeakBlobs = 0;
+		uint32_t PeakArea = 0;
+	};
+
+	// Turns the per-frame blob count into start/stop events. Motion has to hold for a few
+	// frames before an event opens and stay gone for a few more before it closes
+	class MotionEventLog
+	{
+	public:
+		MotionEventLog(uint32_t startFrames = 3, uint32_t stopFrames = 15, size_t capacity = 256);
+
+		void Update(uint32_t blobCount, uint32_t area);
+		void Close();
+		void Clear();
+
+		bool IsActive() const;
+		// Newest first
+		const std::deque<MotionEvent>& GetEvents() const;
+	private:
+		static std::string GetTimestamp(std::chrono::system_clock::time_point time);
+
+		uint32_t m_StartFrames, m_StopFrames;
+		size_t m_Capacity;
+		uint32_t m_MovingFrames = 0, m_StillFrames = 0;
+		bool m_Active = false;
+		std::chrono::steady_clock::time_point m_EventStart;
+		std::deque<MotionEvent> m_Events;
+	};
+}
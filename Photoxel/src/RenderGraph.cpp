@@ -0,0 +1,936 @@
+#include "RenderGraph.h"
+#include "Renderer.h"
+#include "Anonymise.h"
+#include <glad/glad.h>
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+
+namespace Photoxel
+{
+	static constexpr size_t DEFAULT_CACHE_BUDGET = 256ull * 1024 * 1024;
+	// Side of the scissored tiles a refinement renders
+	static constexpr uint32_t REFINE_TILE_SIZE = 1024;
+	// Long side of the render the histogram statistics are taken from
+	static constexpr uint32_t ANALYSIS_SIZE = 512;
+	// Long side of the render faces are looked for in, the detector finds faces from 80 pixels up
+	static constexpr uint32_t FACE_ANALYSIS_SIZE = 2048;
+
+	// FNV-1a over the bytes of value
+	template <typename T>
+	static uint64_t Hash(uint64_t seed, const T& value)
+	{
+		const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+		for (size_t i = 0; i < sizeof(T); i++) {
+			seed = (seed ^ bytes[i]) * 0x100000001B3ull;
+		}
+		return seed;
+	}
+
+	// Only the parameters a pass reads go into its key, so moving a slider of a later pass
+	// leaves the keys of everything before it untouched
+	static uint64_t HashPass(uint64_t seed, const RenderPass& pass, const FilterParameters& parameters)
+	{
+		for (Filter filter : pass.Filters) {
+			seed = Hash(seed, filter);
+			switch (filter)
+			{
+				case Filter::Brightness:	seed = Hash(seed, parameters.Brightness); break;
+				case Filter::Contrast:		seed = Hash(seed, parameters.Contrast); break;
+				case Filter::Binary:		seed = Hash(seed, parameters.Thresehold); break;
+				case Filter::Pixelate:		seed = Hash(seed, parameters.Mosaic); break;
+				case Filter::GaussianBlur:	seed = Hash(seed, parameters.BlurSigma); break;
+				case Filter::Convolution:
+					seed = Hash(seed, parameters.Kernel.Size);
+					seed = Hash(seed, parameters.Kernel.Bias);
+					for (float weight : parameters.Kernel.Weights) {
+						seed = Hash(seed, weight);
+					}
+					break;
+				case Filter::Median:		seed = Hash(seed, parameters.MedianRadius); break;
+				case Filter::Bilateral:
+					seed = Hash(seed, parameters.BilateralSpatial);
+					seed = Hash(seed, parameters.BilateralRange);
+					break;
+				case Filter::AutoLevels:	seed = Hash(seed, parameters.LevelsClip); break;
+				case Filter::Clahe:
+					seed = Hash(seed, parameters.ClaheTiles);
+					seed = Hash(seed, parameters.ClaheClip);
+					break;
+				case Filter::Anonymise:
+					seed = Hash(seed, parameters.Anonymise);
+					seed = Hash(seed, parameters.FaceMosaic);
+					seed = Hash(seed, parameters.FaceBlurSigma);
+					seed = Hash(seed, parameters.FacePadding);
+					seed = Hash(seed, parameters.FaceModel);
+					break;
+				case Filter::Lut:
+					seed = Hash(seed, parameters.Lut ? parameters.Lut->GetId() : 0);
+					seed = Hash(seed, parameters.Interpolation);
+					break;
+				case Filter::Gradient:
+					seed = Hash(seed, parameters.StartColour);
+					seed = Hash(seed, parameters.EndColour);
+					seed = Hash(seed, parameters.Angle);
+					seed = Hash(seed, parameters.Intensity);
+					break;
+				// The rest have no parameters
+				default:
+					break;
+			}
+		}
+		return seed;
+	}
+
+	// Pixels of output a pass reads beyond the one it writes, spatial parameters are in output pixels
+	static uint32_t GetPassHalo(const RenderPass& pass, const FilterParameters& parameters, float scale)
+	{
+		if (pass.Filters.empty()) {
+			return 0;
+		}
+
+		switch (pass.Filters.front())
+		{
+			case Filter::EdgeDetection:	return 1;
+			case Filter::Pixelate:		return static_cast<uint32_t>(std::ceil(parameters.Mosaic * scale)) + 1;
+			case Filter::GaussianBlur:	return static_cast<uint32_t>(std::ceil(parameters.BlurSigma * 3.0f)) + 1;
+			case Filter::Convolution:	return static_cast<uint32_t>(std::ceil((parameters.Kernel.GetRadius() + 0.5f) * scale));
+			case Filter::Median:		return static_cast<uint32_t>(std::ceil(parameters.MedianRadius * scale));
+			case Filter::Bilateral:		return static_cast<uint32_t>(std::ceil(parameters.BilateralSpatial * scale * 3.0f)) + 1;
+			case Filter::Anonymise:
+				return parameters.Anonymise == AnonymiseMode::Pixelate
+					? static_cast<uint32_t>(std::ceil(parameters.FaceMosaic * scale)) + 1
+					: static_cast<uint32_t>(std::ceil(parameters.FaceBlurSigma * scale * 3.0f)) + 1;
+			default:					return 0;
+		}
+	}
+
+	// Faces of the last source a face pass saw. ChainKey only covers the passes ahead of it, while it
+	// holds a new source is the next frame of the same video and the tracker follows the faces
+	struct RenderGraph::FaceAnalysis {
+		uint64_t Key = 0, ChainKey = 0;
+		// Of the analysis render the faces are given in
+		uint32_t Width = 0, Height = 0;
+		FaceTracker Tracker;
+		std::vector<uint8_t> Pixels;
+	};
+
+	// Places inner, given as bounds in the same space as outer, in the texture coordinates of outer
+	// as an offset and a size
+	static glm::vec4 RelativeRect(const glm::vec4& outer, const glm::vec4& inner)
+	{
+		const glm::vec2 size(outer.z - outer.x, outer.w - outer.y);
+		return glm::vec4((inner.x - outer.x) / size.x, (inner.y - outer.y) / size.y,
+			(inner.z - inner.x) / size.x, (inner.w - inner.y) / size.y);
+	}
+
+	static void ApplyParameters(Shader& program, const FilterParameters& parameters, uint32_t width, uint32_t height,
+		uint32_t sourceWidth, uint32_t sourceHeight)
+	{
+		program.SetFloat("u_Brightness", parameters.Brightness);
+		program.SetFloat("u_Contrast", parameters.Contrast);
+		program.SetFloat("u_Thresehold", parameters.Thresehold);
+		program.SetInt("u_Width", width);
+		program.SetInt("u_Height", height);
+		program.SetInt("u_Mosaic", parameters.Mosaic);
+		program.SetInt("u_MosaicWidth", sourceWidth);
+		program.SetInt("u_MosaicHeight", sourceHeight);
+		program.SetFloat3("u_StartColour", parameters.StartColour);
+		program.SetFloat3("u_EndColour", parameters.EndColour);
+		program.SetFloat("u_Angle", parameters.Angle);
+		program.SetFloat("u_Intensity", parameters.Intensity);
+		program.SetInt("u_Texture", 0);
+	}
+
+	// The table goes on the second texture unit, the first one stays with the input
+	static void BindLut(Shader& program, const Lut3D& lut, LutInterpolation interpolation)
+	{
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_3D, lut.GetTexture());
+		glActiveTexture(GL_TEXTURE0);
+		program.SetInt("u_Lut", 1);
+		program.SetFloat("u_LutSize", static_cast<float>(lut.GetSize()));
+		program.SetFloat3("u_LutDomainMin", lut.GetDomainMin());
+		program.SetFloat3("u_LutDomainMax", lut.GetDomainMax());
+		program.SetInt("u_LutTetrahedral", interpolation == LutInterpolation::Tetrahedral);
+	}
+
+	Framebuffer* FramebufferPool::Acquire(uint32_t width, uint32_t height)
+	{
+		Entry* free = nullptr;
+		for (auto& entry : m_Entries) {
+			if (entry.InUse) continue;
+			if (entry.Target->GetWidth() == width && entry.Target->GetHeight() == height) {
+				free = &entry;
+				break;
+			}
+			if (!free) free = &entry;
+		}
+
+		if (!free) {
+			m_Entries.push_back({ std::make_unique<Framebuffer>(width, height), false });
+			free = &m_Entries.back();
+		}
+		free->Target->Resize(width, height);
+		free->InUse = true;
+		return free->Target.get();
+	}
+
+	void FramebufferPool::Release(Framebuffer* framebuffer)
+	{
+		for (auto& entry : m_Entries) {
+			if (entry.Target.get() == framebuffer) {
+				entry.InUse = false;
+				return;
+			}
+		}
+	}
+
+	size_t FramebufferPool::GetSize() const
+	{
+		return m_Entries.size();
+	}
+
+	PassCache::PassCache(FramebufferPool& pool, size_t budget)
+		: m_Pool(pool), m_Budget(budget)
+	{
+	}
+
+	Framebuffer* PassCache::Find(uint64_t key)
+	{
+		auto found = m_Index.find(key);
+		if (found == m_Index.end()) {
+			return nullptr;
+		}
+		m_Entries.splice(m_Entries.begin(), m_Entries, found->second);
+		return found->second->Target;
+	}
+
+	bool PassCache::Insert(uint64_t key, uint64_t sourceKey, Framebuffer* framebuffer)
+	{
+		const size_t bytes = static_cast<size_t>(framebuffer->GetWidth()) * framebuffer->GetHeight() * 4;
+		if (bytes > m_Budget || m_Index.count(key)) {
+			return false;
+		}
+
+		Evict(m_Budget - bytes);
+		m_Entries.push_front({ key, sourceKey, framebuffer, bytes });
+		m_Index[key] = m_Entries.begin();
+		m_Usage += bytes;
+		return true;
+	}
+
+	void PassCache::DropOtherSources(uint64_t sourceKey)
+	{
+		for (auto entry = m_Entries.begin(); entry != m_Entries.end();) {
+			if (entry->SourceKey == sourceKey) {
+				++entry;
+				continue;
+			}
+			m_Pool.Release(entry->Target);
+			m_Usage -= entry->Bytes;
+			m_Index.erase(entry->Key);
+			entry = m_Entries.erase(entry);
+		}
+	}
+
+	void PassCache::Clear()
+	{
+		Evict(0);
+	}
+
+	void PassCache::SetBudget(size_t budget)
+	{
+		m_Budget = budget;
+		Evict(budget);
+	}
+
+	size_t PassCache::GetBudget() const
+	{
+		return m_Budget;
+	}
+
+	size_t PassCache::GetUsage() const
+	{
+		return m_Usage;
+	}
+
+	size_t PassCache::GetEntryCount() const
+	{
+		return m_Entries.size();
+	}
+
+	void PassCache::Evict(size_t budget)
+	{
+		while (m_Usage > budget && !m_Entries.empty()) {
+			const Entry& entry = m_Entries.back();
+			m_Pool.Release(entry.Target);
+			m_Usage -= entry.Bytes;
+			m_Index.erase(entry.Key);
+			m_Entries.pop_back();
+		}
+	}
+
+	RenderGraph::RenderGraph(Renderer& renderer)
+		: m_Renderer(renderer), m_Cache(m_Pool, DEFAULT_CACHE_BUDGET), m_IdentityLut(MIN_LUT_SIZE)
+	{
+		m_CopyProgram = std::make_unique<Shader>(std::initializer_list<ShaderProperties>{
+			{ "VertexShader", ShaderType::Vertex },
+			{ "PixelShader", ShaderType::Pixel }
+		}, std::vector<Filter>());
+
+		glGenTextures(1, &m_CpuTexture);
+		glBindTexture(GL_TEXTURE_2D, m_CpuTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		SetChain({});
+	}
+
+	RenderGraph::~RenderGraph()
+	{
+		CancelRefinement();
+		m_Cache.Clear();
+		glDeleteTextures(1, &m_CpuTexture);
+	}
+
+	void RenderGraph::SetChain(const std::vector<Filter>& chain)
+	{
+		m_Chain = chain;
+		m_Passes.clear();
+
+		for (Filter filter : chain) {
+			if (filter == Filter::GaussianBlur || filter == Filter::Convolution || filter == Filter::Median
+				|| filter == Filter::Bilateral || filter == Filter::AutoLevels || filter == Filter::Clahe
+				|| filter == Filter::Anonymise) {
+				RenderPass pass;
+				switch (filter)
+				{
+					case Filter::GaussianBlur:	pass.Type = PassType::Blur; break;
+					case Filter::Convolution:	pass.Type = PassType::Convolution; break;
+					case Filter::AutoLevels:
+					case Filter::Clahe:			pass.Type = PassType::Histogram; break;
+					case Filter::Anonymise:		pass.Type = PassType::Faces; break;
+					default:					pass.Type = PassType::Denoise; break;
+				}
+				pass.Filters.push_back(filter);
+				m_Passes.push_back(std::move(pass));
+				continue;
+			}
+
+			if (!IsPointwise(filter) || m_Passes.empty() || m_Passes.back().Type != PassType::Shader) {
+				m_Passes.emplace_back();
+			}
+			m_Passes.back().Filters.push_back(filter);
+		}
+
+		// An empty chain still has to copy the source into the target
+		if (m_Passes.empty()) {
+			m_Passes.emplace_back();
+		}
+
+		for (auto& pass : m_Passes) {
+			if (pass.Type != PassType::Shader) continue;
+			pass.Program = std::make_unique<Shader>(std::initializer_list<ShaderProperties>{
+				{ "VertexShader", ShaderType::Vertex },
+				{ "PixelShader", ShaderType::Pixel }
+			}, pass.Filters);
+		}
+
+		m_Analyses.clear();
+		m_Analyses.resize(m_Passes.size());
+		m_FaceAnalyses.clear();
+		m_FaceAnalyses.resize(m_Passes.size());
+	}
+
+	const std::vector<Filter>& RenderGraph::GetChain() const
+	{
+		return m_Chain;
+	}
+
+	const std::vector<RenderPass>& RenderGraph::GetPasses() const
+	{
+		return m_Passes;
+	}
+
+	size_t RenderGraph::GetPoolSize() const
+	{
+		return m_Pool.GetSize();
+	}
+
+	double RenderGraph::GetLastCpuBlurTime() const
+	{
+		return m_CpuBlur.GetLastBlurTime();
+	}
+
+	const ConvolutionEngine& RenderGraph::GetConvolutionEngine() const
+	{
+		return m_Convolution;
+	}
+
+	std::shared_ptr<Lut3D> RenderGraph::BakeLut(const std::vector<Filter>& filters, const FilterParameters& parameters,
+		uint32_t size)
+	{
+		size = std::clamp(size, MIN_LUT_SIZE, MAX_LUT_SIZE);
+		// Lattice point (r, g, b) is drawn at pixel (r + b * size, g) of a float target, so the
+		// chain sees every colour exactly and its output is read back without rounding
+		const uint32_t width = size * size, height = size;
+		const float last = static_cast<float>(size - 1);
+		std::vector<float> pixels(static_cast<size_t>(width) * height * 4);
+		for (uint32_t g = 0; g < size; g++) {
+			for (uint32_t b = 0; b < size; b++) {
+				for (uint32_t r = 0; r < size; r++) {
+					float* pixel = pixels.data() + (static_cast<size_t>(g) * width + b * size + r) * 4;
+					pixel[0] = r / last;
+					pixel[1] = g / last;
+					pixel[2] = b / last;
+					pixel[3] = 1.0f;
+				}
+			}
+		}
+
+		uint32_t textures[2], framebuffer;
+		glGenTextures(2, textures);
+		for (uint32_t texture : textures) {
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT,
+				texture == textures[0] ? pixels.data() : nullptr);
+		}
+		glGenFramebuffers(1, &framebuffer);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[1], 0);
+		glViewport(0, 0, width, height);
+
+		Shader program({
+			{ "VertexShader", ShaderType::Vertex },
+			{ "PixelShader", ShaderType::Pixel }
+		}, filters);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, textures[0]);
+		program.Bind();
+		ApplyParameters(program, parameters, width, height, width, height);
+		if (HasFilter(filters, Filter::Lut)) {
+			BindLut(program, parameters.Lut ? *parameters.Lut : m_IdentityLut, parameters.Interpolation);
+		}
+		program.SetFloat4("u_TexRect", glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		m_Renderer.OnRender();
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_FLOAT, pixels.data());
+
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glDeleteFramebuffers(1, &framebuffer);
+		glDeleteTextures(2, textures);
+
+		// Back to the table order, clamped like the 8 bit targets the chain normally renders into
+		std::vector<float> table(static_cast<size_t>(size) * size * size * 4);
+		for (uint32_t b = 0; b < size; b++) {
+			for (uint32_t g = 0; g < size; g++) {
+				for (uint32_t r = 0; r < size; r++) {
+					const float* pixel = pixels.data() + (static_cast<size_t>(g) * width + b * size + r) * 4;
+					float* entry = table.data() + ((static_cast<size_t>(b) * size + g) * size + r) * 4;
+					for (int c = 0; c < 3; c++) {
+						entry[c] = std::clamp(pixel[c], 0.0f, 1.0f);
+					}
+					entry[3] = 0.0f;
+				}
+			}
+		}
+		return std::make_shared<Lut3D>(size, std::move(table), "Photoxel bake");
+	}
+
+	const MedianFilter& RenderGraph::GetMedianFilter() const
+	{
+		return m_Median;
+	}
+
+	const BilateralGrid& RenderGraph::GetBilateralGrid() const
+	{
+		return m_Bilateral;
+	}
+
+	double RenderGraph::GetLastHistogramTime() const
+	{
+		return m_LastHistogramTime;
+	}
+
+	void RenderGraph::SetFaceKeyframeInterval(uint32_t renders)
+	{
+		m_FaceKeyframeInterval = std::max(renders, 1u);
+	}
+
+	uint32_t RenderGraph::GetFaceKeyframeInterval() const
+	{
+		return m_FaceKeyframeInterval;
+	}
+
+	uint32_t RenderGraph::GetLastFaceCount() const
+	{
+		return m_LastFaceCount;
+	}
+
+	double RenderGraph::GetLastFaceTime() const
+	{
+		return m_LastFaceTime;
+	}
+
+	std::string RenderGraph::GetFaceModelError() const
+	{
+		return m_FaceDetector ? m_FaceDetector->GetModelError() : std::string();
+	}
+
+	PassCache& RenderGraph::GetCache()
+	{
+		return m_Cache;
+	}
+
+	uint32_t RenderGraph::GetLastReusedPasses() const
+	{
+		return m_LastReusedPasses;
+	}
+
+	void RenderGraph::Execute(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+		const FilterParameters& parameters, Framebuffer& target, const glm::vec4& region)
+	{
+		CancelRefinement();
+		Prepare(source, sourceWidth, sourceHeight, sourceRevision, parameters, target, region);
+
+		GraphExecution& execution = m_Execution;
+		while (execution.Pass < m_Passes.size()) {
+			RunPass(m_Passes[execution.Pass], *execution.Output);
+			FinishPass();
+		}
+
+		target.Begin();
+	}
+
+	void RenderGraph::BeginRefinement(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+		const FilterParameters& parameters, Framebuffer& target, const glm::vec4& region)
+	{
+		CancelRefinement();
+		Prepare(source, sourceWidth, sourceHeight, sourceRevision, parameters, target, region);
+		m_Refining = true;
+	}
+
+	bool RenderGraph::StepRefinement(uint32_t tiles)
+	{
+		if (!m_Refining) {
+			return true;
+		}
+
+		GraphExecution& execution = m_Execution;
+		while (tiles > 0 && execution.Pass < m_Passes.size()) {
+			const RenderPass& pass = m_Passes[execution.Pass];
+			tiles--;
+			if (pass.Type != PassType::Shader) {
+				RunPass(pass, *execution.Output);
+				FinishPass();
+				continue;
+			}
+
+			const uint32_t width = execution.Output->GetWidth();
+			const uint32_t height = execution.Output->GetHeight();
+			const uint32_t columns = (width + REFINE_TILE_SIZE - 1) / REFINE_TILE_SIZE;
+			const uint32_t x = (execution.Tile % columns) * REFINE_TILE_SIZE;
+			const uint32_t y = (execution.Tile / columns) * REFINE_TILE_SIZE;
+			glEnable(GL_SCISSOR_TEST);
+			glScissor(x, y, std::min(REFINE_TILE_SIZE, width - x), std::min(REFINE_TILE_SIZE, height - y));
+			RunPass(pass, *execution.Output);
+			glDisable(GL_SCISSOR_TEST);
+
+			if (++execution.Tile == GetTileCount()) {
+				FinishPass();
+			}
+		}
+		// Get the tiles going while the rest of the frame is recorded
+		glFlush();
+
+		if (execution.Pass < m_Passes.size()) {
+			return false;
+		}
+		m_Refining = false;
+		execution.Target->Begin();
+		return true;
+	}
+
+	void RenderGraph::CancelRefinement()
+	{
+		if (!m_Refining) {
+			return;
+		}
+
+		GraphExecution& execution = m_Execution;
+		if (execution.Output && execution.Output != execution.Target) {
+			m_Pool.Release(execution.Output);
+		}
+		if (execution.Previous) {
+			m_Pool.Release(execution.Previous);
+		}
+		execution.Output = execution.Previous = nullptr;
+		m_Refining = false;
+	}
+
+	bool RenderGraph::IsRefining() const
+	{
+		return m_Refining;
+	}
+
+	float RenderGraph::GetRefinementProgress() const
+	{
+		if (!m_Refining) {
+			return 1.0f;
+		}
+
+		const GraphExecution& execution = m_Execution;
+		const float total = static_cast<float>(m_Passes.size() - execution.FirstPass);
+		const float tiles = m_Passes[execution.Pass].Type == PassType::Shader ? static_cast<float>(GetTileCount()) : 1.0f;
+		return (execution.Pass - execution.FirstPass + execution.Tile / tiles) / total;
+	}
+
+	void RenderGraph::Prepare(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+		const FilterParameters& parameters, Framebuffer& target, const glm::vec4& region)
+	{
+		const uint32_t width = target.GetWidth();
+		const uint32_t height = target.GetHeight();
+
+		GraphExecution& execution = m_Execution;
+		execution = GraphExecution();
+		execution.Target = &target;
+		execution.Source = source;
+		execution.SourceWidth = sourceWidth;
+		execution.SourceHeight = sourceHeight;
+		execution.SourceRevision = sourceRevision;
+		execution.SourceParameters = parameters;
+		execution.FullWidth = width / std::max(region.z - region.x, 1e-6f);
+		execution.FullHeight = height / std::max(region.w - region.y, 1e-6f);
+		const float scale = execution.FullWidth / std::max(sourceWidth, 1u);
+		execution.Parameters = parameters;
+		execution.Parameters.BlurSigma *= scale;
+
+		// Each output has to cover its consumer's region plus every halo still ahead of it
+		m_Layouts.resize(m_Passes.size());
+		const float x0 = region.x * execution.FullWidth, x1 = x0 + width;
+		const float y0 = region.y * execution.FullHeight, y1 = y0 + height;
+		uint32_t halo = 0;
+		for (size_t i = m_Passes.size(); i-- > 0;) {
+			const uint32_t left = std::min(halo, static_cast<uint32_t>(std::ceil(std::max(x0, 0.0f))));
+			const uint32_t right = std::min(halo, static_cast<uint32_t>(std::ceil(std::max(execution.FullWidth - x1, 0.0f))));
+			const uint32_t top = std::min(halo, static_cast<uint32_t>(std::ceil(std::max(y0, 0.0f))));
+			const uint32_t bottom = std::min(halo, static_cast<uint32_t>(std::ceil(std::max(execution.FullHeight - y1, 0.0f))));
+
+			PassLayout& layout = m_Layouts[i];
+			layout.Width = width + left + right;
+			layout.Height = height + top + bottom;
+			layout.Rect = glm::vec4((x0 - left) / execution.FullWidth, (y0 - top) / execution.FullHeight,
+				(x1 + right) / execution.FullWidth, (y1 + bottom) / execution.FullHeight);
+			halo += GetPassHalo(m_Passes[i], execution.Parameters, scale);
+		}
+
+		// Proxies, crops and full resolution renders of one source share the cache, only the
+		// pass keys tell them apart
+		execution.SourceKey = Hash(Hash(0xCBF29CE484222325ull, source), sourceRevision);
+		m_Cache.DropOtherSources(execution.SourceKey);
+
+		m_PassKeys.resize(m_Passes.size());
+		uint64_t key = Hash(Hash(Hash(execution.SourceKey, width), height), region);
+		for (size_t i = 0; i < m_Passes.size(); i++) {
+			// The layout grows with the halos of the later passes, an output of another one is misaligned
+			const PassLayout& layout = m_Layouts[i];
+			key = Hash(Hash(Hash(key, layout.Rect), layout.Width), layout.Height);
+			key = HashPass(key, m_Passes[i], parameters);
+			m_PassKeys[i] = key;
+		}
+
+		// Resume after the last intermediate output that is still cached
+		execution.Input = source;
+		execution.InputWidth = sourceWidth;
+		execution.InputHeight = sourceHeight;
+		for (size_t i = m_Passes.size() - 1; i-- > 0;) {
+			if (Framebuffer* cached = m_Cache.Find(m_PassKeys[i])) {
+				execution.FirstPass = i + 1;
+				execution.Input = cached->GetColorAttachment();
+				execution.InputWidth = m_Layouts[i].Width;
+				execution.InputHeight = m_Layouts[i].Height;
+				execution.InputRect = m_Layouts[i].Rect;
+				break;
+			}
+		}
+		execution.Pass = execution.FirstPass;
+		m_LastReusedPasses = static_cast<uint32_t>(execution.FirstPass);
+
+		const PassLayout& layout = m_Layouts[execution.Pass];
+		const bool last = (execution.Pass + 1 == m_Passes.size());
+		execution.Output = last ? &target : m_Pool.Acquire(layout.Width, layout.Height);
+	}
+
+	void RenderGraph::FinishPass()
+	{
+		GraphExecution& execution = m_Execution;
+		const bool last = (execution.Pass + 1 == m_Passes.size());
+		Framebuffer* output = execution.Output;
+
+		// The previous output was this pass' input, nothing reads it anymore
+		if (execution.Previous) {
+			m_Pool.Release(execution.Previous);
+		}
+		execution.Previous = (last || m_Cache.Insert(m_PassKeys[execution.Pass], execution.SourceKey, output)) ? nullptr : output;
+		execution.Input = output->GetColorAttachment();
+		execution.InputWidth = output->GetWidth();
+		execution.InputHeight = output->GetHeight();
+		execution.InputRect = m_Layouts[execution.Pass].Rect;
+		execution.Pass++;
+		execution.Tile = 0;
+
+		if (execution.Pass < m_Passes.size()) {
+			const PassLayout& layout = m_Layouts[execution.Pass];
+			const bool next = (execution.Pass + 1 == m_Passes.size());
+			execution.Output = next ? execution.Target : m_Pool.Acquire(layout.Width, layout.Height);
+		}
+		else {
+			execution.Output = nullptr;
+		}
+	}
+
+	uint32_t RenderGraph::GetTileCount() const
+	{
+		const uint32_t width = m_Execution.Output->GetWidth();
+		const uint32_t height = m_Execution.Output->GetHeight();
+		return ((width + REFINE_TILE_SIZE - 1) / REFINE_TILE_SIZE) * ((height + REFINE_TILE_SIZE - 1) / REFINE_TILE_SIZE);
+	}
+
+	void RenderGraph::RunPass(const RenderPass& pass, Framebuffer& output)
+	{
+		const GraphExecution& execution = m_Execution;
+		const FilterParameters& parameters = execution.Parameters;
+		const glm::vec4& outputRect = m_Layouts[execution.Pass].Rect;
+
+		if (pass.Type == PassType::Blur) {
+			if (parameters.BlurSigma <= MAX_GPU_GAUSSIAN_SIGMA) {
+				// The horizontal pass keeps the rows of the input the vertical pass reaches
+				const float halo = GetPassHalo(pass, parameters, 1.0f) / execution.FullHeight;
+				const glm::vec4 scratchBounds(outputRect.x, std::max(execution.InputRect.y, outputRect.y - halo),
+					outputRect.z, std::min(execution.InputRect.w, outputRect.w + halo));
+				const uint32_t scratchHeight = std::max(1u,
+					static_cast<uint32_t>(std::lround((scratchBounds.w - scratchBounds.y) * execution.FullHeight)));
+
+				Framebuffer* scratch = m_Pool.Acquire(output.GetWidth(), scratchHeight);
+				m_Renderer.BlurTexture(execution.Input, parameters.BlurSigma, *scratch, output,
+					RelativeRect(execution.InputRect, scratchBounds), RelativeRect(scratchBounds, outputRect));
+				m_Pool.Release(scratch);
+			}
+			else {
+				RunCpuPass(pass, output);
+			}
+			return;
+		}
+		if (pass.Type == PassType::Convolution || pass.Type == PassType::Denoise || pass.Type == PassType::Histogram
+			|| pass.Type == PassType::Faces) {
+			RunCpuPass(pass, output);
+			return;
+		}
+
+		output.Begin();
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, execution.Input);
+		pass.Program->Bind();
+		ApplyParameters(*pass.Program, parameters, execution.InputWidth, execution.InputHeight,
+			execution.SourceWidth, execution.SourceHeight);
+		if (HasFilter(pass.Filters, Filter::Lut)) {
+			BindLut(*pass.Program, parameters.Lut ? *parameters.Lut : m_IdentityLut, parameters.Interpolation);
+		}
+		pass.Program->SetFloat4("u_TexRect", RelativeRect(execution.InputRect, outputRect));
+		pass.Program->SetFloat4("u_InputRect", glm::vec4(execution.InputRect.x, execution.InputRect.y,
+			execution.InputRect.z - execution.InputRect.x, execution.InputRect.w - execution.InputRect.y));
+		m_Renderer.OnRender();
+	}
+
+	void RenderGraph::RunCpuPass(const RenderPass& pass, Framebuffer& target)
+	{
+		const GraphExecution& execution = m_Execution;
+		const uint32_t width = execution.InputWidth;
+		const uint32_t height = execution.InputHeight;
+		// The analysis renders through its own graph, before the input is bound for the read back
+		auto start = std::chrono::high_resolution_clock::now();
+		HistogramAnalysis* analysis = pass.Type == PassType::Histogram ? &Analyse(execution.Pass) : nullptr;
+		FaceAnalysis* faces = pass.Type == PassType::Faces ? &DetectFaces(execution.Pass) : nullptr;
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, execution.Input);
+
+		m_CpuPixels.resize(static_cast<size_t>(width) * height * 4);
+		glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_CpuPixels.data());
+		if (pass.Type == PassType::Blur) {
+			// sigma is in output pixels, the input can be the full resolution source
+			const float inputScale = width / ((execution.InputRect.z - execution.InputRect.x) * execution.FullWidth);
+			m_CpuBlur.Apply(m_CpuPixels.data(), m_CpuPixels.data(), width, height, execution.Parameters.BlurSigma * inputScale);
+		}
+		else if (pass.Type == PassType::Convolution) {
+			// The kernel is given in source pixels, the input is the source or a render at display resolution
+			const float sourceScale = width / ((execution.InputRect.z - execution.InputRect.x) * execution.SourceWidth);
+			m_Convolution.Apply(m_CpuPixels.data(), m_CpuPixels.data(), width, height, execution.Parameters.Kernel.Scale(sourceScale));
+		}
+		else if (analysis) {
+			if (pass.Filters.front() == Filter::AutoLevels) {
+				ApplyLevels(m_CpuPixels.data(), m_CpuPixels.data(), width, height, 4, analysis->Levels);
+			}
+			else {
+				// The tile curves are placed over the whole image, the input only covers its rect
+				analysis->Equalizer.Apply(m_CpuPixels.data(), m_CpuPixels.data(), width, height, 4, execution.InputRect);
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+			m_LastHistogramTime = std::chrono::duration<double, std::milli>(end - start).count();
+		}
+		else if (faces) {
+			// Faces are found in the analysis render, the input only covers its rect of the source
+			const glm::vec2 rectSize(execution.InputRect.z - execution.InputRect.x, execution.InputRect.w - execution.InputRect.y);
+			const glm::vec2 toInput = glm::vec2(width, height) / rectSize;
+			const glm::vec2 origin = -glm::vec2(execution.InputRect.x, execution.InputRect.y) * toInput;
+			const glm::vec4 analysisSize(faces->Width, faces->Height, faces->Width, faces->Height);
+			std::vector<glm::vec4> bounds;
+			for (const dlib::rectangle& face : faces->Tracker.GetFaces()) {
+				const glm::vec4 rect = PadFace(face, execution.Parameters.FacePadding) / analysisSize;
+				bounds.push_back(glm::vec4(origin, origin) + rect * glm::vec4(toInput, toInput));
+			}
+			// Mosaic and sigma are given in source pixels
+			const float sourceScale = width / (rectSize.x * execution.SourceWidth);
+			AnonymiseFaces(m_CpuPixels.data(), width, height, 4, bounds, execution.Parameters, sourceScale, m_CpuBlur, origin);
+			m_LastFaceCount = static_cast<uint32_t>(bounds.size());
+			auto end = std::chrono::high_resolution_clock::now();
+			m_LastFaceTime = std::chrono::duration<double, std::milli>(end - start).count();
+		}
+		else {
+			// Both are given in source pixels
+			const float sourceScale = width / ((execution.InputRect.z - execution.InputRect.x) * execution.SourceWidth);
+			if (pass.Filters.front() == Filter::Median) {
+				const uint32_t radius = static_cast<uint32_t>(std::lround(execution.Parameters.MedianRadius * sourceScale));
+				m_Median.Apply(m_CpuPixels.data(), m_CpuPixels.data(), width, height, 4, radius);
+			}
+			else {
+				m_Bilateral.Apply(m_CpuPixels.data(), m_CpuPixels.data(), width, height, 4,
+					execution.Parameters.BilateralSpatial * sourceScale, execution.Parameters.BilateralRange);
+			}
+		}
+
+		glBindTexture(GL_TEXTURE_2D, m_CpuTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, m_CpuPixels.data());
+
+		target.Begin();
+		m_CopyProgram->Bind();
+		m_CopyProgram->SetInt("u_Texture", 0);
+		m_CopyProgram->SetFloat4("u_TexRect", RelativeRect(execution.InputRect, m_Layouts[execution.Pass].Rect));
+		m_Renderer.OnRender();
+	}
+
+	RenderGraph::HistogramAnalysis& RenderGraph::Analyse(size_t pass)
+	{
+		const GraphExecution& execution = m_Execution;
+		uint64_t key = execution.SourceKey;
+		for (size_t i = 0; i <= pass; i++) {
+			key = HashPass(key, m_Passes[i], execution.SourceParameters);
+		}
+
+		HistogramAnalysis& analysis = m_Analyses[pass];
+		if (analysis.Key == key) {
+			return analysis;
+		}
+
+		RenderAnalysis(pass, ANALYSIS_SIZE);
+		const uint32_t width = m_AnalysisTarget->GetWidth();
+		const uint32_t height = m_AnalysisTarget->GetHeight();
+		const std::vector<uint8_t> pixels = m_AnalysisTarget->GetData();
+		const FilterParameters& parameters = execution.SourceParameters;
+		if (m_Passes[pass].Filters.front() == Filter::AutoLevels) {
+			Histogram histogram;
+			histogram.Compute(pixels.data(), width, height, 4);
+			analysis.Levels = ComputeAutoLevels(histogram, parameters.LevelsClip);
+		}
+		else {
+			analysis.Equalizer.Analyse(pixels.data(), width, height, 4, parameters.ClaheTiles, parameters.ClaheClip);
+		}
+		analysis.Key = key;
+		return analysis;
+	}
+
+	void RenderGraph::RenderAnalysis(size_t pass, uint32_t size)
+	{
+		const GraphExecution& execution = m_Execution;
+		std::vector<Filter> upstream;
+		for (size_t i = 0; i < pass; i++) {
+			upstream.insert(upstream.end(), m_Passes[i].Filters.begin(), m_Passes[i].Filters.end());
+		}
+		if (!m_Analysis) {
+			m_Analysis = std::make_unique<RenderGraph>(m_Renderer);
+		}
+		if (m_Analysis->GetChain() != upstream) {
+			m_Analysis->SetChain(upstream);
+		}
+
+		const float fit = std::min(1.0f, static_cast<float>(size) / std::max({ execution.SourceWidth, execution.SourceHeight, 1u }));
+		const uint32_t width = std::max(1u, static_cast<uint32_t>(std::lround(execution.SourceWidth * fit)));
+		const uint32_t height = std::max(1u, static_cast<uint32_t>(std::lround(execution.SourceHeight * fit)));
+		if (!m_AnalysisTarget) {
+			m_AnalysisTarget = std::make_unique<Framebuffer>(width, height);
+		}
+		m_AnalysisTarget->Resize(width, height);
+		m_Analysis->Execute(execution.Source, execution.SourceWidth, execution.SourceHeight, execution.SourceRevision,
+			execution.SourceParameters, *m_AnalysisTarget);
+	}
+
+	RenderGraph::FaceAnalysis& RenderGraph::DetectFaces(size_t pass)
+	{
+		const GraphExecution& execution = m_Execution;
+		// Another model finds other faces, the tracks start over
+		uint64_t chainKey = Hash(0xCBF29CE484222325ull, execution.SourceParameters.FaceModel);
+		for (size_t i = 0; i < pass; i++) {
+			chainKey = HashPass(chainKey, m_Passes[i], execution.SourceParameters);
+		}
+		// How the faces are covered does not change where they are
+		const uint64_t key = Hash(chainKey, execution.SourceKey);
+
+		std::unique_ptr<FaceAnalysis>& analysis = m_FaceAnalyses[pass];
+		if (!analysis) {
+			analysis = std::make_unique<FaceAnalysis>();
+		}
+		if (analysis->Key == key) {
+			return *analysis;
+		}
+
+		if (!m_FaceDetector) {
+			// The analysis render is already small enough to scan as it is
+			DetectionProfile profile;
+			profile.DetectionResolution = 0;
+			m_FaceDetector = std::make_unique<FaceDetector>();
+			m_FaceDetector->SetProfile(profile);
+		}
+		if (m_FaceDetector->GetProfile().Model != execution.SourceParameters.FaceModel) {
+			DetectionProfile profile = m_FaceDetector->GetProfile();
+			profile.Model = execution.SourceParameters.FaceModel;
+			m_FaceDetector->SetProfile(profile);
+		}
+		if (analysis->ChainKey != chainKey) {
+			analysis->Tracker.Reset();
+		}
+		analysis->Tracker.SetKeyframeInterval(m_FaceKeyframeInterval);
+
+		RenderAnalysis(pass, FACE_ANALYSIS_SIZE);
+		const uint32_t width = m_AnalysisTarget->GetWidth();
+		const uint32_t height = m_AnalysisTarget->GetHeight();
+		const std::vector<uint8_t> pixels = m_AnalysisTarget->GetData();
+		analysis->Pixels.resize(static_cast<size_t>(width) * height * 3);
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++) {
+			analysis->Pixels[i * 3 + 0] = pixels[i * 4 + 0];
+			analysis->Pixels[i * 3 + 1] = pixels[i * 4 + 1];
+			analysis->Pixels[i * 3 + 2] = pixels[i * 4 + 2];
+		}
+		analysis->Tracker.Update(*m_FaceDetector, analysis->Pixels.data(), width, height);
+		analysis->Width = width;
+		analysis->Height = height;
+		analysis->Key = key;
+		analysis->ChainKey = chainKey;
+		return *analysis;
+	}
+}
@@ -0,0 +1,237 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include "Filters.h"
+#include "Shader.h"
+#include "Framebuffer.h"
+#include "GaussianBlur.h"
+#include "Convolution.h"
+#include "Lut3D.h"
+#include "Denoise.h"
+#include "Histogram.h"
+
+namespace Photoxel
+{
+	class Renderer;
+	class FaceDetector;
+
+	// Intermediate targets shared by the passes of a graph. Released targets are handed out
+	// again before a new one is created, so the passes in flight only ever need three
+	class FramebufferPool
+	{
+	public:
+		FramebufferPool() = default;
+
+		Framebuffer* Acquire(uint32_t width, uint32_t height);
+		void Release(Framebuffer* framebuffer);
+
+		size_t GetSize() const;
+	private:
+		struct Entry {
+			std::unique_ptr<Framebuffer> Target;
+			bool InUse = false;
+		};
+		std::vector<Entry> m_Entries;
+	};
+
+	// Outputs of intermediate passes, keyed by a hash of the source and of every pass and
+	// parameter upstream of them. Cached targets stay acquired from the pool and are given
+	// back, least recently used first, once the memory budget is exceeded
+	class PassCache
+	{
+	public:
+		PassCache(FramebufferPool& pool, size_t budget);
+
+		// Marks the entry as most recently used
+		Framebuffer* Find(uint64_t key);
+		// Takes ownership of the acquired target, returns false if it alone exceeds the budget
+		bool Insert(uint64_t key, uint64_t sourceKey, Framebuffer* framebuffer);
+		// Entries of an older source can never be hit again, video frames would only pile up
+		void DropOtherSources(uint64_t sourceKey);
+		void Clear();
+
+		void SetBudget(size_t budget);
+		size_t GetBudget() const;
+		size_t GetUsage() const;
+		size_t GetEntryCount() const;
+	private:
+		struct Entry {
+			uint64_t Key, SourceKey;
+			Framebuffer* Target;
+			size_t Bytes;
+		};
+
+		void Evict(size_t budget);
+
+		FramebufferPool& m_Pool;
+		size_t m_Budget;
+		size_t m_Usage = 0;
+		// Most recently used first
+		std::list<Entry> m_Entries;
+		std::unordered_map<uint64_t, std::list<Entry>::iterator> m_Index;
+	};
+
+	enum class PassType {
+		Shader,
+		Blur,
+		// User kernels, run by the CPU convolution engine at the resolution of the output
+		Convolution,
+		// Median and bilateral grid noise reduction, on the CPU as well
+		Denoise,
+		// Auto levels and CLAHE, mapped on the CPU from statistics of the whole image
+		Histogram,
+		// Face anonymisation, faces are found in the whole image and covered on the CPU
+		Faces
+	};
+
+	struct RenderPass {
+		PassType Type = PassType::Shader;
+		// At most one neighbourhood filter, always first, followed by the pointwise filters fused behind it
+		std::vector<Filter> Filters;
+		std::unique_ptr<Shader> Program;
+	};
+
+	// Output of one pass, Rect holds its bounds in source texture coordinates (x0, y0, x1, y1).
+	// Passes ahead of a neighbourhood filter render a halo around the region they are needed for
+	struct PassLayout {
+		glm::vec4 Rect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		uint32_t Width = 0, Height = 0;
+	};
+
+	// Where a render stands, so a full resolution render can be spread over several frames
+	struct GraphExecution {
+		// Spatial parameters are in output pixels
+		FilterParameters Parameters;
+		Framebuffer* Target = nullptr;
+		uint32_t Source = 0, SourceWidth = 0, SourceHeight = 0;
+		uint64_t SourceRevision = 0;
+		// As given, for the analysis renders of the whole source
+		FilterParameters SourceParameters;
+		// Size of the whole source at the output resolution
+		float FullWidth = 0.0f, FullHeight = 0.0f;
+		uint64_t SourceKey = 0;
+		size_t FirstPass = 0, Pass = 0;
+		uint32_t Tile = 0;
+		uint32_t Input = 0, InputWidth = 0, InputHeight = 0;
+		glm::vec4 InputRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+		// Output of the current pass, and the uncached output of the previous one it reads
+		Framebuffer* Output = nullptr;
+		Framebuffer* Previous = nullptr;
+	};
+
+	// Splits a filter chain into passes at every neighbourhood filter so each of them samples
+	// the rendered result of everything before it. Pointwise runs stay fused in a single pass
+	class RenderGraph
+	{
+	public:
+		RenderGraph(Renderer& renderer);
+		~RenderGraph();
+
+		void SetChain(const std::vector<Filter>& chain);
+		const std::vector<Filter>& GetChain() const;
+		const std::vector<RenderPass>& GetPasses() const;
+		size_t GetPoolSize() const;
+		double GetLastCpuBlurTime() const;
+		const ConvolutionEngine& GetConvolutionEngine() const;
+		const MedianFilter& GetMedianFilter() const;
+		const BilateralGrid& GetBilateralGrid() const;
+		// Analysis and mapping of the last auto levels or CLAHE pass
+		double GetLastHistogramTime() const;
+		// Renders of a changed source only run the face detector every that many times and track the
+		// faces in between, 1 detects on every render. Video sources set it, stills keep 1
+		void SetFaceKeyframeInterval(uint32_t renders);
+		uint32_t GetFaceKeyframeInterval() const;
+		// Faces covered and detection or tracking plus anonymisation time of the last face pass
+		uint32_t GetLastFaceCount() const;
+		double GetLastFaceTime() const;
+		// Empty unless the CNN face model was asked for and could not be loaded
+		std::string GetFaceModelError() const;
+		PassCache& GetCache();
+		// Renders a lattice of size^3 colours through the colour only filters, with the same shader
+		// they run in over an image, and returns the result as a table
+		std::shared_ptr<Lut3D> BakeLut(const std::vector<Filter>& filters, const FilterParameters& parameters, uint32_t size);
+		// Passes taken from the cache by the last Execute
+		uint32_t GetLastReusedPasses() const;
+
+		// Renders the chain over the source texture into target and leaves target bound.
+		// sourceRevision must change whenever the contents of the source texture do.
+		//
+		// target covers region of the source (x0, y0, x1, y1 in texture coordinates) at its own
+		// resolution, and intermediate passes run at that resolution plus the pixels the passes
+		// after them read around it. Spatial parameters are given in source pixels and scaled to
+		// that resolution, so a small target renders a proxy of the full resolution result
+		void Execute(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+			const FilterParameters& parameters, Framebuffer& target,
+			const glm::vec4& region = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+
+		// Same render as Execute, done a few tiles at a time by StepRefinement. Every tile of a pass
+		// is rendered before the next pass starts, so tiles never need a halo of their own
+		void BeginRefinement(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+			const FilterParameters& parameters, Framebuffer& target,
+			const glm::vec4& region = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
+		// Returns true once target holds the whole result. Blur passes count as a single tile
+		bool StepRefinement(uint32_t tiles);
+		void CancelRefinement();
+		bool IsRefining() const;
+		float GetRefinementProgress() const;
+	private:
+		void Prepare(uint32_t source, uint32_t sourceWidth, uint32_t sourceHeight, uint64_t sourceRevision,
+			const FilterParameters& parameters, Framebuffer& target, const glm::vec4& region);
+		void FinishPass();
+		uint32_t GetTileCount() const;
+		// Both read the input of the current pass from m_Execution
+		void RunPass(const RenderPass& pass, Framebuffer& output);
+		void RunCpuPass(const RenderPass& pass, Framebuffer& target);
+
+		// Auto levels and CLAHE take their statistics from the whole source rendered small through
+		// the passes ahead of them, so crops, proxies and the full resolution render of one image
+		// all get the same mapping. Kept per pass until the source or an upstream parameter changes
+		struct HistogramAnalysis {
+			uint64_t Key = 0;
+			LevelsTable Levels{};
+			Clahe Equalizer;
+		};
+		HistogramAnalysis& Analyse(size_t pass);
+		// Renders the whole source through the passes ahead of the face pass, defined with the tracker
+		struct FaceAnalysis;
+		FaceAnalysis& DetectFaces(size_t pass);
+		// Shared by both analyses, into m_AnalysisTarget
+		void RenderAnalysis(size_t pass, uint32_t size);
+
+		Renderer& m_Renderer;
+		std::vector<Filter> m_Chain;
+		std::vector<RenderPass> m_Passes;
+		FramebufferPool m_Pool;
+		PassCache m_Cache;
+		std::vector<uint64_t> m_PassKeys;
+		std::vector<PassLayout> m_Layouts;
+		uint32_t m_LastReusedPasses = 0;
+		GraphExecution m_Execution;
+		bool m_Refining = false;
+
+		// Blurs wider than the shader kernel, convolutions and noise reduction go through the CPU and back
+		std::unique_ptr<Shader> m_CopyProgram;
+		GaussianBlur m_CpuBlur;
+		ConvolutionEngine m_Convolution;
+		MedianFilter m_Median;
+		BilateralGrid m_Bilateral;
+		std::vector<HistogramAnalysis> m_Analyses;
+		std::unique_ptr<RenderGraph> m_Analysis;
+		std::unique_ptr<Framebuffer> m_AnalysisTarget;
+		double m_LastHistogramTime = 0.0;
+		std::vector<std::unique_ptr<FaceAnalysis>> m_FaceAnalyses;
+		std::unique_ptr<FaceDetector> m_FaceDetector;
+		uint32_t m_FaceKeyframeInterval = 1;
+		uint32_t m_LastFaceCount = 0;
+		double m_LastFaceTime = 0.0;
+		std::vector<uint8_t> m_CpuPixels;
+		uint32_t m_CpuTexture = 0;
+		// Bound when a chain has a LUT filter but no table yet
+		Lut3D m_IdentityLut;
+	};
+}
@@ -1,4 +1,5 @@
 #include "Renderer.h"
+#include "GaussianBlur.h"
 #include <iostream>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -15,18 +16,20 @@ namespace Photoxel
         std::cout << glGetString(GL_RENDERER) << std::endl;
         std::cout << glGetString(GL_VERSION) << std::endl;
 
-        m_Shader = new Shader({
-            { "VertexShader", Photoxel::ShaderType::Vertex },
-            { "PixelShader", Photoxel::ShaderType::Pixel }
-        });
-        m_VideoShader = new Shader({
-            { "VertexShader", Photoxel::ShaderType::Vertex },
-            { "PixelShader", Photoxel::ShaderType::Pixel }
-        });
         m_CameraShader = new Shader({
             { "CameraVertexShader", Photoxel::ShaderType::Vertex },
             { "CameraPixelShader", Photoxel::ShaderType::Pixel }
             });
+        m_BlurShader = new Shader({
+            { "VertexShader", Photoxel::ShaderType::Vertex },
+            { "BlurPixelShader", Photoxel::ShaderType::Pixel }
+        });
+
+        glGenSamplers(1, &m_BlurSampler);
+        glSamplerParameteri(m_BlurSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_BlurSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(m_BlurSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glSamplerParameteri(m_BlurSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
         struct Data {
             glm::vec4 Position;
@@ -74,7 +77,9 @@ namespace Photoxel
 
     Renderer::~Renderer()
     {
-        delete m_Shader;
+        delete m_CameraShader;
+        delete m_BlurShader;
+        glDeleteSamplers(1, &m_BlurSampler);
     }
 
     void Renderer::OnRender()
@@ -92,6 +97,38 @@ namespace Photoxel
         error = glGetError();
     }
 
+    void Renderer::BlurTexture(uint32_t texture, float sigma, Framebuffer& scratch, Framebuffer& target,
+        const glm::vec4& scratchRect, const glm::vec4& targetRect)
+    {
+        ComputeGaussianTaps(sigma, m_BlurOffsets, m_BlurWeights);
+
+        m_BlurShader->Bind();
+        m_BlurShader->SetInt("u_Texture", 0);
+        m_BlurShader->SetInt("u_TapCount", static_cast<int>(m_BlurOffsets.size()));
+        m_BlurShader->SetFloatArray("u_Offsets", m_BlurOffsets.data(), static_cast<int>(m_BlurOffsets.size()));
+        m_BlurShader->SetFloatArray("u_Weights", m_BlurWeights.data(), static_cast<int>(m_BlurWeights.size()));
+
+        glActiveTexture(GL_TEXTURE0);
+        glBindSampler(0, m_BlurSampler);
+
+        // Horizontal pass into scratch, vertical pass from scratch into target
+        // One output texel along each axis, in the coordinates of the texture the pass reads
+        Framebuffer* outputs[2] = { &scratch, &target };
+        const glm::vec4 rects[2] = { scratchRect, targetRect };
+        const glm::vec2 directions[2] = { { scratchRect.z / scratch.GetWidth(), 0.0f }, { 0.0f, targetRect.w / target.GetHeight() } };
+        uint32_t source = texture;
+        for (int pass = 0; pass < 2; pass++) {
+            outputs[pass]->Begin();
+            glBindTexture(GL_TEXTURE_2D, source);
+            m_BlurShader->SetFloat4("u_TexRect", rects[pass]);
+            m_BlurShader->SetFloat2("u_Direction", directions[pass]);
+            OnRender();
+            source = outputs[pass]->GetColorAttachment();
+        }
+
+        glBindSampler(0, 0);
+    }
+
     void Renderer::BeginScene()
     {
         glClearColor(0.15f, 0.15f, 0.15f, 1.0f);
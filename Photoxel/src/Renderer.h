@@ -2,7 +2,9 @@
 
 #include <inttypes.h>
 #include <memory>
+#include <vector>
 #include "Shader.h"
+#include "Framebuffer.h"
 #include <glm/glm.hpp>
 #include <dlib/image_processing/frontal_face_detector.h>
 #include <dlib/image_io.h>
@@ -18,31 +20,25 @@ namespace Photoxel
 
 		void BeginScene();
 
-		Shader* GetShader() const {
-			return m_Shader;
-		}
-
-		Shader* GetShaderVideo() const {
-			return m_VideoShader;
-		}
-
 		Shader* GetShaderCamera() const {
 			return m_CameraShader;
 		}
 
-		void BindImageShader() {
-			m_Shader->Bind();
-		}
-
-		void BindVideoShader() {
-			m_VideoShader->Bind();
-		}
-
 		void BindCameraShader() {
 			m_CameraShader->Bind();
 		}
+
+		// Separable Gaussian blur of texture into target, the horizontal pass goes through scratch.
+		// The rects place scratch in the texture and target in scratch (offset in xy, size in zw),
+		// sigma is in target pixels
+		void BlurTexture(uint32_t texture, float sigma, Framebuffer& scratch, Framebuffer& target,
+			const glm::vec4& scratchRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f),
+			const glm::vec4& targetRect = glm::vec4(0.0f, 0.0f, 1.0f, 1.0f));
 	private:
-		Shader *m_Shader, *m_VideoShader, *m_CameraShader;
+		Shader *m_CameraShader, *m_BlurShader;
+		std::vector<float> m_BlurOffsets, m_BlurWeights;
+		// Linear filtering and edge clamping for the blur reads, whatever the texture itself uses
+		uint32_t m_BlurSampler = 0;
 		uint32_t m_VertexArray = 0;
 		uint32_t m_LineVertexBuffer = 0;
 	};
@@ -0,0 +1,121 @@
+#include "Selection.h"
+#include "GaussianBlur.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Photoxel
+{
+	const char* GetSelectionShapeName(SelectionShape shape)
+	{
+		switch (shape)
+		{
+			case SelectionShape::Ellipse:	return "Ellipse";
+			case SelectionShape::Lasso:		return "Lasso";
+			default:						return "Rectangle";
+		}
+	}
+
+	// Fills the span of row y covered by the shape, pixel centres decide
+	static void RasterizeRow(SelectionShape shape, const std::vector<glm::vec2>& points, const glm::vec2& minimum,
+		const glm::vec2& maximum, uint32_t y, uint32_t x0, uint32_t x1, uint8_t* row)
+	{
+		const float centreY = y + 0.5f;
+		switch (shape)
+		{
+			case SelectionShape::Rectangle: {
+				if (centreY < minimum.y || centreY > maximum.y) return;
+				for (uint32_t x = x0; x < x1; x++) {
+					row[x] = (x + 0.5f >= minimum.x && x + 0.5f <= maximum.x) ? 255 : 0;
+				}
+				break;
+			}
+			case SelectionShape::Ellipse: {
+				const glm::vec2 centre = (minimum + maximum) * 0.5f;
+				const glm::vec2 radius = glm::max((maximum - minimum) * 0.5f, glm::vec2(0.5f));
+				const float dy = (centreY - centre.y) / radius.y;
+				if (dy * dy > 1.0f) return;
+				const float halfWidth = radius.x * std::sqrt(1.0f - dy * dy);
+				for (uint32_t x = x0; x < x1; x++) {
+					row[x] = std::abs(x + 0.5f - centre.x) <= halfWidth ? 255 : 0;
+				}
+				break;
+			}
+			case SelectionShape::Lasso: {
+				// Even-odd rule over the crossings of the closed outline with the row
+				std::vector<float> crossings;
+				for (size_t i = 0; i < points.size(); i++) {
+					const glm::vec2& a = points[i];
+					const glm::vec2& b = points[(i + 1) % points.size()];
+					if ((a.y <= centreY) != (b.y <= centreY)) {
+						crossings.push_back(a.x + (centreY - a.y) / (b.y - a.y) * (b.x - a.x));
+					}
+				}
+				std::sort(crossings.begin(), crossings.end());
+				for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+					const float from = std::max(std::ceil(crossings[i] - 0.5f), static_cast<float>(x0));
+					const float to = std::min(std::ceil(crossings[i + 1] - 0.5f), static_cast<float>(x1));
+					for (float x = from; x < to; x++) {
+						row[static_cast<uint32_t>(x)] = 255;
+					}
+				}
+				break;
+			}
+		}
+	}
+
+	std::unique_ptr<LayerMask> CreateSelection(uint32_t width, uint32_t height, SelectionShape shape,
+		const std::vector<glm::vec2>& points, float feather)
+	{
+		auto selection = std::make_unique<LayerMask>(width, height, 0);
+		if (points.size() < (shape == SelectionShape::Lasso ? 3u : 2u)) {
+			return selection;
+		}
+
+		glm::vec2 minimum = points.front(), maximum = points.front();
+		for (const glm::vec2& point : points) {
+			minimum = glm::min(minimum, point);
+			maximum = glm::max(maximum, point);
+		}
+
+		// Everything the shape and its feathered edge can reach
+		const float halo = feather >= MIN_GAUSSIAN_SIGMA ? std::ceil(3.0f * feather) : 0.0f;
+		const uint32_t x0 = static_cast<uint32_t>(glm::clamp(std::floor(minimum.x - halo), 0.0f, static_cast<float>(width)));
+		const uint32_t y0 = static_cast<uint32_t>(glm::clamp(std::floor(minimum.y - halo), 0.0f, static_cast<float>(height)));
+		const uint32_t x1 = static_cast<uint32_t>(glm::clamp(std::ceil(maximum.x + halo), 0.0f, static_cast<float>(width)));
+		const uint32_t y1 = static_cast<uint32_t>(glm::clamp(std::ceil(maximum.y + halo), 0.0f, static_cast<float>(height)));
+		if (x1 <= x0 || y1 <= y0) {
+			return selection;
+		}
+
+		std::vector<uint8_t> pixels(static_cast<size_t>(width) * height, 0);
+		ThreadPool::Get().ParallelFor(y1 - y0, [&](size_t i) {
+			const uint32_t y = y0 + static_cast<uint32_t>(i);
+			RasterizeRow(shape, points, minimum, maximum, y, x0, x1, pixels.data() + static_cast<size_t>(y) * width);
+		});
+
+		if (halo > 0.0f) {
+			const uint32_t cropWidth = x1 - x0, cropHeight = y1 - y0;
+			std::vector<uint8_t> crop(static_cast<size_t>(cropWidth) * cropHeight * 4, 0);
+			for (uint32_t y = 0; y < cropHeight; y++) {
+				const uint8_t* src = pixels.data() + static_cast<size_t>(y0 + y) * width + x0;
+				uint8_t* dst = crop.data() + static_cast<size_t>(y) * cropWidth * 4;
+				for (uint32_t x = 0; x < cropWidth; x++) {
+					dst[x * 4] = src[x];
+				}
+			}
+			GaussianBlur blur;
+			blur.Apply(crop.data(), crop.data(), cropWidth, cropHeight, feather);
+			for (uint32_t y = 0; y < cropHeight; y++) {
+				const uint8_t* src = crop.data() + static_cast<size_t>(y) * cropWidth * 4;
+				uint8_t* dst = pixels.data() + static_cast<size_t>(y0 + y) * width + x0;
+				for (uint32_t x = 0; x < cropWidth; x++) {
+					dst[x] = src[x * 4];
+				}
+			}
+		}
+
+		selection->SetPixels(pixels.data());
+		return selection;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <inttypes.h>
+#include <memory>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Layer.h"
+
+namespace Photoxel
+{
+	static constexpr float MAX_SELECTION_FEATHER = 64.0f;
+
+	enum class SelectionShape {
+		Rectangle,
+		Ellipse,
+		Lasso
+	};
+
+	const char* GetSelectionShapeName(SelectionShape shape);
+
+	// Rasterizes a selection at the size of the image. Rectangles and ellipses take the two corners
+	// of their bounds, lassos every point of the outline, all in image pixels. Feather is the sigma
+	// of the Gaussian softening the edge, only the bounds of the shape and its halo are blurred
+	std::unique_ptr<LayerMask> CreateSelection(uint32_t width, uint32_t height, SelectionShape shape,
+		const std::vector<glm::vec2>& points, float feather);
+}
@@ -42,6 +42,11 @@ namespace Photoxel
 		glUseProgram(m_RendererID);
 	}
 
+	Shader::Shader(std::initializer_list<ShaderProperties> properties, const std::vector<Filter>& filters)
+	{
+		RecreateShader(properties, filters);
+	}
+
 	Shader::~Shader()
 	{
 		glDeleteProgram(m_RendererID);
@@ -52,7 +57,7 @@ namespace Photoxel
 		glUseProgram(m_RendererID);
 	}
 
-	void Shader::RecreateShader(std::initializer_list<ShaderProperties> properties, std::unordered_set<Filter> filtersApply)
+	void Shader::RecreateShader(std::initializer_list<ShaderProperties> properties, const std::vector<Filter>& filtersApply)
 	{
 		Kill();
 		m_RendererID = glCreateProgram();
@@ -94,12 +99,30 @@ namespace Photoxel
 		glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value));
 	}
 
+	void Shader::SetFloat2(const std::string& name, const glm::vec2& value)
+	{
+		GLint location = glGetUniformLocation(m_RendererID, name.c_str());
+		glUniform2f(location, value.x, value.y);
+	}
+
 	void Shader::SetFloat3(const std::string& name, const glm::vec3& value)
 	{
 		GLint location = glGetUniformLocation(m_RendererID, name.c_str());
 		glUniform3f(location, value.x, value.y, value.z);
 	}
 
+	void Shader::SetFloat4(const std::string& name, const glm::vec4& value)
+	{
+		GLint location = glGetUniformLocation(m_RendererID, name.c_str());
+		glUniform4f(location, value.x, value.y, value.z, value.w);
+	}
+
+	void Shader::SetFloatArray(const std::string& name, const float* values, int count)
+	{
+		GLint location = glGetUniformLocation(m_RendererID, name.c_str());
+		glUniform1fv(location, count, values);
+	}
+
 	void Shader::Kill()
 	{
 		glDeleteProgram(m_RendererID);
@@ -128,7 +151,7 @@ namespace Photoxel
 		return shader;
 	}
 
-	uint32_t Shader::CreateShader(ShaderProperties properties, std::unordered_set<Filter> filters)
+	uint32_t Shader::CreateShader(ShaderProperties properties, const std::vector<Filter>& filters)
 	{
 		GLuint shader = glCreateShader(PhotoxelToGLShaderType(properties.Type));
 		std::string codeStr = GetShaderCode(properties.Filepath).c_str();
@@ -186,7 +209,29 @@ namespace Photoxel
 						headerCode += "uniform int u_Mosaic;\n";
 						headerCode += "uniform int u_MosaicWidth;\n";
 						headerCode += "uniform int u_MosaicHeight;\n";
-						mainCode += "o_FragColor = mosaic(u_Mosaic, u_MosaicWidth, u_MosaicHeight);\n";
+						headerCode += "uniform vec4 u_InputRect;\n";
+						mainCode += "o_FragColor = mosaic(u_Mosaic, u_MosaicWidth, u_MosaicHeight, u_InputRect);\n";
+						break;
+					}
+					case Filter::Lut:
+					{
+						headerCode += "uniform sampler3D u_Lut;\n";
+						headerCode += "uniform float u_LutSize;\n";
+						headerCode += "uniform vec3 u_LutDomainMin;\n";
+						headerCode += "uniform vec3 u_LutDomainMax;\n";
+						headerCode += "uniform int u_LutTetrahedral;\n";
+						mainCode += "o_FragColor = lut(o_FragColor, u_Lut, u_LutSize, u_LutDomainMin, u_LutDomainMax, u_LutTetrahedral);\n";
+						break;
+					}
+					case Filter::GaussianBlur:
+					case Filter::Convolution:
+					case Filter::Median:
+					case Filter::Bilateral:
+					case Filter::AutoLevels:
+					case Filter::Clahe:
+					case Filter::Anonymise:
+					{
+						// Never part of a shader, the render graph runs them as their own passes
 						break;
 					}
 					case Filter::Gradient:
@@ -2,7 +2,6 @@
 
 #include <string>
 #include <vector>
-#include <unordered_set>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -24,24 +23,29 @@ namespace Photoxel {
 	{
 	public:
 		Shader(std::initializer_list<ShaderProperties> properties);
+		// Pixel stages get the filters spliced in, in chain order
+		Shader(std::initializer_list<ShaderProperties> properties, const std::vector<Filter>& filters);
 		~Shader();
 
 		virtual void Bind() const;
 
 		virtual void RecreateShader(std::initializer_list<ShaderProperties> properties,
-			std::unordered_set<Filter> filtersApply);
+			const std::vector<Filter>& filtersApply);
 
 		void SetInt(const std::string& name, int value);
 		void SetFloat(const std::string& name, float value);
 		void SetMat4(const std::string& name, const glm::mat4& value);
+		void SetFloat2(const std::string& name, const glm::vec2& value);
 		void SetFloat3(const std::string& name, const glm::vec3& value);
+		void SetFloat4(const std::string& name, const glm::vec4& value);
+		void SetFloatArray(const std::string& name, const float* values, int count);
 
 		void Kill();
 	private:
 		uint32_t CreateShader(ShaderProperties properties);
-		uint32_t CreateShader(ShaderProperties properties, std::unordered_set<Filter> filters);
+		uint32_t CreateShader(ShaderProperties properties, const std::vector<Filter>& filters);
 		std::string GetShaderCode(const std::string& filepath);
-		uint32_t m_RendererID;
+		uint32_t m_RendererID = 0;
 		std::string m_VertexFilepath = "", m_FragmentFilepath = "";
 	};
 }
\ No newline at end of file
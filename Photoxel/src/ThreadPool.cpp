@@ -0,0 +1,155 @@
+#include "ThreadPool.h"
+#include <atomic>
+#include <algorithm>
+
+namespace Photoxel
+{
+	// The pool and the deque of the worker running on this thread
+	static thread_local const ThreadPool* t_Pool = nullptr;
+	static thread_local size_t t_Worker = 0;
+
+	ThreadPool::ThreadPool(uint32_t threadCount)
+	{
+		threadCount = std::max(threadCount, 1u);
+		for (uint32_t i = 0; i <= threadCount; i++) {
+			m_Queues.push_back(std::make_unique<WorkQueue>());
+		}
+		m_Workers.reserve(threadCount);
+		for (uint32_t i = 0; i < threadCount; i++) {
+			m_Workers.emplace_back([this, i]() { WorkerLoop(i); });
+		}
+	}
+
+	ThreadPool::~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stop = true;
+		}
+		m_ConditionVariable.notify_all();
+
+		for (auto& worker : m_Workers) {
+			if (worker.joinable()) {
+				worker.join();
+			}
+		}
+	}
+
+	void ThreadPool::ParallelFor(size_t count, const std::function<void(size_t)>& fn, uint32_t maxParallelism)
+	{
+		if (count == 0) return;
+
+		uint32_t parallelism = GetThreadCount() + 1;
+		if (maxParallelism > 0) {
+			parallelism = std::min(parallelism, maxParallelism);
+		}
+		parallelism = static_cast<uint32_t>(std::min<size_t>(parallelism, count));
+
+		if (parallelism <= 1) {
+			for (size_t i = 0; i < count; i++) {
+				fn(i);
+			}
+			return;
+		}
+
+		// Helpers may start after the caller already drained the loop, so they only
+		// hold the shared state and never touch fn once every index was claimed
+		struct LoopState {
+			std::atomic<size_t> Next{ 0 };
+			std::atomic<size_t> Done{ 0 };
+			size_t Count = 0;
+			const std::function<void(size_t)>* Fn = nullptr;
+			std::mutex Mutex;
+			std::condition_variable Finished;
+		};
+
+		auto state = std::make_shared<LoopState>();
+		state->Count = count;
+		state->Fn = &fn;
+
+		auto work = [](LoopState& loop) {
+			size_t index;
+			while ((index = loop.Next.fetch_add(1)) < loop.Count) {
+				(*loop.Fn)(index);
+				if (loop.Done.fetch_add(1) + 1 == loop.Count) {
+					std::lock_guard<std::mutex> lock(loop.Mutex);
+					loop.Finished.notify_all();
+				}
+			}
+		};
+
+		for (uint32_t i = 0; i < parallelism - 1; i++) {
+			Enqueue([state, work]() { work(*state); });
+		}
+		work(*state);
+
+		std::unique_lock<std::mutex> lock(state->Mutex);
+		state->Finished.wait(lock, [&]() { return state->Done.load() == state->Count; });
+	}
+
+	uint32_t ThreadPool::GetThreadCount() const
+	{
+		return static_cast<uint32_t>(m_Workers.size());
+	}
+
+	ThreadPool& ThreadPool::Get()
+	{
+		static ThreadPool pool;
+		return pool;
+	}
+
+	void ThreadPool::Enqueue(std::function<void()> task)
+	{
+		WorkQueue& queue = *m_Queues[t_Pool == this ? t_Worker : m_Workers.size()];
+		// Counted under the lock the workers sleep on, so a worker about to sleep sees it, and before
+		// the task can be taken, so the count never drops below zero
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			std::lock_guard<std::mutex> queueLock(queue.Mutex);
+			m_Pending++;
+			queue.Tasks.push_back(std::move(task));
+		}
+		m_ConditionVariable.notify_one();
+	}
+
+	bool ThreadPool::TakeTask(size_t worker, std::function<void()>& task)
+	{
+		// Newest of its own first, then the shared queue, then the oldest task of the others
+		const size_t count = m_Queues.size();
+		for (size_t i = 0; i < count; i++) {
+			const size_t index = i == 0 ? worker : (i == 1 ? count - 1 : (worker + i - 1) % (count - 1));
+			WorkQueue& queue = *m_Queues[index];
+			std::lock_guard<std::mutex> lock(queue.Mutex);
+			if (queue.Tasks.empty()) continue;
+			if (index == worker) {
+				task = std::move(queue.Tasks.back());
+				queue.Tasks.pop_back();
+			}
+			else {
+				task = std::move(queue.Tasks.front());
+				queue.Tasks.pop_front();
+			}
+			m_Pending--;
+			return true;
+		}
+		return false;
+	}
+
+	void ThreadPool::WorkerLoop(size_t worker)
+	{
+		t_Pool = this;
+		t_Worker = worker;
+		while (true) {
+			std::function<void()> task;
+			if (TakeTask(worker, task)) {
+				task();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_ConditionVariable.wait(lock, [this]() { return m_Stop || m_Pending.load() > 0; });
+			if (m_Stop && m_Pending.load() == 0) {
+				return;
+			}
+		}
+	}
+}
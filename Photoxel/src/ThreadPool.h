@@ -0,0 +1,66 @@
+#pragma once
+
+#include <inttypes.h>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+
+namespace Photoxel
+{
+	// Every worker keeps its own deque of tasks. Tasks submitted from a worker go to the back of
+	// its deque and it takes its newest task first, so the stages of one job stay on the core that
+	// holds its data. Idle workers steal the oldest task of another deque, and tasks submitted from
+	// outside the pool wait in a shared queue
+	class ThreadPool
+	{
+	public:
+		ThreadPool(uint32_t threadCount = std::thread::hardware_concurrency());
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		template <typename Fn>
+		auto Submit(Fn&& task) -> std::future<decltype(task())>
+		{
+			using ReturnType = decltype(task());
+			auto packaged = std::make_shared<std::packaged_task<ReturnType()>>(std::forward<Fn>(task));
+			std::future<ReturnType> result = packaged->get_future();
+			Enqueue([packaged]() { (*packaged)(); });
+			return result;
+		}
+
+		// Runs fn(i) for every i in [0, count) and blocks until all of them finished. The calling
+		// thread takes part in the loop, so it is safe to call from inside a pool task
+		void ParallelFor(size_t count, const std::function<void(size_t)>& fn, uint32_t maxParallelism = 0);
+
+		uint32_t GetThreadCount() const;
+
+		// Process wide pool shared by the image, video and camera pipelines
+		static ThreadPool& Get();
+	private:
+		struct WorkQueue {
+			std::mutex Mutex;
+			std::deque<std::function<void()>> Tasks;
+		};
+
+		void Enqueue(std::function<void()> task);
+		bool TakeTask(size_t worker, std::function<void()>& task);
+		void WorkerLoop(size_t worker);
+
+		std::vector<std::thread> m_Workers;
+		// One per worker, the last one is the shared queue
+		std::vector<std::unique_ptr<WorkQueue>> m_Queues;
+		// Tasks queued and not taken yet, the workers sleep while it is zero
+		std::atomic<size_t> m_Pending{ 0 };
+		std::mutex m_Mutex;
+		std::condition_variable m_ConditionVariable;
+		bool m_Stop = false;
+	};
+}
@@ -30,6 +30,7 @@ public:
     void Seek(int second);
 
     bool IsPaused() const { return m_Paused; }
+    const std::string& GetFilename() const { return m_Filename; }
     int GetWidth();
     int GetHeight();
     int GetDuration();
@@ -0,0 +1,206 @@
+#include "VideoAnonymiser.h"
+#include "VideoIO.h"
+#include "Anonymise.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+
+namespace Photoxel
+{
+	// Frames each queue holds, enough to ride out a keyframe detection without stalling the decoder
+	static constexpr size_t QUEUE_FRAMES = 16;
+	// Long side the keyframes are scanned at, faces from about 120 pixels up are found in 1080p
+	static constexpr uint32_t EXPORT_DETECTION_RESOLUTION = 1280;
+
+	// Hands frames from one stage to the next. Push waits while the queue is full and Pop while it
+	// is empty, both give up once the queue is closed and Pop has drained it
+	class FrameQueue
+	{
+	public:
+		FrameQueue(size_t capacity)
+			: m_Capacity(capacity)
+		{
+		}
+
+		bool Push(std::vector<uint8_t> frame)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_NotFull.wait(lock, [&]() { return m_Closed || m_Frames.size() < m_Capacity; });
+			if (m_Closed) {
+				return false;
+			}
+			m_Frames.push_back(std::move(frame));
+			m_NotEmpty.notify_one();
+			return true;
+		}
+
+		bool Pop(std::vector<uint8_t>& frame)
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_NotEmpty.wait(lock, [&]() { return m_Closed || !m_Frames.empty(); });
+			if (m_Frames.empty()) {
+				return false;
+			}
+			frame = std::move(m_Frames.front());
+			m_Frames.pop_front();
+			m_NotFull.notify_one();
+			return true;
+		}
+
+		void Close()
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Closed = true;
+			m_NotFull.notify_all();
+			m_NotEmpty.notify_all();
+		}
+	private:
+		size_t m_Capacity;
+		std::deque<std::vector<uint8_t>> m_Frames;
+		bool m_Closed = false;
+		std::mutex m_Mutex;
+		std::condition_variable m_NotFull, m_NotEmpty;
+	};
+
+	VideoAnonymiser::~VideoAnonymiser()
+	{
+		Cancel();
+	}
+
+	void VideoAnonymiser::Start(const std::string& input, const std::string& output, const FilterParameters& parameters,
+		uint32_t keyframeInterval)
+	{
+		Cancel();
+		m_Cancelled = false;
+		m_FramesWritten = 0;
+		m_FrameCount = 0;
+		m_FramesPerSecond = 0.0;
+		Fail("");
+		m_Running = true;
+		m_Thread = std::thread(&VideoAnonymiser::Run, this, input, output, parameters, keyframeInterval);
+	}
+
+	void VideoAnonymiser::Cancel()
+	{
+		m_Cancelled = true;
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void VideoAnonymiser::Fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Error = error;
+	}
+
+	void VideoAnonymiser::Run(std::string input, std::string output, FilterParameters parameters, uint32_t keyframeInterval)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		std::string error;
+		VideoReader reader;
+		VideoWriter writer;
+		if (!reader.Open(input, error) || !writer.Open(output, reader.GetWidth(), reader.GetHeight(), reader.GetFrameRate(), error)) {
+			Fail(error);
+			m_Running = false;
+			return;
+		}
+		m_FrameCount = reader.GetFrameCount();
+
+		const uint32_t width = reader.GetWidth();
+		const uint32_t height = reader.GetHeight();
+		const size_t frameSize = static_cast<size_t>(width) * height * 3;
+		FrameQueue decoded(QUEUE_FRAMES), anonymised(QUEUE_FRAMES);
+
+		std::thread decoder([&]() {
+			std::vector<uint8_t> frame(frameSize);
+			while (!m_Cancelled && reader.Read(frame.data())) {
+				if (!decoded.Push(std::move(frame))) break;
+				frame.resize(frameSize);
+			}
+			decoded.Close();
+		});
+
+		std::thread encoder([&]() {
+			std::vector<uint8_t> frame;
+			while (!m_Cancelled && anonymised.Pop(frame)) {
+				if (!writer.Write(frame.data())) {
+					Fail("Could not encode frame " + std::to_string(m_FramesWritten.load()));
+					m_Cancelled = true;
+					break;
+				}
+				m_FramesWritten++;
+				const auto now = std::chrono::high_resolution_clock::now();
+				m_FramesPerSecond = m_FramesWritten / std::chrono::duration<double>(now - start).count();
+			}
+			// Unblocks the face stage when the export stopped early
+			anonymised.Close();
+		});
+
+		FaceDetector detector;
+		DetectionProfile profile;
+		profile.DetectionResolution = EXPORT_DETECTION_RESOLUTION;
+		profile.Model = parameters.FaceModel;
+		detector.SetProfile(profile);
+		if (!detector.GetModelError().empty()) {
+			Fail(detector.GetModelError());
+			m_Cancelled = true;
+		}
+		FaceTracker tracker(keyframeInterval);
+		GaussianBlur blur;
+		std::vector<uint8_t> frame;
+		std::vector<glm::vec4> faces;
+		while (!m_Cancelled && decoded.Pop(frame)) {
+			faces.clear();
+			for (const dlib::rectangle& face : tracker.Update(detector, frame.data(), width, height)) {
+				faces.push_back(PadFace(face, parameters.FacePadding));
+			}
+			// Parameters are in source pixels, which are the frame's own here
+			AnonymiseFaces(frame.data(), width, height, 3, faces, parameters, 1.0f, blur);
+			if (!anonymised.Push(std::move(frame))) break;
+		}
+		decoded.Close();
+		anonymised.Close();
+		decoder.join();
+		encoder.join();
+
+		const bool finished = writer.Close();
+		if (m_Cancelled) {
+			std::error_code ignored;
+			std::filesystem::remove(output, ignored);
+		}
+		else if (!finished) {
+			Fail("Could not finish " + output);
+		}
+		m_Running = false;
+	}
+
+	bool VideoAnonymiser::IsRunning() const
+	{
+		return m_Running;
+	}
+
+	float VideoAnonymiser::GetProgress() const
+	{
+		const int64_t count = m_FrameCount;
+		return count > 0 ? std::min(1.0f, static_cast<float>(m_FramesWritten) / count) : 0.0f;
+	}
+
+	int64_t VideoAnonymiser::GetFramesWritten() const
+	{
+		return m_FramesWritten;
+	}
+
+	double VideoAnonymiser::GetFramesPerSecond() const
+	{
+		return m_FramesPerSecond;
+	}
+
+	std::string VideoAnonymiser::GetError() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Error;
+	}
+}
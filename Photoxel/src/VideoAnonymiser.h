@@ -0,0 +1,49 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "Filters.h"
+
+namespace Photoxel
+{
+	// Writes a copy of a video with every face anonymised, on a thread of its own. Decoding, the
+	// face pass and encoding run as three stages over bounded queues so they overlap. The detector
+	// only runs on keyframes, the faces are tracked in between, and every stage spreads its own
+	// work over the thread pool. Only the video stream is written
+	class VideoAnonymiser
+	{
+	public:
+		VideoAnonymiser() = default;
+		~VideoAnonymiser();
+
+		VideoAnonymiser(const VideoAnonymiser&) = delete;
+		VideoAnonymiser& operator=(const VideoAnonymiser&) = delete;
+
+		// Only the anonymisation fields of parameters are read. An export still running is cancelled
+		void Start(const std::string& input, const std::string& output, const FilterParameters& parameters,
+			uint32_t keyframeInterval);
+		// Stops the export and removes the unfinished file
+		void Cancel();
+
+		bool IsRunning() const;
+		// Fraction of the frames written, 0 while the container does not say how many there are
+		float GetProgress() const;
+		int64_t GetFramesWritten() const;
+		double GetFramesPerSecond() const;
+		// Empty unless the last export failed
+		std::string GetError() const;
+	private:
+		void Run(std::string input, std::string output, FilterParameters parameters, uint32_t keyframeInterval);
+		void Fail(const std::string& error);
+
+		std::thread m_Thread;
+		std::atomic<bool> m_Running{ false }, m_Cancelled{ false };
+		std::atomic<int64_t> m_FramesWritten{ 0 }, m_FrameCount{ 0 };
+		std::atomic<double> m_FramesPerSecond{ 0.0 };
+		mutable std::mutex m_ErrorMutex;
+		std::string m_Error;
+	};
+}
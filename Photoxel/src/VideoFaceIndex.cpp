@@ -0,0 +1,426 @@
+#include "VideoFaceIndex.h"
+#include "VideoIO.h"
+#include "Anonymise.h"
+#include "FaceDetector.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <numeric>
+
+namespace Photoxel
+{
+	// Segments per worker, a long shot between two keyframes then holds up one worker, not the rest
+	static constexpr uint32_t SEGMENTS_PER_WORKER = 4;
+	// Frames a worker hands the detector at once when it detects on every frame
+	static constexpr size_t FRAME_BATCH = 4;
+
+	struct FaceSegment {
+		// Timestamps of the first frame of this segment and of the next one
+		int64_t Start = 0, End = std::numeric_limits<int64_t>::max();
+		std::vector<std::pair<int64_t, std::vector<IndexedFace>>> Frames;
+		// Tracks are numbered from 0 in every segment
+		uint32_t TrackCount = 0;
+	};
+
+	static double GetOverlap(const dlib::rectangle& a, const dlib::rectangle& b)
+	{
+		const double intersection = static_cast<double>(a.intersect(b).area());
+		const double area = static_cast<double>(a.area() + b.area()) - intersection;
+		return area > 0.0 ? intersection / area : 0.0;
+	}
+
+	// Pairs of indices into previous and current, the most overlapping pairs are taken first
+	static std::vector<std::pair<size_t, size_t>> MatchFaces(const std::vector<IndexedFace>& previous,
+		const std::vector<IndexedFace>& current, float minOverlap)
+	{
+		struct Candidate {
+			double Overlap;
+			size_t Previous, Current;
+		};
+		std::vector<Candidate> candidates;
+		for (size_t i = 0; i < previous.size(); i++) {
+			for (size_t j = 0; j < current.size(); j++) {
+				const double overlap = GetOverlap(previous[i].Box, current[j].Box);
+				if (overlap >= minOverlap) {
+					candidates.push_back({ overlap, i, j });
+				}
+			}
+		}
+		std::sort(candidates.begin(), candidates.end(), [](const Candidate& a, const Candidate& b) {
+			return a.Overlap > b.Overlap;
+		});
+
+		std::vector<bool> previousTaken(previous.size(), false), currentTaken(current.size(), false);
+		std::vector<std::pair<size_t, size_t>> matches;
+		for (const Candidate& candidate : candidates) {
+			if (previousTaken[candidate.Previous] || currentTaken[candidate.Current]) continue;
+			previousTaken[candidate.Previous] = currentTaken[candidate.Current] = true;
+			matches.emplace_back(candidate.Previous, candidate.Current);
+		}
+		return matches;
+	}
+
+	static void AddFrame(FaceSegment& segment, int64_t frame, const std::vector<dlib::rectangle>& boxes, float minOverlap)
+	{
+		std::vector<IndexedFace> faces;
+		for (const dlib::rectangle& box : boxes) {
+			faces.push_back({ 0, box });
+		}
+
+		// A face continues the track it overlaps in the frame before, the rest start new ones
+		const std::vector<IndexedFace> none;
+		const bool consecutive = !segment.Frames.empty() && segment.Frames.back().first + 1 == frame;
+		const std::vector<IndexedFace>& previous = consecutive ? segment.Frames.back().second : none;
+		std::vector<bool> matched(faces.size(), false);
+		for (const auto& [from, to] : MatchFaces(previous, faces, minOverlap)) {
+			faces[to].Track = previous[from].Track;
+			matched[to] = true;
+		}
+		for (size_t i = 0; i < faces.size(); i++) {
+			if (!matched[i]) {
+				faces[i].Track = segment.TrackCount++;
+			}
+		}
+		segment.Frames.emplace_back(frame, std::move(faces));
+	}
+
+	static void ScanSegment(FaceSegment& segment, VideoReader& reader, FaceDetector& detector, FaceTracker& tracker,
+		std::vector<std::vector<uint8_t>>& buffers, float minOverlap, const std::atomic<bool>& cancelled,
+		std::atomic<int64_t>& scanned)
+	{
+		// Every segment starts on a keyframe of its own, for the decoder and for the detector
+		reader.Seek(segment.Start);
+		tracker.Reset();
+
+		// Detecting on every frame needs no tracker, the frames go through the detector in batches
+		const bool batched = tracker.GetKeyframeInterval() <= 1;
+		const size_t batchSize = batched ? buffers.size() : 1;
+		std::vector<const uint8_t*> batch;
+		std::vector<int64_t> frames;
+		bool ended = false;
+		while (!ended && !cancelled) {
+			batch.clear();
+			frames.clear();
+			while (batch.size() < batchSize) {
+				uint8_t* rgb = buffers[batch.size()].data();
+				int64_t timestamp = 0;
+				if (!reader.Read(rgb, &timestamp) || timestamp >= segment.End) {
+					ended = true;
+					break;
+				}
+				// Leading frames of an open GOP belong to the segment before
+				if (timestamp < segment.Start) continue;
+				batch.push_back(rgb);
+				frames.push_back(reader.GetFrameIndex(timestamp));
+			}
+
+			if (batched) {
+				const auto dets = detector.DetectBatch(batch, reader.GetWidth(), reader.GetHeight());
+				for (size_t i = 0; i < batch.size(); i++) {
+					AddFrame(segment, frames[i], dets[i], minOverlap);
+				}
+			}
+			else {
+				for (size_t i = 0; i < batch.size(); i++) {
+					AddFrame(segment, frames[i], tracker.Update(detector, batch[i], reader.GetWidth(), reader.GetHeight()), minOverlap);
+				}
+			}
+			scanned += batch.size();
+		}
+	}
+
+	static uint32_t FindTrack(std::vector<uint32_t>& parents, uint32_t track)
+	{
+		while (parents[track] != track) {
+			parents[track] = parents[parents[track]];
+			track = parents[track];
+		}
+		return track;
+	}
+
+	std::vector<float> FaceIndex::GetFaceCountPerSecond() const
+	{
+		std::vector<float> counts;
+		if (FrameRate <= 0.0) {
+			return counts;
+		}
+		counts.resize(static_cast<size_t>(std::ceil(Frames.size() / FrameRate)), 0.0f);
+		for (size_t frame = 0; frame < Frames.size(); frame++) {
+			float& count = counts[std::min(counts.size() - 1, static_cast<size_t>(frame / FrameRate))];
+			count = std::max(count, static_cast<float>(Frames[frame].size()));
+		}
+		return counts;
+	}
+
+	static std::string EscapeJson(const std::string& text)
+	{
+		std::string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') {
+				escaped += '\\';
+			}
+			escaped += c;
+		}
+		return escaped;
+	}
+
+	bool FaceIndex::SaveJson(const std::string& path) const
+	{
+		std::ofstream writer(path);
+		if (!writer) {
+			return false;
+		}
+
+		writer << "{\n";
+		writer << "\t\"source\": \"" << EscapeJson(Source) << "\",\n";
+		writer << "\t\"width\": " << Width << ",\n";
+		writer << "\t\"height\": " << Height << ",\n";
+		writer << "\t\"frameRate\": " << FrameRate << ",\n";
+		writer << "\t\"frameCount\": " << Frames.size() << ",\n";
+		writer << "\t\"trackCount\": " << TrackCount << ",\n";
+		writer << "\t\"frames\": [";
+		bool first = true;
+		for (size_t frame = 0; frame < Frames.size(); frame++) {
+			if (Frames[frame].empty()) continue;
+			writer << (first ? "\n" : ",\n");
+			writer << "\t\t{ \"frame\": " << frame << ", \"time\": " << frame / FrameRate << ", \"faces\": [";
+			for (size_t i = 0; i < Frames[frame].size(); i++) {
+				const IndexedFace& face = Frames[frame][i];
+				writer << (i > 0 ? ", " : " ") << "{ \"track\": " << face.Track << ", \"x\": " << face.Box.left()
+					<< ", \"y\": " << face.Box.top() << ", \"width\": " << face.Box.width()
+					<< ", \"height\": " << face.Box.height() << " }";
+			}
+			writer << " ] }";
+			first = false;
+		}
+		writer << "\n\t]\n}\n";
+		return static_cast<bool>(writer);
+	}
+
+	bool FaceIndex::SaveCsv(const std::string& path) const
+	{
+		std::ofstream writer(path);
+		if (!writer) {
+			return false;
+		}
+
+		writer << "frame,time,track,x,y,width,height\n";
+		for (size_t frame = 0; frame < Frames.size(); frame++) {
+			for (const IndexedFace& face : Frames[frame]) {
+				writer << frame << ',' << frame / FrameRate << ',' << face.Track << ',' << face.Box.left() << ','
+					<< face.Box.top() << ',' << face.Box.width() << ',' << face.Box.height() << '\n';
+			}
+		}
+		return static_cast<bool>(writer);
+	}
+
+	VideoFaceIndexer::~VideoFaceIndexer()
+	{
+		Cancel();
+	}
+
+	void VideoFaceIndexer::Start(const std::string& path, const FaceIndexOptions& options)
+	{
+		Cancel();
+		m_Cancelled = false;
+		m_FramesScanned = 0;
+		m_FrameCount = 0;
+		m_FramesPerSecond = 0.0;
+		Fail("");
+		m_Running = true;
+		m_Thread = std::thread(&VideoFaceIndexer::Run, this, path, options);
+	}
+
+	void VideoFaceIndexer::Cancel()
+	{
+		m_Cancelled = true;
+		if (m_Thread.joinable()) {
+			m_Thread.join();
+		}
+	}
+
+	void VideoFaceIndexer::Fail(const std::string& error)
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		m_Error = error;
+	}
+
+	void VideoFaceIndexer::Run(std::string path, FaceIndexOptions options)
+	{
+		const auto start = std::chrono::high_resolution_clock::now();
+		std::string error;
+		VideoReader probe;
+		if (!probe.Open(path, error, 1)) {
+			Fail(error);
+			m_Running = false;
+			return;
+		}
+		m_FrameCount = probe.GetFrameCount();
+		std::vector<int64_t> keyframes = probe.ScanKeyframes();
+		if (keyframes.empty()) {
+			keyframes.push_back(probe.GetStartTime());
+		}
+		// Anything before the first keyframe cannot be decoded anyway
+		keyframes.front() = std::min(keyframes.front(), probe.GetStartTime());
+
+		const uint32_t workers = options.Workers > 0 ? options.Workers : std::max(1u, std::thread::hardware_concurrency());
+		const size_t segmentCount = std::min<size_t>(keyframes.size(), static_cast<size_t>(workers) * SEGMENTS_PER_WORKER);
+		std::vector<FaceSegment> segments(segmentCount);
+		for (size_t i = 0; i < segmentCount; i++) {
+			segments[i].Start = keyframes[i * keyframes.size() / segmentCount];
+			if (i > 0) {
+				segments[i - 1].End = segments[i].Start;
+			}
+		}
+
+		std::atomic<size_t> nextSegment{ 0 };
+		std::vector<std::thread> threads;
+		for (uint32_t worker = 0; worker < std::min<size_t>(workers, segmentCount); worker++) {
+			threads.emplace_back([&]() {
+				// The segments are the parallelism, every decoder and detector stays on one thread
+				VideoReader reader;
+				std::string openError;
+				if (!reader.Open(path, openError, 1)) {
+					Fail(openError);
+					m_Cancelled = true;
+					return;
+				}
+				FaceDetector detector;
+				DetectionProfile profile;
+				profile.DetectionResolution = options.DetectionResolution;
+				profile.ThreadCount = 1;
+				profile.Model = options.Model;
+				detector.SetProfile(profile);
+				if (!detector.GetModelError().empty()) {
+					Fail(detector.GetModelError());
+					m_Cancelled = true;
+					return;
+				}
+				FaceTracker tracker(options.KeyframeInterval);
+				const size_t frameSize = static_cast<size_t>(reader.GetWidth()) * reader.GetHeight() * 3;
+				std::vector<std::vector<uint8_t>> buffers(options.KeyframeInterval <= 1 ? FRAME_BATCH : 1,
+					std::vector<uint8_t>(frameSize));
+
+				for (size_t segment = nextSegment++; segment < segments.size() && !m_Cancelled; segment = nextSegment++) {
+					ScanSegment(segments[segment], reader, detector, tracker, buffers, options.MinOverlap, m_Cancelled, m_FramesScanned);
+					const auto now = std::chrono::high_resolution_clock::now();
+					m_FramesPerSecond = m_FramesScanned / std::chrono::duration<double>(now - start).count();
+				}
+			});
+		}
+		for (std::thread& thread : threads) {
+			thread.join();
+		}
+		if (m_Cancelled) {
+			m_Running = false;
+			return;
+		}
+
+		// Tracks that touch across a boundary are joined, then numbered in order of appearance
+		std::vector<uint32_t> offsets(segments.size(), 0);
+		for (size_t i = 1; i < segments.size(); i++) {
+			offsets[i] = offsets[i - 1] + segments[i - 1].TrackCount;
+		}
+		std::vector<uint32_t> parents(segments.empty() ? 0 : offsets.back() + segments.back().TrackCount);
+		std::iota(parents.begin(), parents.end(), 0u);
+		for (size_t i = 0; i + 1 < segments.size(); i++) {
+			if (segments[i].Frames.empty() || segments[i + 1].Frames.empty()) continue;
+			const auto& last = segments[i].Frames.back();
+			const auto& first = segments[i + 1].Frames.front();
+			if (last.first + 1 != first.first) continue;
+			for (const auto& [from, to] : MatchFaces(last.second, first.second, options.MinOverlap)) {
+				const uint32_t a = FindTrack(parents, offsets[i] + last.second[from].Track);
+				const uint32_t b = FindTrack(parents, offsets[i + 1] + first.second[to].Track);
+				parents[b] = a;
+			}
+		}
+
+		FaceIndex index;
+		index.Source = path;
+		index.Width = probe.GetWidth();
+		index.Height = probe.GetHeight();
+		index.FrameRate = av_q2d(probe.GetFrameRate());
+		index.SegmentCount = static_cast<uint32_t>(segments.size());
+		std::vector<uint32_t> numbers(parents.size(), std::numeric_limits<uint32_t>::max());
+		for (size_t i = 0; i < segments.size(); i++) {
+			for (auto& [frame, faces] : segments[i].Frames) {
+				if (frame < 0) continue;
+				if (static_cast<size_t>(frame) >= index.Frames.size()) {
+					index.Frames.resize(static_cast<size_t>(frame) + 1);
+				}
+				for (IndexedFace& face : faces) {
+					uint32_t& number = numbers[FindTrack(parents, offsets[i] + face.Track)];
+					if (number == std::numeric_limits<uint32_t>::max()) {
+						number = index.TrackCount++;
+					}
+					face.Track = number;
+				}
+				index.Frames[static_cast<size_t>(frame)] = std::move(faces);
+			}
+		}
+		const auto end = std::chrono::high_resolution_clock::now();
+		index.Time = std::chrono::duration<double>(end - start).count();
+		m_Index = std::move(index);
+		m_Running = false;
+	}
+
+	bool VideoFaceIndexer::IsRunning() const
+	{
+		return m_Running;
+	}
+
+	float VideoFaceIndexer::GetProgress() const
+	{
+		const int64_t count = m_FrameCount;
+		return count > 0 ? std::min(1.0f, static_cast<float>(m_FramesScanned) / count) : 0.0f;
+	}
+
+	int64_t VideoFaceIndexer::GetFramesScanned() const
+	{
+		return m_FramesScanned;
+	}
+
+	double VideoFaceIndexer::GetFramesPerSecond() const
+	{
+		return m_FramesPerSecond;
+	}
+
+	std::string VideoFaceIndexer::GetError() const
+	{
+		std::lock_guard<std::mutex> lock(m_ErrorMutex);
+		return m_Error;
+	}
+
+	const FaceIndex& VideoFaceIndexer::GetIndex() const
+	{
+		return m_Index;
+	}
+
+	int RunVideoFaceIndex(const std::string& videoPath, const std::string& outputPath)
+	{
+		VideoFaceIndexer indexer;
+		indexer.Start(videoPath);
+		while (indexer.IsRunning()) {
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+			std::cout << indexer.GetFramesScanned() << " frames (" << static_cast<int>(indexer.GetProgress() * 100.0f)
+				<< "%), " << indexer.GetFramesPerSecond() << " fps" << std::endl;
+		}
+		if (!indexer.GetError().empty()) {
+			std::cerr << indexer.GetError() << std::endl;
+			return 1;
+		}
+
+		const FaceIndex& index = indexer.GetIndex();
+		const bool csv = outputPath.size() >= 4 && outputPath.compare(outputPath.size() - 4, 4, ".csv") == 0;
+		if (!(csv ? index.SaveCsv(outputPath) : index.SaveJson(outputPath))) {
+			std::cerr << "Could not write " << outputPath << std::endl;
+			return 1;
+		}
+		std::cout << index.Frames.size() << " frames, " << index.TrackCount << " tracks in " << index.SegmentCount
+			<< " segments, " << index.Time << " s" << std::endl;
+		return 0;
+	}
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <inttypes.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <dlib/image_processing.h>
+#include "Filters.h"
+
+namespace Photoxel
+{
+	struct IndexedFace {
+		// The same face keeps its id for as long as it stays in view
+		uint32_t Track = 0;
+		dlib::rectangle Box;
+	};
+
+	struct FaceIndexOptions {
+		// Segments scanned at once, 0 runs one per core
+		uint32_t Workers = 0;
+		// Frames between two detections, the faces are tracked in between. 1 detects on every frame
+		uint32_t KeyframeInterval = 1;
+		// Long side of the image the detector scans
+		uint32_t DetectionResolution = 960;
+		// Intersection over union a face needs with one of the frame before to continue its track
+		float MinOverlap = 0.3f;
+		DetectionModel Model = DetectionModel::Hog;
+	};
+
+	struct FaceIndex {
+		std::string Source;
+		uint32_t Width = 0, Height = 0;
+		double FrameRate = 0.0;
+		// Faces of every frame, by frame number
+		std::vector<std::vector<IndexedFace>> Frames;
+		uint32_t TrackCount = 0;
+		uint32_t SegmentCount = 0;
+		double Time = 0.0;
+
+		// Most faces seen in each second, for the timeline
+		std::vector<float> GetFaceCountPerSecond() const;
+		// Only frames with faces are listed
+		bool SaveJson(const std::string& path) const;
+		// One row per face: frame, time, track, x, y, width, height
+		bool SaveCsv(const std::string& path) const;
+	};
+
+	// Runs the face detector over a whole video file on a thread of its own. The file is cut at its
+	// keyframes into segments and every worker decodes and scans the segments it takes with its own
+	// decoder, detector and tracker, so nothing is shared until the tracks are stitched together
+	// across the segment boundaries at the end
+	class VideoFaceIndexer
+	{
+	public:
+		VideoFaceIndexer() = default;
+		~VideoFaceIndexer();
+
+		VideoFaceIndexer(const VideoFaceIndexer&) = delete;
+		VideoFaceIndexer& operator=(const VideoFaceIndexer&) = delete;
+
+		// An index still running is cancelled
+		void Start(const std::string& path, const FaceIndexOptions& options = FaceIndexOptions());
+		void Cancel();
+
+		bool IsRunning() const;
+		// Fraction of the frames scanned, 0 while the container does not say how many there are
+		float GetProgress() const;
+		int64_t GetFramesScanned() const;
+		double GetFramesPerSecond() const;
+		// Empty unless the last index failed
+		std::string GetError() const;
+		// The last index that completed, only valid while nothing runs
+		const FaceIndex& GetIndex() const;
+	private:
+		void Run(std::string path, FaceIndexOptions options);
+		void Fail(const std::string& error);
+
+		std::thread m_Thread;
+		std::atomic<bool> m_Running{ false }, m_Cancelled{ false };
+		std::atomic<int64_t> m_FramesScanned{ 0 }, m_FrameCount{ 0 };
+		std::atomic<double> m_FramesPerSecond{ 0.0 };
+		mutable std::mutex m_ErrorMutex;
+		std::string m_Error;
+		FaceIndex m_Index;
+	};
+
+	// "Photoxel --index-faces video.mp4 faces.json" indexes a video from the command line, a .csv
+	// output gets the table instead
+	int RunVideoFaceIndex(const std::string& videoPath, const std::string& outputPath);
+}
@@ -0,0 +1,350 @@
+#include "VideoIO.h"
+extern "C" {
+#include <libavutil/opt.h>
+}
+#include <algorithm>
+#include <cmath>
+
+namespace Photoxel
+{
+	VideoReader::~VideoReader()
+	{
+		Close();
+	}
+
+	bool VideoReader::Open(const std::string& path, std::string& error, uint32_t threads)
+	{
+		Close();
+		if (avformat_open_input(&m_FormatContext, path.c_str(), nullptr, nullptr) < 0) {
+			error = "Could not open " + path;
+			return false;
+		}
+		if (avformat_find_stream_info(m_FormatContext, nullptr) < 0) {
+			error = "Could not read the streams of " + path;
+			Close();
+			return false;
+		}
+
+		m_StreamIndex = av_find_best_stream(m_FormatContext, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
+		const AVCodec* decoder = m_StreamIndex >= 0
+			? avcodec_find_decoder(m_FormatContext->streams[m_StreamIndex]->codecpar->codec_id) : nullptr;
+		if (!decoder) {
+			error = path + " has no video stream that can be decoded";
+			Close();
+			return false;
+		}
+
+		AVStream* stream = m_FormatContext->streams[m_StreamIndex];
+		m_CodecContext = avcodec_alloc_context3(decoder);
+		avcodec_parameters_to_context(m_CodecContext, stream->codecpar);
+		// Frame threads keep a 1080p decode well ahead of the rest of the pipeline
+		m_CodecContext->thread_count = static_cast<int>(threads);
+		m_CodecContext->thread_type = FF_THREAD_FRAME | FF_THREAD_SLICE;
+		if (avcodec_open2(m_CodecContext, decoder, nullptr) < 0) {
+			error = "Could not open the decoder of " + path;
+			Close();
+			return false;
+		}
+
+		m_Width = m_CodecContext->width;
+		m_Height = m_CodecContext->height;
+		m_FrameRate = av_guess_frame_rate(m_FormatContext, stream, nullptr);
+		if (m_FrameRate.num <= 0 || m_FrameRate.den <= 0) {
+			m_FrameRate = { 25, 1 };
+		}
+		m_TimeBase = stream->time_base;
+		m_StartTime = stream->start_time != AV_NOPTS_VALUE ? stream->start_time : 0;
+		m_FrameCount = stream->nb_frames;
+		if (m_FrameCount <= 0 && m_FormatContext->duration > 0) {
+			m_FrameCount = static_cast<int64_t>(m_FormatContext->duration / static_cast<double>(AV_TIME_BASE) * av_q2d(m_FrameRate));
+		}
+
+		m_Frame = av_frame_alloc();
+		m_Packet = av_packet_alloc();
+		m_Flushing = false;
+		return true;
+	}
+
+	bool VideoReader::Receive(uint8_t* rgb, int64_t* timestamp)
+	{
+		if (avcodec_receive_frame(m_CodecContext, m_Frame) < 0) {
+			return false;
+		}
+		if (timestamp) {
+			*timestamp = m_Frame->best_effort_timestamp != AV_NOPTS_VALUE ? m_Frame->best_effort_timestamp : m_Frame->pts;
+		}
+
+		// The pixel format is only certain once a frame is out
+		m_SwsContext = sws_getCachedContext(m_SwsContext, m_Frame->width, m_Frame->height,
+			static_cast<AVPixelFormat>(m_Frame->format), m_Width, m_Height, AV_PIX_FMT_RGB24,
+			SWS_BILINEAR, nullptr, nullptr, nullptr);
+		uint8_t* dest[4] = { rgb, nullptr, nullptr, nullptr };
+		int stride[4] = { static_cast<int>(m_Width * 3), 0, 0, 0 };
+		sws_scale(m_SwsContext, m_Frame->data, m_Frame->linesize, 0, m_Frame->height, dest, stride);
+		av_frame_unref(m_Frame);
+		return true;
+	}
+
+	bool VideoReader::Read(uint8_t* rgb, int64_t* timestamp)
+	{
+		if (!m_CodecContext) {
+			return false;
+		}
+
+		while (true) {
+			if (Receive(rgb, timestamp)) {
+				return true;
+			}
+			if (m_Flushing) {
+				return false;
+			}
+
+			if (av_read_frame(m_FormatContext, m_Packet) < 0) {
+				// End of the file, the decoder still holds the frames it was reordering
+				avcodec_send_packet(m_CodecContext, nullptr);
+				m_Flushing = true;
+				continue;
+			}
+			// Damaged packets are skipped, the decoder picks up again at the next keyframe
+			if (m_Packet->stream_index == m_StreamIndex) {
+				avcodec_send_packet(m_CodecContext, m_Packet);
+			}
+			av_packet_unref(m_Packet);
+		}
+	}
+
+	std::vector<int64_t> VideoReader::ScanKeyframes()
+	{
+		std::vector<int64_t> keyframes;
+		if (!m_FormatContext) {
+			return keyframes;
+		}
+
+		while (av_read_frame(m_FormatContext, m_Packet) >= 0) {
+			if (m_Packet->stream_index == m_StreamIndex && (m_Packet->flags & AV_PKT_FLAG_KEY)) {
+				const int64_t timestamp = m_Packet->pts != AV_NOPTS_VALUE ? m_Packet->pts : m_Packet->dts;
+				if (timestamp != AV_NOPTS_VALUE) {
+					keyframes.push_back(timestamp);
+				}
+			}
+			av_packet_unref(m_Packet);
+		}
+		// Decode order, an open GOP can put a keyframe ahead of frames shown before it
+		std::sort(keyframes.begin(), keyframes.end());
+		keyframes.erase(std::unique(keyframes.begin(), keyframes.end()), keyframes.end());
+		Seek(m_StartTime);
+		return keyframes;
+	}
+
+	bool VideoReader::Seek(int64_t timestamp)
+	{
+		if (!m_FormatContext || av_seek_frame(m_FormatContext, m_StreamIndex, timestamp, AVSEEK_FLAG_BACKWARD) < 0) {
+			return false;
+		}
+		avcodec_flush_buffers(m_CodecContext);
+		m_Flushing = false;
+		return true;
+	}
+
+	void VideoReader::Close()
+	{
+		if (m_SwsContext) {
+			sws_freeContext(m_SwsContext);
+			m_SwsContext = nullptr;
+		}
+		if (m_Packet) {
+			av_packet_free(&m_Packet);
+		}
+		if (m_Frame) {
+			av_frame_free(&m_Frame);
+		}
+		if (m_CodecContext) {
+			avcodec_free_context(&m_CodecContext);
+		}
+		if (m_FormatContext) {
+			avformat_close_input(&m_FormatContext);
+		}
+		m_StreamIndex = -1;
+	}
+
+	uint32_t VideoReader::GetWidth() const
+	{
+		return m_Width;
+	}
+
+	uint32_t VideoReader::GetHeight() const
+	{
+		return m_Height;
+	}
+
+	AVRational VideoReader::GetFrameRate() const
+	{
+		return m_FrameRate;
+	}
+
+	int64_t VideoReader::GetFrameCount() const
+	{
+		return m_FrameCount;
+	}
+
+	AVRational VideoReader::GetTimeBase() const
+	{
+		return m_TimeBase;
+	}
+
+	int64_t VideoReader::GetStartTime() const
+	{
+		return m_StartTime;
+	}
+
+	int64_t VideoReader::GetFrameIndex(int64_t timestamp) const
+	{
+		return std::llround((timestamp - m_StartTime) * av_q2d(m_TimeBase) * av_q2d(m_FrameRate));
+	}
+
+	VideoWriter::~VideoWriter()
+	{
+		Close();
+	}
+
+	bool VideoWriter::Open(const std::string& path, uint32_t width, uint32_t height, AVRational frameRate, std::string& error)
+	{
+		Close();
+		avformat_alloc_output_context2(&m_FormatContext, nullptr, nullptr, path.c_str());
+		if (!m_FormatContext) {
+			error = "No container format matches " + path;
+			return false;
+		}
+
+		const AVOutputFormat* format = m_FormatContext->oformat;
+		const AVCodec* encoder = avcodec_find_encoder(AV_CODEC_ID_H264);
+		if (!encoder || avformat_query_codec(format, AV_CODEC_ID_H264, FF_COMPLIANCE_NORMAL) != 1) {
+			encoder = avcodec_find_encoder(format->video_codec);
+		}
+		if (!encoder) {
+			error = "No video encoder for " + path;
+			Close();
+			return false;
+		}
+
+		m_Width = width;
+		m_Height = height;
+		m_Stream = avformat_new_stream(m_FormatContext, nullptr);
+		m_CodecContext = avcodec_alloc_context3(encoder);
+		// 4:2:0 chroma needs even sizes, an odd row or column is scaled away
+		m_CodecContext->width = std::max(2u, width & ~1u);
+		m_CodecContext->height = std::max(2u, height & ~1u);
+		m_CodecContext->pix_fmt = AV_PIX_FMT_YUV420P;
+		m_CodecContext->time_base = av_inv_q(frameRate);
+		m_CodecContext->framerate = frameRate;
+		m_CodecContext->thread_count = 0;
+		if (encoder->id == AV_CODEC_ID_H264) {
+			// Fast enough to stay ahead of the anonymisation at 1080p, at a visually lossless rate
+			av_opt_set(m_CodecContext->priv_data, "preset", "veryfast", 0);
+			av_opt_set(m_CodecContext->priv_data, "crf", "18", 0);
+		}
+		if (format->flags & AVFMT_GLOBALHEADER) {
+			m_CodecContext->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+		}
+		if (avcodec_open2(m_CodecContext, encoder, nullptr) < 0) {
+			error = std::string("Could not open the ") + encoder->name + " encoder";
+			Close();
+			return false;
+		}
+		avcodec_parameters_from_context(m_Stream->codecpar, m_CodecContext);
+		m_Stream->time_base = m_CodecContext->time_base;
+
+		if (!(format->flags & AVFMT_NOFILE) && avio_open(&m_FormatContext->pb, path.c_str(), AVIO_FLAG_WRITE) < 0) {
+			error = "Could not write " + path;
+			Close();
+			return false;
+		}
+		if (avformat_write_header(m_FormatContext, nullptr) < 0) {
+			error = "Could not write the header of " + path;
+			Close();
+			return false;
+		}
+		m_HeaderWritten = true;
+
+		m_Frame = av_frame_alloc();
+		m_Frame->format = m_CodecContext->pix_fmt;
+		m_Frame->width = m_CodecContext->width;
+		m_Frame->height = m_CodecContext->height;
+		av_frame_get_buffer(m_Frame, 0);
+		m_Packet = av_packet_alloc();
+		m_SwsContext = sws_getContext(width, height, AV_PIX_FMT_RGB24, m_CodecContext->width, m_CodecContext->height,
+			m_CodecContext->pix_fmt, SWS_BILINEAR, nullptr, nullptr, nullptr);
+		m_NextPts = 0;
+		return true;
+	}
+
+	bool VideoWriter::Write(const uint8_t* rgb)
+	{
+		if (!m_HeaderWritten || av_frame_make_writable(m_Frame) < 0) {
+			return false;
+		}
+
+		const uint8_t* src[4] = { rgb, nullptr, nullptr, nullptr };
+		int stride[4] = { static_cast<int>(m_Width * 3), 0, 0, 0 };
+		sws_scale(m_SwsContext, src, stride, 0, m_Height, m_Frame->data, m_Frame->linesize);
+		m_Frame->pts = m_NextPts++;
+		if (avcodec_send_frame(m_CodecContext, m_Frame) < 0) {
+			return false;
+		}
+		return Drain();
+	}
+
+	bool VideoWriter::Drain()
+	{
+		while (true) {
+			const int result = avcodec_receive_packet(m_CodecContext, m_Packet);
+			// Wants more frames, or has nothing left once flushed
+			if (result == AVERROR(EAGAIN) || result == AVERROR_EOF) {
+				return true;
+			}
+			if (result < 0) {
+				return false;
+			}
+			av_packet_rescale_ts(m_Packet, m_CodecContext->time_base, m_Stream->time_base);
+			m_Packet->stream_index = m_Stream->index;
+			// Takes the packet's reference
+			if (av_interleaved_write_frame(m_FormatContext, m_Packet) < 0) {
+				return false;
+			}
+		}
+	}
+
+	bool VideoWriter::Close()
+	{
+		bool written = false;
+		if (m_HeaderWritten) {
+			avcodec_send_frame(m_CodecContext, nullptr);
+			written = Drain();
+			written = av_write_trailer(m_FormatContext) == 0 && written;
+			m_HeaderWritten = false;
+		}
+
+		if (m_SwsContext) {
+			sws_freeContext(m_SwsContext);
+			m_SwsContext = nullptr;
+		}
+		if (m_Packet) {
+			av_packet_free(&m_Packet);
+		}
+		if (m_Frame) {
+			av_frame_free(&m_Frame);
+		}
+		if (m_CodecContext) {
+			avcodec_free_context(&m_CodecContext);
+		}
+		if (m_FormatContext) {
+			if (!(m_FormatContext->oformat->flags & AVFMT_NOFILE)) {
+				avio_closep(&m_FormatContext->pb);
+			}
+			avformat_free_context(m_FormatContext);
+			m_FormatContext = nullptr;
+		}
+		m_Stream = nullptr;
+		return written;
+	}
+}
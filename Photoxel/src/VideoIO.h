@@ -0,0 +1,94 @@
+#pragma once
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libswscale/swscale.h>
+}
+#include <inttypes.h>
+#include <string>
+#include <vector>
+
+namespace Photoxel
+{
+	// Decodes every frame of the best video stream of a file in order, as fast as the decoder goes.
+	// Video plays a file back in real time, this is for the offline pipelines
+	class VideoReader
+	{
+	public:
+		VideoReader() = default;
+		~VideoReader();
+
+		VideoReader(const VideoReader&) = delete;
+		VideoReader& operator=(const VideoReader&) = delete;
+
+		// Returns false and fills error when the file has no video stream that can be decoded.
+		// threads is the decoder's own thread count, 0 lets it use every core
+		bool Open(const std::string& path, std::string& error, uint32_t threads = 0);
+		// Writes the next frame as packed RGB24 rows, returns false once the stream is over.
+		// timestamp gets the presentation time of the frame in stream time base units
+		bool Read(uint8_t* rgb, int64_t* timestamp = nullptr);
+		// Demuxes the whole stream without decoding it and returns the timestamps of its keyframes
+		// in order, then goes back to the start
+		std::vector<int64_t> ScanKeyframes();
+		// Goes to the keyframe at or before timestamp, the frames after it decode from there
+		bool Seek(int64_t timestamp);
+		void Close();
+
+		uint32_t GetWidth() const;
+		uint32_t GetHeight() const;
+		AVRational GetFrameRate() const;
+		AVRational GetTimeBase() const;
+		// Timestamp of the first frame
+		int64_t GetStartTime() const;
+		// Position of the frame with that timestamp, assuming a constant frame rate
+		int64_t GetFrameIndex(int64_t timestamp) const;
+		// From the container, an estimate from the duration when it does not say
+		int64_t GetFrameCount() const;
+	private:
+		// Returns false when no frame is left in the decoder
+		bool Receive(uint8_t* rgb, int64_t* timestamp);
+
+		AVFormatContext* m_FormatContext = nullptr;
+		AVCodecContext* m_CodecContext = nullptr;
+		AVFrame* m_Frame = nullptr;
+		AVPacket* m_Packet = nullptr;
+		SwsContext* m_SwsContext = nullptr;
+		int m_StreamIndex = -1;
+		uint32_t m_Width = 0, m_Height = 0;
+		AVRational m_FrameRate = { 0, 1 };
+		AVRational m_TimeBase = { 0, 1 };
+		int64_t m_StartTime = 0;
+		int64_t m_FrameCount = 0;
+		bool m_Flushing = false;
+	};
+
+	// Encodes packed RGB24 frames into a file, H.264 when the build has an encoder for it and the
+	// default codec of the container otherwise. Frames are numbered in the order they are written
+	class VideoWriter
+	{
+	public:
+		VideoWriter() = default;
+		~VideoWriter();
+
+		VideoWriter(const VideoWriter&) = delete;
+		VideoWriter& operator=(const VideoWriter&) = delete;
+
+		bool Open(const std::string& path, uint32_t width, uint32_t height, AVRational frameRate, std::string& error);
+		bool Write(const uint8_t* rgb);
+		// Drains the encoder and finishes the file, nothing is playable before it
+		bool Close();
+	private:
+		bool Drain();
+
+		AVFormatContext* m_FormatContext = nullptr;
+		AVCodecContext* m_CodecContext = nullptr;
+		AVStream* m_Stream = nullptr;
+		AVFrame* m_Frame = nullptr;
+		AVPacket* m_Packet = nullptr;
+		SwsContext* m_SwsContext = nullptr;
+		uint32_t m_Width = 0, m_Height = 0;
+		int64_t m_NextPts = 0;
+		bool m_HeaderWritten = false;
+	};
+}
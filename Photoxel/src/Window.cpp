@@ -3,6 +3,11 @@
 
 namespace Photoxel
 {
+	// Wakes an idle window now and then so timers and the OS stay in sync with the UI
+	static constexpr double IDLE_TIMEOUT = 0.5;
+	// ImGui reacts to an input over a couple of frames, keep polling for these after waking up
+	static constexpr uint32_t FRAMES_AFTER_EVENT = 3;
+
 	Window::Window()
 		: m_Width(1280), m_Height(720), m_Title("Photoxel")
 	{
@@ -58,10 +63,17 @@ namespace Photoxel
 		photoxelWindow->m_WindowCloseEventFn();
 	}
 
-	void Window::Update()
+	void Window::Update(bool waitForEvents)
 	{
-		glfwPollEvents();
 		glfwSwapBuffers(m_Window);
+		if (waitForEvents && m_FramesToPoll == 0) {
+			glfwWaitEventsTimeout(IDLE_TIMEOUT);
+			m_FramesToPoll = FRAMES_AFTER_EVENT;
+		}
+		else {
+			glfwPollEvents();
+			if (m_FramesToPoll > 0) m_FramesToPoll--;
+		}
 	}
 
 	void* Window::GetNativeHandler() const
@@ -17,7 +17,9 @@ namespace Photoxel
 		Window(uint32_t width, uint32_t height, const std::string& title);
 		virtual ~Window();
 
-		void Update();
+		// Presents the frame, then polls events or, when waitForEvents is set, sleeps until
+		// one arrives or the idle timeout passes
+		void Update(bool waitForEvents = false);
 
 		void* GetNativeHandler() const;
 
@@ -32,6 +34,7 @@ namespace Photoxel
 		uint32_t m_Width, m_Height;
 		std::string m_Title;
 		WindowCloseEventFn m_WindowCloseEventFn = []() {};
+		uint32_t m_FramesToPoll = 0;
 		bool InitWindow();
 
 		static void WindowCloseEventHandler(GLFWwindow* window);
@@ -1,7 +1,40 @@
 #include "Application.h"
+#include "Benchmark.h"
+#include "VideoFaceIndex.h"
+#include "FaceLibrary.h"
+#include "DuplicateFinder.h"
+#include "BatchProcessor.h"
 #include <Windows.h>
 
-int main() {
+int main(int argc, char** argv) {
+    if (argc >= 3 && std::string(argv[1]) == "--bench-faces") {
+        return Photoxel::RunFaceDetectionBenchmark(argv[2]);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--bench-denoise") {
+        return Photoxel::RunDenoiseBenchmark(argv[2]);
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--bench-lut") {
+        return Photoxel::RunLutBenchmark(argv[2], argv[3], argc >= 5 ? argv[4] : "");
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--bench-detectors") {
+        return Photoxel::RunDetectorBenchmark(argv[2], argc >= 4 ? argv[3] : "");
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--index-faces") {
+        return Photoxel::RunVideoFaceIndex(argv[2], argv[3]);
+    }
+    if (argc >= 2 && std::string(argv[1]) == "--bench-face-search") {
+        return Photoxel::RunFaceSearchBenchmark(argc >= 3 ? std::stoul(argv[2]) : 1000000);
+    }
+    if (argc >= 4 && std::string(argv[1]) == "--face-library") {
+        return Photoxel::RunFaceLibrary(argv[2], argv[3]);
+    }
+    if (argc >= 3 && std::string(argv[1]) == "--find-duplicates") {
+        return Photoxel::RunDuplicateFinder(argv[2], argc >= 4 ? std::stoul(argv[3]) : Photoxel::DuplicateOptions().MaxDistance);
+    }
+    if (argc >= 5 && std::string(argv[1]) == "--batch") {
+        return Photoxel::RunBatch(argv[2], argv[3], argv[4]);
+    }
+
     Photoxel::Application* app = new Photoxel::Application();
     app->Run();
     delete app;